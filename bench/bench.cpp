@@ -0,0 +1,971 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <chrono>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include "network.h"
+#include "dqn.h"
+#include "replay_memory.h"
+#include "goal_env.h"
+#include "gemm.h"
+#include "layers/fc_layer.h"
+#include "layers/activation.h"
+
+#include <Eigen/Dense>
+
+using namespace std;
+using namespace Eigen;
+using namespace Neural;
+
+typedef chrono::high_resolution_clock Clock;
+
+
+// One benchmark result, written as one JSON object.
+struct Result
+{
+  string name;
+  vector<pair<string, string>> params;
+  vector<pair<string, double>> metrics;
+};
+
+static vector<Result> results;
+static double min_time = 0.2;  // seconds of measurement per case
+
+
+static string Str(long long v)
+{
+  return to_string(v);
+}
+
+
+/**
+ * @brief Runs fn until min_time has passed, after one warm-up call.
+ *
+ * @return double Median seconds per call over batches of calls
+ */
+static double TimeIt(const function<void()> &fn)
+{
+  fn();
+
+  // size a batch of calls to ~1/20 of the measure time, the median of the batches is kept
+  int reps = 1;
+  for (;;) {
+    auto start = Clock::now();
+    for (int i = 0; i < reps; i++) fn();
+    double t = chrono::duration<double>(Clock::now() - start).count();
+    if (t > min_time / 20 || reps > (1 << 24)) break;
+    reps *= 2;
+  }
+
+  vector<double> samples;
+  auto begin = Clock::now();
+  while (samples.size() < 5 || chrono::duration<double>(Clock::now() - begin).count() < min_time) {
+    auto start = Clock::now();
+    for (int i = 0; i < reps; i++) fn();
+    samples.push_back(chrono::duration<double>(Clock::now() - start).count() / reps);
+  }
+
+  sort(samples.begin(), samples.end());
+  return samples[samples.size() / 2];
+}
+
+
+static double Percentile(vector<double> v, double p)
+{
+  sort(v.begin(), v.end());
+  size_t i = min(v.size() - 1, (size_t)(p * (v.size() - 1) + 0.5));
+  return v[i];
+}
+
+
+static void BenchFcLayer(const vector<int> &widths, const vector<int> &batches)
+{
+  for (int w : widths) {
+    for (int b : batches) {
+      srand(1);
+      Fc_Layer layer(w, w, ActivationType::RELU);
+      MatrixXd x = MatrixXd::Random(b, w);
+      MatrixXd err = MatrixXd::Random(b, w);
+      double flops = 2.0 * b * w * w;
+
+      double forward = TimeIt([&]() { layer.FeedForward(x); });
+      // zero learning rate, the update runs but the weights stay put
+      double backward = TimeIt([&]() { layer.BackPropagation(err, 0.0f); });
+
+      results.push_back({"fc_feedforward", {{"width", Str(w)}, {"batch", Str(b)}},
+                         {{"us", forward * 1e6}, {"gflops", flops / forward / 1e9}}});
+      results.push_back({"fc_backpropagation", {{"width", Str(w)}, {"batch", Str(b)}},
+                         {{"us", backward * 1e6}, {"gflops", 2 * flops / backward / 1e9}}});
+    }
+  }
+}
+
+
+static void BenchActivations(int rows, int cols)
+{
+  vector<pair<string, shared_ptr<Activation>>> activations = {
+    {"sigmoid", make_shared<Sigmoid>()},
+    {"relu", make_shared<ReLU>()},
+    {"leaky_relu", make_shared<LeakyReLU>()},
+    {"elu", make_shared<ELU>()},
+    {"tanh", make_shared<Tanh>()},
+    {"softmax", make_shared<Softmax>()},
+  };
+
+  MatrixXd x = MatrixXd::Random(rows, cols) * 4;
+  double n = (double)rows * cols;
+
+  for (auto &a : activations) {
+    double compute = TimeIt([&]() { MatrixXd y = a.second->Compute(x); });
+    double derivative = TimeIt([&]() { MatrixXd y = a.second->ComputeDerivative(x); });
+
+    results.push_back({"activation", {{"type", a.first}, {"rows", Str(rows)}, {"cols", Str(cols)}},
+                       {{"compute_ns_per_element", compute / n * 1e9},
+                        {"derivative_ns_per_element", derivative / n * 1e9}}});
+  }
+}
+
+
+static void BenchAdam(const vector<int> &sizes)
+{
+  for (int s : sizes) {
+    MatrixXd w = MatrixXd::Random(s, s);
+    MatrixXd g = MatrixXd::Random(s, s) * 0.01;
+    Adam adam(0.001);
+
+    double t = TimeIt([&]() { adam.UpdateWeights(w, g); });
+    // parameter, gradient, two moments read, parameter and moments written
+    double bytes = 7.0 * s * s * sizeof(double);
+
+    results.push_back({"adam_update", {{"rows", Str(s)}, {"cols", Str(s)}},
+                       {{"us", t * 1e6}, {"gb_per_s", bytes / t / 1e9}}});
+  }
+}
+
+
+static Network* BuildNetwork(int inputs, int hidden, int outputs)
+{
+  srand(1);
+
+  Network *net = new Network();
+  net->Use(new Mse());
+  net->Add(new Fc_Layer(inputs, hidden, ActivationType::TANH));
+  net->Add(new Fc_Layer(hidden, hidden, ActivationType::RELU));
+  net->Add(new Fc_Layer(hidden, outputs, ActivationType::NONE));
+  net->UseOptimizer(new Adam(0.001));
+
+  return net;
+}
+
+
+static void BenchFit(int samples, const vector<int> &batches)
+{
+  srand(2);
+  MatrixXd x = MatrixXd::Random(samples, 32);
+  MatrixXd y = MatrixXd::Random(samples, 10);
+
+  for (int b : batches) {
+    unique_ptr<Network> net(BuildNetwork(32, 256, 10));
+
+    net->Fit(x, y, 1, 0.01, b, 0);  // warm up
+    auto start = Clock::now();
+    int epochs = 0;
+    while (epochs < 2 || chrono::duration<double>(Clock::now() - start).count() < min_time) {
+      net->Fit(x, y, 1, 0.01, b, 0);
+      epochs++;
+    }
+    double t = chrono::duration<double>(Clock::now() - start).count();
+
+    results.push_back({"fit", {{"network", "32-256-256-10"}, {"batch", Str(b)}, {"samples", Str(samples)}},
+                       {{"samples_per_s", (double)samples * epochs / t}}});
+  }
+}
+
+
+static void BenchPredict(const vector<pair<int, int>> &cases)
+{
+  unique_ptr<Network> net(BuildNetwork(64, 256, 10));
+
+  for (auto &c : cases) {
+    int batch = c.first;
+    int calls = c.second;
+    MatrixXd x = MatrixXd::Random(batch, 64);
+    MatrixXd out;
+    vector<double> latency;
+
+    net->PredictBatch(x, out);
+    for (int i = 0; i < calls; i++) {
+      auto start = Clock::now();
+      net->PredictBatch(x, out);
+      latency.push_back(chrono::duration<double>(Clock::now() - start).count());
+    }
+
+    results.push_back({"predict_latency", {{"network", "64-256-256-10"}, {"batch", Str(batch)}, {"calls", Str(calls)}},
+                       {{"p50_us", Percentile(latency, 0.5) * 1e6},
+                        {"p99_us", Percentile(latency, 0.99) * 1e6},
+                        {"samples_per_s", batch / Percentile(latency, 0.5)}}});
+  }
+}
+
+
+// interleaved spiral arms in 2-D, one per class, with one-hot labels
+static void Spirals(int samples, int classes, MatrixXd &x, MatrixXd &y)
+{
+  srand(3);
+  x.resize(samples, 2);
+  y = MatrixXd::Zero(samples, classes);
+
+  for (int i = 0; i < samples; i++) {
+    int c = i % classes;
+    double r = (double)rand() / RAND_MAX;
+    double t = c * 2 * M_PI / classes + r * 10.0 + 0.2 * ((double)rand() / RAND_MAX - 0.5);
+    x(i, 0) = r * cos(t);
+    x(i, 1) = r * sin(t);
+    y(i, c) = 1;
+  }
+}
+
+
+static double Accuracy(const Network &net, const MatrixXd &x, const MatrixXd &y)
+{
+  MatrixXd p;
+  net.PredictBatch(x, p);
+
+  int correct = 0;
+  for (int i = 0; i < x.rows(); i++) {
+    int predicted, expected;
+    p.row(i).maxCoeff(&predicted);
+    y.row(i).maxCoeff(&expected);
+    correct += predicted == expected;
+  }
+
+  return (double)correct / x.rows();
+}
+
+
+// epochs until a softmax classifier reaches the target training accuracy, with the
+// fused cross-entropy and with MSE through the softmax derivative
+static void BenchClassification(int samples, int classes, double target, int max_epochs)
+{
+  MatrixXd x, y;
+  Spirals(samples, classes, x, y);
+
+  for (bool cross_entropy : {false, true}) {
+    srand(1);
+    Network net;
+    if (cross_entropy) net.Use(new CrossEntropy());
+    else net.Use(new Mse());
+    net.Add(new Fc_Layer(2, 64, ActivationType::TANH));
+    net.Add(new Fc_Layer(64, 64, ActivationType::TANH));
+    net.Add(new Fc_Layer(64, classes, ActivationType::SOFTMAX));
+    net.UseOptimizer(new Adam(0.003));
+
+    int epochs = 0;
+    double accuracy = 0;
+    auto start = Clock::now();
+    while (epochs < max_epochs && accuracy < target) {
+      net.Fit(x, y, 1, 0.01, 32, 0);
+      accuracy = Accuracy(net, x, y);
+      epochs++;
+    }
+    double t = chrono::duration<double>(Clock::now() - start).count();
+
+    results.push_back({"epochs_to_accuracy", {{"loss", cross_entropy ? "cross_entropy" : "mse_softmax"},
+                                              {"classes", Str(classes)}, {"samples", Str(samples)}},
+                       {{"target", target}, {"reached", accuracy >= target ? 1.0 : 0.0}, {"epochs", (double)epochs},
+                        {"accuracy", accuracy}, {"seconds", t}}});
+  }
+}
+
+
+// the kernels the CPU can run, Eigen first as the reference
+static vector<GemmKernel> Kernels()
+{
+  vector<GemmKernel> kernels;
+  for (GemmKernel k : {GemmKernel::EIGEN, GemmKernel::PORTABLE, GemmKernel::AVX2, GemmKernel::AVX512})
+    if (SmallGemm::Use(k)) kernels.push_back(k);
+
+  SmallGemm::Use(SmallGemm::Best());
+  return kernels;
+}
+
+
+static void BenchSmallGemm(const vector<pair<int, int>> &shapes, const vector<int> &batches)
+{
+  for (GemmKernel kernel : Kernels()) {
+    SmallGemm::Use(kernel);
+
+    for (auto &s : shapes) {
+      for (int b : batches) {
+        MatrixXd x = MatrixXd::Random(b, s.first);
+        MatrixXd w = MatrixXd::Random(s.first, s.second);
+        MatrixXd g = MatrixXd::Random(b, s.second);
+        MatrixXd out(b, s.second), grad(s.first, s.second), err(b, s.first);
+
+        // the three products of a Fc layer: forward, weight gradient, input error
+        double forward = TimeIt([&]() {
+          if (!SmallGemm::Product<double>(x, w, out)) out.noalias() = x * w;
+        });
+        double weights = TimeIt([&]() {
+          if (!SmallGemm::Product<double>(x, g, grad, true, false)) grad.noalias() = x.transpose() * g;
+        });
+        double input = TimeIt([&]() {
+          if (!SmallGemm::Product<double>(g, w, err, false, true)) err.noalias() = g * w.transpose();
+        });
+
+        results.push_back({"small_gemm", {{"kernel", SmallGemm::Name(kernel)}, {"inputs", Str(s.first)},
+                                          {"outputs", Str(s.second)}, {"batch", Str(b)}},
+                           {{"forward_ns", forward * 1e9}, {"weight_grad_ns", weights * 1e9},
+                            {"input_error_ns", input * 1e9}}});
+      }
+    }
+  }
+
+  SmallGemm::Use(SmallGemm::Best());
+}
+
+
+// the QNetwork of examples/game.cpp, one state per call as when the agent acts
+static void BenchQNetwork(int calls)
+{
+  srand(1);
+  Network net;
+  net.Add(new Fc_Layer(2, 64, ActivationType::RELU));
+  net.Add(new Fc_Layer(64, 32, ActivationType::RELU));
+  net.Add(new Fc_Layer(32, 3, ActivationType::NONE));
+
+  MatrixXd x = MatrixXd::Random(1, 2);
+  MatrixXd out;
+
+  for (GemmKernel kernel : Kernels()) {
+    SmallGemm::Use(kernel);
+    vector<double> latency;
+
+    net.PredictBatch(x, out);
+    for (int i = 0; i < calls; i++) {
+      auto start = Clock::now();
+      net.PredictBatch(x, out);
+      latency.push_back(chrono::duration<double>(Clock::now() - start).count());
+    }
+
+    results.push_back({"qnetwork_latency", {{"kernel", SmallGemm::Name(kernel)}, {"network", "2-64-32-3"}, {"batch", "1"}},
+                       {{"p50_ns", Percentile(latency, 0.5) * 1e9}, {"p99_ns", Percentile(latency, 0.99) * 1e9}}});
+  }
+
+  SmallGemm::Use(SmallGemm::Best());
+}
+
+
+// One learner step of the game's agent on a sampled batch: per transition two Predict calls
+// and a one-row Fit, against a single batched Dqn update.
+static void BenchDqnUpdate(int transitions)
+{
+  srand(1);
+  Network net;
+  net.Add(new Fc_Layer(2, 64, ActivationType::TANH));
+  net.Add(new Fc_Layer(64, 32, ActivationType::LEAKY_RELU));
+  net.Add(new Fc_Layer(32, 3, ActivationType::NONE));
+  net.Use(new Mse());
+
+  double gamma = 0.99, learning_rate = 0.001;
+  MatrixXd states = MatrixXd::Random(transitions, 2);
+  MatrixXd next_states = MatrixXd::Random(transitions, 2);
+  VectorXd rewards = VectorXd::Random(transitions);
+  VectorXd done = VectorXd::Zero(transitions);
+  VectorXi actions(transitions);
+  for (int i = 0; i < transitions; i++)
+    actions(i) = rand() % 3;
+
+  double per_sample = TimeIt([&] {
+    for (int i = 0; i < transitions; i++) {
+      MatrixXd q = net.Predict(states.row(i))[0];
+      MatrixXd next_q = net.Predict(next_states.row(i))[0];
+      double target = rewards(i) + gamma * next_q.maxCoeff();
+      q(actions(i)) = (1 - learning_rate) * q(actions(i)) + learning_rate * target;
+      net.Fit(states.row(i), q, 1, learning_rate, 1, 0);
+    }
+  });
+
+  Dqn dqn(net, gamma, learning_rate);
+  double batched = TimeIt([&] { dqn.Update(states, actions, rewards, next_states, done, learning_rate); });
+
+  results.push_back({"dqn_update", {{"mode", "per_sample"}, {"network", "2-64-32-3"}, {"transitions", Str(transitions)}},
+                     {{"ms_per_update", per_sample * 1e3}}});
+  results.push_back({"dqn_update", {{"mode", "batched"}, {"network", "2-64-32-3"}, {"transitions", Str(transitions)}},
+                     {{"ms_per_update", batched * 1e3}, {"speedup", per_sample / batched}}});
+}
+
+
+// Inserts into a full memory and batches of 256 sampled from it, uniform and prioritized.
+static void BenchReplayMemory(const vector<int> &capacities)
+{
+  const int state_size = 8, batch_size = 256;
+  MatrixXd state = MatrixXd::Random(1, state_size);
+  MatrixXd next_state = MatrixXd::Random(1, state_size);
+
+  for (int capacity : capacities) {
+    for (bool prioritized : {false, true}) {
+      ReplayMemory memory(capacity, state_size, prioritized);
+      TransitionBatch batch;
+
+      for (int i = 0; i < capacity; i++)
+        memory.Add(state, i % 3, 1.0, next_state, false);
+
+      double insert = TimeIt([&] { memory.Add(state, 1, 1.0, next_state, false); });
+      double sample = TimeIt([&] { memory.Sample(batch_size, batch); });
+
+      VectorXd errors = VectorXd::Random(batch_size);
+      double update = TimeIt([&] { memory.UpdatePriorities(batch.indices, errors); });
+
+      vector<pair<string, double>> metrics = {{"inserts_per_s", 1.0 / insert}, {"samples_per_s", batch_size / sample}};
+      if (prioritized)
+        metrics.push_back({"priority_updates_per_s", batch_size / update});
+
+      results.push_back({"replay_memory", {{"sampling", prioritized ? "prioritized" : "uniform"}, {"capacity", Str(capacity)},
+                                           {"state", Str(state_size)}, {"batch", Str(batch_size)}}, metrics});
+    }
+  }
+}
+
+
+// Environment steps per second of the headless goal game, with random actions and with the
+// actions of all the instances from one forward pass of the game's Q-network.
+static void BenchGoalEnv(const vector<int> &instances)
+{
+  srand(1);
+  Network net;
+  net.Add(new Fc_Layer(2, 64, ActivationType::TANH));
+  net.Add(new Fc_Layer(64, 32, ActivationType::LEAKY_RELU));
+  net.Add(new Fc_Layer(32, 3, ActivationType::NONE));
+  Dqn dqn(net, 0.99);
+
+  vector<int> threads = {1};
+  if (thread::hardware_concurrency() > 1)
+    threads.push_back(thread::hardware_concurrency());
+
+  for (int n : instances) {
+    VectorXi actions(n);
+    for (int i = 0; i < n; i++)
+      actions(i) = rand() % GoalEnv::ACTIONS;
+
+    for (int t : threads) {
+      GoalEnv env(n, t);
+      double step = TimeIt([&] { env.Step(actions); });
+      double policy = TimeIt([&] { env.Step(dqn.Act(env.Observations())); });
+
+      results.push_back({"goal_env", {{"instances", Str(n)}, {"threads", Str(t)}},
+                         {{"steps_per_s", n / step}, {"steps_per_s_with_policy", n / policy}}});
+    }
+  }
+}
+
+
+// Training and inference throughput of a small convolutional network on 1x28x28 images,
+// 1.3k weights before the classifier, against a dense stack with the same layer widths and
+// 2.5M weights.
+static void BenchConv(const vector<int> &batches)
+{
+  const int classes = 10;
+  srand(1);
+  Network conv;
+  conv.Add(new Conv2D_Layer(1, 28, 28, 8, 3, ActivationType::RELU, 1, 1));
+  conv.Add(new MaxPool_Layer(8, 28, 28, 2));
+  conv.Add(new Conv2D_Layer(8, 14, 14, 16, 3, ActivationType::RELU, 1, 1));
+  conv.Add(new MaxPool_Layer(16, 14, 14, 2));
+  conv.Add(new Fc_Layer(16 * 7 * 7, classes, ActivationType::NONE));
+  conv.Use(new Mse());
+
+  Network dense;
+  dense.Add(new Fc_Layer(28 * 28, 8 * 14 * 14, ActivationType::RELU));
+  dense.Add(new Fc_Layer(8 * 14 * 14, 16 * 7 * 7, ActivationType::RELU));
+  dense.Add(new Fc_Layer(16 * 7 * 7, classes, ActivationType::NONE));
+  dense.Use(new Mse());
+
+  for (int b : batches) {
+    MatrixXd x = MatrixXd::Random(b, 28 * 28);
+    MatrixXd y = MatrixXd::Random(b, classes);
+
+    for (auto net : {make_pair("conv", &conv), make_pair("dense", &dense)}) {
+      double train = TimeIt([&] { net.second->TrainOnBatch(x, y, 0.0); });
+      double predict = TimeIt([&] { net.second->PredictBatch(x); });
+
+      results.push_back({"conv_network", {{"network", net.first}, {"batch", Str(b)}},
+                         {{"train_samples_per_s", b / train}, {"predict_samples_per_s", b / predict}}});
+    }
+  }
+}
+
+
+// Adam training steps on categorical ids, through an Embedding_Layer and through an
+// Fc_Layer on one-hot rows, the one-hot inputs are only built for the smaller vocabularies.
+static void BenchEmbedding(const vector<int> &vocabs, int one_hot_limit)
+{
+  const int dim = 32, batch = 256;
+
+  for (int vocab : vocabs) {
+    srand(1);
+    MatrixXd ids(batch, 1);
+    MatrixXd y = MatrixXd::Random(batch, 1);
+    for (int i = 0; i < batch; i++)
+      ids(i, 0) = rand() % vocab;
+
+    Network embedding;
+    embedding.Add(new Embedding_Layer(vocab, dim));
+    embedding.Add(new Fc_Layer(dim, 1, ActivationType::NONE));
+    embedding.Use(new Mse());
+    embedding.UseOptimizer(new Adam(0.001));
+
+    double sparse = TimeIt([&] { embedding.TrainOnBatch(ids, y, 0.001); });
+    results.push_back({"embedding_step", {{"layer", "embedding"}, {"vocab", Str(vocab)}, {"dim", Str(dim)}, {"batch", Str(batch)}},
+                       {{"us", sparse * 1e6}}});
+
+    if (vocab > one_hot_limit)
+      continue;
+
+    MatrixXd one_hot = MatrixXd::Zero(batch, vocab);
+    for (int i = 0; i < batch; i++)
+      one_hot(i, (int)ids(i, 0)) = 1;
+
+    Network dense;
+    dense.Add(new Fc_Layer(vocab, dim, ActivationType::NONE));
+    dense.Add(new Fc_Layer(dim, 1, ActivationType::NONE));
+    dense.Use(new Mse());
+    dense.UseOptimizer(new Adam(0.001));
+
+    double full = TimeIt([&] { dense.TrainOnBatch(one_hot, y, 0.001); });
+    results.push_back({"embedding_step", {{"layer", "one_hot_fc"}, {"vocab", Str(vocab)}, {"dim", Str(dim)}, {"batch", Str(batch)}},
+                       {{"us", full * 1e6}, {"embedding_speedup", full / sparse}}});
+  }
+}
+
+
+// LSTM written gate by gate: one input and one recurrent product per gate and step, and a
+// separate pass for every activation and state update, the formulation the packed layer
+// replaces. Trained with plain gradient descent on the last hidden state.
+struct NaiveLstm
+{
+  int features, hidden, steps;
+  MatrixXd wx[4], wh[4], b[4];
+  vector<MatrixXd> x, h, c, gate[4];
+
+  NaiveLstm(int features, int hidden, int steps) : features(features), hidden(hidden), steps(steps)
+  {
+    for (int g = 0; g < 4; g++) {
+      wx[g] = MatrixXd::Random(features, hidden);
+      wh[g] = MatrixXd::Random(hidden, hidden);
+      b[g] = MatrixXd::Zero(1, hidden);
+    }
+  }
+
+  MatrixXd Forward(const MatrixXd &input)
+  {
+    int batch = input.rows();
+    x.assign(steps, MatrixXd());
+    h.assign(steps + 1, MatrixXd::Zero(batch, hidden));
+    c.assign(steps + 1, MatrixXd::Zero(batch, hidden));
+    for (int g = 0; g < 4; g++)
+      gate[g].assign(steps, MatrixXd());
+
+    for (int t = 0; t < steps; t++) {
+      x[t] = input.middleCols(t * features, features);
+      for (int g = 0; g < 4; g++) {
+        MatrixXd pre = x[t] * wx[g] + h[t] * wh[g];
+        pre.rowwise() += b[g].row(0);
+        gate[g][t] = (g == 2) ? MatrixXd(pre.array().tanh()) : MatrixXd((1 + (-pre.array()).exp()).inverse());
+      }
+      c[t + 1] = gate[1][t].cwiseProduct(c[t]) + gate[0][t].cwiseProduct(gate[2][t]);
+      h[t + 1] = gate[3][t].cwiseProduct(MatrixXd(c[t + 1].array().tanh()));
+    }
+
+    return h[steps];
+  }
+
+  void Backward(const MatrixXd &error, double learning_rate)
+  {
+    MatrixXd dh = error, dc = MatrixXd::Zero(error.rows(), hidden);
+    MatrixXd dwx[4], dwh[4], db[4];
+    for (int g = 0; g < 4; g++) {
+      dwx[g] = MatrixXd::Zero(features, hidden);
+      dwh[g] = MatrixXd::Zero(hidden, hidden);
+      db[g] = MatrixXd::Zero(1, hidden);
+    }
+
+    for (int t = steps - 1; t >= 0; t--) {
+      ArrayXXd tc = c[t + 1].array().tanh();
+      ArrayXXd i = gate[0][t].array(), f = gate[1][t].array(), g = gate[2][t].array(), o = gate[3][t].array();
+      dc += MatrixXd(dh.array() * o * (1 - tc.square()));
+      MatrixXd dpre[4] = {
+        dc.array() * g * i * (1 - i), dc.array() * c[t].array() * f * (1 - f),
+        dc.array() * i * (1 - g.square()), dh.array() * tc * o * (1 - o) };
+      dc = dc.cwiseProduct(gate[1][t]);
+      dh = MatrixXd::Zero(error.rows(), hidden);
+      for (int k = 0; k < 4; k++) {
+        dwx[k] += x[t].transpose() * dpre[k];
+        dwh[k] += h[t].transpose() * dpre[k];
+        db[k] += dpre[k].colwise().sum();
+        dh += dpre[k] * wh[k].transpose();
+      }
+    }
+
+    for (int g = 0; g < 4; g++) {
+      wx[g] -= learning_rate * dwx[g];
+      wh[g] -= learning_rate * dwh[g];
+      b[g] -= learning_rate * db[g];
+    }
+  }
+};
+
+
+// Sequences per second of the LSTM and GRU layers against the gate-by-gate LSTM, inference
+// and training on the last hidden state.
+static void BenchRecurrent(const vector<int> &batches, int features, int hidden, int steps)
+{
+  for (int batch : batches) {
+    srand(1);
+    MatrixXd x = MatrixXd::Random(batch, steps * features);
+    MatrixXd y = MatrixXd::Random(batch, hidden);
+    vector<pair<string, string>> params = {{"batch", Str(batch)}, {"features", Str(features)}, {"hidden", Str(hidden)},
+                                           {"steps", Str(steps)}};
+
+    NaiveLstm naive(features, hidden, steps);
+    double naive_predict = TimeIt([&] { naive.Forward(x); });
+    double naive_train = TimeIt([&] { naive.Backward(naive.Forward(x) - y, 0.0); });
+
+    auto with = [&](const string &layer) {
+      vector<pair<string, string>> p = params;
+      p.insert(p.begin(), {"layer", layer});
+      return p;
+    };
+    results.push_back({"recurrent", with("naive_lstm"),
+                       {{"predict_sequences_per_s", batch / naive_predict}, {"train_sequences_per_s", batch / naive_train}}});
+
+    for (LayerKind kind : {LayerKind::LSTM, LayerKind::GRU}) {
+      Network net;
+      if (kind == LayerKind::LSTM)
+        net.Add(new LSTM_Layer(features, hidden, steps));
+      else
+        net.Add(new GRU_Layer(features, hidden, steps));
+      net.Use(new Mse());
+
+      double predict = TimeIt([&] { net.PredictBatch(x); });
+      double train = TimeIt([&] { net.TrainOnBatch(x, y, 0.0); });
+
+      vector<pair<string, double>> metrics = {{"predict_sequences_per_s", batch / predict}, {"train_sequences_per_s", batch / train}};
+      if (kind == LayerKind::LSTM) {
+        metrics.push_back({"predict_speedup", naive_predict / predict});
+        metrics.push_back({"train_speedup", naive_train / train});
+      }
+      results.push_back({"recurrent", with(kind == LayerKind::LSTM ? "lstm" : "gru"), metrics});
+    }
+  }
+}
+
+
+// The 64-256-256-10 network of BenchPredict written with separate Activation_Layers, as
+// it runs layer by layer and after Compile folds the activations into the Fc_Layers, and
+// the same network with the activations in the Fc_Layers, before and after Compile.
+static void BenchCompile(const vector<int> &batches)
+{
+  auto build = [](bool split) {
+    srand(1);
+    Network *net = new Network();
+    net->Use(new Mse());
+    net->Add(new Fc_Layer(64, 256, split ? ActivationType::NONE : ActivationType::TANH));
+    if (split) net->Add(new Activation_Layer(new Tanh()));
+    net->Add(new Fc_Layer(256, 256, split ? ActivationType::NONE : ActivationType::RELU));
+    if (split) net->Add(new Activation_Layer(new ReLU()));
+    net->Add(new Fc_Layer(256, 10, ActivationType::NONE));
+    return net;
+  };
+
+  for (int b : batches) {
+    MatrixXd x = MatrixXd::Random(b, 64);
+    MatrixXd y = MatrixXd::Random(b, 10);
+
+    for (bool split : {true, false}) {
+      for (bool compiled : {false, true}) {
+        unique_ptr<Network> net(build(split));
+        MatrixXd out;
+        if (compiled)
+          net->Compile();
+
+        double train = TimeIt([&] { net->TrainOnBatch(x, y, 0.0); });
+        double predict = TimeIt([&] { net->PredictBatch(x, out); });
+
+        AllocationCounter::Start();
+        long long allocations = AllocationCounter::Count();
+        net->TrainOnBatch(x, y, 0.0);
+        allocations = AllocationCounter::Count() - allocations;
+        AllocationCounter::Stop();
+
+        results.push_back({"compile", {{"layers", split ? "fc+activation_layer" : "fc"}, {"compiled", compiled ? "true" : "false"},
+                                       {"batch", Str(b)}},
+                           {{"train_samples_per_s", b / train}, {"predict_samples_per_s", b / predict},
+                            {"workspace_bytes", (double)net->WorkspaceBytes()},
+                            {"train_step_allocations", AllocationCounter::Enabled() ? (double)allocations : -1.0}}});
+      }
+    }
+  }
+}
+
+
+// Training steps on one logical batch taken whole and as micro-batches of gradient
+// accumulation, the workspace is sized for one micro-batch.
+static void BenchMicroBatch(int batch, const vector<int> &micro_batches)
+{
+  srand(2);
+  MatrixXd x = MatrixXd::Random(batch, 64);
+  MatrixXd y = MatrixXd::Random(batch, 10);
+
+  for (int micro : micro_batches) {
+    unique_ptr<Network> net(BuildNetwork(64, 256, 10));
+    net->UseMicroBatches(micro);
+
+    double train = TimeIt([&] { net->TrainOnBatch(x, y, 0.01); });
+
+    results.push_back({"micro_batch", {{"network", "64-256-256-10"}, {"batch", Str(batch)}, {"micro_batch", micro > 0 ? Str(micro) : "whole"}},
+                       {{"samples_per_s", batch / train}, {"workspace_bytes", (double)net->WorkspaceBytes()}}});
+  }
+}
+
+
+// Training steps of a deep MLP with activation checkpointing, the kept activations against
+// the forward passes run again.
+static void BenchCheckpoint(int batch, int depth, const vector<int> &segments)
+{
+  srand(2);
+  MatrixXd x = MatrixXd::Random(batch, 256);
+  MatrixXd y = MatrixXd::Random(batch, 10);
+
+  for (int segment : segments) {
+    srand(1);
+    Network net;
+    net.Use(new Mse());
+    for (int i = 0; i < depth; i++) {
+      net.Add(new Fc_Layer(256, (i == depth - 1) ? 10 : 256, (i == depth - 1) ? ActivationType::NONE : ActivationType::RELU));
+    }
+    net.UseOptimizer(new Adam(0.001));
+    net.UseCheckpoints(segment);
+
+    double train = TimeIt([&] { net.TrainOnBatch(x, y, 0.001); });
+
+    results.push_back({"checkpoint", {{"network", Str(depth) + "x256"}, {"batch", Str(batch)}, {"segment", segment > 0 ? Str(segment) : "off"}},
+                       {{"samples_per_s", batch / train}, {"activation_bytes", (double)net.ActivationBytes()},
+                        {"workspace_bytes", (double)net.WorkspaceBytes()}}});
+  }
+}
+
+
+// Training steps of a deep MLP on data-parallel replicas and on pipeline stages with the
+// same number of threads, with the share of stage time lost in the pipeline bubble.
+static void BenchPipeline(int batch, int depth, const vector<int> &threads)
+{
+  srand(2);
+  MatrixXd x = MatrixXd::Random(batch, 512);
+  MatrixXd y = MatrixXd::Random(batch, 10);
+
+  for (int t : threads) {
+    for (string mode : {"data_parallel", "gpipe", "1f1b"}) {
+      srand(1);
+      Network net;
+      net.Use(new Mse());
+      for (int i = 0; i < depth; i++) {
+        net.Add(new Fc_Layer(512, (i == depth - 1) ? 10 : 512, (i == depth - 1) ? ActivationType::NONE : ActivationType::RELU));
+      }
+      net.UseOptimizer(new Adam(0.001));
+      if (mode == "data_parallel")
+        net.UseThreads(t);
+      else
+        net.UsePipeline(t, mode == "gpipe" ? PipelineSchedule::GPIPE : PipelineSchedule::ONE_F_ONE_B);
+
+      double train = TimeIt([&] { net.TrainOnBatch(x, y, 0.001); });
+      PipelineReport report = net.GetPipelineReport();
+
+      double low = report.stages.empty() ? 0 : 1, high = 0;
+      for (auto &stage : report.stages) {
+        low = min(low, stage.utilization);
+        high = max(high, stage.utilization);
+      }
+
+      results.push_back({"pipeline", {{"network", Str(depth) + "x512"}, {"batch", Str(batch)}, {"threads", Str(t)}, {"mode", mode}},
+                         {{"samples_per_s", batch / train}, {"micro_batches", (double)report.micro_batches}, {"bubble", report.bubble},
+                          {"min_stage_utilization", low}, {"max_stage_utilization", high},
+                          {"workspace_bytes", (double)net.WorkspaceBytes()}}});
+    }
+  }
+}
+
+
+// Asynchronous Hogwild training of the tiny networks of the examples against single-threaded
+// Fit for the same number of epochs: XOR and the game QNetwork fitting the Q-values of a
+// fixed teacher on GoalEnv observations. The loss is the mean squared error after training.
+static void BenchHogwild(int samples, int epochs, const vector<int> &workers)
+{
+  srand(2);
+  MatrixXd xor_x(samples, 2), xor_y(samples, 1);
+  for (int i = 0; i < samples; i++) {
+    int a = i & 1, b = (i >> 1) & 1;
+    xor_x.row(i) << a, b;
+    xor_y(i, 0) = a ^ b;
+  }
+
+  GoalEnv env(samples);
+  VectorXi actions(samples);
+  for (int step = 0; step < 50; step++) {
+    for (int i = 0; i < samples; i++)
+      actions(i) = rand() % GoalEnv::ACTIONS;
+    env.Step(actions);
+  }
+  MatrixXd game_x = env.Observations();
+
+  auto q_network = [](Network &net) {
+    net.Add(new Fc_Layer(2, 64, ActivationType::TANH));
+    net.Add(new Fc_Layer(64, 32, ActivationType::LEAKY_RELU));
+    net.Add(new Fc_Layer(32, 3, ActivationType::NONE));
+  };
+  Network teacher;
+  q_network(teacher);
+  MatrixXd game_y = teacher.PredictBatch(game_x);
+
+  for (string workload : {"xor", "game"}) {
+    const MatrixXd &x = (workload == "xor") ? xor_x : game_x;
+    const MatrixXd &y = (workload == "xor") ? xor_y : game_y;
+
+    for (int w : workers) {
+      srand(1);
+      Network net;
+      net.Use(new Mse());
+      if (workload == "xor") {
+        net.Add(new Fc_Layer(2, 8, ActivationType::TANH));
+        net.Add(new Fc_Layer(8, 1, ActivationType::TANH));
+      }
+      else {
+        q_network(net);
+      }
+      net.UseOptimizer(new Adam(0.001));
+      net.UseHogwild(w);
+
+      auto start = Clock::now();
+      net.Fit(x, y, epochs, 0.01, 4, 0);
+      double t = chrono::duration<double>(Clock::now() - start).count();
+      double loss = (net.PredictBatch(x) - y).squaredNorm() / y.size();
+      HogwildReport report = net.GetHogwildReport();
+
+      results.push_back({"hogwild", {{"workload", workload}, {"samples", Str(samples)}, {"epochs", Str(epochs)},
+                                     {"mode", w == 0 ? "fit" : "hogwild"}, {"workers", Str(max(w, 1))}},
+                         {{"samples_per_s", (double)samples * epochs / t}, {"loss", loss},
+                          {"mean_staleness", report.mean_staleness}, {"max_staleness", (double)report.max_staleness},
+                          {"conflict_share", report.layer_updates > 0 ? (double)report.conflicts / report.layer_updates : 0.0}}});
+    }
+  }
+}
+
+
+static string Escape(const string &s)
+{
+  string out;
+  for (char c : s) {
+    if (c == '"' || c == '\\') out += '\\';
+    out += c;
+  }
+  return out;
+}
+
+
+static void WriteJson(ostream &os)
+{
+  os << "{\n";
+  os << "  \"meta\": {\"compiler\": \"" << Escape(__VERSION__) << "\", \"eigen\": \""
+     << EIGEN_WORLD_VERSION << "." << EIGEN_MAJOR_VERSION << "." << EIGEN_MINOR_VERSION
+     << "\", \"simd\": \"" << Escape(SimdInstructionSetsInUse()) << "\", \"hardware_threads\": "
+     << thread::hardware_concurrency() << ", \"gemm_kernel\": \"" << SmallGemm::Name(SmallGemm::Best())
+     << "\", \"scalar\": \"double\", \"min_time_s\": " << min_time << "},\n";
+  os << "  \"results\": [\n";
+
+  for (size_t i = 0; i < results.size(); i++) {
+    const Result &r = results[i];
+    os << "    {\"name\": \"" << r.name << "\"";
+    for (auto &p : r.params) os << ", \"" << p.first << "\": \"" << Escape(p.second) << "\"";
+    for (auto &m : r.metrics) os << ", \"" << m.first << "\": " << m.second;
+    os << "}" << (i + 1 < results.size() ? "," : "") << "\n";
+  }
+
+  os << "  ]\n}\n";
+}
+
+
+// Benchmark suite of the library, the results are written as JSON to stdout or to the
+// file given as argument. --quick runs smaller cases for a fast check.
+int main(int argc, char *argv[])
+{
+  string output;
+  bool quick = false;
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--quick") == 0) quick = true;
+    else output = argv[i];
+  }
+
+  if (quick) {
+    min_time = 0.05;
+    BenchFcLayer({64, 256}, {1, 32});
+    BenchActivations(64, 256);
+    BenchAdam({256});
+    BenchFit(2048, {64});
+    BenchPredict({{1, 500}, {256, 50}});
+    BenchSmallGemm({{2, 64}, {64, 32}, {32, 3}}, {1, 8});
+    BenchQNetwork(2000);
+    BenchDqnUpdate(321);
+    BenchReplayMemory({1 << 16, 1 << 20});
+    BenchGoalEnv({1, 1024, 65536});
+    BenchConv({32});
+    BenchEmbedding({1000, 100000}, 1000);
+    BenchRecurrent({32}, 16, 64, 20);
+    BenchCompile({32});
+    BenchMicroBatch(1024, {0, 64});
+    BenchCheckpoint(64, 8, {0, 3});
+    BenchPipeline(128, 6, {2});
+    BenchHogwild(1024, 5, {0, 1, 2});
+    BenchClassification(1500, 6, 0.8, 80);
+  }
+  else {
+    BenchFcLayer({64, 256, 1024}, {1, 32, 256});
+    BenchActivations(256, 1024);
+    BenchAdam({64, 256, 1024});
+    BenchFit(16384, {32, 256});
+    BenchPredict({{1, 5000}, {32, 2000}, {1024, 200}});
+    BenchSmallGemm({{2, 64}, {64, 32}, {32, 3}, {64, 64}, {256, 256}}, {1, 4, 8, 16});
+    BenchQNetwork(20000);
+    BenchDqnUpdate(321);
+    BenchReplayMemory({1 << 16, 1 << 20, 1 << 22});
+    BenchGoalEnv({1, 64, 1024, 16384, 262144});
+    BenchConv({1, 32, 256});
+    BenchEmbedding({1000, 10000, 100000, 1000000}, 10000);
+    BenchRecurrent({1, 32, 256}, 16, 64, 20);
+    BenchCompile({1, 32, 256});
+    BenchMicroBatch(4096, {0, 32, 128, 512});
+    BenchCheckpoint(256, 16, {0, 1, 2, 4, 8});
+    BenchPipeline(512, 12, {2, 4});
+    BenchHogwild(4096, 20, {0, 1, 2, 4});
+    BenchClassification(3000, 6, 0.95, 300);
+  }
+
+  if (output.empty()) {
+    WriteJson(cout);
+  }
+  else {
+    ofstream ofs(output.c_str());
+    WriteJson(ofs);
+    cerr << "Results written to " << output << endl;
+  }
+
+  return 0;
+}
@@ -0,0 +1,91 @@
+#include <iostream>
+#include <chrono>
+#include "network.h"
+#include "layers/fc_layer.h"
+
+#include <Eigen/Dense>
+
+using namespace std;
+using namespace Eigen;
+using namespace Neural;
+
+
+// GFLOP/s of a n x n x n matrix product with scalar type T
+template <typename T>
+static double GemmThroughput(int n)
+{
+  DynMatrix<T> a = DynMatrix<T>::Random(n, n);
+  DynMatrix<T> b = DynMatrix<T>::Random(n, n);
+  DynMatrix<T> c(n, n);
+
+  int repeat = std::max(1, (int)(2e8 / ((double)n * n * n)));
+
+  auto start = chrono::high_resolution_clock::now();
+  for (int i = 0; i < repeat; i++) {
+    c.noalias() = a * b;
+  }
+  auto stop = chrono::high_resolution_clock::now();
+  double elapsed = chrono::duration<double>(stop - start).count();
+
+  return 2.0 * n * n * n * repeat / elapsed * 1e-9;
+}
+
+
+// samples/s of the inference forward pass of a 256 -> 512 -> 512 -> 10 network
+template <typename T>
+static double ForwardThroughput(int batch)
+{
+  NetworkT<T> net;
+  net.Add(new Fc_LayerT<T>(256, 512, ActivationType::RELU));
+  net.Add(new Fc_LayerT<T>(512, 512, ActivationType::RELU));
+  net.Add(new Fc_LayerT<T>(512, 10, ActivationType::NONE));
+
+  DynMatrix<T> x = DynMatrix<T>::Random(batch, 256);
+  DynMatrix<T> y;
+  int repeat = 20;
+
+  auto start = chrono::high_resolution_clock::now();
+  for (int i = 0; i < repeat; i++) {
+    net.PredictBatch(x, y);
+  }
+  auto stop = chrono::high_resolution_clock::now();
+
+  return (double)batch * repeat / chrono::duration<double>(stop - start).count();
+}
+
+
+int main(int argc, char *argv[])
+{
+  int sizes[] = { 64, 128, 256, 512, 1024 };
+
+  cout << "GEMM GFLOP/s" << endl;
+  for (int n : sizes) {
+    cout << "  n = " << n
+         << "\t| float " << GemmThroughput<float>(n)
+         << "\t| double " << GemmThroughput<double>(n) << endl;
+  }
+
+  cout << "Forward samples/s (batch 1024)" << endl;
+  cout << "  float  " << ForwardThroughput<float>(1024) << endl;
+  cout << "  double " << ForwardThroughput<double>(1024) << endl;
+
+  // the model file records the scalar type, a float model is loaded back as float
+  NetworkF *net = new NetworkF();
+  net->Use(new MseF());
+  net->Add(new Fc_LayerF(2, 8, ActivationType::TANH));
+  net->Add(new Fc_LayerF(8, 1, ActivationType::NONE));
+  net->SaveModel("float_model");
+
+  MatrixXf x = MatrixXf::Random(4, 2);
+  NetworkF *fnet = NetworkF::LoadModel("float_model");
+  Network *dnet = Network::LoadModel("float_model");
+
+  cout << "Loaded float model, max diff float " << (fnet->PredictBatch(x) - net->PredictBatch(x)).cwiseAbs().maxCoeff()
+       << " | as double " << (dnet->PredictBatch(x.cast<double>()).cast<float>() - net->PredictBatch(x)).cwiseAbs().maxCoeff() << endl;
+
+  delete net;
+  delete fnet;
+  delete dnet;
+
+  return 0;
+}
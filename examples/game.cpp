@@ -1,134 +1,78 @@
 #include <raylib.h>
 #include <cmath>
 #include <string>
+#include <chrono>
+#include <iostream>
+#include <cstdlib>
 #include "network.h"
+#include "dqn.h"
+#include "goal_env.h"
 #include "layers/fc_layer.h"
 #include "layers/activation_layer.h"
 #include <vector>
-#include <random>
 
 using namespace Neural;
 
-const int screenWidth = 800;
-const int screenHeight = 600;
-const float playerSize = 20.0f;
-const float playerSpeed = 2.0f;
-const float playerRotationSpeed = 2.0f;
-const float wallThickness = 10.0f;
+const int screenWidth = (int)GoalEnv::WIDTH;
+const int screenHeight = (int)GoalEnv::HEIGHT;
+const float playerSize = GoalEnv::PLAYER_SIZE;
+const float wallThickness = GoalEnv::WALL;
 
-#define MOVE_LEFT     0x01
-#define MOVE_RIGHT    0x02
-#define MOVE_FORWARD  0x04
-#define MOVE_BACKWORD 0x08
 
-struct Player
+// draws one instance of the environment after every step
+class RenderObserver : public EnvObserver
 {
-  Vector2 position;
-  float rotation;
-  Vector2 direction;
-};
-
-struct Goal
-{
-  Vector2 position;
-  float radius;
-};
-
-Player player;
-Goal goal;
-
-void InitGame()
-{
-  player.position = (Vector2){screenWidth / 2.0f, screenHeight / 2.0f};
-  player.rotation = (float)GetRandomValue(0, 360);
-  player.direction = (Vector2){1.0f, 0.0f};
+private:
+  RenderTexture2D renderTexture;
 
-  goal.position = (Vector2){(float)GetRandomValue(50, screenWidth - 50), (float)GetRandomValue(50, screenHeight - 50)};
-  goal.radius = 10.0f;
-}
+public:
+  RenderObserver() { renderTexture = LoadRenderTexture(screenWidth, screenHeight); }
+  ~RenderObserver() { UnloadRenderTexture(renderTexture); }
 
-void UpdatePlayer(int inputAction)
-{
-  if (inputAction & MOVE_FORWARD)
+  void OnStep(const GoalEnv &env, int instance) override
   {
-    player.position.x += player.direction.x * playerSpeed;
-    player.position.y += player.direction.y * playerSpeed;
-  }
-  else if (inputAction & MOVE_BACKWORD)
-  {
-    player.position.x -= player.direction.x * playerSpeed;
-    player.position.y -= player.direction.y * playerSpeed; 
-  }
-
-  if (inputAction & MOVE_LEFT)
-    player.rotation += playerRotationSpeed;
-  if (inputAction & MOVE_RIGHT)
-    player.rotation -= playerRotationSpeed;
-
-  // Update direction
-  player.direction.x = cos(player.rotation * DEG2RAD);
-  player.direction.y = sin(player.rotation * DEG2RAD);
-
-  // Collision Detection
-  if (player.position.x < wallThickness)
-    player.position.x = wallThickness;
-  if (player.position.y < wallThickness)
-    player.position.y = wallThickness;
-  if (player.position.x > screenWidth - wallThickness)
-    player.position.x = screenWidth - wallThickness;
-  if (player.position.y > screenHeight - wallThickness)
-    player.position.y = screenHeight - wallThickness;
-}
+    Vector2 position = {(float)env.PlayerX(instance), (float)env.PlayerY(instance)};
+    float rotation = env.Rotation(instance);
+    Vector2 direction = {cosf(rotation * DEG2RAD), sinf(rotation * DEG2RAD)};
+    Vector2 goal = {(float)env.GoalX(instance), (float)env.GoalY(instance)};
 
-bool CheckGoalReached()
-{
-  return CheckCollisionCircleRec(goal.position, goal.radius,
-                                 (Rectangle){player.position.x - playerSize / 2, player.position.y - playerSize / 2, playerSize, playerSize});
-}
-
-void CalculateDirectionToGoal(float &angleDifference, float &distance)
-{
-  float dx = goal.position.x - player.position.x;
-  float dy = goal.position.y - player.position.y;
+    BeginTextureMode(renderTexture);
+      ClearBackground(RAYWHITE);
 
-  // Caculate angle
-  float angleToGoal = atan2(dy, dx) * RAD2DEG;
+      // Draw walls
+      DrawRectangle(0, 0, screenWidth, wallThickness, GRAY);
+      DrawRectangle(0, screenHeight - wallThickness, screenWidth, wallThickness, GRAY);
+      DrawRectangle(0, 0, wallThickness, screenHeight, GRAY);
+      DrawRectangle(screenWidth - wallThickness, 0, wallThickness, screenHeight, GRAY);
 
-  // Convert angle to 0-360 degree range
-  if (angleToGoal < 0) angleToGoal += 360;
+      // 繪製玩家
+      DrawRectanglePro(
+          (Rectangle){position.x, position.y, playerSize, playerSize},
+          (Vector2){playerSize / 2, playerSize / 2},
+          rotation,
+          BLUE);
 
-  angleDifference = angleToGoal - fmod(player.rotation, 360);
+      // 繪製玩家方向
+      DrawLineEx(position, (Vector2){position.x + direction.x * 30, position.y + direction.y * 30}, 3, RED);
 
-  if (angleDifference > 180)  angleDifference -= 360;
-  if (angleDifference < -180) angleDifference += 360;
+      // 繪製目標
+      DrawCircleV(goal, (float)GoalEnv::GOAL_RADIUS, GREEN);
+    EndTextureMode();
 
-  // Caculate distance
-  distance = sqrt(dx * dx + dy * dy);
-}
+    double reward = env.Rewards()(instance);
+    double angleDifference = env.PreviousObservations()(instance, 0);
+    double distanceToGoal = env.PreviousObservations()(instance, 1);
 
-void DrawGame()
-{
-  // Draw walls
-  DrawRectangle(0, 0, screenWidth, wallThickness, GRAY);
-  DrawRectangle(0, screenHeight - wallThickness, screenWidth, wallThickness, GRAY);
-  DrawRectangle(0, 0, wallThickness, screenHeight, GRAY);
-  DrawRectangle(screenWidth - wallThickness, 0, wallThickness, screenHeight, GRAY);
-
-  // 繪製玩家
-  DrawRectanglePro(
-      (Rectangle){player.position.x, player.position.y, playerSize, playerSize},
-      (Vector2){playerSize / 2, playerSize / 2},
-      player.rotation,
-      BLUE);
-
-  // 繪製玩家方向
-  DrawLineEx(player.position,
-             (Vector2){player.position.x + player.direction.x * 30, player.position.y + player.direction.y * 30},
-             3, RED);
-
-  // 繪製目標
-  DrawCircleV(goal.position, goal.radius, GREEN);
-}
+    BeginDrawing();
+      ClearBackground(RAYWHITE);
+      DrawTextureEx(renderTexture.texture, (Vector2){0, 0}, 0, 1.0, RAYWHITE);
+      DrawText(("Reward: " + std::to_string(reward)).c_str(), 10, 70, 20, RED);
+      DrawText(("Angle to Goal: " + std::to_string(static_cast<int>(angleDifference)) + "°").c_str(), 10, 10, 20, BLACK);
+      DrawText(("Distance to Goal: " + std::to_string(static_cast<int>(distanceToGoal))).c_str(), 10, 40, 20, BLACK);
+      DrawText(("Instances: " + std::to_string(env.Instances())).c_str(), 10, 100, 20, DARKGRAY);
+    EndDrawing();
+  }
+};
 
 
 
@@ -154,46 +98,6 @@ public:
 
 
 
-struct Experience {
-    Eigen::MatrixXd state;
-    int action;
-    double reward;
-    Eigen::MatrixXd next_state;
-    bool done;
-};
-
-class ReplayBuffer {
-private:
-    std::vector<Experience> buffer;
-    size_t max_size;
-    std::random_device rd;
-    std::mt19937 gen;
-
-public:
-    ReplayBuffer(size_t size) : max_size(size), gen(rd()) {}
-
-    void add(const Experience& exp) {
-        if (buffer.size() >= max_size) {
-            buffer.erase(buffer.begin());
-        }
-        buffer.push_back(exp);
-    }
-
-    std::vector<Experience> sample(size_t batch_size) {
-        std::vector<Experience> batch;
-        for (size_t i = 0; i < batch_size && i < buffer.size(); ++i) {
-            size_t index = std::uniform_int_distribution<>(0, buffer.size() - 1)(gen);
-            batch.push_back(buffer[index]);
-        }
-        return batch;
-    }
-
-    size_t size() const {
-        return buffer.size();
-    }
-};
-
-
 class QLearningAgent
 {
 private:
@@ -202,58 +106,37 @@ private:
   double gamma;
   double learning_rate;
 
-  ReplayBuffer replay_buffer;
+  ReplayMemory replay_memory;
+  TransitionBatch samples;
   size_t batch_size;
 
+  // the Q-values move learning_rate of the way to their targets, as a per-sample blend did
+  Dqn dqn;
+
 public:
   QLearningAgent(double eps = 1.0, double g = 0.99, double lr = 0.001, size_t buffer_size = 10000, size_t batch = 320)
-      : epsilon(eps), gamma(g), learning_rate(lr), replay_buffer(buffer_size), batch_size(batch) {}
+      : epsilon(eps), gamma(g), learning_rate(lr), replay_memory(buffer_size, 2), batch_size(batch),
+        dqn(qnetwork, g, lr) {}
 
-  int GetAction(const Eigen::MatrixXd &state)
+  // one forward pass chooses the actions of all the instances
+  const Eigen::VectorXi& GetActions(const Eigen::MatrixXd &states)
   {
-    // if (((double)rand() / RAND_MAX) < epsilon)
-    // {
-    //   if (epsilon > 0) epsilon -= 0.0001;
-    //   return rand() % 3; // 隨機探索
-    // }
-    // else
-    {
-      Eigen::MatrixXd q_values = qnetwork.GetQValues(state);
-      Eigen::MatrixXd::Index maxRow, maxCol;
-      q_values.maxCoeff(&maxRow, &maxCol);
-      return static_cast<int>(maxCol);
-    }
+    // if (epsilon > 0) epsilon -= 0.0001;
+    // return dqn.Act(states, epsilon); // 隨機探索
+    return dqn.Act(states);
   }
 
-  void Update(const Eigen::MatrixXd &state, int action, double reward, const Eigen::MatrixXd &next_state, bool done)
+  void Update(const GoalEnv &env, const Eigen::VectorXi &actions)
   {
     // 添加經驗到緩衝區
-    replay_buffer.add({state, action, reward, next_state, done});
+    replay_memory.Add(env.PreviousObservations(), actions, env.Rewards(), env.Observations(), env.Done());
 
     // 如果緩衝區中的經驗不夠，就不進行學習
-    if (replay_buffer.size() < batch_size) return;
-
-    auto batch = replay_buffer.sample(batch_size);
-    batch.push_back({state,action, reward, next_state, done});
-
-    for (const auto &exp : batch) {
-      Eigen::MatrixXd q_values = qnetwork.GetQValues(exp.state);
-      Eigen::MatrixXd next_q_values = qnetwork.GetQValues(exp.next_state);
-
-      double target = exp.reward;
-      if (!exp.done) {
-        target += gamma * next_q_values.maxCoeff();
-      }
-
-      q_values(exp.action) = (1 - learning_rate) * q_values(exp.action) + learning_rate * target;
+    if ((size_t)replay_memory.Size() < batch_size) return;
 
-      Eigen::MatrixXd input(1, 2);
-      input << exp.state;
-      Eigen::MatrixXd output(1, 3);
-      output << q_values;
-
-      qnetwork.Fit(input, output, 1, learning_rate, 1, 0);
-    }
+    // 整批一起更新: 一次前向計算所有 next state, 一次前向與反向計算所有 state
+    replay_memory.Sample(batch_size, samples);
+    dqn.Update(samples, learning_rate);
   }
 
   void SaveModel(void) {
@@ -262,108 +145,63 @@ public:
 };
 
 
-int main()
+// game [--headless] [instances] [steps]
+// The window shows instance 0 at 60 steps per second, the arrow keys move its goal.
+// Headless the instances are stepped as fast as they can be trained on.
+int main(int argc, char *argv[])
 {
-  InitWindow(screenWidth, screenHeight, "AI Training Environment");
-  SetTargetFPS(60);
-
-  RenderTexture2D renderTexture = LoadRenderTexture(screenWidth, screenHeight);
-
-  InitGame();
+  bool headless = (argc > 1 && std::string(argv[1]) == "--headless");
+  int instances = (argc > 2) ? atoi(argv[2]) : 32;
+  long steps = (argc > 3) ? atol(argv[3]) : 100000;
 
+  GoalEnv env(instances);
   QLearningAgent agent;
-  double reward = 0;
-  double time = 0;
-  float angleDifference, distanceToGoal;
-
-  while (!WindowShouldClose())
-  {
-    // Get current state
-    CalculateDirectionToGoal(angleDifference, distanceToGoal);
-    Eigen::MatrixXd state(1, 2);
-    state << angleDifference, distanceToGoal;
-
-    // Get action
-    int action = agent.GetAction(state);
-    int inputAction = 0;
 
-    if (action == 0)      inputAction = 0;
-    else if (action == 1) inputAction = MOVE_LEFT;
-    else if (action == 2) inputAction = MOVE_RIGHT;
+  if (headless) {
+    auto start = std::chrono::steady_clock::now();
 
-    if (IsKeyDown(KEY_LEFT))       goal.position.x -= 2;
-    else if (IsKeyDown(KEY_RIGHT)) goal.position.x += 2;
+    for (long i = 0; i < steps; i++) {
+      const Eigen::VectorXi &actions = agent.GetActions(env.Observations());
+      env.Step(actions);
+      agent.Update(env, actions);
+    }
 
-    if (IsKeyDown(KEY_UP))         goal.position.y += 2;
-    else if (IsKeyDown(KEY_DOWN))  goal.position.y -= 2;
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << steps * instances / seconds << " environment steps per second" << std::endl;
 
-    UpdatePlayer(inputAction | MOVE_FORWARD);
+    agent.SaveModel();
+    return 0;
+  }
 
-    bool done = false;
-    if (CheckGoalReached())
-    {
-      done = true;
-      reward = 100;
-      InitGame();
-    }
-    else if (player.position.x <= wallThickness || player.position.x >= screenWidth - wallThickness ||
-             player.position.y <= wallThickness || player.position.y >= screenHeight - wallThickness)
-    {
-      done = true;
-      reward = -10; // 撞牆懲罰
-      InitGame();
-    }
+  InitWindow(screenWidth, screenHeight, "AI Training Environment");
+  SetTargetFPS(60);
 
-    // Get new state
-    float newAngleDifference, newDistanceToGoal;
-    CalculateDirectionToGoal(newAngleDifference, newDistanceToGoal);
-
-    if (!done) {
-      time += 0.01;
-      reward = -time;
-      // 計算獎勵
-      if (fabs(newAngleDifference) < 10) {
-        reward += 0.5;
-      }
-      else if (fabs(newAngleDifference) < fabs(angleDifference)) 
-        reward += 0;
-      else
-        reward += -20;
-      
-      if (newDistanceToGoal < distanceToGoal)
-        reward += 0.1;
-      else
-        reward += -1;
-    }
-    else {
-      time = 0;
-    }
+  RenderObserver renderer;
+  env.Observe(&renderer, 0);
 
-    Eigen::MatrixXd next_state(1, 2);
+  while (!WindowShouldClose())
+  {
+    double goalX = env.GoalX(0), goalY = env.GoalY(0);
 
-    next_state << newAngleDifference, newDistanceToGoal;
+    if (IsKeyDown(KEY_LEFT))       goalX -= 2;
+    else if (IsKeyDown(KEY_RIGHT)) goalX += 2;
 
-    // 更新Q-network
-    agent.Update(state, action, reward, next_state, done);
+    if (IsKeyDown(KEY_UP))         goalY += 2;
+    else if (IsKeyDown(KEY_DOWN))  goalY -= 2;
 
-    if (done) reward = 0;
+    env.SetGoal(0, goalX, goalY);
 
-    BeginTextureMode(renderTexture);
-      ClearBackground(RAYWHITE);
-      DrawGame();
-    EndTextureMode();
+    // 每個實例都向前走, 由 Q-network 決定轉向
+    const Eigen::VectorXi &actions = agent.GetActions(env.Observations());
+    env.Step(actions);
 
-    BeginDrawing();
-      ClearBackground(RAYWHITE);
-      DrawTextureEx(renderTexture.texture, (Vector2){0, 0}, 0, 1.0, RAYWHITE);
-      DrawText(("Reward: " + std::to_string(static_cast<double>(reward))).c_str(), 10, 70, 20, RED);
-      DrawText(("Angle to Goal: " + std::to_string(static_cast<int>(angleDifference)) + "°").c_str(), 10, 10, 20, BLACK);
-      DrawText(("Distance to Goal: " + std::to_string(static_cast<int>(distanceToGoal))).c_str(), 10, 40, 20, BLACK);      
-    EndDrawing();
+    // 更新Q-network
+    agent.Update(env, actions);
   }
 
+  env.Observe(nullptr);
   agent.SaveModel();
 
   CloseWindow();
   return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,69 @@
+#include <iostream>
+#include <chrono>
+#include <cstdlib>
+#include "network.h"
+#include "layers/fc_layer.h"
+
+#include <Eigen/Dense>
+
+using namespace std;
+using namespace Eigen;
+using namespace Neural;
+
+
+static double Seconds(chrono::high_resolution_clock::time_point start)
+{
+  return chrono::duration<double>(chrono::high_resolution_clock::now() - start).count();
+}
+
+
+// Cold start of a large model: LoadModel maps the file, so it returns before the weights
+// are read, the first prediction pays the page faults. Loading with verify reads every
+// page to check the parameter checksum.
+int main(int argc, char *argv[])
+{
+  int width = 2048;
+  if (argc > 1) width = atoi(argv[1]);
+
+  const char *name = "model_load.bin";
+
+  srand(1);
+  Network *net = new Network();
+  net->Use(new Mse());
+  net->Add(new Fc_Layer(64, width, ActivationType::RELU));
+  net->Add(new Fc_Layer(width, width, ActivationType::RELU));
+  net->Add(new Fc_Layer(width, width, ActivationType::RELU));
+  net->Add(new Fc_Layer(width, 10, ActivationType::NONE));
+
+  MatrixXd x = MatrixXd::Random(16, 64);
+  MatrixXd reference = net->PredictBatch(x);
+
+  auto start = chrono::high_resolution_clock::now();
+  net->SaveModel(name);
+  cout << "save                  " << Seconds(start) * 1e3 << " ms" << endl;
+  delete net;
+
+  start = chrono::high_resolution_clock::now();
+  Network *mapped = Network::LoadModel(name);
+  cout << "load (mapped)         " << Seconds(start) * 1e3 << " ms" << endl;
+
+  start = chrono::high_resolution_clock::now();
+  MatrixXd predict = mapped->PredictBatch(x);
+  cout << "first predict         " << Seconds(start) * 1e3 << " ms" << endl;
+
+  start = chrono::high_resolution_clock::now();
+  predict = mapped->PredictBatch(x);
+  cout << "second predict        " << Seconds(start) * 1e3 << " ms" << endl;
+
+  start = chrono::high_resolution_clock::now();
+  Network *verified = Network::LoadModel(name, true);
+  cout << "load (verify)         " << Seconds(start) * 1e3 << " ms" << endl;
+
+  cout << "max diff vs saved net " << (predict - reference).cwiseAbs().maxCoeff() << endl;
+
+  delete mapped;
+  delete verified;
+  remove(name);
+
+  return 0;
+}
@@ -0,0 +1,71 @@
+#include <iostream>
+#include <chrono>
+#include <thread>
+#include <cstdlib>
+#include "network.h"
+#include "layers/fc_layer.h"
+
+#include <Eigen/Dense>
+
+using namespace std;
+using namespace Eigen;
+using namespace Neural;
+
+
+static Network* BuildNetwork()
+{
+  // same seed for every network, so they all start from the same weights
+  srand(1);
+
+  Network *net = new Network();
+  net->Use(new Mse());
+
+  net->Add(new Fc_Layer(32, 256, ActivationType::TANH));
+  net->Add(new Fc_Layer(256, 256, ActivationType::RELU));
+  net->Add(new Fc_Layer(256, 10, ActivationType::NONE));
+
+  net->UseOptimizer(new Adam(0.001));
+
+  return net;
+}
+
+
+// Samples/sec scaling curve of data-parallel Fit from 1 to N threads, and the difference
+// of the trained predictions against single-threaded training.
+int main(int argc, char *argv[])
+{
+  int max_threads = std::max(1u, std::thread::hardware_concurrency());
+  if (argc > 1) max_threads = atoi(argv[1]);
+
+  int samples = 16384;
+  int batch_size = 512;
+  int epochs = 3;
+
+  srand(2);
+  MatrixXd x = MatrixXd::Random(samples, 32);
+  MatrixXd y = MatrixXd::Random(samples, 10);
+
+  MatrixXd reference;
+
+  for (int threads = 1; threads <= max_threads; threads *= 2) {
+    Network *net = BuildNetwork();
+    net->UseThreads(threads);
+
+    srand(3);
+    auto start = chrono::high_resolution_clock::now();
+    net->Fit(x, y, epochs, 0.01, batch_size, 0);
+    auto stop = chrono::high_resolution_clock::now();
+    double elapsed = chrono::duration<double>(stop - start).count();
+
+    MatrixXd predict = net->PredictBatch(x.topRows(256));
+    if (threads == 1) reference = predict;
+
+    cout << "threads " << threads
+         << "\t| " << (double)samples * epochs / elapsed << " samples/s"
+         << "\t| max diff vs 1 thread " << (predict - reference).cwiseAbs().maxCoeff() << endl;
+
+    delete net;
+  }
+
+  return 0;
+}
@@ -0,0 +1,77 @@
+#include <iostream>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include "network.h"
+#include "layers/fc_layer.h"
+
+#include <Eigen/Dense>
+
+using namespace std;
+using namespace Eigen;
+using namespace Neural;
+
+
+// Throughput of the per-row Predict against the batched PredictBatch, on a network
+// shaped like the QNetwork of the game example.
+int main(int argc, char *argv[])
+{
+  int samples = 100000;
+  if (argc > 1) samples = atoi(argv[1]);
+
+  Network *net = new Network();
+  net->Use(new Mse());
+
+  net->Add(new Fc_Layer(2, 64, ActivationType::TANH));
+  net->Add(new Fc_Layer(64, 32, ActivationType::LEAKY_RELU));
+  net->Add(new Fc_Layer(32, 3, ActivationType::NONE));
+
+  MatrixXd x = MatrixXd::Random(samples, 2);
+
+  auto start = chrono::high_resolution_clock::now();
+  auto rows = net->Predict(x);
+  auto stop = chrono::high_resolution_clock::now();
+  double elapsed = chrono::duration<double>(stop - start).count();
+
+  cout << "Predict (per row)      : " << samples / elapsed << " samples/s" << endl;
+
+  MatrixXd output;
+  int chunks[] = { 1, 16, 64, 256, 1024, 0 };
+
+  for (int chunk : chunks) {
+    start = chrono::high_resolution_clock::now();
+    net->PredictBatch(x, output, chunk);
+    stop = chrono::high_resolution_clock::now();
+    elapsed = chrono::duration<double>(stop - start).count();
+
+    cout << "PredictBatch (chunk " << (chunk == 0 ? samples : chunk) << ")"
+         << "\t: " << samples / elapsed << " samples/s" << endl;
+  }
+
+  double diff = 0.0;
+  for (int i = 0; i < samples; i++) {
+    diff = std::max(diff, (rows[i] - output.row(i)).cwiseAbs().maxCoeff());
+  }
+  cout << "Max difference         : " << diff << endl;
+
+  // Inference does not touch the layers, so every thread shares the same weights.
+  unsigned int threads = std::max(1u, std::thread::hardware_concurrency());
+  vector<thread> workers;
+
+  start = chrono::high_resolution_clock::now();
+  for (unsigned int t = 0; t < threads; t++) {
+    workers.emplace_back([&]() {
+      MatrixXd y;
+      net->PredictBatch(x, y, 256);
+    });
+  }
+  for (auto &w : workers) w.join();
+  stop = chrono::high_resolution_clock::now();
+  elapsed = chrono::duration<double>(stop - start).count();
+
+  cout << "PredictBatch x" << threads << " threads\t: " << threads * samples / elapsed << " samples/s" << endl;
+
+  delete net;
+
+  return 0;
+}
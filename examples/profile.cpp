@@ -0,0 +1,70 @@
+#include <iostream>
+#include <chrono>
+#include <cstdlib>
+#include "network.h"
+#include "layers/fc_layer.h"
+
+#include <Eigen/Dense>
+
+using namespace std;
+using namespace Eigen;
+using namespace Neural;
+
+
+static Network* BuildNetwork()
+{
+  srand(1);
+
+  Network *net = new Network();
+  net->Use(new Mse());
+
+  net->Add(new Fc_Layer(32, 512, ActivationType::TANH));
+  net->Add(new Fc_Layer(512, 256, ActivationType::RELU));
+  net->Add(new Fc_Layer(256, 10, ActivationType::NONE));
+
+  net->UseOptimizer(new Adam(0.001));
+
+  return net;
+}
+
+
+static double FitTime(Network *net, const MatrixXd &x, const MatrixXd &y)
+{
+  auto start = chrono::high_resolution_clock::now();
+  net->Fit(x, y, 2, 0.01, 128, 0);
+  return chrono::duration<double>(chrono::high_resolution_clock::now() - start).count();
+}
+
+
+// Per-layer report of a training run and of batch inference, and the cost of the
+// instrumentation when it is off and on.
+int main(int argc, char *argv[])
+{
+  srand(2);
+  MatrixXd x = MatrixXd::Random(8192, 32);
+  MatrixXd y = MatrixXd::Random(8192, 10);
+
+  Network *net = BuildNetwork();
+  double off = FitTime(net, x, y);
+
+  net->EnableProfiling();
+  double on = FitTime(net, x, y);
+  MatrixXd out = net->PredictBatch(x, 256);
+
+  ProfileReport report = net->GetProfile();
+  report.Print(cout);
+
+  // the report is plain data, e.g. the layer with the most training time
+  int slowest = 0;
+  for (auto &layer : report.layers) {
+    if (layer.forward_seconds + layer.backward_seconds + layer.update_seconds >
+        report.layers[slowest].forward_seconds + report.layers[slowest].backward_seconds + report.layers[slowest].update_seconds)
+      slowest = layer.index;
+  }
+  cout << "slowest layer  : " << slowest << endl;
+  cout << "fit time off/on: " << off << " s / " << on << " s" << endl;
+
+  delete net;
+
+  return 0;
+}
@@ -0,0 +1,96 @@
+#include <iostream>
+#include <chrono>
+#include "network.h"
+#include "layers/fc_layer.h"
+
+#include <Eigen/Dense>
+
+using namespace std;
+using namespace Eigen;
+using namespace Neural;
+
+
+static double Accuracy(const MatrixXd &y_pred, const MatrixXd &y_true)
+{
+  int correct = 0;
+  for (int i = 0; i < y_pred.rows(); i++) {
+    MatrixXd::Index p, t;
+    y_pred.row(i).maxCoeff(&p);
+    y_true.row(i).maxCoeff(&t);
+    correct += (p == t);
+  }
+
+  return (double)correct / y_pred.rows();
+}
+
+
+// average latency in microseconds of PredictBatch on batch rows
+static double Latency(const Network *net, const MatrixXd &x, int batch, int repeat)
+{
+  MatrixXd input = x.topRows(batch);
+  MatrixXd output;
+
+  auto start = chrono::high_resolution_clock::now();
+  for (int i = 0; i < repeat; i++) {
+    net->PredictBatch(input, output);
+  }
+  auto stop = chrono::high_resolution_clock::now();
+
+  return chrono::duration<double, micro>(stop - start).count() / repeat;
+}
+
+
+// Accuracy delta and latency of an int8 post-training quantized model against the
+// double model it was built from.
+int main(int argc, char *argv[])
+{
+  int samples = 4096;
+  int features = 16;
+  int classes = 4;
+
+  srand(1);
+  MatrixXd x = MatrixXd::Random(samples, features);
+  MatrixXd projection = MatrixXd::Random(features, classes);
+  MatrixXd score = (x * projection).array().tanh();
+  MatrixXd y = MatrixXd::Zero(samples, classes);
+  for (int i = 0; i < samples; i++) {
+    MatrixXd::Index c;
+    score.row(i).maxCoeff(&c);
+    y(i, c) = 1.0;
+  }
+
+  Network *net = new Network();
+  net->Use(new Mse());
+  net->Add(new Fc_Layer(features, 128, ActivationType::TANH));
+  net->Add(new Fc_Layer(128, 128, ActivationType::RELU));
+  net->Add(new Fc_Layer(128, classes, ActivationType::NONE));
+  net->Fit(x, y, 60, 0.01, 32, 0);
+
+  Network *qnet = net->Quantize(x.topRows(512));
+
+  MatrixXd y_double = net->PredictBatch(x);
+  MatrixXd y_int8 = qnet->PredictBatch(x);
+
+  cout << "accuracy double   : " << Accuracy(y_double, y) << endl;
+  cout << "accuracy int8     : " << Accuracy(y_int8, y) << endl;
+  cout << "argmax agreement  : " << Accuracy(y_int8, y_double) << endl;
+  cout << "max output delta  : " << (y_int8 - y_double).cwiseAbs().maxCoeff() << endl;
+
+  int batches[] = { 1, 32, 256 };
+  for (int batch : batches) {
+    int repeat = 20000 / batch;
+    cout << "latency batch " << batch
+         << "\t| double " << Latency(net, x, batch, repeat) << " us"
+         << "\t| int8 " << Latency(qnet, x, batch, repeat) << " us" << endl;
+  }
+
+  qnet->SaveModel("int8_model");
+  Network *lnet = Network::LoadModel("int8_model");
+  cout << "reloaded int8 max delta : " << (lnet->PredictBatch(x) - y_int8).cwiseAbs().maxCoeff() << endl;
+
+  delete net;
+  delete qnet;
+  delete lnet;
+
+  return 0;
+}
@@ -0,0 +1,68 @@
+#include <iostream>
+#include <cstdlib>
+#include "network.h"
+#include "layers/fc_layer.h"
+
+#include <Eigen/Dense>
+
+using namespace std;
+using namespace Eigen;
+using namespace Neural;
+
+
+static Network* BuildNetwork()
+{
+  srand(1);
+
+  Network *net = new Network();
+  net->Use(new Mse());
+
+  net->Add(new Fc_Layer(32, 256, ActivationType::TANH));
+  net->Add(new Fc_Layer(256, 128, ActivationType::RELU));
+  net->Add(new Fc_Layer(128, 10, ActivationType::NONE));
+
+  net->UseOptimizer(new Adam(0.001));
+
+  return net;
+}
+
+
+static void Run(int threads, const MatrixXd &x, const MatrixXd &y, int batch_size, int epochs)
+{
+  Network *net = BuildNetwork();
+  net->UseThreads(threads);
+  net->EnableProfiling();
+
+  net->Fit(x, y, epochs, 0.01, batch_size, 0);
+
+  ProfileReport report = net->GetProfile();
+  cout << "threads " << threads << "\t| allocations per epoch";
+  for (long long n : report.epoch_allocations)
+    cout << " " << n;
+  cout << endl;
+
+  delete net;
+}
+
+
+// Heap allocations of each Fit epoch. The workspace, the loader buffers and the optimizer
+// state are allocated in the first epoch, the next ones allocate nothing, with a last batch
+// smaller than the others. Build it with NEURAL_COUNT_ALLOCATIONS (make COUNT_ALLOCATIONS=1).
+int main(int argc, char *argv[])
+{
+  int samples = 5000;   // 39 batches of 128 and one of 8
+  int batch_size = 128;
+  int epochs = 5;
+
+  srand(2);
+  MatrixXd x = MatrixXd::Random(samples, 32);
+  MatrixXd y = MatrixXd::Random(samples, 10);
+
+  if (!AllocationCounter::Enabled())
+    cout << "allocations are not counted, build with NEURAL_COUNT_ALLOCATIONS" << endl;
+
+  Run(1, x, y, batch_size, epochs);
+  Run(4, x, y, batch_size, epochs);
+
+  return 0;
+}
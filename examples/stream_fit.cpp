@@ -0,0 +1,115 @@
+#include <iostream>
+#include <fstream>
+#include <chrono>
+#include <cstdlib>
+#include "network.h"
+#include "data_source.h"
+#include "layers/fc_layer.h"
+
+#include <Eigen/Dense>
+
+using namespace std;
+using namespace Eigen;
+using namespace Neural;
+
+
+static Network* BuildNetwork()
+{
+  srand(1);
+
+  Network *net = new Network();
+  net->Use(new Mse());
+
+  net->Add(new Fc_Layer(32, 128, ActivationType::TANH));
+  net->Add(new Fc_Layer(128, 10, ActivationType::NONE));
+
+  net->UseOptimizer(new Adam(0.01));
+
+  return net;
+}
+
+
+static void WriteCsv(const char *name, const MatrixXd &x, const MatrixXd &y)
+{
+  ofstream ofs(name);
+
+  for (int i = 0; i < x.rows(); i++) {
+    for (int c = 0; c < x.cols(); c++) ofs << x(i, c) << ",";
+    for (int c = 0; c < y.cols(); c++) ofs << y(i, c) << (c + 1 < y.cols() ? "," : "\n");
+  }
+}
+
+
+// Gathers every batch of one epoch, without training, to time the source alone.
+static double EpochTime(DataSource &source, int batch_size, bool prefetch)
+{
+  DataLoader loader(source, batch_size, true, prefetch);
+  const DataLoader::MatrixMap *x, *y;
+
+  auto start = chrono::high_resolution_clock::now();
+  loader.Start();
+  while (loader.Next(x, y)) {}
+  auto stop = chrono::high_resolution_clock::now();
+
+  return chrono::duration<double>(stop - start).count();
+}
+
+
+static void Train(const char *name, DataSource &source, int epochs, int batch_size, const MatrixXd &x_test, const MatrixXd &y_test)
+{
+  Network *net = BuildNetwork();
+
+  srand(3);
+  auto start = chrono::high_resolution_clock::now();
+  net->Fit(source, epochs, 0.01, batch_size, 0);
+  auto stop = chrono::high_resolution_clock::now();
+  double elapsed = chrono::duration<double>(stop - start).count();
+
+  double mse = (net->PredictBatch(x_test) - y_test).array().square().mean();
+
+  cout << name << "\t| " << (double)source.Size() * epochs / elapsed << " samples/s"
+       << "\t| test mse " << mse << endl;
+
+  delete net;
+}
+
+
+// Fit streaming the same data set from memory, a mapped binary file and a chunked CSV file,
+// and the gather time of one epoch with and without the prefetch thread.
+int main(int argc, char *argv[])
+{
+  int samples = 65536;
+  int batch_size = 256;
+  int epochs = 3;
+
+  srand(2);
+  MatrixXd teacher = MatrixXd::Random(32, 10);
+  MatrixXd x = MatrixXd::Random(samples, 32);
+  MatrixXd y = (x * teacher).array().tanh().matrix();
+  MatrixXd x_test = MatrixXd::Random(1024, 32);
+  MatrixXd y_test = (x_test * teacher).array().tanh().matrix();
+
+  MappedDataSource::Save("stream_fit.bin", x, y);
+  WriteCsv("stream_fit.csv", x, y);
+
+  MemoryDataSource memory(x, y);
+  MappedDataSource mapped;
+  CsvDataSource csv(32, 4096);
+
+  if (!mapped.Open("stream_fit.bin") || !csv.Open("stream_fit.csv"))
+    return 1;
+
+  cout << "epoch gather time (ms)\t| no prefetch\t| prefetch" << endl;
+  cout << "memory\t\t\t| " << EpochTime(memory, batch_size, false) * 1e3 << "\t| " << EpochTime(memory, batch_size, true) * 1e3 << endl;
+  cout << "mapped\t\t\t| " << EpochTime(mapped, batch_size, false) * 1e3 << "\t| " << EpochTime(mapped, batch_size, true) * 1e3 << endl;
+  cout << "csv\t\t\t| " << EpochTime(csv, batch_size, false) * 1e3 << "\t| " << EpochTime(csv, batch_size, true) * 1e3 << endl;
+
+  Train("memory", memory, epochs, batch_size, x_test, y_test);
+  Train("mapped", mapped, epochs, batch_size, x_test, y_test);
+  Train("csv", csv, epochs, batch_size, x_test, y_test);
+
+  remove("stream_fit.bin");
+  remove("stream_fit.csv");
+
+  return 0;
+}
@@ -1,16 +1,35 @@
 #ifndef __CORE_H__
 #define __CORE_H__
 
+#include <iosfwd>
 #include <Eigen/Dense>
 
 
 namespace Neural
 {
+  template <typename T>
+  using DynMatrix = Eigen::Matrix<T, Eigen::Dynamic, Eigen::Dynamic>;
+
+  // scalar type of a model, recorded in the model file
+  enum class DataType
+  {
+    FLOAT32, FLOAT64
+  };
+
+  template <typename T> struct DataTypeOf;
+  template <> struct DataTypeOf<float>  { static const DataType value = DataType::FLOAT32; };
+  template <> struct DataTypeOf<double> { static const DataType value = DataType::FLOAT64; };
+
   class Core {
     public:
       Core() {};
-      static Eigen::MatrixXd RandomMatrix(int rows, int cols, float min, float max);
+
+      template <typename T = double>
+      static DynMatrix<T> RandomMatrix(int rows, int cols, float min, float max);
+
+      template <typename T>
+      static void ReadMatrix(std::ifstream &infile, DynMatrix<T> &m, int rows, int cols, DataType dtype);
   };
 }
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,216 @@
+#ifndef __DATA_SOURCE_H__
+#define __DATA_SOURCE_H__
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <Eigen/Dense>
+
+#include "core.h"
+#include "mapped_file.h"
+
+namespace Neural
+{
+  /**
+   * @brief A training set read by sample index. Fit never holds the whole set, it gathers
+   *        each mini-batch from the source, so sources can stream data bigger than memory.
+   */
+  template <typename T>
+  class DataSourceT
+  {
+    public:
+      typedef DynMatrix<T> Matrix;
+
+      virtual ~DataSourceT() {};
+
+      virtual int Size() const = 0;
+      virtual int InputSize() const = 0;
+      virtual int OutputSize() const = 0;
+
+      // samples that are cheap to read together, the shuffle keeps such blocks together
+      virtual int BlockSize() const { return 1; }
+
+      // copies the samples of indices into the count rows of x and y
+      virtual void Gather(const int *indices, int count, Eigen::Ref<Matrix> x, Eigen::Ref<Matrix> y) = 0;
+  };
+
+
+  // matrices in memory, they are referenced and must outlive the source
+  template <typename T>
+  class MemoryDataSourceT : public DataSourceT<T>
+  {
+    public:
+      typedef DynMatrix<T> Matrix;
+
+    private:
+      const Matrix &m_x;
+      const Matrix &m_y;
+
+    public:
+      MemoryDataSourceT(const Matrix &x, const Matrix &y);
+
+      int Size() const override { return m_x.rows(); }
+      int InputSize() const override { return m_x.cols(); }
+      int OutputSize() const override { return m_y.cols(); }
+      void Gather(const int *indices, int count, Eigen::Ref<Matrix> x, Eigen::Ref<Matrix> y) override;
+  };
+
+
+  // header of a binary data file, followed at offset 64 by the samples, row-major, each
+  // row holds the inputs then the outputs
+  const int32_t DATA_MAGIC = 0x00444C4E;  // "NLD"
+  const int32_t DATA_VERSION = 1;
+
+  struct DataHeader
+  {
+    int32_t magic;
+    int32_t version;
+    uint32_t byte_order;
+    int32_t dtype;
+    int64_t rows;
+    int32_t input_cols;
+    int32_t output_cols;
+    uint64_t reserved[4];
+  };
+
+  static_assert(sizeof(DataHeader) == 64, "data header must stay 64 bytes");
+
+
+  // binary data file mapped into memory, only the pages of the gathered samples are read
+  template <typename T>
+  class MappedDataSourceT : public DataSourceT<T>
+  {
+    public:
+      typedef DynMatrix<T> Matrix;
+
+    private:
+      MappedFile m_file;
+      DataHeader m_header;
+
+      template <typename S>
+      void GatherAs(const int *indices, int count, Eigen::Ref<Matrix> x, Eigen::Ref<Matrix> y) const;
+
+    public:
+      MappedDataSourceT();
+
+      bool Open(const std::string &name);
+      static bool Save(const std::string &name, const Matrix &x, const Matrix &y);
+
+      int Size() const override { return m_header.rows; }
+      int InputSize() const override { return m_header.input_cols; }
+      int OutputSize() const override { return m_header.output_cols; }
+      void Gather(const int *indices, int count, Eigen::Ref<Matrix> x, Eigen::Ref<Matrix> y) override;
+  };
+
+
+  // comma separated text file, one sample per line, the first input_cols values are the
+  // inputs and the rest the outputs. Only one chunk of parsed rows is kept in memory.
+  template <typename T>
+  class CsvDataSourceT : public DataSourceT<T>
+  {
+    public:
+      typedef DynMatrix<T> Matrix;
+      typedef Eigen::Matrix<T, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> RowMatrix;
+
+    private:
+      std::string m_name;
+      int m_rows;
+      int m_input_cols;
+      int m_cols;
+      int m_chunk_rows;
+      std::vector<int64_t> m_chunk_offset;  // file offset of the first line of each chunk
+
+      // the file and the buffers of one chunk stay allocated, sized by Open for the largest
+      // chunk, so loading a chunk allocates nothing
+      std::ifstream m_file;
+      int m_loaded_chunk;
+      RowMatrix m_chunk;
+      std::string m_text;
+
+      bool LoadChunk(int chunk);
+
+    public:
+      CsvDataSourceT(int input_cols, int chunk_rows = 4096);
+
+      bool Open(const std::string &name, bool skip_header = false);
+
+      int Size() const override { return m_rows; }
+      int InputSize() const override { return m_input_cols; }
+      int OutputSize() const override { return m_cols - m_input_cols; }
+      int BlockSize() const override { return m_chunk_rows; }
+      void Gather(const int *indices, int count, Eigen::Ref<Matrix> x, Eigen::Ref<Matrix> y) override;
+  };
+
+
+  /**
+   * @brief Splits a data source into shuffled mini-batches. With prefetch a background
+   *        thread gathers the next batch into the second of two buffers while the current
+   *        one trains. The buffers are sized for a full batch, a smaller last batch is a
+   *        view of their first rows, and the thread lives as long as the loader, so the
+   *        epochs after the first allocate nothing.
+   */
+  template <typename T>
+  class DataLoaderT
+  {
+    public:
+      typedef DynMatrix<T> Matrix;
+      typedef Eigen::Map<Matrix> MatrixMap;
+
+    private:
+      struct Batch {
+        Matrix x, y;
+        MatrixMap x_view{nullptr, 0, 0};
+        MatrixMap y_view{nullptr, 0, 0};
+        bool ready = false;
+      };
+
+      DataSourceT<T> &m_source;
+      int m_batch_size;
+      bool m_shuffle;
+      bool m_prefetch;
+
+      std::vector<int> m_indices;
+      std::vector<int> m_order;
+      Batch m_batch[2];
+      int m_batches;
+      int m_consumed;
+
+      std::thread m_worker;
+      std::mutex m_mutex;
+      std::condition_variable m_cv;
+      int m_epoch;       // incremented by Start, the worker fills the batches of each epoch
+      bool m_restart;    // the worker drops the rest of its epoch
+      bool m_busy;
+      bool m_stop;
+
+      void Fill(int batch);
+      void Produce();
+      void Stop();
+
+    public:
+      DataLoaderT(DataSourceT<T> &source, int batch_size, bool shuffle = true, bool prefetch = true);
+      ~DataLoaderT();
+
+      void Start();
+      bool Next(const MatrixMap *&x, const MatrixMap *&y);
+      int Batches() const { return m_batches; }
+  };
+
+  typedef DataSourceT<double>       DataSource;
+  typedef MemoryDataSourceT<double> MemoryDataSource;
+  typedef MappedDataSourceT<double> MappedDataSource;
+  typedef CsvDataSourceT<double>    CsvDataSource;
+  typedef DataLoaderT<double>       DataLoader;
+
+  typedef DataSourceT<float>        DataSourceF;
+  typedef MemoryDataSourceT<float>  MemoryDataSourceF;
+  typedef MappedDataSourceT<float>  MappedDataSourceF;
+  typedef CsvDataSourceT<float>     CsvDataSourceF;
+  typedef DataLoaderT<float>        DataLoaderF;
+}
+
+#endif
@@ -0,0 +1,108 @@
+#ifndef __DQN_H__
+#define __DQN_H__
+
+#include <random>
+#include <Eigen/Dense>
+
+#include "network.h"
+#include "replay_memory.h"
+
+namespace Neural
+{
+  /**
+   * @brief Squared temporal-difference error of the actions taken. y_true has two columns per
+   *        row, the action taken and its target, and an optional third one weighing the row;
+   *        the Q-values of the other actions get no gradient. step scales the gradient, the
+   *        fraction of the error a target moves the Q-value before the learning rate.
+   */
+  template <typename T>
+  class TdLossT : public LossT<T> {
+    public:
+      typedef DynMatrix<T> Matrix;
+
+      TdLossT(double step = 1.0) : m_step(step) {};
+      virtual double Compute(const Eigen::Ref<const Matrix>& y_true, const Eigen::Ref<const Matrix>& y_pred) {
+        double loss = 0;
+        for (int i = 0; i < y_pred.rows(); i++) {
+          T error = y_pred(i, (int)y_true(i, 0)) - y_true(i, 1);
+          loss += double(Weight(y_true, i) * error * error);
+        }
+        return y_pred.rows() > 0 ? loss / y_pred.rows() : 0.0;
+      }
+      virtual Matrix ComputeDerivative(const Eigen::Ref<const Matrix>& y_true, const Eigen::Ref<const Matrix>& y_pred) {
+        Matrix gradient(y_pred.rows(), y_pred.cols());
+        ComputeDerivative(y_true, y_pred, gradient);
+        return gradient;
+      }
+      virtual void ComputeDerivative(const Eigen::Ref<const Matrix>& y_true, const Eigen::Ref<const Matrix>& y_pred,
+                                     Eigen::Ref<Matrix> gradient) {
+        T scale = T(2 * m_step / y_pred.rows());
+        gradient.setZero();
+        for (int i = 0; i < y_pred.rows(); i++) {
+          int action = (int)y_true(i, 0);
+          gradient(i, action) = scale * Weight(y_true, i) * (y_pred(i, action) - y_true(i, 1));
+        }
+      }
+
+    private:
+      double m_step;
+
+      static T Weight(const Eigen::Ref<const Matrix>& y_true, int row) {
+        return y_true.cols() > 2 ? y_true(row, 2) : T(1);
+      }
+  };
+
+
+  /**
+   * @brief Batched deep Q-learning update. The targets r + gamma * max Q(s') of a whole batch
+   *        of transitions come from one forward pass over the next states, and the network
+   *        trains on the states with one forward and one backward pass. The buffers are kept
+   *        between updates, a batch of the same size allocates nothing but the prediction
+   *        scratch. A weighted batch of a prioritized memory also gets the TD errors of its
+   *        transitions, for which the states go through the target forward pass as well.
+   */
+  template <typename T>
+  class DqnT
+  {
+    public:
+      typedef DynMatrix<T> Matrix;
+      typedef Eigen::Matrix<T, Eigen::Dynamic, 1> Vector;
+
+    private:
+      NetworkT<T> &m_network;
+      double m_gamma;
+      TdLossT<T> m_loss;
+      Matrix m_next_q;    // Q-values of the next states, below those of the states for a weighted batch
+      Matrix m_targets;   // action, target and weight of each transition
+      Matrix m_inputs;    // states over next states
+      Vector m_errors;
+      Matrix m_q;
+      Eigen::VectorXi m_actions;
+      std::mt19937 m_random;
+
+      void SetTargets(const Eigen::VectorXi &actions, const Vector &rewards, const Vector &done,
+                      const Eigen::Ref<const Matrix> &next_q);
+
+    public:
+      DqnT(NetworkT<T> &network, double gamma, double target_step = 1.0);
+
+      const Eigen::VectorXi& Act(const Matrix &states, double epsilon = 0.0);
+
+      const Matrix& Targets(const Eigen::VectorXi &actions, const Vector &rewards, const Matrix &next_states,
+                            const Vector &done);
+      double Update(const Matrix &states, const Eigen::VectorXi &actions, const Vector &rewards,
+                    const Matrix &next_states, const Vector &done, double learning_rate);
+      double Update(const TransitionBatchT<T> &batch, double learning_rate);
+
+      // TD errors of the last weighted batch, target - Q(s, a) before the update
+      const Vector& TdErrors() const { return m_errors; }
+  };
+
+  typedef TdLossT<double> TdLoss;
+  typedef DqnT<double>    Dqn;
+
+  typedef TdLossT<float>  TdLossF;
+  typedef DqnT<float>     DqnF;
+}
+
+#endif
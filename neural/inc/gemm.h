@@ -0,0 +1,45 @@
+#ifndef __GEMM_H__
+#define __GEMM_H__
+
+#include <cstdint>
+#include <Eigen/Dense>
+
+#include "core.h"
+
+namespace Neural
+{
+  // implementation of the small products, EIGEN turns the micro-kernels off
+  enum class GemmKernel
+  {
+    EIGEN, PORTABLE, AVX2, AVX512
+  };
+
+  /**
+   * @brief Micro-kernels for the skinny products of Fc layers at small batches, where the
+   *        setup of Eigen's general product costs more than the arithmetic. The kernels are
+   *        compiled for AVX-512, AVX2+FMA and plain C++ in the same binary, the best one the
+   *        CPU supports is chosen at the first call.
+   */
+  class SmallGemm
+  {
+    public:
+      // rows of the batch side up to which the kernels beat Eigen
+      static const int MAX_ROWS = 16;
+      // bytes of the int8 rows read at once, the rows of Int8Product are padded to it
+      static const int INT8_DEPTH = 64;
+
+      static GemmKernel Best();
+      static GemmKernel Active();
+      static bool Use(GemmKernel kernel);
+      static const char* Name(GemmKernel kernel);
+
+      template <typename T>
+      static bool Product(const Eigen::Ref<const DynMatrix<T>> &lhs, const Eigen::Ref<const DynMatrix<T>> &rhs,
+                          Eigen::Ref<DynMatrix<T>> dst, bool transpose_lhs = false, bool transpose_rhs = false);
+
+      static void Int8Product(int m, int n, int k, const int8_t *x, long ldx, const int8_t *w, long ldw,
+                              const int32_t *w_sums, int32_t *c, long ldc);
+  };
+}
+
+#endif
@@ -0,0 +1,105 @@
+#ifndef __GOAL_ENV_H__
+#define __GOAL_ENV_H__
+
+#include <cstdint>
+#include <vector>
+#include <Eigen/Dense>
+
+#include "core.h"
+#include "thread_pool.h"
+
+namespace Neural
+{
+  template <typename T> class GoalEnvT;
+
+  // called after every step of an environment, for instance to draw one of its instances
+  template <typename T>
+  class EnvObserverT
+  {
+    public:
+      virtual ~EnvObserverT() {};
+      virtual void OnStep(const GoalEnvT<T> &env, int instance) = 0;
+  };
+
+
+  /**
+   * @brief Headless version of the goal game: a player always moving forward turns left,
+   *        right or not at all to reach a goal in a walled arena. N independent instances
+   *        are held as one array per field and stepped together, split over a thread pool.
+   *        An instance whose episode ends is reset in the same step. The observations are
+   *        the angle to the goal in degrees and its distance, one row per instance, and
+   *        the previous ones are kept for the transitions.
+   */
+  template <typename T>
+  class GoalEnvT
+  {
+    public:
+      typedef DynMatrix<T> Matrix;
+      typedef Eigen::Matrix<T, Eigen::Dynamic, 1> Vector;
+
+      static const int OBSERVATIONS = 2;
+      static const int ACTIONS = 3;     // none, left, right
+
+      static constexpr T WIDTH = 800;
+      static constexpr T HEIGHT = 600;
+      static constexpr T WALL = 10;
+      static constexpr T PLAYER_SIZE = 20;
+      static constexpr T PLAYER_SPEED = 2;
+      static constexpr T ROTATION_SPEED = 2;  // degrees per step
+      static constexpr T GOAL_RADIUS = 10;
+
+    private:
+      int m_instances;
+      ThreadPool *m_pool;
+      int m_chunks;
+
+      Vector m_x, m_y;
+      Vector m_rotation;        // degrees in [0, 360)
+      Vector m_dir_x, m_dir_y;
+      Vector m_goal_x, m_goal_y;
+      Vector m_time;
+      std::vector<uint32_t> m_random;
+
+      Matrix m_observations[2];
+      int m_current;
+      Vector m_rewards;
+      Vector m_done;
+
+      EnvObserverT<T> *m_observer;
+      int m_observed;
+
+      T Random(int instance, T min, T max);
+      void ResetInstance(int instance);
+      void Observe(int instance, Matrix &observations);
+      void StepRange(int begin, int end, const Eigen::VectorXi &actions);
+
+    public:
+      GoalEnvT(int instances, int threads = 1, unsigned seed = 1);
+      ~GoalEnvT();
+
+      void Reset();
+      void Step(const Eigen::VectorXi &actions);
+      void Observe(EnvObserverT<T> *observer, int instance = 0);
+      void SetGoal(int instance, T x, T y);
+
+      int Instances() const { return m_instances; }
+      const Matrix& Observations() const { return m_observations[m_current]; }
+      const Matrix& PreviousObservations() const { return m_observations[1 - m_current]; }
+      const Vector& Rewards() const { return m_rewards; }
+      const Vector& Done() const { return m_done; }
+
+      T PlayerX(int instance) const { return m_x(instance); }
+      T PlayerY(int instance) const { return m_y(instance); }
+      T Rotation(int instance) const { return m_rotation(instance); }
+      T GoalX(int instance) const { return m_goal_x(instance); }
+      T GoalY(int instance) const { return m_goal_y(instance); }
+  };
+
+  typedef EnvObserverT<double> EnvObserver;
+  typedef GoalEnvT<double>     GoalEnv;
+
+  typedef EnvObserverT<float>  EnvObserverF;
+  typedef GoalEnvT<float>      GoalEnvF;
+}
+
+#endif
@@ -5,6 +5,8 @@
 #include <Eigen/Dense>
 #include <cmath>
 
+#include "../core.h"
+
 namespace Neural
 {
   enum class ActivationType
@@ -12,121 +14,330 @@ namespace Neural
     NONE, SIGMOID, RELU, LEAKY_RELU, ELU, TANH, SOFTMAX
   };
 
-  class Activation {
+  // Activation kernels chosen at compile time. Apply works in place on a tile of net sums,
+  // Derivative multiplies a tile of output errors by f'(net sum) in the same pass.
+  template <ActivationType A, typename T>
+  struct ActivationOp;
+
+  template <typename T>
+  struct ActivationOp<ActivationType::NONE, T> {
+    static void Apply(Eigen::Ref<DynMatrix<T>> x, T alpha) {}
+    static void Derivative(const Eigen::Ref<const DynMatrix<T>>& z, Eigen::Ref<DynMatrix<T>> grad, T alpha) {}
+  };
+
+  template <typename T>
+  struct ActivationOp<ActivationType::SIGMOID, T> {
+    static void Apply(Eigen::Ref<DynMatrix<T>> x, T alpha) {
+      x.array() = (T(1) + (-x.array()).exp()).inverse();
+    }
+    static void Derivative(const Eigen::Ref<const DynMatrix<T>>& z, Eigen::Ref<DynMatrix<T>> grad, T alpha) {
+      // s * (1 - s) == (1 - tanh(z / 2)^2) / 4, one transcendental per element
+      grad.array() *= T(0.25) * (T(1) - (T(0.5) * z.array()).tanh().square());
+    }
+  };
+
+  template <typename T>
+  struct ActivationOp<ActivationType::RELU, T> {
+    static void Apply(Eigen::Ref<DynMatrix<T>> x, T alpha) {
+      x.array() = x.array().max(T(0));
+    }
+    static void Derivative(const Eigen::Ref<const DynMatrix<T>>& z, Eigen::Ref<DynMatrix<T>> grad, T alpha) {
+      grad.array() = (z.array() > T(0)).select(grad.array(), T(0));
+    }
+  };
+
+  template <typename T>
+  struct ActivationOp<ActivationType::LEAKY_RELU, T> {
+    static void Apply(Eigen::Ref<DynMatrix<T>> x, T alpha) {
+      x.array() = (x.array() < T(0)).select(alpha * x.array(), x.array());
+    }
+    static void Derivative(const Eigen::Ref<const DynMatrix<T>>& z, Eigen::Ref<DynMatrix<T>> grad, T alpha) {
+      grad.array() = (z.array() < T(0)).select(alpha * grad.array(), grad.array());
+    }
+  };
+
+  template <typename T>
+  struct ActivationOp<ActivationType::ELU, T> {
+    static void Apply(Eigen::Ref<DynMatrix<T>> x, T alpha) {
+      x.array() = (x.array() < T(0)).select(alpha * (x.array().exp() - T(1)), x.array());
+    }
+    static void Derivative(const Eigen::Ref<const DynMatrix<T>>& z, Eigen::Ref<DynMatrix<T>> grad, T alpha) {
+      grad.array() = (z.array() < T(0)).select(alpha * z.array().exp() * grad.array(), grad.array());
+    }
+  };
+
+  template <typename T>
+  struct ActivationOp<ActivationType::TANH, T> {
+    static void Apply(Eigen::Ref<DynMatrix<T>> x, T alpha) {
+      x.array() = x.array().tanh();
+    }
+    static void Derivative(const Eigen::Ref<const DynMatrix<T>>& z, Eigen::Ref<DynMatrix<T>> grad, T alpha) {
+      grad.array() *= T(1) - z.array().tanh().square();
+    }
+  };
+
+  template <typename T>
+  struct ActivationOp<ActivationType::SOFTMAX, T> {
+    // rows are normalized, the tile must hold whole rows
+    static void Apply(Eigen::Ref<DynMatrix<T>> x, T alpha) {
+      for (int i = 0; i < x.rows(); i++) {
+        x.row(i).array() = (x.row(i).array() - x.row(i).maxCoeff()).exp();
+        x.row(i) /= x.row(i).sum();
+      }
+    }
+    // the diagonal of the Jacobian, s * (1 - s), recomputed row by row without a copy of z
+    static void Derivative(const Eigen::Ref<const DynMatrix<T>>& z, Eigen::Ref<DynMatrix<T>> grad, T alpha) {
+      for (int i = 0; i < z.rows(); i++) {
+        T max = z.row(i).maxCoeff();
+        T sum = (z.row(i).array() - max).exp().sum();
+        auto s = (z.row(i).array() - max).exp() / sum;
+        grad.row(i).array() *= s * (T(1) - s);
+      }
+    }
+  };
+
+  /**
+   * @brief Calls f with the ActivationOp of type, so the activation is resolved once per
+   *        call instead of once per element.
+   */
+  template <typename T, typename F>
+  inline void DispatchActivation(ActivationType type, F &&f)
+  {
+    switch (type) {
+      case ActivationType::SIGMOID:    f(ActivationOp<ActivationType::SIGMOID, T>()); break;
+      case ActivationType::RELU:       f(ActivationOp<ActivationType::RELU, T>()); break;
+      case ActivationType::LEAKY_RELU: f(ActivationOp<ActivationType::LEAKY_RELU, T>()); break;
+      case ActivationType::ELU:        f(ActivationOp<ActivationType::ELU, T>()); break;
+      case ActivationType::TANH:       f(ActivationOp<ActivationType::TANH, T>()); break;
+      case ActivationType::SOFTMAX:    f(ActivationOp<ActivationType::SOFTMAX, T>()); break;
+      default:                         f(ActivationOp<ActivationType::NONE, T>()); break;
+    }
+  }
+
+
+  // the default parameters of LeakyReLU and ELU
+  template <typename T>
+  inline T DefaultAlpha(ActivationType type)
+  {
+    if (type == ActivationType::LEAKY_RELU)
+      return T(0.01);
+    else if (type == ActivationType::ELU)
+      return T(1);
+    else
+      return T(0);
+  }
+
+
+  template <typename T>
+  class ActivationT {
     public:
-      Activation() {};
-      virtual Eigen::MatrixXd Compute(const Eigen::MatrixXd& x) = 0;
-      virtual Eigen::MatrixXd ComputeDerivative(const Eigen::MatrixXd& x) = 0;
+      typedef DynMatrix<T> Matrix;
+
+      ActivationT() {};
+      virtual ~ActivationT() {};
+      virtual Matrix Compute(const Matrix& x) const = 0;
+      virtual Matrix ComputeDerivative(const Matrix& x) const = 0;
+      virtual ActivationT* Clone() const = 0;
       ActivationType getType() {
         return this->m_type;
       }
+      // the parameter of LeakyReLU and ELU
+      virtual T GetAlpha() const {
+        return T(0);
+      }
       protected:
         ActivationType m_type;
   };
 
-  class Sigmoid : public Activation {
+  template <typename T>
+  class SigmoidT : public ActivationT<T> {
     public:
-      Sigmoid() {
-        m_type = ActivationType::SIGMOID;
+      typedef DynMatrix<T> Matrix;
+
+      SigmoidT() {
+        this->m_type = ActivationType::SIGMOID;
       };
 
-      virtual Eigen::MatrixXd Compute(const Eigen::MatrixXd& x) {
-        return 1.0 / (1.0 + (-x.array()).exp());
+      virtual Matrix Compute(const Matrix& x) const {
+        Matrix y = x;
+        ActivationOp<ActivationType::SIGMOID, T>::Apply(y, T(0));
+        return y;
+      }
+
+      virtual Matrix ComputeDerivative(const Matrix& x) const {
+        Matrix d = Matrix::Ones(x.rows(), x.cols());
+        ActivationOp<ActivationType::SIGMOID, T>::Derivative(x, d, T(0));
+        return d;
       }
 
-      virtual Eigen::MatrixXd ComputeDerivative(const Eigen::MatrixXd& x) {
-        Eigen::MatrixXd s = Compute(x);
-        return s.array() * (1 - s.array());
+      virtual ActivationT<T>* Clone() const {
+        return new SigmoidT(*this);
       }
   };
 
 
-  class ReLU : public Activation {
+  template <typename T>
+  class ReLUT : public ActivationT<T> {
     public:
-      ReLU() {
-        m_type = ActivationType::RELU;
+      typedef DynMatrix<T> Matrix;
+
+      ReLUT() {
+        this->m_type = ActivationType::RELU;
       };
 
-      virtual Eigen::MatrixXd Compute(const Eigen::MatrixXd& x) {
-        return x.array().max(0);
+      virtual Matrix Compute(const Matrix& x) const {
+        Matrix y = x;
+        ActivationOp<ActivationType::RELU, T>::Apply(y, T(0));
+        return y;
       }
 
-      virtual Eigen::MatrixXd ComputeDerivative(const Eigen::MatrixXd& x) {
-        return (x.array() > 0).cast<double>();
+      virtual Matrix ComputeDerivative(const Matrix& x) const {
+        Matrix d = Matrix::Ones(x.rows(), x.cols());
+        ActivationOp<ActivationType::RELU, T>::Derivative(x, d, T(0));
+        return d;
+      }
+
+      virtual ActivationT<T>* Clone() const {
+        return new ReLUT(*this);
       }
   };
 
 
-  class LeakyReLU : public Activation {
+  template <typename T>
+  class LeakyReLUT : public ActivationT<T> {
     private:
-      double alpha;    
+      T alpha;
     public:
-      LeakyReLU(double alpha = 0.01) : alpha(alpha) {
-        m_type = ActivationType::LEAKY_RELU;
+      typedef DynMatrix<T> Matrix;
+
+      LeakyReLUT(T alpha = T(0.01)) : alpha(alpha) {
+        this->m_type = ActivationType::LEAKY_RELU;
       };
-    
-      virtual Eigen::MatrixXd Compute(const Eigen::MatrixXd& x) {
-        return (x.array() < 0).select(alpha * x.array(), x.array());      
+
+      virtual Matrix Compute(const Matrix& x) const {
+        Matrix y = x;
+        ActivationOp<ActivationType::LEAKY_RELU, T>::Apply(y, alpha);
+        return y;
+      }
+
+      virtual Matrix ComputeDerivative(const Matrix& x) const {
+        Matrix d = Matrix::Ones(x.rows(), x.cols());
+        ActivationOp<ActivationType::LEAKY_RELU, T>::Derivative(x, d, alpha);
+        return d;
       }
 
-      virtual Eigen::MatrixXd ComputeDerivative(const Eigen::MatrixXd& x) {
-        return (x.array() < 0).select(Eigen::MatrixXd::Constant(x.rows(), x.cols(), alpha), Eigen::MatrixXd::Constant(x.rows(), x.cols(), 1.0));
+      virtual T GetAlpha() const {
+        return alpha;
+      }
+
+      virtual ActivationT<T>* Clone() const {
+        return new LeakyReLUT(*this);
       }
   };
 
 
-  class ELU : public Activation {
+  template <typename T>
+  class ELUT : public ActivationT<T> {
     private:
-      double alpha;
+      T alpha;
     public:
-      ELU(double alpha = 1.0) : alpha(alpha) {
-        m_type = ActivationType::ELU;
+      typedef DynMatrix<T> Matrix;
+
+      ELUT(T alpha = T(1)) : alpha(alpha) {
+        this->m_type = ActivationType::ELU;
       };
 
-      virtual Eigen::MatrixXd Compute(const Eigen::MatrixXd& x) {
-        return (x.array() < 0).select(alpha * (x.array().exp() - 1), x.array());
+      virtual Matrix Compute(const Matrix& x) const {
+        Matrix y = x;
+        ActivationOp<ActivationType::ELU, T>::Apply(y, alpha);
+        return y;
       }
 
-      virtual Eigen::MatrixXd ComputeDerivative(const Eigen::MatrixXd& x) {
-        return (x.array() < 0).select(alpha * x.array().exp(), Eigen::MatrixXd::Constant(x.rows(), x.cols(), 1.0));
+      virtual Matrix ComputeDerivative(const Matrix& x) const {
+        Matrix d = Matrix::Ones(x.rows(), x.cols());
+        ActivationOp<ActivationType::ELU, T>::Derivative(x, d, alpha);
+        return d;
+      }
+
+      virtual T GetAlpha() const {
+        return alpha;
+      }
+
+      virtual ActivationT<T>* Clone() const {
+        return new ELUT(*this);
       }
   };
 
 
-  class Tanh : public Activation {
+  template <typename T>
+  class TanhT : public ActivationT<T> {
     public:
-      Tanh() {
-        m_type = ActivationType::TANH;
+      typedef DynMatrix<T> Matrix;
+
+      TanhT() {
+        this->m_type = ActivationType::TANH;
       };
 
-      virtual Eigen::MatrixXd Compute(const Eigen::MatrixXd& x) {
-        return x.array().tanh();
+      virtual Matrix Compute(const Matrix& x) const {
+        Matrix y = x;
+        ActivationOp<ActivationType::TANH, T>::Apply(y, T(0));
+        return y;
+      }
+
+      virtual Matrix ComputeDerivative(const Matrix& x) const {
+        Matrix d = Matrix::Ones(x.rows(), x.cols());
+        ActivationOp<ActivationType::TANH, T>::Derivative(x, d, T(0));
+        return d;
       }
 
-      virtual Eigen::MatrixXd ComputeDerivative(const Eigen::MatrixXd& x) {
-        return 1-x.array().tanh().pow(2);
+      virtual ActivationT<T>* Clone() const {
+        return new TanhT(*this);
       }
   };
 
 
-  class Softmax : public Activation {
+  template <typename T>
+  class SoftmaxT : public ActivationT<T> {
     public:
-      Softmax() {
-        m_type = ActivationType::SOFTMAX;
+      typedef DynMatrix<T> Matrix;
+
+      SoftmaxT() {
+        this->m_type = ActivationType::SOFTMAX;
       };
 
-      virtual Eigen::MatrixXd Compute(const Eigen::MatrixXd& x) {
-        Eigen::MatrixXd exp_x = x.array().exp();
-        Eigen::VectorXd sum_exp = exp_x.rowwise().sum();
-        return exp_x.array().colwise() / sum_exp.array();
+      virtual Matrix Compute(const Matrix& x) const {
+        Matrix y = x;
+        ActivationOp<ActivationType::SOFTMAX, T>::Apply(y, T(0));
+        return y;
+      }
+
+      virtual Matrix ComputeDerivative(const Matrix& x) const {
+        Matrix d = Matrix::Ones(x.rows(), x.cols());
+        ActivationOp<ActivationType::SOFTMAX, T>::Derivative(x, d, T(0));
+        return d;
       }
 
-      virtual Eigen::MatrixXd ComputeDerivative(const Eigen::MatrixXd& x) {
-        // Note: This is a simplified version. The actual Jacobian of Softmax is more complex.
-        Eigen::MatrixXd s = Compute(x);
-        return s.array() * (1 - s.array());
+      virtual ActivationT<T>* Clone() const {
+        return new SoftmaxT(*this);
       }
   };
+
+
+  typedef ActivationT<double> Activation;
+  typedef SigmoidT<double>    Sigmoid;
+  typedef ReLUT<double>       ReLU;
+  typedef LeakyReLUT<double>  LeakyReLU;
+  typedef ELUT<double>        ELU;
+  typedef TanhT<double>       Tanh;
+  typedef SoftmaxT<double>    Softmax;
+
+  typedef ActivationT<float>  ActivationF;
+  typedef SigmoidT<float>     SigmoidF;
+  typedef ReLUT<float>        ReLUF;
+  typedef LeakyReLUT<float>   LeakyReLUF;
+  typedef ELUT<float>         ELUF;
+  typedef TanhT<float>        TanhF;
+  typedef SoftmaxT<float>     SoftmaxF;
 }
 
-#endif
\ No newline at end of file
+#endif
@@ -6,19 +6,37 @@
 
 namespace Neural
 {
-  class Activation_Layer : public Layer
+  template <typename T>
+  class Activation_LayerT : public LayerT<T>
   {
+    public:
+      typedef DynMatrix<T> Matrix;
+
     private:
-      Activation *p_activation;
+      ActivationT<T> *p_activation;
 
     public:
-      Activation_Layer();
-      Activation_Layer(Activation *a);
-      ~Activation_Layer();
+      Activation_LayerT();
+      Activation_LayerT(ActivationT<T> *a);
+      ~Activation_LayerT();
 
-      virtual Eigen::MatrixXd FeedForward(Eigen::MatrixXd input_data);
-      virtual Eigen::MatrixXd BackPropagation(Eigen::MatrixXd output_error, float learning_rate);
+      Matrix FeedForward(const Matrix& input_data) override;
+      void Forward(const Matrix& input_data, Matrix& output) const override;
+      Matrix BackPropagation(const Matrix& output_error, float learning_rate) override;
+      Matrix Backward(const Matrix& output_error) override;
+      LayerT<T>* Clone() const override;
+      LayerKind GetKind() const override { return LayerKind::ACTIVATION; }
+      ActivationType GetActivationType() const override { return p_activation->getType(); }
+      T GetAlpha() const { return p_activation->GetAlpha(); }
+
+      void SaveLayer(std::ofstream &outfile) override;
+      bool SaveRecord(ModelWriter &writer) const override;
+      void SetWeights(Matrix &weights) override {};
+      void SetBias(Matrix &bias) override {};
   };
+
+  typedef Activation_LayerT<double> Activation_Layer;
+  typedef Activation_LayerT<float>  Activation_LayerF;
 }
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,71 @@
+#ifndef __CONV_LAYER_H__
+#define __CONV_LAYER_H__
+
+#include "layer.h"
+#include "window.h"
+#include "../model_file.h"
+
+namespace Neural
+{
+  /**
+   * @brief 2D convolution over images flattened channel by channel, one sample per row, with
+   *        an output of filters x out_height x out_width in the same layout. The weights are
+   *        a (channels * kernel * kernel) x filters matrix. Both passes unfold tiles of
+   *        window patches into a matrix (im2col) sized to stay in L2 cache and run them
+   *        through one matrix product each.
+   */
+  template <typename T>
+  class Conv2D_LayerT : public LayerT<T>
+  {
+    public:
+      typedef DynMatrix<T> Matrix;
+      typedef typename LayerT<T>::MatrixMap MatrixMap;
+
+    protected:
+      WindowShape m_shape;
+      ActivationType m_activation;
+      T m_alpha;
+      int m_tile_rows;
+      // workspace offsets of the training buffers, max_batch rows each, and of the tiles
+      size_t m_ws_net_sum;
+      size_t m_ws_output;
+      size_t m_ws_gradient;
+      size_t m_ws_input_error;
+      size_t m_ws_patches;
+      size_t m_ws_tile;
+      size_t m_ws_weight_tile;
+
+      Conv2D_LayerT() {};
+
+    public:
+      Conv2D_LayerT(int channels, int height, int width, int filters, int kernel, ActivationType activationType,
+                    int stride = 1, int padding = 0, int dilation = 1);
+      Conv2D_LayerT(const Conv2D_LayerT &other);
+
+      Matrix FeedForward(const Matrix& input_data) override;
+      void Forward(const Matrix& input_data, Matrix& output) const override;
+      Matrix BackPropagation(const Matrix& output_error, float learning_rate) override;
+      Matrix Backward(const Matrix& output_error) override;
+      int OutputSize(int input_size) const override;
+      void BindWorkspace(WorkspaceT<T> &workspace, int max_batch) override;
+      const MatrixMap& TrainForward(const Eigen::Ref<const Matrix>& input) override;
+      const MatrixMap& TrainBackward(const Eigen::Ref<const Matrix>& output_error) override;
+      bool FoldActivation(ActivationType type, T alpha) override;
+      LayerT<T>* Clone() const override;
+      LayerKind GetKind() const override { return LayerKind::CONV2D; }
+      LayerCost GetCost(int batch) const override;
+      ActivationType GetActivationType() const override { return m_activation; }
+      const WindowShape& GetShape() const { return m_shape; }
+
+      void SaveLayer(std::ofstream &outfile) override;
+      bool SaveRecord(ModelWriter &writer) const override;
+      static Conv2D_LayerT* MapLayer(const std::shared_ptr<ModelFile> &file, const ModelLayerRecord &record);
+      void SetWeights(Matrix &weights) override;
+      void SetBias(Matrix &bias) override;
+  };
+
+  typedef Conv2D_LayerT<double> Conv2D_Layer;
+  typedef Conv2D_LayerT<float>  Conv2D_LayerF;
+}
+
+#endif
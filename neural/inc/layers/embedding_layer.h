@@ -0,0 +1,84 @@
+#ifndef __EMBEDDING_LAYER_H__
+#define __EMBEDDING_LAYER_H__
+
+#include <vector>
+#include "layer.h"
+#include "../model_file.h"
+
+namespace Neural
+{
+  /**
+   * @brief Lookup table of dense vectors for categorical ids. Every input row holds `inputs`
+   *        ids stored as numbers, the output row is their vectors one after the other. The
+   *        weights are a dim x vocab matrix, one column per id, so a lookup reads one
+   *        contiguous column. The backward pass only sums the gradients of the ids in the
+   *        batch and the update only touches their columns, a step costs the same for any
+   *        vocabulary size. Ids outside the vocabulary read a zero vector and get no update.
+   */
+  template <typename T>
+  class Embedding_LayerT : public LayerT<T>
+  {
+    public:
+      typedef DynMatrix<T> Matrix;
+      typedef typename LayerT<T>::MatrixMap MatrixMap;
+
+    protected:
+      int m_inputs;
+      // ids of the last backward pass, in order of appearance, and the gradient column of
+      // every id of the vocabulary, -1 for the others
+      std::vector<int> m_columns;
+      std::vector<int> m_slot;
+      // columns of the last update, and update counts to sync replicas with the changed
+      // columns only, a change of unknown columns skips a count
+      std::vector<int> m_updated;
+      long m_version;
+      long m_synced;
+      // workspace offsets of the training buffers, max_batch rows each
+      size_t m_ws_output;
+      size_t m_ws_input_error;
+
+      Embedding_LayerT() : m_inputs(1), m_version(0), m_synced(-1) {};
+      MatrixMap GradColumns();
+      void ReserveColumns(size_t columns);
+      int Slot(int id);
+      void Accumulate(const Eigen::Ref<const Matrix> &ids, const Eigen::Ref<const Matrix> &output_error);
+
+    public:
+      Embedding_LayerT(int vocab, int dim, int inputs = 1);
+      Embedding_LayerT(const Embedding_LayerT &other);
+
+      Matrix FeedForward(const Matrix& input_data) override;
+      void Forward(const Matrix& input_data, Matrix& output) const override;
+      Matrix BackPropagation(const Matrix& output_error, float learning_rate) override;
+      Matrix Backward(const Matrix& output_error) override;
+      void ApplyGradients(float learning_rate) override;
+      int OutputSize(int input_size) const override;
+      void BindWorkspace(WorkspaceT<T> &workspace, int max_batch) override;
+      const MatrixMap& TrainForward(const Eigen::Ref<const Matrix>& input) override;
+      const MatrixMap& TrainBackward(const Eigen::Ref<const Matrix>& output_error) override;
+      LayerT<T>* Clone() const override;
+      LayerKind GetKind() const override { return LayerKind::EMBEDDING; }
+      LayerCost GetCost(int batch) const override;
+      int Vocabulary() const { return this->m_weights.cols(); }
+      int Dimension() const { return this->m_weights.rows(); }
+      const std::vector<int>& TouchedColumns() const { return m_columns; }
+
+      void CopyParameters(const LayerT<T> &other) override;
+      void ScaleGradients(double factor) override;
+      void AddGradients(const LayerT<T> &other) override;
+      void CopyGradients(const LayerT<T> &other) override;
+      void StoreGradients(typename LayerT<T>::Gradients &sum, bool add) const override;
+      void LoadGradients(const typename LayerT<T>::Gradients &sum) override;
+
+      void SaveLayer(std::ofstream &outfile) override;
+      bool SaveRecord(ModelWriter &writer) const override;
+      static Embedding_LayerT* MapLayer(const std::shared_ptr<ModelFile> &file, const ModelLayerRecord &record);
+      void SetWeights(Matrix &weights) override;
+      void SetBias(Matrix &bias) override {};
+  };
+
+  typedef Embedding_LayerT<double> Embedding_Layer;
+  typedef Embedding_LayerT<float>  Embedding_LayerF;
+}
+
+#endif
@@ -2,25 +2,60 @@
 #define __FC_LAYER_H__
 
 #include "layer.h"
+#include "../model_file.h"
 
 namespace Neural
 {
-  class Fc_Layer : public Layer
+  template <typename T>
+  class Fc_LayerT : public LayerT<T>
   {
+    public:
+      typedef DynMatrix<T> Matrix;
+      typedef typename LayerT<T>::MatrixMap MatrixMap;
+
     protected:
-      Activation *p_activation;
+      ActivationType m_activation;
+      T m_alpha;
+      // the softmax is left to the loss during training
+      bool m_fused_softmax;
+      // workspace offsets of the training buffers, max_batch rows each
+      size_t m_ws_net_sum;
+      size_t m_ws_output;
+      size_t m_ws_gradient;
+      size_t m_ws_input_error;
+
+      Fc_LayerT() : m_fused_softmax(false) {};
+      ActivationType TrainingActivation() const;
 
     public:
-      Fc_Layer(int input_size, int output_size, ActivationType activationType);
+      Fc_LayerT(int input_size, int output_size, ActivationType activationType);
+      Fc_LayerT(const Fc_LayerT &other);
 
-      Eigen::MatrixXd FeedForward(const Eigen::MatrixXd& input_data) override;
-      Eigen::MatrixXd BackPropagation(const Eigen::MatrixXd& output_error, float learning_rate) override;
+      Matrix FeedForward(const Matrix& input_data) override;
+      void Forward(const Matrix& input_data, Matrix& output) const override;
+      Matrix BackPropagation(const Matrix& output_error, float learning_rate) override;
+      Matrix Backward(const Matrix& output_error) override;
+      void BindWorkspace(WorkspaceT<T> &workspace, int max_batch) override;
+      const MatrixMap& TrainForward(const Eigen::Ref<const Matrix>& input) override;
+      const MatrixMap& TrainBackward(const Eigen::Ref<const Matrix>& output_error) override;
+      bool FuseSoftmax(bool fuse) override;
+      bool FoldActivation(ActivationType type, T alpha) override;
+      LayerT<T>* Clone() const override;
+      LayerKind GetKind() const override { return LayerKind::FC; }
+      LayerCost GetCost(int batch) const override;
+      ActivationType GetActivationType() const override;
+      T GetAlpha() const { return m_alpha; }
 
       virtual void SaveLayer(std::ofstream &outfile);
-      static Fc_Layer* LoadLayer(std::ifstream &infile);
-      void SetWeights(Eigen::MatrixXd &weights);
-      void SetBias(Eigen::MatrixXd &bias);
+      static Fc_LayerT* LoadLayer(std::ifstream &infile, DataType dtype = DataTypeOf<T>::value);
+      bool SaveRecord(ModelWriter &writer) const override;
+      static Fc_LayerT* MapLayer(const std::shared_ptr<ModelFile> &file, const ModelLayerRecord &record);
+      void SetWeights(Matrix &weights);
+      void SetBias(Matrix &bias);
   };
+
+  typedef Fc_LayerT<double> Fc_Layer;
+  typedef Fc_LayerT<float>  Fc_LayerF;
 }
 
-#endif
\ No newline at end of file
+#endif
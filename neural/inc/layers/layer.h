@@ -2,35 +2,126 @@
 #define __LAYER_H__
 
 #include <iostream>
+#include <memory>
+#include <vector>
 #include <Eigen/Dense>
 
+#include "../core.h"
+#include "../workspace.h"
 #include "activation.h"
 #include "../optimizers/optimizer.h"
 
 namespace Neural
 {
-  class Layer
+  // layer record tag of the model file
+  enum class LayerKind
   {
+    FC, QUANTIZED_FC, ACTIVATION, CONV2D, MAX_POOL, AVG_POOL, EMBEDDING, LSTM, GRU
+  };
+
+  class ModelFile;
+  class ModelWriter;
+
+  // analytical cost of one layer call on a batch, read by the profiler
+  struct LayerCost
+  {
+    double forward_flops = 0;
+    double backward_flops = 0;
+    double forward_bytes = 0;
+    double backward_bytes = 0;
+    double update_bytes = 0;   // parameters and gradients, without the optimizer state
+  };
+
+  template <typename T>
+  class LayerT
+  {
+    public:
+      typedef DynMatrix<T> Matrix;
+      typedef Eigen::Map<Matrix> MatrixMap;
+      typedef Eigen::Map<const Matrix, 0, Eigen::OuterStride<>> ConstMatrixMap;
+
     protected:
-      Eigen::MatrixXd m_input;
-      Eigen::MatrixXd m_net_sum;
-      Eigen::MatrixXd m_output;
-      Eigen::MatrixXd m_weights;
-      Eigen::MatrixXd m_bias;
+      Matrix m_input;
+      Matrix m_net_sum;
+      Matrix m_output;
+      // the parameters are views, over the owned storage or over a mapped model file
+      MatrixMap m_weights;
+      MatrixMap m_bias;
+      Matrix m_weight_storage;
+      Matrix m_bias_storage;
+      std::shared_ptr<ModelFile> m_mapping;
+      Matrix m_grad_weights;
+      Matrix m_grad_bias;
       bool m_as_weight;
+      // views of the last TrainForward and TrainBackward, over workspace buffers
+      ConstMatrixMap m_input_view;
+      MatrixMap m_output_view;
+      MatrixMap m_error_view;
+      Matrix m_input_error;
+      WorkspaceT<T> *m_workspace;
+
+      void AssignWeights(const Eigen::Ref<const Matrix> &weights);
+      void AssignBias(const Eigen::Ref<const Matrix> &bias);
+      void BindParameters(T *weights, int rows, int cols, T *bias, const std::shared_ptr<ModelFile> &mapping);
     public:
-      std::unique_ptr<Optimizer> m_optimizer;
+      std::unique_ptr<OptimizerT<T>> m_optimizer;
+
+      // gradients kept apart from the layer, without its parameters: the sums over the
+      // micro-batches of a pipeline stage. A sparse layer keeps the ids of its columns.
+      struct Gradients
+      {
+        Matrix weights;
+        Matrix bias;
+        std::vector<int> columns;
+        std::vector<int> slot;
+      };
 
     public:
-    Layer() {};
+    LayerT() : m_weights(nullptr, 0, 0), m_bias(nullptr, 0, 0), m_input_view(nullptr, 0, 0, Eigen::OuterStride<>(0)),
+               m_output_view(nullptr, 0, 0), m_error_view(nullptr, 0, 0), m_workspace(nullptr) {};
+    virtual ~LayerT() {};
 
     public:
-      virtual Eigen::MatrixXd FeedForward(const Eigen::MatrixXd& input) = 0;
-      virtual Eigen::MatrixXd BackPropagation(const Eigen::MatrixXd& output_error, float learning_rate) = 0;
+      virtual Matrix FeedForward(const Matrix& input) = 0;
+      virtual void Forward(const Matrix& input, Matrix& output) const = 0;
+      virtual Matrix BackPropagation(const Matrix& output_error, float learning_rate) = 0;
+      virtual Matrix Backward(const Matrix& output_error) = 0;
+      virtual void ApplyGradients(float learning_rate);
+      virtual int OutputSize(int input_size) const { return m_weights.size() > 0 ? m_weights.cols() : input_size; }
+      virtual void BindWorkspace(WorkspaceT<T> &workspace, int max_batch) {};
+      virtual const MatrixMap& TrainForward(const Eigen::Ref<const Matrix>& input);
+      virtual const MatrixMap& TrainBackward(const Eigen::Ref<const Matrix>& output_error);
+      // trains on logits for a loss that folds the softmax in, true if the training output are logits
+      virtual bool FuseSoftmax(bool fuse) { return false; }
+      // takes over the activation of a following layer, true if the layer now applies it
+      virtual bool FoldActivation(ActivationType type, T alpha) { return false; }
+      virtual ActivationType GetActivationType() const { return ActivationType::NONE; }
+      virtual LayerT* Clone() const = 0;
+      virtual LayerKind GetKind() const = 0;
+      virtual LayerCost GetCost(int batch) const { return LayerCost(); }
       virtual void SaveLayer(std::ofstream &outfile) = 0;
-      virtual void SetWeights(Eigen::MatrixXd &weights) = 0;
-      virtual void SetBias(Eigen::MatrixXd &bias) = 0;
+      virtual bool SaveRecord(ModelWriter &writer) const = 0;
+      virtual void SetWeights(Matrix &weights) = 0;
+      virtual void SetBias(Matrix &bias) = 0;
+
+      const MatrixMap& GetWeights() const { return m_weights; }
+      const MatrixMap& GetBias() const { return m_bias; }
+      // the outputs of the last TrainForward
+      const MatrixMap& TrainOutput() const { return m_output_view; }
+      // bound to a workspace, the training passes allocate nothing
+      bool TrainsInWorkspace() const { return m_workspace != nullptr; }
+
+      virtual void CopyParameters(const LayerT &other);
+      void ShareParameters(LayerT &other);
+      virtual void ScaleGradients(double factor);
+      virtual void AddGradients(const LayerT &other);
+      virtual void CopyGradients(const LayerT &other);
+      virtual void StoreGradients(Gradients &sum, bool add) const;
+      virtual void LoadGradients(const Gradients &sum);
   };
+
+  typedef LayerT<double> Layer;
+  typedef LayerT<float>  LayerF;
 }
 
-#endif
\ No newline at end of file
+#endif
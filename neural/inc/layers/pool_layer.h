@@ -0,0 +1,82 @@
+#ifndef __POOL_LAYER_H__
+#define __POOL_LAYER_H__
+
+#include <vector>
+#include "layer.h"
+#include "window.h"
+#include "../model_file.h"
+
+namespace Neural
+{
+  /**
+   * @brief Max or average pooling over images flattened channel by channel, one sample per
+   *        row, each channel pooled on its own. Every output column is computed for the
+   *        whole batch at once from the input columns under its window. Average pooling
+   *        divides by the taps inside the image, the padding is not counted.
+   */
+  template <typename T>
+  class Pool_LayerT : public LayerT<T>
+  {
+    public:
+      typedef DynMatrix<T> Matrix;
+      typedef typename LayerT<T>::MatrixMap MatrixMap;
+
+    protected:
+      LayerKind m_kind;
+      WindowShape m_shape;
+      // window tap of the maximum of every output, batch rows per column, -1 when none
+      std::vector<int> m_argmax;
+      // workspace offsets of the training buffers, max_batch rows each
+      size_t m_ws_output;
+      size_t m_ws_input_error;
+
+      Pool_LayerT(LayerKind kind, const WindowShape &shape);
+
+    public:
+      Pool_LayerT(LayerKind kind, int channels, int height, int width, int pool, int stride = 0, int padding = 0);
+
+      Matrix FeedForward(const Matrix& input_data) override;
+      void Forward(const Matrix& input_data, Matrix& output) const override;
+      Matrix BackPropagation(const Matrix& output_error, float learning_rate) override;
+      Matrix Backward(const Matrix& output_error) override;
+      int OutputSize(int input_size) const override;
+      void BindWorkspace(WorkspaceT<T> &workspace, int max_batch) override;
+      const MatrixMap& TrainForward(const Eigen::Ref<const Matrix>& input) override;
+      const MatrixMap& TrainBackward(const Eigen::Ref<const Matrix>& output_error) override;
+      LayerT<T>* Clone() const override;
+      LayerKind GetKind() const override { return m_kind; }
+      LayerCost GetCost(int batch) const override;
+      const WindowShape& GetShape() const { return m_shape; }
+
+      void SaveLayer(std::ofstream &outfile) override;
+      bool SaveRecord(ModelWriter &writer) const override;
+      static Pool_LayerT* MapLayer(const std::shared_ptr<ModelFile> &file, const ModelLayerRecord &record);
+      void SetWeights(Matrix &weights) override {};
+      void SetBias(Matrix &bias) override {};
+  };
+
+
+  template <typename T>
+  class MaxPool_LayerT : public Pool_LayerT<T>
+  {
+    public:
+      MaxPool_LayerT(int channels, int height, int width, int pool, int stride = 0, int padding = 0)
+        : Pool_LayerT<T>(LayerKind::MAX_POOL, channels, height, width, pool, stride, padding) {};
+  };
+
+
+  template <typename T>
+  class AvgPool_LayerT : public Pool_LayerT<T>
+  {
+    public:
+      AvgPool_LayerT(int channels, int height, int width, int pool, int stride = 0, int padding = 0)
+        : Pool_LayerT<T>(LayerKind::AVG_POOL, channels, height, width, pool, stride, padding) {};
+  };
+
+  typedef MaxPool_LayerT<double> MaxPool_Layer;
+  typedef MaxPool_LayerT<float>  MaxPool_LayerF;
+  typedef AvgPool_LayerT<double> AvgPool_Layer;
+  typedef AvgPool_LayerT<float>  AvgPool_LayerF;
+}
+
+#endif
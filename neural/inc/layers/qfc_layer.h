@@ -0,0 +1,60 @@
+#ifndef __QFC_LAYER_H__
+#define __QFC_LAYER_H__
+
+#include <cstdint>
+#include "layer.h"
+#include "fc_layer.h"
+#include "../model_file.h"
+
+namespace Neural
+{
+  // Inference-only int8 version of a Fc_Layer. Weights are quantized per output channel,
+  // inputs per tensor with a scale calibrated on sample data.
+  template <typename T>
+  class QFc_LayerT : public LayerT<T>
+  {
+    public:
+      typedef DynMatrix<T> Matrix;
+      typedef Eigen::Matrix<int8_t, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> QMatrix;
+      typedef Eigen::Map<QMatrix> QMatrixMap;
+
+    protected:
+      QMatrixMap m_qweights;  // input x output, row-major, over m_qweight_storage or a mapped file
+      QMatrix m_qweight_storage;
+      QMatrix m_qpacked;  // output x input padded to SmallGemm::INT8_DEPTH, the rows read by the int8 kernels
+      Eigen::Matrix<int32_t, 1, Eigen::Dynamic> m_qsums;  // sum of the int8 weights of each output
+      Matrix m_weight_scale;
+      T m_input_scale;
+      ActivationType m_activation;
+      T m_alpha;
+
+      QFc_LayerT() : m_qweights(nullptr, 0, 0) {};
+      void UseQWeightStorage();
+      void PackWeights();
+
+    public:
+      QFc_LayerT(const Fc_LayerT<T> &layer, T input_range);
+
+      Matrix FeedForward(const Matrix& input_data) override;
+      void Forward(const Matrix& input_data, Matrix& output) const override;
+      Matrix BackPropagation(const Matrix& output_error, float learning_rate) override;
+      Matrix Backward(const Matrix& output_error) override;
+      void ApplyGradients(float learning_rate) override {};
+      int OutputSize(int input_size) const override { return m_qweights.cols(); }
+      LayerT<T>* Clone() const override;
+      LayerKind GetKind() const override { return LayerKind::QUANTIZED_FC; }
+      LayerCost GetCost(int batch) const override;
+
+      virtual void SaveLayer(std::ofstream &outfile);
+      static QFc_LayerT* LoadLayer(std::ifstream &infile, DataType dtype = DataTypeOf<T>::value);
+      bool SaveRecord(ModelWriter &writer) const override;
+      static QFc_LayerT* MapLayer(const std::shared_ptr<ModelFile> &file, const ModelLayerRecord &record);
+      void SetWeights(Matrix &weights);
+      void SetBias(Matrix &bias);
+  };
+
+  typedef QFc_LayerT<double> QFc_Layer;
+  typedef QFc_LayerT<float>  QFc_LayerF;
+}
+
+#endif
@@ -0,0 +1,125 @@
+#ifndef __RECURRENT_LAYER_H__
+#define __RECURRENT_LAYER_H__
+
+#include <vector>
+#include "layer.h"
+#include "../model_file.h"
+
+namespace Neural
+{
+  /**
+   * @brief LSTM or GRU over sequences of a fixed number of steps, one sequence per row laid
+   *        out step by step, features x steps values. The output row is the hidden state of
+   *        every step in the same layout, or only the last one.
+   *
+   *        The gate weights are packed in one (features + hidden) x (gates * hidden) matrix,
+   *        input rows first, gates side by side: i, f, g, o for the LSTM, r, z, n for the GRU.
+   *        The input projections of all the steps are one product, then every step is one
+   *        product of the previous hidden state with the recurrent rows and one fused
+   *        elementwise kernel for all the gates. The GRU applies the reset gate after the
+   *        recurrent product, with one bias per gate.
+   *
+   *        Training runs truncated backpropagation through time: with bptt > 0 the gradient
+   *        of the hidden state stops at every bptt steps from the start of the sequence.
+   */
+  template <typename T>
+  class Recurrent_LayerT : public LayerT<T>
+  {
+    public:
+      typedef DynMatrix<T> Matrix;
+      typedef typename LayerT<T>::MatrixMap MatrixMap;
+      static const int FIELDS = 5;
+
+    protected:
+      // the training buffers of a batch, laid out in one block of memory
+      struct Buffers
+      {
+        T *inputs;      // steps * batch x features, the inputs stacked step by step
+        T *gates;       // steps * batch x gates * hidden, the gates then their gradients
+        T *hidden;      // (steps + 1) * batch x hidden, the initial state first
+        T *cells;       // (steps + 1) * batch x hidden, LSTM cell states
+        T *recurrent;   // batch x gates * hidden, the recurrent product of one step
+        T *candidate;   // steps * batch x hidden, GRU recurrent product of the candidate
+        T *recurrent_gradient;  // steps * batch x gates * hidden, GRU gradient of the recurrent products
+        T *hidden_error;        // batch x hidden
+        T *cell_error;          // batch x hidden
+      };
+
+      LayerKind m_kind;
+      int m_features;
+      int m_hidden;
+      int m_steps;
+      bool m_sequences;
+      int m_bptt;
+      // the parameters as stored in a model file blob
+      int32_t m_record[FIELDS];
+      Matrix m_storage;
+      Buffers m_buffers;
+      // workspace offsets of the training buffers, max_batch rows each
+      size_t m_ws_buffers;
+      size_t m_ws_output;
+      size_t m_ws_input_error;
+
+      Recurrent_LayerT() {};
+      Recurrent_LayerT(LayerKind kind, int features, int hidden, int steps, bool sequences, int bptt);
+      int Gates() const { return (m_kind == LayerKind::LSTM) ? 4 : 3; }
+      size_t BufferSize(int batch) const;
+      Buffers Layout(T *memory, int batch) const;
+      void Run(const Eigen::Ref<const Matrix> &input, Buffers &buffers, Eigen::Ref<Matrix> output,
+               WorkspaceT<T> *workspace) const;
+      void CellForward(const Buffers &buffers, int step, int batch) const;
+      void CellBackward(const Buffers &buffers, int step, int batch) const;
+      void RunBackward(const Eigen::Ref<const Matrix> &output_error, const Buffers &buffers, Eigen::Ref<Matrix> input_error,
+                       WorkspaceT<T> *workspace);
+
+    public:
+      Recurrent_LayerT(const Recurrent_LayerT &other);
+
+      Matrix FeedForward(const Matrix& input_data) override;
+      void Forward(const Matrix& input_data, Matrix& output) const override;
+      Matrix BackPropagation(const Matrix& output_error, float learning_rate) override;
+      Matrix Backward(const Matrix& output_error) override;
+      int OutputSize(int input_size) const override;
+      void BindWorkspace(WorkspaceT<T> &workspace, int max_batch) override;
+      const MatrixMap& TrainForward(const Eigen::Ref<const Matrix>& input) override;
+      const MatrixMap& TrainBackward(const Eigen::Ref<const Matrix>& output_error) override;
+      LayerT<T>* Clone() const override;
+      LayerKind GetKind() const override { return m_kind; }
+      LayerCost GetCost(int batch) const override;
+      int Steps() const { return m_steps; }
+      int Hidden() const { return m_hidden; }
+
+      void SaveLayer(std::ofstream &outfile) override;
+      bool SaveRecord(ModelWriter &writer) const override;
+      static Recurrent_LayerT* MapLayer(const std::shared_ptr<ModelFile> &file, const ModelLayerRecord &record);
+      void SetWeights(Matrix &weights) override;
+      void SetBias(Matrix &bias) override;
+  };
+
+
+  template <typename T>
+  class LSTM_LayerT : public Recurrent_LayerT<T>
+  {
+    public:
+      LSTM_LayerT(int features, int hidden, int steps, bool sequences = false, int bptt = 0)
+        : Recurrent_LayerT<T>(LayerKind::LSTM, features, hidden, steps, sequences, bptt) {};
+  };
+
+
+  template <typename T>
+  class GRU_LayerT : public Recurrent_LayerT<T>
+  {
+    public:
+      GRU_LayerT(int features, int hidden, int steps, bool sequences = false, int bptt = 0)
+        : Recurrent_LayerT<T>(LayerKind::GRU, features, hidden, steps, sequences, bptt) {};
+  };
+
+  typedef Recurrent_LayerT<double> Recurrent_Layer;
+  typedef Recurrent_LayerT<float>  Recurrent_LayerF;
+  typedef LSTM_LayerT<double> LSTM_Layer;
+  typedef LSTM_LayerT<float>  LSTM_LayerF;
+  typedef GRU_LayerT<double>  GRU_Layer;
+  typedef GRU_LayerT<float>   GRU_LayerF;
+}
+
+#endif
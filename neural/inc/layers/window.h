@@ -0,0 +1,47 @@
+#ifndef __WINDOW_H__
+#define __WINDOW_H__
+
+#include <cstdint>
+#include <vector>
+
+namespace Neural
+{
+  /**
+   * @brief Geometry of a square window sliding over images of channels x height x width,
+   *        flattened channel by channel into one row per sample, as convolution and
+   *        pooling layers read them. The output positions are numbered row by row, and
+   *        every tap of the window at every position is looked up once here.
+   */
+  struct WindowShape
+  {
+    static const int FIELDS = 7;
+
+    int channels = 0;
+    int height = 0;
+    int width = 0;
+    int kernel = 0;
+    int stride = 1;
+    int padding = 0;
+    int dilation = 1;
+    int out_height = 0;
+    int out_width = 0;
+    // Positions() x Taps(), the input pixel under each tap, -1 in the padding
+    std::vector<int> taps;
+    // the parameters as stored in a model file blob
+    int32_t record[FIELDS] = {};
+
+    WindowShape() {};
+    WindowShape(int channels, int height, int width, int kernel, int stride, int padding, int dilation);
+
+    int Taps() const { return kernel * kernel; }
+    int Positions() const { return out_height * out_width; }
+    int Pixels() const { return height * width; }
+    int InputSize() const { return channels * height * width; }
+    bool Valid() const { return out_height > 0 && out_width > 0; }
+    int Tap(int position, int tap) const { return taps[position * Taps() + tap]; }
+
+    static WindowShape Read(const int32_t *fields);
+  };
+}
+
+#endif
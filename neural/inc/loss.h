@@ -1,30 +1,129 @@
 #ifndef __LOSS_H__
 #define __LOSS_H__
 
+#include <cmath>
 #include <Eigen/Dense>
 
+#include "core.h"
+
 
 namespace Neural
 {
-  class Loss {
+  template <typename T>
+  class LossT {
     public:
-      Loss() {};
-      virtual double Compute(Eigen::MatrixXd y_true, Eigen::MatrixXd y_pred) = 0;
-      virtual Eigen::MatrixXd ComputeDerivative(Eigen::MatrixXd y_true, Eigen::MatrixXd y_pred) = 0;
+      typedef DynMatrix<T> Matrix;
+
+      LossT() {};
+      virtual ~LossT() {};
+      virtual double Compute(const Eigen::Ref<const Matrix>& y_true, const Eigen::Ref<const Matrix>& y_pred) = 0;
+      virtual Matrix ComputeDerivative(const Eigen::Ref<const Matrix>& y_true, const Eigen::Ref<const Matrix>& y_pred) = 0;
+
+      // derivative into a preallocated matrix of the batch shape, for the training step
+      virtual void ComputeDerivative(const Eigen::Ref<const Matrix>& y_true, const Eigen::Ref<const Matrix>& y_pred,
+                                     Eigen::Ref<Matrix> gradient) {
+        gradient = ComputeDerivative(y_true, y_pred);
+      }
+
+      // loss and derivative of a training step, a loss may compute both in one pass
+      virtual double ComputeWithDerivative(const Eigen::Ref<const Matrix>& y_true, const Eigen::Ref<const Matrix>& y_pred,
+                                           Eigen::Ref<Matrix> gradient) {
+        ComputeDerivative(y_true, y_pred, gradient);
+        return Compute(y_true, y_pred);
+      }
+
+      // the loss reads logits, a final softmax is folded into it during training
+      virtual bool TakesLogits() const { return false; }
   };
 
-  class Mse : public Loss {
+  template <typename T>
+  class MseT : public LossT<T> {
     public:
-      Mse() {};
-      virtual double Compute(Eigen::MatrixXd y_true, Eigen::MatrixXd y_pred) {
-        Eigen::MatrixXd diff = y_true-y_pred;
-        return diff.array().pow(2).mean();
+      typedef DynMatrix<T> Matrix;
+
+      MseT() {};
+      virtual double Compute(const Eigen::Ref<const Matrix>& y_true, const Eigen::Ref<const Matrix>& y_pred) {
+        return (y_true-y_pred).array().square().mean();
+      }
+      virtual Matrix ComputeDerivative(const Eigen::Ref<const Matrix>& y_true, const Eigen::Ref<const Matrix>& y_pred) {
+        Matrix diff = y_pred-y_true;
+        return (T(2)*diff)/T(y_true.size());
       }
-      virtual Eigen::MatrixXd ComputeDerivative(Eigen::MatrixXd y_true, Eigen::MatrixXd y_pred) {
-        Eigen::MatrixXd diff = y_pred-y_true;
-        return (2*diff)/y_true.size();
+      virtual void ComputeDerivative(const Eigen::Ref<const Matrix>& y_true, const Eigen::Ref<const Matrix>& y_pred,
+                                     Eigen::Ref<Matrix> gradient) {
+        gradient = (T(2)*(y_pred-y_true))/T(y_true.size());
       }
   };
+
+  /**
+   * @brief Cross-entropy of a softmax, fused with it. y_pred are the logits z of the output
+   *        layer: a Fc_Layer with SOFTMAX trains without its softmax when this loss is used,
+   *        inference still applies it. The loss of a row is logsumexp(z) - y.z, summed with
+   *        the max of the row taken out so exp never overflows, and its gradient (p - y) / N
+   *        is exact, the softmax Jacobian is never formed. Rows of y_true are distributions,
+   *        one-hot for classes.
+   */
+  template <typename T>
+  class CrossEntropyT : public LossT<T> {
+    public:
+      typedef DynMatrix<T> Matrix;
+
+      CrossEntropyT() {};
+      virtual double Compute(const Eigen::Ref<const Matrix>& y_true, const Eigen::Ref<const Matrix>& y_pred) {
+        return Fused(y_true, y_pred, nullptr);
+      }
+      virtual Matrix ComputeDerivative(const Eigen::Ref<const Matrix>& y_true, const Eigen::Ref<const Matrix>& y_pred) {
+        Matrix gradient(y_pred.rows(), y_pred.cols());
+        Eigen::Ref<Matrix> view(gradient);
+        Fused(y_true, y_pred, &view);
+        return gradient;
+      }
+      virtual void ComputeDerivative(const Eigen::Ref<const Matrix>& y_true, const Eigen::Ref<const Matrix>& y_pred,
+                                     Eigen::Ref<Matrix> gradient) {
+        Fused(y_true, y_pred, &gradient);
+      }
+      virtual double ComputeWithDerivative(const Eigen::Ref<const Matrix>& y_true, const Eigen::Ref<const Matrix>& y_pred,
+                                           Eigen::Ref<Matrix> gradient) {
+        return Fused(y_true, y_pred, &gradient);
+      }
+      virtual bool TakesLogits() const { return true; }
+
+    private:
+      // one pass over each row: max, exponentials, log-sum-exp, loss and, with a gradient, p - y
+      double Fused(const Eigen::Ref<const Matrix>& y_true, const Eigen::Ref<const Matrix>& z, Eigen::Ref<Matrix>* gradient) {
+        int rows = z.rows();
+        double loss = 0;
+
+        for (int i = 0; i < rows; i++) {
+          T max = z.row(i).maxCoeff();
+          T mass = y_true.row(i).sum();
+          T sum;
+
+          if (gradient != nullptr) {
+            auto g = gradient->row(i);
+            g = (z.row(i).array() - max).exp().matrix();
+            sum = g.sum();
+            g = (g * (mass / sum) - y_true.row(i)) / T(rows);
+          }
+          else {
+            sum = (z.row(i).array() - max).exp().sum();
+          }
+
+          T lse = max + std::log(sum);
+          loss += double(lse * mass - y_true.row(i).dot(z.row(i)));
+        }
+
+        return rows > 0 ? loss / rows : 0.0;
+      }
+  };
+
+  typedef LossT<double>         Loss;
+  typedef MseT<double>          Mse;
+  typedef CrossEntropyT<double> CrossEntropy;
+
+  typedef LossT<float>          LossF;
+  typedef MseT<float>           MseF;
+  typedef CrossEntropyT<float>  CrossEntropyF;
 }
 
-#endif
\ No newline at end of file
+#endif
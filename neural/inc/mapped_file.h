@@ -0,0 +1,38 @@
+#ifndef __MAPPED_FILE_H__
+#define __MAPPED_FILE_H__
+
+#include <cstddef>
+#include <string>
+
+namespace Neural
+{
+  /**
+   * @brief A read-only file mapped into memory. Pages are shared with the page cache and
+   *        every process mapping the same file, and copied on first write (MAP_PRIVATE /
+   *        FILE_MAP_COPY), so the mapping can be modified without touching the file.
+   */
+  class MappedFile
+  {
+    private:
+      char *m_data;
+      size_t m_size;
+#ifdef _WIN32
+      void *m_file;
+      void *m_mapping;
+#endif
+
+    public:
+      MappedFile();
+      ~MappedFile();
+      MappedFile(const MappedFile&) = delete;
+      MappedFile& operator=(const MappedFile&) = delete;
+
+      bool Open(const std::string &name);
+      void Close();
+
+      char* Data() const { return m_data; }
+      size_t Size() const { return m_size; }
+  };
+}
+
+#endif
@@ -0,0 +1,105 @@
+#ifndef __MODEL_FILE_H__
+#define __MODEL_FILE_H__
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "core.h"
+#include "mapped_file.h"
+
+namespace Neural
+{
+  // model file header, files without it are the original headerless double format
+  const int32_t MODEL_MAGIC = 0x004D4C4E;  // "NLM"
+  // 2: layer records start with a LayerKind
+  // 3: fixed size header and layer table, 64-byte aligned parameter blobs that are mapped
+  const int32_t MODEL_VERSION = 3;
+  const uint32_t MODEL_BYTE_ORDER = 0x01020304;
+  const int MODEL_ALIGNMENT = 64;
+
+  // all offsets are in bytes from the start of the file
+  struct ModelHeader
+  {
+    int32_t magic;
+    int32_t version;
+    uint32_t byte_order;     // MODEL_BYTE_ORDER as written by the saving machine
+    int32_t dtype;           // DataType of the parameter blobs
+    int32_t layer_count;
+    int32_t record_size;     // sizeof(ModelLayerRecord)
+    uint64_t table_offset;
+    uint64_t data_offset;
+    uint64_t data_size;
+    uint64_t table_checksum; // FNV-1a of the layer table
+    uint64_t data_checksum;  // FNV-1a of the blobs, checked only on request
+  };
+
+  // one entry of the layer table, the meaning of the blobs and the scalar depends on kind
+  struct ModelLayerRecord
+  {
+    int32_t kind;
+    int32_t activation;
+    int32_t rows;
+    int32_t cols;
+    uint64_t blob[4];
+    double scalar;
+    uint64_t reserved;
+  };
+
+  static_assert(sizeof(ModelHeader) == 64, "model header must stay 64 bytes");
+  static_assert(sizeof(ModelLayerRecord) == 64, "layer record must stay 64 bytes");
+
+
+  /**
+   * @brief Collects the layer records and parameter blobs of a network and writes them as
+   *        a version 3 model file. Blobs are referenced, not copied, until Save.
+   */
+  class ModelWriter
+  {
+    private:
+      struct Blob {
+        const void *data;
+        size_t bytes;
+        uint64_t offset;
+      };
+
+      std::vector<ModelLayerRecord> m_records;
+      std::vector<Blob> m_blobs;
+      uint64_t m_data_size;
+
+    public:
+      ModelWriter();
+
+      uint64_t AddBlob(const void *data, size_t bytes);
+      void AddLayer(const ModelLayerRecord &record);
+      bool Save(const std::string &name, DataType dtype);
+  };
+
+
+  /**
+   * @brief A version 3 model file mapped into memory. Pages are copied on first write, so
+   *        layers can train on mapped weights without touching the file.
+   */
+  class ModelFile
+  {
+    private:
+      MappedFile m_file;
+
+    public:
+      bool Open(const std::string &name, bool verify = false);
+
+      const ModelHeader& Header() const { return *reinterpret_cast<const ModelHeader*>(m_file.Data()); }
+      const ModelLayerRecord& Layer(int index) const;
+      DataType GetDataType() const { return static_cast<DataType>(Header().dtype); }
+
+      char* Blob(uint64_t offset) { return m_file.Data() + Header().data_offset + offset; }
+      bool HasBlob(uint64_t offset, uint64_t bytes) const;
+
+      template <typename T>
+      void CopyMatrix(uint64_t offset, DynMatrix<T> &m, int rows, int cols);
+  };
+
+  uint64_t Fnv1a(const void *data, size_t bytes, uint64_t hash = 0xcbf29ce484222325ull);
+}
+
+#endif
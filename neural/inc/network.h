@@ -3,33 +3,217 @@
 
 #include <vector>
 #include <string>
+#include <atomic>
+#include <memory>
 #include "layers/fc_layer.h"
+#include "layers/activation_layer.h"
+#include "layers/qfc_layer.h"
+#include "layers/conv_layer.h"
+#include "layers/pool_layer.h"
+#include "layers/embedding_layer.h"
+#include "layers/recurrent_layer.h"
 #include "loss.h"
+#include "data_source.h"
+#include "thread_pool.h"
+#include "spsc_queue.h"
+#include "profiler.h"
 
 namespace Neural
 {
-  class Network
+  // what Compile changed in the layer list
+  struct CompileReport
   {
+    int layers = 0;     // layers before Compile
+    int steps = 0;      // layers left to run
+    int folded = 0;     // activation layers folded into the layer before them
+    int dropped = 0;    // activation layers that left their inputs unchanged
+  };
+
+  // order of the micro-batch passes of a pipeline stage
+  enum class PipelineSchedule
+  {
+    GPIPE,          // every forward pass, then every backward pass
+    ONE_F_ONE_B     // forward passes until the pipeline is full, then one backward pass per forward pass
+  };
+
+  // counters of one pipeline stage, summed over the steps
+  struct PipelineStageProfile
+  {
+    int first_layer = 0;
+    int layers = 0;
+    long long forwards = 0;
+    long long recomputes = 0;     // forward passes run again before a backward pass
+    long long backwards = 0;
+    double busy_seconds = 0;      // in layer calls and copies, not waiting for the other stages
+    double utilization = 0;       // busy_seconds over the time of the steps
+  };
+
+  // counters of pipeline-parallel training since the stages were laid out
+  struct PipelineReport
+  {
+    int micro_batches = 0;        // of the last step
+    long long steps = 0;
+    double seconds = 0;           // wall time of the steps
+    double bubble = 0;            // share of stage time spent waiting
+    std::vector<PipelineStageProfile> stages;
+  };
+
+  // counters of asynchronous training, summed over the Fit calls
+  struct HogwildReport
+  {
+    long long updates = 0;          // training steps applied to the shared parameters
+    long long layer_updates = 0;
+    long long conflicts = 0;        // layer updates that overlapped an update of the same layer by another worker
+    double mean_staleness = 0;      // steps of other workers applied between the read of the parameters and the update
+    long long max_staleness = 0;
+    double seconds = 0;             // time of the asynchronous epochs
+    long long samples = 0;
+  };
+
+
+  template <typename T>
+  class NetworkT
+  {
+    public:
+      typedef DynMatrix<T> Matrix;
+      typedef typename LayerT<T>::MatrixMap MatrixMap;
+
     private:
-      Loss *m_loss;
-      std::vector<Layer*> m_layer;
+      LossT<T> *m_loss;
+      std::vector<LayerT<T>*> m_layer;
       std::vector<double> m_error;
 
+      int m_threads;
+      // rows of the micro-batches a batch is split into, 0 to train on whole batches
+      int m_micro_batch;
+      // layers per checkpoint segment, only the last layer of a segment keeps its outputs
+      // until the backward pass, 0 keeps every layer
+      int m_checkpoint;
+      ThreadPool *m_pool;
+      std::vector<std::vector<LayerT<T>*>> m_replica;
+      Profiler *m_profiler;
+
+      // training buffers of the layers and the loss gradient, one workspace per replica
+      // when the steps run on the thread pool
+      WorkspaceT<T> m_workspace;
+      std::vector<WorkspaceT<T>> m_replica_workspace;
+      size_t m_ws_loss_gradient;
+      std::vector<double> m_losses;
+      // shape the workspace is bound for, 0 until the first bind or after the layers change
+      int m_bound_batch;
+      int m_bound_inputs;
+      // the workspace buffers are shared by liveness once the network is compiled
+      bool m_compiled;
+      // every bound layer trains in its workspace, the epochs after the first allocate nothing
+      bool m_allocation_free;
+
+      // a pipeline stage: contiguous layers trained by one thread on its own workspace, its
+      // inputs and output errors come from the stages around it through the queues
+      struct Stage
+      {
+        std::vector<LayerT<T>*> layers;
+        std::vector<typename LayerT<T>::Gradients> sums;  // gradient sums of the micro-batches, per layer
+        int first;
+        int inputs;
+        WorkspaceT<T> workspace;
+        size_t ws_loss_gradient;
+        Matrix input;                   // inputs of every micro-batch, max_batch rows
+        Matrix error;                   // output errors of every micro-batch, max_batch rows
+        SpscQueue forward;              // micro-batches whose inputs are ready
+        SpscQueue backward;             // micro-batches whose output errors are ready
+        int last_forward;
+      };
+
+      // stages of pipeline-parallel training, 0 when the steps don't run on a pipeline
+      int m_pipeline;
+      PipelineSchedule m_schedule;
+      ThreadPool *m_stage_pool;
+      std::vector<Stage*> m_stages;
+      PipelineReport m_pipeline_report;
+
+      // counters of one asynchronous worker, on a cache line of their own
+      struct alignas(64) WorkerCounters
+      {
+        long long updates;
+        long long conflicts;
+        long long staleness;
+        long long max_staleness;
+      };
+
+      // workers of asynchronous training, 0 when the steps are synchronous
+      int m_hogwild;
+      ThreadPool *m_worker_pool;
+      std::vector<Matrix> m_worker_x;
+      std::vector<Matrix> m_worker_y;
+      std::vector<WorkerCounters> m_worker_counters;
+      // training steps applied to the shared parameters, and workers updating each layer
+      std::atomic<long long> m_updates;
+      std::unique_ptr<std::atomic<int>[]> m_writers;
+      long long m_staleness;
+      HogwildReport m_hogwild_report;
+
+      double TrainStep(const Eigen::Ref<const Matrix>& x_batch, const Eigen::Ref<const Matrix>& y_batch, double learning_rate,
+                       LossT<T> &loss);
+      double ParallelTrainStep(const Eigen::Ref<const Matrix>& x_batch, const Eigen::Ref<const Matrix>& y_batch, double learning_rate,
+                               LossT<T> &loss);
+      double PipelineTrainStep(const Eigen::Ref<const Matrix>& x_batch, const Eigen::Ref<const Matrix>& y_batch, double learning_rate,
+                               LossT<T> &loss);
+      double RunStage(Stage &stage, int s, const Eigen::Ref<const Matrix>& x_batch, const Eigen::Ref<const Matrix>& y_batch,
+                      double learning_rate, LossT<T> &loss, int micro_batches);
+      double HogwildStep(int worker, const Eigen::Ref<const Matrix>& x_batch, const Eigen::Ref<const Matrix>& y_batch,
+                         double learning_rate, LossT<T> &loss);
+      double HogwildEpoch(DataLoaderT<T> &loader, double learning_rate);
+      double ReplicaGradients(const Eigen::Ref<const Matrix>& x_batch, const Eigen::Ref<const Matrix>& y_batch, LossT<T> &loss,
+                              double scale, bool sync);
+      // the steps run on the replicas with several threads or micro-batches
+      bool OnReplicas() const { return m_pipeline == 0 && m_hogwild == 0 && (m_threads > 1 || m_micro_batch > 0); }
+      int PipelineMicroBatches(int rows) const;
+      bool Recomputed(int layer, int layers) const { return m_checkpoint > 0 && layer < layers - 1 && (layer + 1) % m_checkpoint != 0; }
+      void Recompute(const std::vector<LayerT<T>*> &layers, int layer, const Eigen::Ref<const Matrix>& x_batch);
+      size_t BindLayers(const std::vector<LayerT<T>*> &layers, WorkspaceT<T> &workspace, int max_batch, int inputs,
+                        bool output = true);
+      void BindWorkspace(int max_batch, int inputs);
+      void BindStages(int max_batch, int inputs);
+      void ClearReplicas();
+      void ClearStages();
+
     public:
-      Network();
-      ~Network();
+      NetworkT();
+      ~NetworkT();
 
-      void Add(Layer *layer);
-      void Use(Loss *l);
-      void UseOptimizer(Optimizer* optimizer);
-      void Fit(Eigen::MatrixXd x_train, Eigen::MatrixXd y_train, int epochs, double learning_rate, int batch_size, int verbose = 1);
-      void Evaluate(Eigen::MatrixXd y_tests, Eigen::MatrixXd y_true);
+      void Add(LayerT<T> *layer);
+      void Use(LossT<T> *l);
+      CompileReport Compile();
+      void UseOptimizer(OptimizerT<T>* optimizer);
+      void UseThreads(int threads);
+      void UseMicroBatches(int rows);
+      void UseCheckpoints(int segment);
+      void UsePipeline(int stages, PipelineSchedule schedule = PipelineSchedule::ONE_F_ONE_B);
+      PipelineReport GetPipelineReport() const { return m_pipeline_report; }
+      void UseHogwild(int workers);
+      HogwildReport GetHogwildReport() const { return m_hogwild_report; }
+      void EnableProfiling(bool enable = true);
+      ProfileReport GetProfile() const;
+      void ResetProfile();
+      size_t WorkspaceBytes() const;
+      size_t ActivationBytes() const;
+      void Fit(const Matrix& x_train, const Matrix& y_train, int epochs, double learning_rate, int batch_size, int verbose = 1);
+      void Fit(DataSourceT<T>& source, int epochs, double learning_rate, int batch_size, int verbose = 1);
+      double TrainOnBatch(const Eigen::Ref<const Matrix>& x_batch, const Eigen::Ref<const Matrix>& y_batch, double learning_rate,
+                          LossT<T> *loss = nullptr);
+      void Evaluate(Matrix y_tests, Matrix y_true);
 
-      std::vector<Eigen::MatrixXd> Predict(Eigen::MatrixXd input_data);
+      std::vector<Matrix> Predict(const Matrix& input_data) const;
+      Matrix PredictBatch(const Matrix& input_data, int chunk_size = 0) const;
+      void PredictBatch(const Matrix& input_data, Matrix& output, int chunk_size = 0) const;
+      NetworkT* Quantize(const Matrix& calibration_data);
       void SaveModel(std::string name);
-      static Network* LoadModel(std::string name);
+      static NetworkT* LoadModel(std::string name, bool verify = false);
   };
+
+  typedef NetworkT<double> Network;
+  typedef NetworkT<float>  NetworkF;
 }
 
 
-#endif
\ No newline at end of file
+#endif
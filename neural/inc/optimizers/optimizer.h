@@ -4,82 +4,316 @@
 #include <Eigen/Dense>
 #include <vector>
 #include <memory>
+#include <cmath>
+
+#include "../core.h"
 
 namespace Neural
 {
-  class Optimizer
+  template <typename T>
+  class OptimizerT
   {
   public:
-    virtual void UpdateWeights(Eigen::MatrixXd &weights, const Eigen::MatrixXd &grad_weights) = 0;
-    virtual void UpdateBias(Eigen::MatrixXd &bias, const Eigen::MatrixXd &grad_bias) = 0;
-    virtual std::unique_ptr<Optimizer> Clone() const = 0;  // 克隆接口
-    virtual ~Optimizer() {}
+    typedef DynMatrix<T> Matrix;
+    typedef Eigen::Ref<Matrix> Param;
+    typedef const Eigen::Ref<const Matrix>& Grad;
+
+  protected:
+    // per parameter tensor state, keyed by the tensor memory so every tensor counts its own steps,
+    // with the shape of the tensor: freed memory may be reused by a tensor of another shape
+    struct State
+    {
+      Matrix m, v;
+      long t = 0;
+      Eigen::Index rows = 0, cols = 0;
+    };
+
+    std::vector<std::pair<const T*, State>> m_state;
+
+    State& GetState(const Param &param, int buffers)
+    {
+      State *state = nullptr;
+      for (auto &entry : m_state) {
+        if (entry.first == param.data()) {
+          state = &entry.second;
+          break;
+        }
+      }
+
+      if (state != nullptr && state->rows == param.rows() && state->cols == param.cols())
+        return *state;
+
+      // a new tensor, or a tensor of another shape in the memory of a freed one
+      if (state == nullptr) {
+        m_state.emplace_back(param.data(), State());
+        state = &m_state.back().second;
+      }
+
+      *state = State();
+      state->rows = param.rows();
+      state->cols = param.cols();
+      if (buffers > 0) state->m = Matrix::Zero(param.rows(), param.cols());
+      if (buffers > 1) state->v = Matrix::Zero(param.rows(), param.cols());
+
+      return *state;
+    }
+
+  public:
+    // single pass, in place update of one parameter tensor, decay is false for biases
+    virtual void Update(Param param, Grad grad, bool decay = true) = 0;
+    // lazy update of the listed columns of a tensor, grad holds one column per entry, the
+    // state of the other columns is left as it is
+    virtual void UpdateColumns(Param param, Grad grad, const std::vector<int> &columns) = 0;
+    virtual std::unique_ptr<OptimizerT> Clone() const = 0;  // 克隆接口
+    virtual ~OptimizerT() {}
+
+    void UpdateWeights(Param weights, Grad grad_weights) { Update(weights, grad_weights, true); }
+    void UpdateBias(Param bias, Grad grad_bias) { Update(bias, grad_bias, false); }
   };
 
-  class Adam : public Optimizer
+
+  // SGD with optional momentum and Nesterov momentum
+  template <typename T>
+  class SGDT : public OptimizerT<T>
   {
+  public:
+    typedef DynMatrix<T> Matrix;
+    typedef typename OptimizerT<T>::Param Param;
+    typedef typename OptimizerT<T>::Grad Grad;
+
   private:
-    double m_learning_rate;
-    double m_beta1;
-    double m_beta2;
-    double m_epsilon;
-    int m_t;
-    Eigen::MatrixXd m_m_weights, m_v_weights;
-    Eigen::MatrixXd m_m_bias, m_v_bias;
+    T m_learning_rate;
+    T m_momentum;
+    bool m_nesterov;
+
+    void Step(T *__restrict p, const T *__restrict g, T *__restrict velocity, long n)
+    {
+      const T lr = m_learning_rate, mu = m_momentum;
+
+      if (mu == T(0)) {
+        for (long i = 0; i < n; i++) {
+          p[i] -= lr * g[i];
+        }
+      }
+      else if (m_nesterov) {
+        for (long i = 0; i < n; i++) {
+          T vel = mu * velocity[i] + g[i];
+          velocity[i] = vel;
+          p[i] -= lr * (g[i] + mu * vel);
+        }
+      }
+      else {
+        for (long i = 0; i < n; i++) {
+          T vel = mu * velocity[i] + g[i];
+          velocity[i] = vel;
+          p[i] -= lr * vel;
+        }
+      }
+    }
 
   public:
-    Adam(double learning_rate = 0.001, double beta1 = 0.9, double beta2 = 0.999, double epsilon = 1e-8)
-        : m_learning_rate(learning_rate), m_beta1(beta1), m_beta2(beta2), m_epsilon(epsilon), m_t(0) {}
+    SGDT(T learning_rate = 0.01, T momentum = 0, bool nesterov = false)
+        : m_learning_rate(learning_rate), m_momentum(momentum), m_nesterov(nesterov) {}
+
+    void Update(Param param, Grad grad, bool decay = true) override
+    {
+      T *velocity = (m_momentum == T(0)) ? nullptr : this->GetState(param, 1).m.data();
+
+      Step(param.data(), grad.data(), velocity, param.size());
+    }
 
-    void UpdateWeights(Eigen::MatrixXd &weights, const Eigen::MatrixXd &grad_weights) override
+    void UpdateColumns(Param param, Grad grad, const std::vector<int> &columns) override
     {
-      // 初始化動量和方差
-      if (m_m_weights.size() == 0)
-      {
-        m_m_weights = Eigen::MatrixXd::Zero(weights.rows(), weights.cols());
-        m_v_weights = Eigen::MatrixXd::Zero(weights.rows(), weights.cols());
+      T *velocity = (m_momentum == T(0)) ? nullptr : this->GetState(param, 1).m.data();
+      const long rows = param.rows();
+
+      for (size_t j = 0; j < columns.size(); j++) {
+        long offset = columns[j] * rows;
+        Step(param.data() + offset, grad.col(j).data(), velocity ? velocity + offset : nullptr, rows);
       }
+    }
+
+    std::unique_ptr<OptimizerT<T>> Clone() const override {
+      return std::make_unique<SGDT>(m_learning_rate, m_momentum, m_nesterov);
+    }
+  };
+
 
-      m_t++;
-      // Updating momentum and variance 
-      m_m_weights = m_beta1 * m_m_weights + (1 - m_beta1) * grad_weights;
-      m_v_weights = m_beta2 * m_v_weights + (1 - m_beta2) * grad_weights.array().square().matrix();
+  template <typename T>
+  class RMSPropT : public OptimizerT<T>
+  {
+  public:
+    typedef DynMatrix<T> Matrix;
+    typedef typename OptimizerT<T>::Param Param;
+    typedef typename OptimizerT<T>::Grad Grad;
+
+  private:
+    T m_learning_rate;
+    T m_rho;
+    T m_epsilon;
+
+    void Step(T *__restrict p, const T *__restrict g, T *__restrict sq, long n)
+    {
+      const T lr = m_learning_rate, rho = m_rho, eps = m_epsilon;
 
-      // Adjusted momentum and variance
-      Eigen::MatrixXd m_hat = m_m_weights / (1 - std::pow(m_beta1, m_t));
-      Eigen::MatrixXd v_hat = m_v_weights / (1 - std::pow(m_beta2, m_t));
+      for (long i = 0; i < n; i++) {
+        T s = rho * sq[i] + (T(1) - rho) * g[i] * g[i];
+        sq[i] = s;
+        p[i] -= lr * g[i] / (std::sqrt(s) + eps);
+      }
+    }
+
+  public:
+    RMSPropT(T learning_rate = 0.001, T rho = 0.9, T epsilon = 1e-8)
+        : m_learning_rate(learning_rate), m_rho(rho), m_epsilon(epsilon) {}
 
-      // Update weights
-      weights -= m_learning_rate * (m_hat.array() / (v_hat.array().sqrt() + m_epsilon)).matrix();
+    void Update(Param param, Grad grad, bool decay = true) override
+    {
+      Step(param.data(), grad.data(), this->GetState(param, 1).m.data(), param.size());
     }
 
-    void UpdateBias(Eigen::MatrixXd &bias, const Eigen::MatrixXd &grad_bias) override
+    void UpdateColumns(Param param, Grad grad, const std::vector<int> &columns) override
     {
-      // Initialize momentum and variance
-      if (m_m_bias.size() == 0)
-      {
-        m_m_bias = Eigen::MatrixXd::Zero(bias.rows(), bias.cols());
-        m_v_bias = Eigen::MatrixXd::Zero(bias.rows(), bias.cols());
+      T *sq = this->GetState(param, 1).m.data();
+      const long rows = param.rows();
+
+      for (size_t j = 0; j < columns.size(); j++) {
+        long offset = columns[j] * rows;
+        Step(param.data() + offset, grad.col(j).data(), sq + offset, rows);
       }
+    }
+
+    std::unique_ptr<OptimizerT<T>> Clone() const override {
+      return std::make_unique<RMSPropT>(m_learning_rate, m_rho, m_epsilon);
+    }
+  };
+
+
+  template <typename T>
+  class AdamT : public OptimizerT<T>
+  {
+  public:
+    typedef DynMatrix<T> Matrix;
+    typedef typename OptimizerT<T>::Param Param;
+    typedef typename OptimizerT<T>::Grad Grad;
+
+  protected:
+    T m_learning_rate;
+    T m_beta1;
+    T m_beta2;
+    T m_epsilon;
+    T m_weight_decay;
+
+    // bias corrections folded into the step size and epsilon:
+    // lr * m_hat / (sqrt(v_hat) + eps) == lr_t * m / (sqrt(v) + eps_t)
+    void Corrections(long t, T &lr_t, T &eps_t)
+    {
+      T correction1 = T(1) - std::pow(m_beta1, T(t));
+      T correction2 = std::sqrt(T(1) - std::pow(m_beta2, T(t)));
+      lr_t = m_learning_rate * correction2 / correction1;
+      eps_t = m_epsilon * correction2;
+    }
 
-      m_t++;
-      // Updating momentum and variance 
-      m_m_bias = m_beta1 * m_m_bias + (1 - m_beta1) * grad_bias;
-      m_v_bias = m_beta2 * m_v_bias + (1 - m_beta2) * grad_bias.array().square().matrix();
+    void Step(T *__restrict p, const T *__restrict g, T *__restrict m, T *__restrict v, long n, T lr_t, T eps_t, T weight_decay)
+    {
+      const T b1 = m_beta1, b2 = m_beta2;
+      const T decay = T(1) - m_learning_rate * weight_decay;
+
+      for (long i = 0; i < n; i++) {
+        T mi = b1 * m[i] + (T(1) - b1) * g[i];
+        T vi = b2 * v[i] + (T(1) - b2) * g[i] * g[i];
+        m[i] = mi;
+        v[i] = vi;
+        p[i] = decay * p[i] - lr_t * mi / (std::sqrt(vi) + eps_t);
+      }
+    }
 
-      // Adjusted momentum and variance
-      Eigen::MatrixXd m_hat = m_m_bias / (1 - std::pow(m_beta1, m_t));
-      Eigen::MatrixXd v_hat = m_v_bias / (1 - std::pow(m_beta2, m_t));
+    void Step(Param &param, Grad grad, T weight_decay)
+    {
+      typename OptimizerT<T>::State &state = this->GetState(param, 2);
+      T lr_t, eps_t;
+      Corrections(++state.t, lr_t, eps_t);
 
-      // Update bias
-      bias -= m_learning_rate * (m_hat.array() / (v_hat.array().sqrt() + m_epsilon)).matrix();
+      Step(param.data(), grad.data(), state.m.data(), state.v.data(), param.size(), lr_t, eps_t, weight_decay);
     }
 
-    std::unique_ptr<Optimizer> Clone() const override {
-      return std::make_unique<Adam>(m_learning_rate, m_beta1, m_beta2, m_epsilon);
+    // lazy Adam: the moments of the listed columns only, with the step count of the tensor
+    void StepColumns(Param &param, Grad grad, const std::vector<int> &columns, T weight_decay)
+    {
+      typename OptimizerT<T>::State &state = this->GetState(param, 2);
+      const long rows = param.rows();
+      T lr_t, eps_t;
+      Corrections(++state.t, lr_t, eps_t);
+
+      for (size_t j = 0; j < columns.size(); j++) {
+        long offset = columns[j] * rows;
+        Step(param.data() + offset, grad.col(j).data(), state.m.data() + offset, state.v.data() + offset, rows,
+             lr_t, eps_t, weight_decay);
+      }
+    }
+
+  public:
+    AdamT(T learning_rate = 0.001, T beta1 = 0.9, T beta2 = 0.999, T epsilon = 1e-8)
+        : m_learning_rate(learning_rate), m_beta1(beta1), m_beta2(beta2), m_epsilon(epsilon), m_weight_decay(0) {}
+
+    void Update(Param param, Grad grad, bool decay = true) override
+    {
+      Step(param, grad, T(0));
+    }
+
+    void UpdateColumns(Param param, Grad grad, const std::vector<int> &columns) override
+    {
+      StepColumns(param, grad, columns, T(0));
+    }
+
+    std::unique_ptr<OptimizerT<T>> Clone() const override {
+      return std::make_unique<AdamT>(m_learning_rate, m_beta1, m_beta2, m_epsilon);
     }
 
   };
+
+
+  // Adam with decoupled weight decay, biases are not decayed
+  template <typename T>
+  class AdamWT : public AdamT<T>
+  {
+  public:
+    typedef DynMatrix<T> Matrix;
+    typedef typename OptimizerT<T>::Param Param;
+    typedef typename OptimizerT<T>::Grad Grad;
+
+    AdamWT(T learning_rate = 0.001, T beta1 = 0.9, T beta2 = 0.999, T epsilon = 1e-8, T weight_decay = 0.01)
+        : AdamT<T>(learning_rate, beta1, beta2, epsilon) {
+      this->m_weight_decay = weight_decay;
+    }
+
+    void Update(Param param, Grad grad, bool decay = true) override
+    {
+      this->Step(param, grad, decay ? this->m_weight_decay : T(0));
+    }
+
+    // the decay is lazy as well, untouched columns are not decayed
+    void UpdateColumns(Param param, Grad grad, const std::vector<int> &columns) override
+    {
+      this->StepColumns(param, grad, columns, this->m_weight_decay);
+    }
+
+    std::unique_ptr<OptimizerT<T>> Clone() const override {
+      return std::make_unique<AdamWT>(this->m_learning_rate, this->m_beta1, this->m_beta2, this->m_epsilon, this->m_weight_decay);
+    }
+  };
+
+  typedef OptimizerT<double> Optimizer;
+  typedef SGDT<double>       SGD;
+  typedef RMSPropT<double>   RMSProp;
+  typedef AdamT<double>      Adam;
+  typedef AdamWT<double>     AdamW;
+
+  typedef OptimizerT<float>  OptimizerF;
+  typedef SGDT<float>        SGDF;
+  typedef RMSPropT<float>    RMSPropF;
+  typedef AdamT<float>       AdamF;
+  typedef AdamWT<float>      AdamWF;
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,203 @@
+#ifndef __PROFILER_H__
+#define __PROFILER_H__
+
+#include <iosfwd>
+#include <vector>
+#include <mutex>
+#include <chrono>
+
+#include "layers/layer.h"
+
+namespace Neural
+{
+  /**
+   * @brief Process wide heap allocation counter. The allocator hooks of allocation_hooks.cpp
+   *        are only built with NEURAL_COUNT_ALLOCATIONS, the counts are 0 otherwise. They
+   *        count every malloc (glibc) or operator new (other platforms) while at least one
+   *        counter user is started, otherwise they only test a flag.
+   */
+  class AllocationCounter
+  {
+    public:
+      static void Start();
+      static void Stop();
+      static long long Count();
+      static long long Bytes();
+      static void Add(size_t size);
+      static bool Enabled();
+  };
+
+
+  /**
+   * @brief Forbids Eigen heap allocations while in scope, in builds with
+   *        EIGEN_RUNTIME_NO_MALLOC: an Eigen allocation then fails its assertion. Unlike
+   *        the allocator hooks it works on every platform. It does nothing in other builds.
+   *        The Eigen flag is global, the scope forbids allocations in every thread.
+   */
+  class NoMallocScope
+  {
+#ifdef EIGEN_RUNTIME_NO_MALLOC
+    private:
+      bool m_allowed;
+
+    public:
+      NoMallocScope(bool active = true) : m_allowed(Eigen::internal::is_malloc_allowed())
+      {
+        if (active)
+          Eigen::internal::set_is_malloc_allowed(false);
+      }
+
+      ~NoMallocScope() { Eigen::internal::set_is_malloc_allowed(m_allowed); }
+#else
+    public:
+      NoMallocScope(bool active = true) {}
+#endif
+  };
+
+
+  // counters of one layer, times are summed over calls and threads
+  struct LayerProfile
+  {
+    int index = 0;
+    LayerKind kind = LayerKind::FC;
+    int inputs = 0;
+    int outputs = 0;
+
+    long long forward_calls = 0;
+    long long backward_calls = 0;
+    long long update_calls = 0;
+    double forward_seconds = 0;
+    double backward_seconds = 0;
+    double update_seconds = 0;
+    double forward_flops = 0;
+    double backward_flops = 0;
+    double forward_bytes = 0;
+    double backward_bytes = 0;
+    double update_bytes = 0;
+    long long allocations = 0;
+
+    double ForwardGflops() const { return forward_seconds > 0 ? forward_flops / forward_seconds / 1e9 : 0; }
+    double BackwardGflops() const { return backward_seconds > 0 ? backward_flops / backward_seconds / 1e9 : 0; }
+  };
+
+  // counters of Fit, Predict or TrainOnBatch calls as a whole
+  struct CallProfile
+  {
+    long long calls = 0;
+    double seconds = 0;
+    long long allocations = 0;
+    long long allocated_bytes = 0;
+  };
+
+  struct ProfileReport
+  {
+    std::vector<LayerProfile> layers;
+    CallProfile fit;
+    CallProfile predict;
+    CallProfile train_on_batch;
+    std::vector<long long> epoch_allocations;  // heap allocations of each Fit epoch
+
+    void Print(std::ostream &os) const;
+  };
+
+
+  /**
+   * @brief Collects the counters of a network. Records are locked, layers of data-parallel
+   *        replicas and concurrent Predict calls can record at once.
+   */
+  class Profiler
+  {
+    public:
+      enum class Phase { FORWARD, BACKWARD, UPDATE };
+      enum class Call { FIT, PREDICT, TRAIN_ON_BATCH };
+
+    private:
+      std::mutex m_mutex;
+      ProfileReport m_report;
+
+    public:
+      Profiler();
+      ~Profiler();
+
+      void Record(int layer, Phase phase, double seconds, const LayerCost &cost, long long allocations);
+      void Record(Call call, double seconds, long long allocations, long long bytes);
+      void RecordEpoch(long long allocations);
+      ProfileReport Report();
+      void Reset();
+  };
+
+
+  /**
+   * @brief Times one layer call and records it with the analytical cost of the layer. With a
+   *        null profiler it does nothing, so the scopes stay in the training and inference
+   *        loops of release builds.
+   */
+  class LayerScope
+  {
+    private:
+      Profiler *m_profiler;
+      int m_layer;
+      Profiler::Phase m_phase;
+      LayerCost m_cost;
+      long long m_allocations;
+      std::chrono::steady_clock::time_point m_start;
+
+    public:
+      template <typename L>
+      LayerScope(Profiler *profiler, int layer, Profiler::Phase phase, const L *l, int batch) : m_profiler(profiler)
+      {
+        if (profiler == nullptr)
+          return;
+
+        m_layer = layer;
+        m_phase = phase;
+        m_cost = l->GetCost(batch);
+        m_allocations = AllocationCounter::Count();
+        m_start = std::chrono::steady_clock::now();
+      }
+
+      ~LayerScope()
+      {
+        if (m_profiler == nullptr)
+          return;
+
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - m_start).count();
+        m_profiler->Record(m_layer, m_phase, seconds, m_cost, AllocationCounter::Count() - m_allocations);
+      }
+  };
+
+
+  // Times a whole Fit or Predict call and counts its heap allocations.
+  class CallScope
+  {
+    private:
+      Profiler *m_profiler;
+      Profiler::Call m_call;
+      long long m_allocations;
+      long long m_bytes;
+      std::chrono::steady_clock::time_point m_start;
+
+    public:
+      CallScope(Profiler *profiler, Profiler::Call call) : m_profiler(profiler)
+      {
+        if (profiler == nullptr)
+          return;
+
+        m_call = call;
+        m_allocations = AllocationCounter::Count();
+        m_bytes = AllocationCounter::Bytes();
+        m_start = std::chrono::steady_clock::now();
+      }
+
+      ~CallScope()
+      {
+        if (m_profiler == nullptr)
+          return;
+
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - m_start).count();
+        m_profiler->Record(m_call, seconds, AllocationCounter::Count() - m_allocations, AllocationCounter::Bytes() - m_bytes);
+      }
+  };
+}
+
+#endif
@@ -0,0 +1,107 @@
+#ifndef __REPLAY_MEMORY_H__
+#define __REPLAY_MEMORY_H__
+
+#include <vector>
+#include <random>
+#include <Eigen/Dense>
+
+#include "core.h"
+
+namespace Neural
+{
+  /**
+   * @brief Complete binary tree of priorities, every node holds the sum of its children.
+   *        Setting a priority and finding the leaf of a prefix sum both take O(log n).
+   */
+  class SumTree
+  {
+    private:
+      int m_leaves;                   // a power of two, leaf i is node m_leaves + i
+      std::vector<double> m_nodes;    // node 1 is the root, node 0 is unused
+
+    public:
+      SumTree(int capacity = 0);
+
+      void Set(int index, double priority);
+      double Get(int index) const { return m_nodes[m_leaves + index]; }
+      double Total() const { return m_nodes[1]; }
+      int Find(double mass) const;
+  };
+
+
+  // a sampled batch of transitions, one per row
+  template <typename T>
+  struct TransitionBatchT
+  {
+    typedef DynMatrix<T> Matrix;
+    typedef Eigen::Matrix<T, Eigen::Dynamic, 1> Vector;
+
+    Matrix states;
+    Matrix next_states;
+    Eigen::VectorXi actions;
+    Vector rewards;
+    Vector done;                  // 1 where the transition ended the episode
+    Vector weights;               // importance-sampling weights, empty for uniform sampling
+    std::vector<int> indices;     // the slots of the transitions in the memory
+  };
+
+
+  /**
+   * @brief Fixed-capacity replay memory. Each field of the transitions has its own ring
+   *        buffer, the states row-major so a sampled state is one contiguous copy. Once full
+   *        a new transition overwrites the oldest one. Samples are gathered into the
+   *        matrices of a caller's batch, reused while the batch size stays the same.
+   *        A prioritized memory samples in proportion to priority^alpha from a sum tree.
+   */
+  template <typename T>
+  class ReplayMemoryT
+  {
+    public:
+      typedef DynMatrix<T> Matrix;
+      typedef Eigen::Matrix<T, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> RowMatrix;
+      typedef Eigen::Matrix<T, Eigen::Dynamic, 1> Vector;
+
+    private:
+      int m_capacity;
+      int m_size;
+      int m_next;         // the slot of the next transition
+
+      RowMatrix m_states;
+      RowMatrix m_next_states;
+      Eigen::VectorXi m_actions;
+      Vector m_rewards;
+      Vector m_done;
+
+      bool m_prioritized;
+      double m_alpha;
+      double m_max_priority;   // new transitions get the highest priority seen
+      SumTree m_tree;
+
+      std::mt19937 m_random;
+
+      void Gather(TransitionBatchT<T> &batch) const;
+
+    public:
+      ReplayMemoryT(int capacity, int state_size, bool prioritized = false, double alpha = 0.6, unsigned seed = 1);
+
+      void Add(const Eigen::Ref<const Matrix> &state, int action, double reward, const Eigen::Ref<const Matrix> &next_state,
+               bool done);
+      void Add(const Matrix &states, const Eigen::VectorXi &actions, const Vector &rewards, const Matrix &next_states,
+               const Vector &done);
+      bool Sample(int batch_size, TransitionBatchT<T> &batch, double beta = 0.4);
+      void UpdatePriorities(const std::vector<int> &indices, const Vector &td_errors);
+
+      int Size() const { return m_size; }
+      int Capacity() const { return m_capacity; }
+      int StateSize() const { return m_states.cols(); }
+      bool Prioritized() const { return m_prioritized; }
+  };
+
+  typedef TransitionBatchT<double> TransitionBatch;
+  typedef ReplayMemoryT<double>    ReplayMemory;
+
+  typedef TransitionBatchT<float>  TransitionBatchF;
+  typedef ReplayMemoryT<float>     ReplayMemoryF;
+}
+
+#endif
@@ -0,0 +1,75 @@
+#ifndef __SPSC_QUEUE_H__
+#define __SPSC_QUEUE_H__
+
+#include <vector>
+#include <atomic>
+#include <thread>
+
+namespace Neural
+{
+  /**
+   * @brief Lock-free ring of ints between one producer thread and one consumer thread. The
+   *        producer writes the data an item refers to before it pushes the item, the release
+   *        store of Push and the acquire load of Pop order those writes for the consumer.
+   *        The head and tail sit on their own cache lines, each thread only writes one.
+   */
+  class SpscQueue
+  {
+    private:
+      std::vector<int> m_items;
+      alignas(64) std::atomic<size_t> m_head;   // next item to pop, written by the consumer
+      alignas(64) std::atomic<size_t> m_tail;   // next slot to push, written by the producer
+
+    public:
+      SpscQueue() : m_head(0), m_tail(0) {};
+
+      // sets the capacity of an empty queue, while no thread uses it
+      void Reserve(size_t capacity)
+      {
+        if (m_items.size() < capacity)
+          m_items.resize(capacity);
+        m_head.store(0, std::memory_order_relaxed);
+        m_tail.store(0, std::memory_order_relaxed);
+      }
+
+      bool Push(int item)
+      {
+        size_t tail = m_tail.load(std::memory_order_relaxed);
+        if (tail - m_head.load(std::memory_order_acquire) == m_items.size())
+          return false;
+
+        m_items[tail % m_items.size()] = item;
+        m_tail.store(tail + 1, std::memory_order_release);
+        return true;
+      }
+
+      bool Pop(int &item)
+      {
+        size_t head = m_head.load(std::memory_order_relaxed);
+        if (head == m_tail.load(std::memory_order_acquire))
+          return false;
+
+        item = m_items[head % m_items.size()];
+        m_head.store(head + 1, std::memory_order_release);
+        return true;
+      }
+
+      // pushes an item, yields to the other threads while the queue is full
+      void Send(int item)
+      {
+        while (!Push(item))
+          std::this_thread::yield();
+      }
+
+      // pops the next item, yields to the other threads until there is one
+      int Receive()
+      {
+        int item;
+        while (!Pop(item))
+          std::this_thread::yield();
+        return item;
+      }
+  };
+}
+
+#endif
@@ -0,0 +1,36 @@
+#ifndef __THREAD_POOL_H__
+#define __THREAD_POOL_H__
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+namespace Neural
+{
+  class ThreadPool
+  {
+    private:
+      std::vector<std::thread> m_workers;
+      std::mutex m_mutex;
+      std::condition_variable m_start;
+      std::condition_variable m_done;
+      std::function<void(int)> m_task;
+      int m_task_count;
+      int m_next_task;
+      int m_pending;
+      bool m_stop;
+
+      void WorkerLoop();
+
+    public:
+      ThreadPool(int threads);
+      ~ThreadPool();
+
+      int Size() const { return m_workers.size(); }
+      void Run(int task_count, const std::function<void(int)> &task);
+  };
+}
+
+#endif
@@ -0,0 +1,86 @@
+#ifndef __WORKSPACE_H__
+#define __WORKSPACE_H__
+
+#include <cstddef>
+#include <vector>
+#include <Eigen/Dense>
+
+#include "core.h"
+
+namespace Neural
+{
+  // when a workspace buffer holds data during a training step
+  enum class Lifetime
+  {
+    STEP,       // the whole step, such as the outputs kept for the backward pass
+    SCRATCH,    // within each forward or backward call of the layer, nothing is kept between calls
+    ERROR       // from the backward pass of the layer to the one of the layer before, the input error
+  };
+
+  /**
+   * @brief Preallocated training memory of a network. The layers take their buffers once,
+   *        sized for the largest batch, and view the rows of the current batch at every
+   *        step, so a smaller batch uses the front of the same buffers. The packing panels
+   *        of the matrix products come from it too, Eigen allocates them per product.
+   *
+   *        Every buffer is taken with its lifetime in the training step of the layer being
+   *        bound. Share packs the buffers of the layout so that buffers which are never live
+   *        at the same time use the same memory, the layers are then bound again in the same
+   *        order and get the packed offsets.
+   *
+   *        A layer whose forward pass runs again before the backward passes, for activation
+   *        checkpointing, holds its buffers only around its two forward passes and until its
+   *        backward pass. Its kept outputs take no memory in between.
+   */
+  template <typename T>
+  class WorkspaceT
+  {
+    public:
+      typedef DynMatrix<T> Matrix;
+      typedef Eigen::Map<Matrix> MatrixMap;
+
+    private:
+      // a buffer of the layout, live from first[i] to last[i] in the steps of the training
+      // step: forward passes, loss, then backward passes
+      struct Buffer
+      {
+        size_t count;
+        int first[2];
+        int last[2];
+      };
+
+      Matrix m_memory;
+      size_t m_used;         // scalars taken by the current layout
+      size_t m_panel_lhs;    // packing panel sizes, placed after the buffers
+      size_t m_panel_rhs;
+      int m_layer;           // layer being bound, and number of layers
+      int m_layers;
+      int m_recompute;       // step of the second forward pass of the layer, -1 for none
+      std::vector<Buffer> m_buffers;
+      std::vector<size_t> m_offsets;   // packed offsets of the buffers, replayed by Take
+      size_t m_taken;
+
+    public:
+      WorkspaceT();
+
+      void Reset();
+      void SetLayer(int layer, int layers, int recompute = -1);
+      size_t Take(size_t count, Lifetime lifetime = Lifetime::STEP);
+      void Share();
+      void ReserveProduct(int rows, int cols, int depth);
+      void Allocate();
+
+      T* Data(size_t offset) { return m_memory.data() + offset; }
+      MatrixMap View(size_t offset, int rows, int cols) { return MatrixMap(Data(offset), rows, cols); }
+      size_t Bytes() const { return m_memory.size() * sizeof(T); }
+      size_t BufferBytes() const { return m_used * sizeof(T); }
+
+      void Product(const Eigen::Ref<const Matrix> &lhs, const Eigen::Ref<const Matrix> &rhs, Eigen::Ref<Matrix> dst,
+                   bool transpose_lhs = false, bool transpose_rhs = false);
+  };
+
+  typedef WorkspaceT<double> Workspace;
+  typedef WorkspaceT<float>  WorkspaceF;
+}
+
+#endif
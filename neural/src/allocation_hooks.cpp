@@ -0,0 +1,124 @@
+// Allocator hooks of AllocationCounter, they replace the allocator of the whole program and
+// are only built with NEURAL_COUNT_ALLOCATIONS (make COUNT_ALLOCATIONS=1).
+#ifdef NEURAL_COUNT_ALLOCATIONS
+
+#include <cstdlib>
+#include <cerrno>
+#include <new>
+#include "profiler.h"
+
+using namespace Neural;
+
+
+#if defined(__GLIBC__)
+// glibc lets the program replace malloc, the hooks forward to its implementation. Eigen and
+// operator new both allocate through malloc, so every heap allocation is seen. The whole
+// family is replaced, free included, so memory is always released by the allocator that
+// gave it, even when another allocator is preloaded: the program then uses glibc's.
+extern "C" {
+  void *__libc_malloc(size_t size);
+  void *__libc_calloc(size_t count, size_t size);
+  void *__libc_realloc(void *ptr, size_t size);
+  void *__libc_memalign(size_t alignment, size_t size);
+  void *__libc_valloc(size_t size);
+  void *__libc_pvalloc(size_t size);
+  void __libc_free(void *ptr);
+
+  void *malloc(size_t size) __THROW
+  {
+    AllocationCounter::Add(size);
+    return __libc_malloc(size);
+  }
+
+  void *calloc(size_t count, size_t size) __THROW
+  {
+    AllocationCounter::Add(count * size);
+    return __libc_calloc(count, size);
+  }
+
+  void *realloc(void *ptr, size_t size) __THROW
+  {
+    AllocationCounter::Add(size);
+    return __libc_realloc(ptr, size);
+  }
+
+  void *memalign(size_t alignment, size_t size) __THROW
+  {
+    AllocationCounter::Add(size);
+    return __libc_memalign(alignment, size);
+  }
+
+  void *aligned_alloc(size_t alignment, size_t size) __THROW
+  {
+    return memalign(alignment, size);
+  }
+
+  int posix_memalign(void **ptr, size_t alignment, size_t size) __THROW
+  {
+    if (alignment % sizeof(void*) != 0 || (alignment & (alignment - 1)) != 0)
+      return EINVAL;
+
+    void *memory = memalign(alignment, size);
+    if (memory == nullptr)
+      return ENOMEM;
+
+    *ptr = memory;
+    return 0;
+  }
+
+  void *valloc(size_t size) __THROW
+  {
+    AllocationCounter::Add(size);
+    return __libc_valloc(size);
+  }
+
+  void *pvalloc(size_t size) __THROW
+  {
+    AllocationCounter::Add(size);
+    return __libc_pvalloc(size);
+  }
+
+  void free(void *ptr) __THROW
+  {
+    __libc_free(ptr);
+  }
+}
+#else
+// without a replaceable malloc only operator new is counted, Eigen's own malloc calls are not:
+// steady-state training checks them with EIGEN_RUNTIME_NO_MALLOC instead
+void *operator new(size_t size)
+{
+  AllocationCounter::Add(size);
+  void *ptr = std::malloc(size == 0 ? 1 : size);
+  if (ptr == nullptr)
+    throw std::bad_alloc();
+  return ptr;
+}
+
+void *operator new[](size_t size)
+{
+  return operator new(size);
+}
+
+void operator delete(void *ptr) noexcept
+{
+  std::free(ptr);
+}
+
+void operator delete[](void *ptr) noexcept
+{
+  std::free(ptr);
+}
+
+void operator delete(void *ptr, size_t) noexcept
+{
+  std::free(ptr);
+}
+
+void operator delete[](void *ptr, size_t) noexcept
+{
+  std::free(ptr);
+}
+#endif
+
+#endif
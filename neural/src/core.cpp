@@ -1,3 +1,4 @@
+#include <fstream>
 #include "core.h"
 
 using namespace std;
@@ -5,9 +6,47 @@ using namespace Neural;
 using namespace Eigen;
 
 
-Eigen::MatrixXd Core::RandomMatrix(int rows, int cols, float min, float max)
+template <typename T>
+DynMatrix<T> Core::RandomMatrix(int rows, int cols, float min, float max)
 {
-  MatrixXd m = MatrixXd::Random(rows, cols);
+  DynMatrix<T> m = DynMatrix<T>::Random(rows, cols);
 
   return m;
 }
+
+
+/**
+ * @brief Reads a rows x cols matrix stored with the scalar type dtype, converting it when
+ *        it is not the scalar type of the matrix.
+ * 
+ * @param infile The input file stream
+ * @param m The matrix receiving the data
+ * @param rows Number of rows
+ * @param cols Number of columns
+ * @param dtype The scalar type of the data in the file
+ */
+template <typename T>
+void Core::ReadMatrix(ifstream &infile, DynMatrix<T> &m, int rows, int cols, DataType dtype)
+{
+  m.resize(rows, cols);
+
+  if (dtype == DataTypeOf<T>::value) {
+    infile.read(reinterpret_cast<char*>(m.data()), rows * cols * sizeof(T));
+  }
+  else if (dtype == DataType::FLOAT32) {
+    MatrixXf tmp(rows, cols);
+    infile.read(reinterpret_cast<char*>(tmp.data()), rows * cols * sizeof(float));
+    m = tmp.cast<T>();
+  }
+  else {
+    MatrixXd tmp(rows, cols);
+    infile.read(reinterpret_cast<char*>(tmp.data()), rows * cols * sizeof(double));
+    m = tmp.cast<T>();
+  }
+}
+
+
+template DynMatrix<float> Core::RandomMatrix<float>(int rows, int cols, float min, float max);
+template DynMatrix<double> Core::RandomMatrix<double>(int rows, int cols, float min, float max);
+template void Core::ReadMatrix<float>(ifstream &infile, DynMatrix<float> &m, int rows, int cols, DataType dtype);
+template void Core::ReadMatrix<double>(ifstream &infile, DynMatrix<double> &m, int rows, int cols, DataType dtype);
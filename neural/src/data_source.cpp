@@ -0,0 +1,664 @@
+#include <iostream>
+#include <fstream>
+#include <cstring>
+#include <cstdlib>
+#include <algorithm>
+#include <climits>
+#include "data_source.h"
+#include "model_file.h"
+
+using namespace std;
+using namespace Neural;
+using namespace Eigen;
+
+
+/**
+ * @brief Construct a new MemoryDataSource::MemoryDataSource object
+ *
+ * @param x Matrix input data, one sample per row
+ * @param y Matrix result data, one sample per row
+ */
+template <typename T>
+MemoryDataSourceT<T>::MemoryDataSourceT(const Matrix &x, const Matrix &y) : m_x(x), m_y(y)
+{
+}
+
+
+/**
+ * @brief Copies the samples of indices into x and y.
+ *
+ * @param indices The sample indices
+ * @param count Number of samples
+ * @param x Matrix receiving the inputs, count rows
+ * @param y Matrix receiving the results, count rows
+ */
+template <typename T>
+void MemoryDataSourceT<T>::Gather(const int *indices, int count, Ref<Matrix> x, Ref<Matrix> y)
+{
+  // column by column, the matrices are column-major
+  for (int c = 0; c < m_x.cols(); c++) {
+    for (int i = 0; i < count; i++) {
+      x(i, c) = m_x(indices[i], c);
+    }
+  }
+
+  for (int c = 0; c < m_y.cols(); c++) {
+    for (int i = 0; i < count; i++) {
+      y(i, c) = m_y(indices[i], c);
+    }
+  }
+}
+
+
+/**
+ * @brief Construct a new MappedDataSource::MappedDataSource object, Open maps the file.
+ *
+ */
+template <typename T>
+MappedDataSourceT<T>::MappedDataSourceT()
+{
+  memset(&m_header, 0, sizeof(m_header));
+}
+
+
+/**
+ * @brief Maps a binary data file and checks its header.
+ *
+ * @param name The file name
+ * @return true if the file is a valid data file
+ */
+template <typename T>
+bool MappedDataSourceT<T>::Open(const string &name)
+{
+  memset(&m_header, 0, sizeof(m_header));
+
+  if (!m_file.Open(name))
+    return false;
+
+  if (m_file.Size() < sizeof(DataHeader)) {
+    cerr << "Data file is truncated !!" << endl;
+    m_file.Close();
+    return false;
+  }
+
+  DataHeader header;
+  memcpy(&header, m_file.Data(), sizeof(header));
+
+  if (header.magic != DATA_MAGIC || header.byte_order != MODEL_BYTE_ORDER || header.version != DATA_VERSION) {
+    cerr << "Not a data file of this version and byte order !!" << endl;
+    m_file.Close();
+    return false;
+  }
+
+  size_t scalar_size = (header.dtype == static_cast<int32_t>(DataType::FLOAT32)) ? sizeof(float) : sizeof(double);
+  uint64_t bytes = (uint64_t)header.rows * (header.input_cols + header.output_cols) * scalar_size;
+
+  if (header.rows < 0 || sizeof(DataHeader) + bytes > m_file.Size()) {
+    cerr << "Data file is truncated !!" << endl;
+    m_file.Close();
+    return false;
+  }
+
+  // the samples are indexed with int, as by every other data source
+  if (header.rows > INT_MAX) {
+    cerr << "Data file has more than " << INT_MAX << " rows !!" << endl;
+    m_file.Close();
+    return false;
+  }
+
+  this->m_header = header;
+
+  return true;
+}
+
+
+/**
+ * @brief Writes matrices as a binary data file, which MappedDataSource can map.
+ *
+ * @param name The file name
+ * @param x Matrix input data, one sample per row
+ * @param y Matrix result data, one sample per row
+ * @return true if the file was written
+ */
+template <typename T>
+bool MappedDataSourceT<T>::Save(const string &name, const Matrix &x, const Matrix &y)
+{
+  ofstream ofs(name.c_str(), ios::out | ios::binary | ios::trunc);
+
+  if (!ofs) {
+    cerr << "Can't open file !!" << endl;
+    return false;
+  }
+
+  DataHeader header;
+  memset(&header, 0, sizeof(header));
+  header.magic = DATA_MAGIC;
+  header.version = DATA_VERSION;
+  header.byte_order = MODEL_BYTE_ORDER;
+  header.dtype = static_cast<int32_t>(DataTypeOf<T>::value);
+  header.rows = x.rows();
+  header.input_cols = x.cols();
+  header.output_cols = y.cols();
+
+  ofs.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+  vector<T> row(x.cols() + y.cols());
+  for (int i = 0; i < x.rows(); i++) {
+    Map<DynMatrix<T>>(row.data(), 1, x.cols()) = x.row(i);
+    Map<DynMatrix<T>>(row.data() + x.cols(), 1, y.cols()) = y.row(i);
+    ofs.write(reinterpret_cast<const char*>(row.data()), row.size() * sizeof(T));
+  }
+
+  ofs.close();
+
+  return !ofs.fail();
+}
+
+
+template <typename T>
+template <typename S>
+void MappedDataSourceT<T>::GatherAs(const int *indices, int count, Ref<Matrix> x, Ref<Matrix> y) const
+{
+  int inputs = m_header.input_cols;
+  int outputs = m_header.output_cols;
+  const S *data = reinterpret_cast<const S*>(m_file.Data() + sizeof(DataHeader));
+
+  for (int i = 0; i < count; i++) {
+    const S *row = data + (int64_t)indices[i] * (inputs + outputs);
+
+    for (int c = 0; c < inputs; c++) {
+      x(i, c) = T(row[c]);
+    }
+    for (int c = 0; c < outputs; c++) {
+      y(i, c) = T(row[inputs + c]);
+    }
+  }
+}
+
+
+/**
+ * @brief Copies the samples of indices into x and y, converting them when the file was
+ *        written with another scalar type.
+ *
+ * @param indices The sample indices
+ * @param count Number of samples
+ * @param x Matrix receiving the inputs, count rows
+ * @param y Matrix receiving the results, count rows
+ */
+template <typename T>
+void MappedDataSourceT<T>::Gather(const int *indices, int count, Ref<Matrix> x, Ref<Matrix> y)
+{
+  if (m_header.dtype == static_cast<int32_t>(DataType::FLOAT32))
+    GatherAs<float>(indices, count, x, y);
+  else
+    GatherAs<double>(indices, count, x, y);
+}
+
+
+/**
+ * @brief Construct a new CsvDataSource::CsvDataSource object, Open indexes the file.
+ *
+ * @param input_cols Number of input values at the start of each line
+ * @param chunk_rows Number of lines parsed and kept in memory at once
+ */
+template <typename T>
+CsvDataSourceT<T>::CsvDataSourceT(int input_cols, int chunk_rows)
+{
+  this->m_rows = 0;
+  this->m_input_cols = input_cols;
+  this->m_cols = 0;
+  this->m_chunk_rows = std::max(1, chunk_rows);
+  this->m_loaded_chunk = -1;
+}
+
+
+static bool IsBlank(const char *begin, const char *end)
+{
+  for (const char *p = begin; p < end; p++) {
+    if (*p != ' ' && *p != '\t' && *p != '\r')
+      return false;
+  }
+  return true;
+}
+
+
+static int CountValues(const char *begin, const char *end)
+{
+  return std::count(begin, end, ',') + 1;
+}
+
+
+/**
+ * @brief Indexes a CSV file: one pass in large blocks counts the samples and records where
+ *        each chunk starts, no value is parsed yet. The file is kept open and the chunk
+ *        buffers are sized for the largest chunk.
+ *
+ * @param name The file name
+ * @param skip_header Skips the first line
+ * @return true if the file has samples with more than input_cols values
+ */
+template <typename T>
+bool CsvDataSourceT<T>::Open(const string &name, bool skip_header)
+{
+  ifstream ifs(name.c_str(), ios::in | ios::binary);
+
+  if (!ifs) {
+    cerr << "Can't open file !!" << endl;
+    return false;
+  }
+
+  this->m_name = name;
+  this->m_rows = 0;
+  this->m_cols = 0;
+  this->m_loaded_chunk = -1;
+  m_chunk_offset.clear();
+
+  vector<char> buffer(1 << 20);
+  string line;           // the line crossing a block boundary
+  int64_t line_start = 0;
+  int64_t position = 0;
+  bool skip = skip_header;
+  bool too_many = false;
+
+  auto add_line = [&](const char *begin, const char *end) {
+    if (skip) {
+      skip = false;
+      return;
+    }
+    if (IsBlank(begin, end))
+      return;
+
+    if (m_rows == INT_MAX) {
+      too_many = true;
+      return;
+    }
+
+    if (m_cols == 0)
+      this->m_cols = CountValues(begin, end);
+    if (m_rows % m_chunk_rows == 0)
+      m_chunk_offset.push_back(line_start);
+    this->m_rows++;
+  };
+
+  while (ifs) {
+    ifs.read(buffer.data(), buffer.size());
+    streamsize n = ifs.gcount();
+    const char *begin = buffer.data();
+
+    for (streamsize i = 0; i < n; i++) {
+      if (buffer[i] != '\n')
+        continue;
+
+      if (line.empty()) {
+        add_line(begin, buffer.data() + i);
+      }
+      else {
+        line.append(begin, buffer.data() + i - begin);
+        add_line(line.data(), line.data() + line.size());
+        line.clear();
+      }
+
+      begin = buffer.data() + i + 1;
+      line_start = position + i + 1;
+    }
+
+    line.append(begin, buffer.data() + n - begin);
+    position += n;
+  }
+
+  if (!line.empty())
+    add_line(line.data(), line.data() + line.size());
+
+  m_chunk_offset.push_back(position);
+
+  if (too_many) {
+    cerr << "CSV file has more than " << INT_MAX << " samples !!" << endl;
+    this->m_rows = 0;
+    m_chunk_offset.clear();
+    return false;
+  }
+
+  if (m_rows == 0 || m_cols <= m_input_cols) {
+    cerr << "CSV file has no sample with " << m_input_cols << " inputs and outputs !!" << endl;
+    this->m_rows = 0;
+    return false;
+  }
+
+  int64_t text_size = 0;
+  for (size_t i = 0; i + 1 < m_chunk_offset.size(); i++)
+    text_size = std::max(text_size, m_chunk_offset[i + 1] - m_chunk_offset[i]);
+
+  // one more byte ends the text of a chunk, strtod stops there on a last line without '\n'
+  m_text.resize(text_size + 1);
+  m_chunk.resize(std::min(m_chunk_rows, m_rows), m_cols);
+
+  if (m_file.is_open())
+    m_file.close();
+  m_file.open(name.c_str(), ios::in | ios::binary);
+
+  return true;
+}
+
+
+/**
+ * @brief Reads and parses the lines of one chunk into the first rows of the chunk buffers,
+ *        a short last chunk leaves the other rows unused.
+ *
+ * @param chunk The chunk index
+ * @return true if every line has the expected number of values
+ */
+template <typename T>
+bool CsvDataSourceT<T>::LoadChunk(int chunk)
+{
+  int64_t begin = m_chunk_offset[chunk];
+  int64_t end = m_chunk_offset[chunk + 1];
+
+  m_file.clear();
+  m_file.seekg(begin);
+  m_file.read(&m_text[0], end - begin);
+
+  if (m_file.gcount() != end - begin) {
+    cerr << "Can't read chunk " << chunk << " of the CSV file !!" << endl;
+    this->m_loaded_chunk = -1;
+    return false;
+  }
+  m_text[end - begin] = '\0';
+
+  int rows = std::min(m_chunk_rows, m_rows - chunk * m_chunk_rows);
+  auto values = m_chunk.topRows(rows);
+
+  const char *p = m_text.data();
+  const char *text_end = p + (end - begin);
+  int row = 0;
+
+  while (row < rows && p < text_end) {
+    const char *line_end = std::find(p, text_end, '\n');
+
+    if (!IsBlank(p, line_end)) {
+      const char *q = p;
+
+      for (int c = 0; c < m_cols; c++) {
+        char *next;
+        double value = strtod(q, &next);
+
+        if (next == q || next > line_end) {
+          cerr << "Bad value in CSV line of chunk " << chunk << " !!" << endl;
+          this->m_loaded_chunk = -1;
+          return false;
+        }
+
+        values(row, c) = T(value);
+        q = next;
+        while (q < line_end && (*q == ' ' || *q == '\t' || *q == ',')) q++;
+      }
+      row++;
+    }
+
+    p = line_end + 1;
+  }
+
+  this->m_loaded_chunk = chunk;
+
+  return true;
+}
+
+
+/**
+ * @brief Copies the samples of indices into x and y, the chunk of a sample is parsed when
+ *        it is not the loaded one. The loader keeps the samples of a chunk together.
+ *
+ * @param indices The sample indices
+ * @param count Number of samples
+ * @param x Matrix receiving the inputs, count rows
+ * @param y Matrix receiving the results, count rows
+ */
+template <typename T>
+void CsvDataSourceT<T>::Gather(const int *indices, int count, Ref<Matrix> x, Ref<Matrix> y)
+{
+  for (int i = 0; i < count; i++) {
+    int chunk = indices[i] / m_chunk_rows;
+
+    if (chunk != m_loaded_chunk && !LoadChunk(chunk)) {
+      x.row(i).setZero();
+      y.row(i).setZero();
+      continue;
+    }
+
+    int row = indices[i] - chunk * m_chunk_rows;
+    x.row(i) = m_chunk.row(row).head(m_input_cols);
+    y.row(i) = m_chunk.row(row).tail(m_cols - m_input_cols);
+  }
+}
+
+
+/**
+ * @brief Construct a new DataLoader::DataLoader object
+ *
+ * @param source The data source, it must outlive the loader
+ * @param batch_size Number of samples per batch
+ * @param shuffle Shuffles the samples at every Start
+ * @param prefetch Gathers the next batch in a background thread
+ */
+template <typename T>
+DataLoaderT<T>::DataLoaderT(DataSourceT<T> &source, int batch_size, bool shuffle, bool prefetch)
+    : m_source(source)
+{
+  this->m_batch_size = std::max(1, batch_size);
+  this->m_shuffle = shuffle;
+  this->m_prefetch = prefetch;
+  this->m_batches = 0;
+  this->m_consumed = 0;
+  this->m_epoch = 0;
+  this->m_restart = false;
+  this->m_busy = false;
+  this->m_stop = false;
+}
+
+
+/**
+ * @brief Destroy the DataLoader::DataLoader object, stops the prefetch thread.
+ *
+ */
+template <typename T>
+DataLoaderT<T>::~DataLoaderT()
+{
+  Stop();
+}
+
+
+/**
+ * @brief Stops the prefetch thread.
+ *
+ */
+template <typename T>
+void DataLoaderT<T>::Stop()
+{
+  if (!m_worker.joinable())
+    return;
+
+  {
+    lock_guard<mutex> lock(m_mutex);
+    m_stop = true;
+  }
+  m_cv.notify_all();
+  m_worker.join();
+
+  m_stop = false;
+}
+
+
+/**
+ * @brief Starts an epoch: shuffles the sample order and starts gathering the first batches.
+ *        Blocks of the source stay together, their order and the samples inside them are
+ *        shuffled. A running epoch is dropped.
+ *
+ */
+template <typename T>
+void DataLoaderT<T>::Start()
+{
+  // the worker must be idle before the indices change under it
+  {
+    unique_lock<mutex> lock(m_mutex);
+    m_restart = true;
+    m_cv.notify_all();
+    m_cv.wait(lock, [&]() { return !m_busy; });
+  }
+
+  int samples = m_source.Size();
+  int block = m_source.BlockSize();
+
+  m_indices.resize(samples);
+  for (int i = 0; i < samples; i++) {
+    m_indices[i] = i;
+  }
+
+  if (m_shuffle) {
+    if (block <= 1) {
+      std::random_shuffle(m_indices.begin(), m_indices.end());
+    }
+    else {
+      int blocks = (samples + block - 1) / block;
+      m_order.resize(blocks);
+      for (int b = 0; b < blocks; b++) {
+        m_order[b] = b;
+      }
+      std::random_shuffle(m_order.begin(), m_order.end());
+
+      int n = 0;
+      for (int b : m_order) {
+        int begin = n;
+        for (int i = b * block; i < std::min(samples, (b + 1) * block); i++) {
+          m_indices[n++] = i;
+        }
+        std::random_shuffle(m_indices.begin() + begin, m_indices.begin() + n);
+      }
+    }
+  }
+
+  {
+    lock_guard<mutex> lock(m_mutex);
+    this->m_batches = (samples + m_batch_size - 1) / m_batch_size;
+    this->m_consumed = 0;
+    this->m_restart = false;
+    this->m_epoch++;
+    m_batch[0].ready = false;
+    m_batch[1].ready = false;
+  }
+  m_cv.notify_all();
+
+  if (m_prefetch && !m_worker.joinable())
+    m_worker = std::thread(&DataLoaderT::Produce, this);
+}
+
+
+/**
+ * @brief Gathers a batch into its buffer. The buffers get a full batch of rows once, a
+ *        smaller batch is a view of their first rows.
+ *
+ * @param batch The batch index in the epoch
+ */
+template <typename T>
+void DataLoaderT<T>::Fill(int batch)
+{
+  int begin = batch * m_batch_size;
+  int count = std::min(m_batch_size, (int)m_indices.size() - begin);
+  Batch &slot = m_batch[batch % 2];
+
+  if (slot.x.rows() != m_batch_size || slot.x.cols() != m_source.InputSize())
+    slot.x.resize(m_batch_size, m_source.InputSize());
+  if (slot.y.rows() != m_batch_size || slot.y.cols() != m_source.OutputSize())
+    slot.y.resize(m_batch_size, m_source.OutputSize());
+
+  new (&slot.x_view) MatrixMap(slot.x.data(), count, slot.x.cols());
+  new (&slot.y_view) MatrixMap(slot.y.data(), count, slot.y.cols());
+
+  m_source.Gather(m_indices.data() + begin, count, slot.x_view, slot.y_view);
+}
+
+
+/**
+ * @brief Prefetch thread, waits for an epoch and fills each buffer as soon as the trainer
+ *        releases it.
+ *
+ */
+template <typename T>
+void DataLoaderT<T>::Produce()
+{
+  unique_lock<mutex> lock(m_mutex);
+  int epoch = 0;
+
+  for (;;) {
+    m_busy = false;
+    m_cv.notify_all();
+    m_cv.wait(lock, [&]() { return m_stop || m_epoch != epoch; });
+    if (m_stop)
+      return;
+
+    epoch = m_epoch;
+    m_busy = true;
+
+    for (int b = 0; b < m_batches; b++) {
+      Batch &slot = m_batch[b % 2];
+
+      m_cv.wait(lock, [&]() { return !slot.ready || m_stop || m_restart; });
+      if (m_stop || m_restart)
+        break;
+
+      lock.unlock();
+      Fill(b);
+      lock.lock();
+
+      slot.ready = true;
+      m_cv.notify_all();
+    }
+  }
+}
+
+
+/**
+ * @brief Gets the next batch of the epoch and releases the previous one. The views stay
+ *        valid until the next call.
+ *
+ * @param x Set to the batch inputs
+ * @param y Set to the batch results
+ * @return true if there was a batch left in the epoch
+ */
+template <typename T>
+bool DataLoaderT<T>::Next(const MatrixMap *&x, const MatrixMap *&y)
+{
+  unique_lock<mutex> lock(m_mutex);
+
+  if (m_consumed > 0) {
+    m_batch[(m_consumed - 1) % 2].ready = false;
+    m_cv.notify_all();
+  }
+
+  if (m_consumed >= m_batches)
+    return false;
+
+  Batch &slot = m_batch[m_consumed % 2];
+
+  if (m_prefetch) {
+    m_cv.wait(lock, [&]() { return slot.ready; });
+  }
+  else {
+    Fill(m_consumed);
+    slot.ready = true;
+  }
+
+  x = &slot.x_view;
+  y = &slot.y_view;
+  m_consumed++;
+
+  return true;
+}
+
+
+template class Neural::MemoryDataSourceT<float>;
+template class Neural::MemoryDataSourceT<double>;
+template class Neural::MappedDataSourceT<float>;
+template class Neural::MappedDataSourceT<double>;
+template class Neural::CsvDataSourceT<float>;
+template class Neural::CsvDataSourceT<double>;
+template class Neural::DataLoaderT<float>;
+template class Neural::DataLoaderT<double>;
@@ -0,0 +1,144 @@
+#include "dqn.h"
+
+using namespace Neural;
+using namespace Eigen;
+
+
+/**
+ * @brief Construct a new Dqn::Dqn object for a Q-network with one output per action.
+ *
+ * @param network The Q-network, trained in place and not owned
+ * @param gamma The discount of future rewards
+ * @param target_step The fraction of the TD error a target moves the Q-value of its action
+ */
+template <typename T>
+DqnT<T>::DqnT(NetworkT<T> &network, double gamma, double target_step)
+  : m_network(network), m_gamma(gamma), m_loss(target_step), m_random(1)
+{
+}
+
+
+/**
+ * @brief Epsilon-greedy actions of a batch of states, with one forward pass over all of them.
+ *
+ * @param states The states, one per row
+ * @param epsilon The probability of a random action instead of the best one
+ * @return const Eigen::VectorXi& The action of each state, valid until the next call
+ */
+template <typename T>
+const VectorXi& DqnT<T>::Act(const Matrix &states, double epsilon)
+{
+  m_network.PredictBatch(states, m_q);
+  m_actions.resize(states.rows());
+
+  std::uniform_real_distribution<double> explore(0.0, 1.0);
+  std::uniform_int_distribution<int> action(0, m_q.cols() - 1);
+
+  for (int i = 0; i < states.rows(); i++) {
+    if (epsilon > 0 && explore(m_random) < epsilon)
+      m_actions(i) = action(m_random);
+    else
+      m_q.row(i).maxCoeff(&m_actions(i));
+  }
+
+  return m_actions;
+}
+
+
+/**
+ * @brief Computes the Q-learning targets of a batch, r + gamma * max Q(s') or r alone when
+ *        the episode ended, with one forward pass over all the next states.
+ *
+ * @param actions The action taken in each transition
+ * @param rewards The reward of each transition
+ * @param next_states The state after each transition, one per row
+ * @param done 1 where the transition ended the episode, 0 elsewhere
+ * @return const Matrix& The action and the target of each transition, valid until the next call
+ */
+template <typename T>
+const DynMatrix<T>& DqnT<T>::Targets(const VectorXi &actions, const Vector &rewards, const Matrix &next_states,
+                                     const Vector &done)
+{
+  m_network.PredictBatch(next_states, m_next_q);
+  m_targets.resize(next_states.rows(), 2);
+  SetTargets(actions, rewards, done, m_next_q);
+
+  return m_targets;
+}
+
+
+// the first two columns of the targets, sized by the caller
+template <typename T>
+void DqnT<T>::SetTargets(const VectorXi &actions, const Vector &rewards, const Vector &done, const Ref<const Matrix> &next_q)
+{
+  int count = next_q.rows();
+
+  m_targets.col(0) = actions.template cast<T>();
+  m_targets.col(1) = rewards + T(m_gamma) * (Vector::Ones(count) - done).cwiseProduct(next_q.rowwise().maxCoeff());
+}
+
+
+/**
+ * @brief One learner step on a batch of transitions: targets from the next states, then a
+ *        single training step of the network on the states.
+ *
+ * @param states The state of each transition, one per row
+ * @param actions The action taken in each transition
+ * @param rewards The reward of each transition
+ * @param next_states The state after each transition, one per row
+ * @param done 1 where the transition ended the episode, 0 elsewhere
+ * @param learning_rate The step size of the network update
+ * @return double The mean squared TD error of the batch before the update
+ */
+template <typename T>
+double DqnT<T>::Update(const Matrix &states, const VectorXi &actions, const Vector &rewards,
+                       const Matrix &next_states, const Vector &done, double learning_rate)
+{
+  if (states.rows() == 0)
+    return 0.0;
+
+  Targets(actions, rewards, next_states, done);
+
+  return m_network.TrainOnBatch(states, m_targets, learning_rate, &m_loss);
+}
+
+
+/**
+ * @brief One learner step on a sampled batch. With importance-sampling weights the loss
+ *        of each transition is weighed, and the states and next states share one forward
+ *        pass that also gives the TD errors, see TdErrors.
+ *
+ * @param batch The transitions, as sampled from a replay memory
+ * @param learning_rate The step size of the network update
+ * @return double The weighted mean squared TD error of the batch before the update
+ */
+template <typename T>
+double DqnT<T>::Update(const TransitionBatchT<T> &batch, double learning_rate)
+{
+  int count = batch.states.rows();
+
+  if (count == 0)
+    return 0.0;
+
+  if (batch.weights.size() == 0)
+    return Update(batch.states, batch.actions, batch.rewards, batch.next_states, batch.done, learning_rate);
+
+  m_inputs.resize(2 * count, batch.states.cols());
+  m_inputs.topRows(count) = batch.states;
+  m_inputs.bottomRows(count) = batch.next_states;
+  m_network.PredictBatch(m_inputs, m_next_q);
+
+  m_targets.resize(count, 3);
+  SetTargets(batch.actions, batch.rewards, batch.done, m_next_q.bottomRows(count));
+  m_targets.col(2) = batch.weights;
+
+  m_errors.resize(count);
+  for (int i = 0; i < count; i++)
+    m_errors(i) = m_targets(i, 1) - m_next_q(i, batch.actions(i));
+
+  return m_network.TrainOnBatch(batch.states, m_targets, learning_rate, &m_loss);
+}
+
+
+template class Neural::DqnT<float>;
+template class Neural::DqnT<double>;
@@ -0,0 +1,499 @@
+#include <atomic>
+#include "gemm.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define NEURAL_X86_KERNELS
+#include <immintrin.h>
+#endif
+
+using namespace Neural;
+using namespace Eigen;
+
+
+namespace Neural
+{
+  // plain C++, one lane, the compiler vectorizes what it can for the baseline target
+  namespace Portable
+  {
+    template <typename T>
+    struct Lane
+    {
+      typedef T Scalar;
+      typedef T Reg;
+      static const int N = 1;
+
+      static inline Reg Zero() { return T(0); }
+      static inline Reg Load(const T *p) { return *p; }
+      static inline Reg Set(T x) { return x; }
+      static inline Reg Fma(Reg a, Reg b, Reg acc) { return a * b + acc; }
+      static inline void Store(T *p, Reg r) { *p = r; }
+      static inline T Sum(Reg r) { return r; }
+    };
+
+    typedef Lane<double> Double;
+    typedef Lane<float>  Float;
+
+    #include "gemm_kernels.h"
+
+    // c(r, j) = x[r] . w[j] of int8 rows in int32, the compiler widens the products
+    static void Int8Kernel(int m, int n, int k, const int8_t *x, long ldx, const int8_t *w, long ldw,
+                           const int32_t *w_sums, int32_t *c, long ldc)
+    {
+      for (int r = 0; r < m; r++) {
+        const int8_t *xr = x + r * ldx;
+
+        for (int j = 0; j < n; j++) {
+          const int8_t *wj = w + j * ldw;
+          int32_t sum = 0;
+          for (int p = 0; p < k; p++)
+            sum += int16_t(xr[p]) * int16_t(wj[p]);
+          c[r * ldc + j] = sum;
+        }
+      }
+    }
+  }
+
+#ifdef NEURAL_X86_KERNELS
+  #pragma GCC push_options
+  #pragma GCC target("avx2,fma")
+  namespace Avx2
+  {
+    struct Double
+    {
+      typedef double Scalar;
+      typedef __m256d Reg;
+      static const int N = 4;
+
+      static inline Reg Zero() { return _mm256_setzero_pd(); }
+      static inline Reg Load(const double *p) { return _mm256_loadu_pd(p); }
+      static inline Reg Set(double x) { return _mm256_set1_pd(x); }
+      static inline Reg Fma(Reg a, Reg b, Reg acc) { return _mm256_fmadd_pd(a, b, acc); }
+      static inline void Store(double *p, Reg r) { _mm256_storeu_pd(p, r); }
+      static inline double Sum(Reg r)
+      {
+        __m128d s = _mm_add_pd(_mm256_castpd256_pd128(r), _mm256_extractf128_pd(r, 1));
+        return _mm_cvtsd_f64(_mm_add_sd(s, _mm_unpackhi_pd(s, s)));
+      }
+    };
+
+    struct Float
+    {
+      typedef float Scalar;
+      typedef __m256 Reg;
+      static const int N = 8;
+
+      static inline Reg Zero() { return _mm256_setzero_ps(); }
+      static inline Reg Load(const float *p) { return _mm256_loadu_ps(p); }
+      static inline Reg Set(float x) { return _mm256_set1_ps(x); }
+      static inline Reg Fma(Reg a, Reg b, Reg acc) { return _mm256_fmadd_ps(a, b, acc); }
+      static inline void Store(float *p, Reg r) { _mm256_storeu_ps(p, r); }
+      static inline float Sum(Reg r)
+      {
+        __m128 s = _mm_add_ps(_mm256_castps256_ps128(r), _mm256_extractf128_ps(r, 1));
+        s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+        return _mm_cvtss_f32(_mm_add_ss(s, _mm_movehdup_ps(s)));
+      }
+    };
+
+    #include "gemm_kernels.h"
+
+    static inline int32_t SumInt32(__m256i v)
+    {
+      __m128i s = _mm_add_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+      s = _mm_add_epi32(s, _mm_shuffle_epi32(s, 0x4E));
+      s = _mm_add_epi32(s, _mm_shuffle_epi32(s, 0xB1));
+      return _mm_cvtsi128_si32(s);
+    }
+
+    /**
+     * @brief Rows x Cols int8 dot products of length k, a multiple of 32. pmaddubsw takes
+     *        unsigned x signed bytes: |x| times w with the sign of x, the pair sums are at
+     *        most 2 * 127 * 127 and never saturate int16.
+     */
+    template <int Rows, int Cols>
+    static inline void Int8Block(int k, const int8_t *x, long ldx, const int8_t *w, long ldw, int32_t *c, long ldc)
+    {
+      const __m256i ones = _mm256_set1_epi16(1);
+      __m256i acc[Rows][Cols];
+
+      for (int r = 0; r < Rows; r++)
+        for (int j = 0; j < Cols; j++)
+          acc[r][j] = _mm256_setzero_si256();
+
+      for (int p = 0; p < k; p += 32) {
+        __m256i xv[Rows], ax[Rows];
+        for (int r = 0; r < Rows; r++) {
+          xv[r] = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(x + r * ldx + p));
+          ax[r] = _mm256_abs_epi8(xv[r]);
+        }
+
+        for (int j = 0; j < Cols; j++) {
+          __m256i wv = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(w + j * ldw + p));
+          for (int r = 0; r < Rows; r++) {
+            __m256i pairs = _mm256_maddubs_epi16(ax[r], _mm256_sign_epi8(wv, xv[r]));
+            acc[r][j] = _mm256_add_epi32(acc[r][j], _mm256_madd_epi16(pairs, ones));
+          }
+        }
+      }
+
+      for (int r = 0; r < Rows; r++)
+        for (int j = 0; j < Cols; j++)
+          c[r * ldc + j] = SumInt32(acc[r][j]);
+    }
+
+    template <int Rows>
+    static void Int8Rows(int n, int k, const int8_t *x, long ldx, const int8_t *w, long ldw, int32_t *c, long ldc)
+    {
+      int j = 0;
+      for (; j + 4 <= n; j += 4)
+        Int8Block<Rows, 4>(k, x, ldx, w + j * ldw, ldw, c + j, ldc);
+      for (; j < n; j++)
+        Int8Block<Rows, 1>(k, x, ldx, w + j * ldw, ldw, c + j, ldc);
+    }
+
+    static void Int8Kernel(int m, int n, int k, const int8_t *x, long ldx, const int8_t *w, long ldw,
+                           const int32_t *w_sums, int32_t *c, long ldc)
+    {
+      int i = 0;
+      for (; i + 2 <= m; i += 2)
+        Int8Rows<2>(n, k, x + i * ldx, ldx, w, ldw, c + i * ldc, ldc);
+      if (i < m)
+        Int8Rows<1>(n, k, x + i * ldx, ldx, w, ldw, c + i * ldc, ldc);
+    }
+  }
+  #pragma GCC pop_options
+
+  #pragma GCC push_options
+  #pragma GCC target("avx512f,avx2,fma")
+  namespace Avx512
+  {
+    struct Double
+    {
+      typedef double Scalar;
+      typedef __m512d Reg;
+      static const int N = 8;
+
+      static inline Reg Zero() { return _mm512_setzero_pd(); }
+      static inline Reg Load(const double *p) { return _mm512_loadu_pd(p); }
+      static inline Reg Set(double x) { return _mm512_set1_pd(x); }
+      static inline Reg Fma(Reg a, Reg b, Reg acc) { return _mm512_fmadd_pd(a, b, acc); }
+      static inline void Store(double *p, Reg r) { _mm512_storeu_pd(p, r); }
+      static inline double Sum(Reg r)
+      {
+        // _mm512_reduce_add_pd trips a false uninitialized warning of GCC 12
+        alignas(64) double v[8];
+        _mm512_store_pd(v, r);
+        return ((v[0] + v[4]) + (v[1] + v[5])) + ((v[2] + v[6]) + (v[3] + v[7]));
+      }
+    };
+
+    struct Float
+    {
+      typedef float Scalar;
+      typedef __m512 Reg;
+      static const int N = 16;
+
+      static inline Reg Zero() { return _mm512_setzero_ps(); }
+      static inline Reg Load(const float *p) { return _mm512_loadu_ps(p); }
+      static inline Reg Set(float x) { return _mm512_set1_ps(x); }
+      static inline Reg Fma(Reg a, Reg b, Reg acc) { return _mm512_fmadd_ps(a, b, acc); }
+      static inline void Store(float *p, Reg r) { _mm512_storeu_ps(p, r); }
+      static inline float Sum(Reg r)
+      {
+        alignas(64) float v[16];
+        _mm512_store_ps(v, r);
+        float s = 0;
+        for (int i = 0; i < 8; i++)
+          s += v[i] + v[i + 8];
+        return s;
+      }
+    };
+
+    #include "gemm_kernels.h"
+  }
+  #pragma GCC pop_options
+
+  #pragma GCC push_options
+  #pragma GCC target("avx512f,avx512bw,avx512vnni,avx2,fma")
+  namespace Avx512Vnni
+  {
+    /**
+     * @brief Rows x Cols int8 dot products of length k, a multiple of 64. vpdpbusd takes
+     *        unsigned x signed bytes: x + 128 times w, the excess 128 * sum(w) is removed
+     *        with the sums of the weight rows.
+     */
+    template <int Rows, int Cols>
+    static inline void Int8Block(int k, const int8_t *x, long ldx, const int8_t *w, long ldw, const int32_t *w_sums,
+                                 int32_t *c, long ldc)
+    {
+      const __m512i offset = _mm512_set1_epi8(-128);
+      __m512i acc[Rows][Cols];
+
+      for (int r = 0; r < Rows; r++)
+        for (int j = 0; j < Cols; j++)
+          acc[r][j] = _mm512_setzero_si512();
+
+      for (int p = 0; p < k; p += 64) {
+        __m512i xv[Rows];
+        for (int r = 0; r < Rows; r++)
+          xv[r] = _mm512_xor_si512(_mm512_loadu_si512(x + r * ldx + p), offset);
+
+        for (int j = 0; j < Cols; j++) {
+          __m512i wv = _mm512_loadu_si512(w + j * ldw + p);
+          for (int r = 0; r < Rows; r++)
+            acc[r][j] = _mm512_dpbusd_epi32(acc[r][j], xv[r], wv);
+        }
+      }
+
+      for (int r = 0; r < Rows; r++) {
+        for (int j = 0; j < Cols; j++) {
+          alignas(64) int32_t v[16];
+          _mm512_store_si512(v, acc[r][j]);
+          int32_t sum = 0;
+          for (int i = 0; i < 16; i++)
+            sum += v[i];
+          c[r * ldc + j] = sum - 128 * w_sums[j];
+        }
+      }
+    }
+
+    template <int Rows>
+    static void Int8Rows(int n, int k, const int8_t *x, long ldx, const int8_t *w, long ldw, const int32_t *w_sums,
+                         int32_t *c, long ldc)
+    {
+      int j = 0;
+      for (; j + 4 <= n; j += 4)
+        Int8Block<Rows, 4>(k, x, ldx, w + j * ldw, ldw, w_sums + j, c + j, ldc);
+      for (; j < n; j++)
+        Int8Block<Rows, 1>(k, x, ldx, w + j * ldw, ldw, w_sums + j, c + j, ldc);
+    }
+
+    static void Int8Kernel(int m, int n, int k, const int8_t *x, long ldx, const int8_t *w, long ldw,
+                           const int32_t *w_sums, int32_t *c, long ldc)
+    {
+      int i = 0;
+      for (; i + 4 <= m; i += 4)
+        Int8Rows<4>(n, k, x + i * ldx, ldx, w, ldw, w_sums, c + i * ldc, ldc);
+      for (; i < m; i++)
+        Int8Rows<1>(n, k, x + i * ldx, ldx, w, ldw, w_sums, c + i * ldc, ldc);
+    }
+  }
+  #pragma GCC pop_options
+#endif
+}
+
+
+// the kernels of one scalar type and instruction set
+template <typename T>
+struct KernelSet
+{
+  typedef void (*Kernel)(int m, int n, int k, const T *a, long lda, const T *b, long ldb, T *c, long ldc);
+  Kernel nn, tn, nt;
+};
+
+template <typename T> struct Kernels;
+
+template <> struct Kernels<double>
+{
+  static KernelSet<double> Get(GemmKernel kernel)
+  {
+    switch (kernel) {
+#ifdef NEURAL_X86_KERNELS
+      case GemmKernel::AVX512: return { Avx512::KernelNN<Avx512::Double>, Avx512::KernelTN<Avx512::Double>, Avx512::KernelNT<Avx512::Double> };
+      case GemmKernel::AVX2:   return { Avx2::KernelNN<Avx2::Double>, Avx2::KernelTN<Avx2::Double>, Avx2::KernelNT<Avx2::Double> };
+#endif
+      default:                 return { Portable::KernelNN<Portable::Double>, Portable::KernelTN<Portable::Double>, Portable::KernelNT<Portable::Double> };
+    }
+  }
+};
+
+template <> struct Kernels<float>
+{
+  static KernelSet<float> Get(GemmKernel kernel)
+  {
+    switch (kernel) {
+#ifdef NEURAL_X86_KERNELS
+      case GemmKernel::AVX512: return { Avx512::KernelNN<Avx512::Float>, Avx512::KernelTN<Avx512::Float>, Avx512::KernelNT<Avx512::Float> };
+      case GemmKernel::AVX2:   return { Avx2::KernelNN<Avx2::Float>, Avx2::KernelTN<Avx2::Float>, Avx2::KernelNT<Avx2::Float> };
+#endif
+      default:                 return { Portable::KernelNN<Portable::Float>, Portable::KernelTN<Portable::Float>, Portable::KernelNT<Portable::Float> };
+    }
+  }
+};
+
+
+// shortest dimension worth vectors: the depth of KernelNN, the rows of KernelTN and the
+// columns of KernelNT. A shallow KernelNN runs in scalar, the others are left to Eigen.
+static const int MIN_LENGTH = 4;
+
+
+static GemmKernel Detect()
+{
+#ifdef NEURAL_X86_KERNELS
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f"))
+    return GemmKernel::AVX512;
+  if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+    return GemmKernel::AVX2;
+#endif
+  return GemmKernel::PORTABLE;
+}
+
+
+static std::atomic<GemmKernel>& ActiveKernel()
+{
+  static std::atomic<GemmKernel> kernel(Detect());
+  return kernel;
+}
+
+
+/**
+ * @brief Gets the fastest kernel the CPU supports.
+ *
+ * @return GemmKernel AVX512, AVX2 or PORTABLE
+ */
+GemmKernel SmallGemm::Best()
+{
+  static const GemmKernel best = Detect();
+  return best;
+}
+
+
+/**
+ * @brief Gets the kernel in use, the best one unless Use changed it.
+ *
+ * @return GemmKernel The active kernel
+ */
+GemmKernel SmallGemm::Active()
+{
+  return ActiveKernel().load(std::memory_order_relaxed);
+}
+
+
+/**
+ * @brief Chooses the kernel of the next products, to compare them or to turn them off.
+ *
+ * @param kernel The kernel, EIGEN for Eigen's product only
+ * @return true if the CPU supports it
+ */
+bool SmallGemm::Use(GemmKernel kernel)
+{
+  if (kernel == GemmKernel::AVX512 && Best() != GemmKernel::AVX512)
+    return false;
+  if (kernel == GemmKernel::AVX2 && Best() == GemmKernel::PORTABLE)
+    return false;
+
+  ActiveKernel().store(kernel);
+  return true;
+}
+
+
+/**
+ * @brief Gets the name of a kernel.
+ *
+ * @param kernel The kernel
+ * @return const char* The name
+ */
+const char* SmallGemm::Name(GemmKernel kernel)
+{
+  switch (kernel) {
+    case GemmKernel::EIGEN:    return "eigen";
+    case GemmKernel::PORTABLE: return "portable";
+    case GemmKernel::AVX2:     return "avx2";
+    default:                   return "avx512";
+  }
+}
+
+
+/**
+ * @brief Small product dst = op(lhs) * op(rhs) with the active kernel. Only shapes with a
+ *        small batch side are handled: lhs rows for lhs * rhs and lhs * rhs^T, lhs rows of
+ *        the transposed operand for lhs^T * rhs.
+ *
+ * @param lhs The left operand
+ * @param rhs The right operand
+ * @param dst The result, of the product's shape
+ * @param transpose_lhs Uses the transpose of lhs
+ * @param transpose_rhs Uses the transpose of rhs
+ * @return true if the product was computed, false when the caller must use Eigen
+ */
+template <typename T>
+bool SmallGemm::Product(const Ref<const DynMatrix<T>> &lhs, const Ref<const DynMatrix<T>> &rhs,
+                        Ref<DynMatrix<T>> dst, bool transpose_lhs, bool transpose_rhs)
+{
+  GemmKernel kernel = Active();
+
+  if (kernel == GemmKernel::EIGEN || (transpose_lhs && transpose_rhs) || dst.size() == 0)
+    return false;
+
+  KernelSet<T> set = Kernels<T>::Get(kernel);
+  int m = dst.rows();
+  int n = dst.cols();
+
+  if (transpose_lhs) {
+    int k = lhs.rows();
+    if (k > MAX_ROWS || m < MIN_LENGTH)
+      return false;
+    set.tn(m, n, k, lhs.data(), lhs.outerStride(), rhs.data(), rhs.outerStride(), dst.data(), dst.outerStride());
+  }
+  else if (transpose_rhs) {
+    int k = lhs.cols();
+    if (m > MAX_ROWS || n < MIN_LENGTH)
+      return false;
+    set.nt(m, n, k, lhs.data(), lhs.outerStride(), rhs.data(), rhs.outerStride(), dst.data(), dst.outerStride());
+  }
+  else {
+    int k = lhs.cols();
+    if (m > MAX_ROWS || k > Portable::PACK_DEPTH)
+      return false;
+    if (k < MIN_LENGTH)
+      set.nn = Kernels<T>::Get(GemmKernel::PORTABLE).nn;
+    set.nn(m, n, k, lhs.data(), lhs.outerStride(), rhs.data(), rhs.outerStride(), dst.data(), dst.outerStride());
+  }
+
+  return true;
+}
+
+
+template bool SmallGemm::Product<float>(const Ref<const DynMatrix<float>>&, const Ref<const DynMatrix<float>>&,
+                                        Ref<DynMatrix<float>>, bool, bool);
+template bool SmallGemm::Product<double>(const Ref<const DynMatrix<double>>&, const Ref<const DynMatrix<double>>&,
+                                         Ref<DynMatrix<double>>, bool, bool);
+
+
+typedef void (*Int8Kernel)(int m, int n, int k, const int8_t *x, long ldx, const int8_t *w, long ldw,
+                           const int32_t *w_sums, int32_t *c, long ldc);
+
+// the int8 kernel of the active instruction set, AVX-512 needs VNNI for its own
+static Int8Kernel Int8KernelOf(GemmKernel kernel)
+{
+#ifdef NEURAL_X86_KERNELS
+  static const bool vnni = __builtin_cpu_supports("avx512bw") && __builtin_cpu_supports("avx512vnni");
+
+  if (kernel == GemmKernel::AVX512 && vnni)
+    return Avx512Vnni::Int8Kernel;
+  if (kernel == GemmKernel::AVX512 || kernel == GemmKernel::AVX2)
+    return Avx2::Int8Kernel;
+#endif
+  return Portable::Int8Kernel;
+}
+
+
+/**
+ * @brief Product of int8 rows with int32 sums, c(r, j) = x[r] . w[j] for m rows of x and n
+ *        rows of w, all of length k. The rows are read in steps of INT8_DEPTH bytes, k is
+ *        a multiple of it and padded with zeros. The Eigen setting runs the portable kernel.
+ *
+ * @param m Rows of x
+ * @param n Rows of w, the columns of c
+ * @param k Length of the rows, a multiple of INT8_DEPTH
+ * @param x The first operand, row-major with a stride of ldx
+ * @param w The second operand, row-major with a stride of ldw
+ * @param w_sums The sums of the n rows of w
+ * @param c The result, row-major with a stride of ldc
+ */
+void SmallGemm::Int8Product(int m, int n, int k, const int8_t *x, long ldx, const int8_t *w, long ldw,
+                            const int32_t *w_sums, int32_t *c, long ldc)
+{
+  Int8KernelOf(Active())(m, n, k, x, ldx, w, ldw, w_sums, c, ldc);
+}
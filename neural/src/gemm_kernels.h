@@ -0,0 +1,218 @@
+// Small-product kernels, written once over a vector type. There is no include guard: gemm.cpp
+// includes this file once per instruction set, inside a namespace that defines the vector
+// traits Double and Float and under the matching target pragma:
+//   Scalar, Reg, N lanes, Zero(), Load(p), Set(x), Fma(a, b, acc) = a * b + acc, Store(p, r), Sum(r)
+// Everything here is static, so the copies of each instruction set never merge at link time,
+// and nothing is included, so no shared inline code gets compiled for a wider target.
+
+static const int PACK_DEPTH = 2048;  // longest lhs row packed by KernelNN
+static const int PACK_CHUNK = 256;   // lhs columns packed at once by KernelTN
+
+
+/**
+ * @brief Rows x Cols dot products of length k, c(r, j) = x[r] . w(:, j). The accumulators
+ *        stay in registers, the remainder of k is summed in scalar.
+ */
+template <typename V, int Rows, int Cols>
+static inline void DotBlock(int k, const typename V::Scalar *const *x, const typename V::Scalar *w, long ldw,
+                            typename V::Scalar *c, long ldc)
+{
+  typedef typename V::Scalar T;
+  typename V::Reg acc[Rows][Cols];
+
+  for (int r = 0; r < Rows; r++)
+    for (int j = 0; j < Cols; j++)
+      acc[r][j] = V::Zero();
+
+  int p = 0;
+  for (; p + V::N <= k; p += V::N) {
+    typename V::Reg xv[Rows];
+    for (int r = 0; r < Rows; r++)
+      xv[r] = V::Load(x[r] + p);
+
+    for (int j = 0; j < Cols; j++) {
+      typename V::Reg wv = V::Load(w + j * ldw + p);
+      for (int r = 0; r < Rows; r++)
+        acc[r][j] = V::Fma(xv[r], wv, acc[r][j]);
+    }
+  }
+
+  for (int r = 0; r < Rows; r++) {
+    for (int j = 0; j < Cols; j++) {
+      T s = V::Sum(acc[r][j]);
+      for (int q = p; q < k; q++)
+        s += x[r][q] * w[j * ldw + q];
+      c[r + j * ldc] = s;
+    }
+  }
+}
+
+
+/**
+ * @brief dst = lhs * rhs, with lhs m x k for a small m and rhs k x n. Each output is a dot
+ *        product along k, the lhs rows are packed contiguous two at a time.
+ */
+template <typename V>
+static void KernelNN(int m, int n, int k, const typename V::Scalar *a, long lda,
+                     const typename V::Scalar *b, long ldb, typename V::Scalar *c, long ldc)
+{
+  typedef typename V::Scalar T;
+  T packed[2 * PACK_DEPTH];
+
+  for (int i = 0; i < m; i += 2) {
+    int rows = (m - i >= 2) ? 2 : 1;
+    const T *x[2];
+
+    // a single row of a column-major matrix is already contiguous
+    if (lda == 1) {
+      x[0] = a;
+    }
+    else {
+      for (int r = 0; r < rows; r++) {
+        for (int p = 0; p < k; p++)
+          packed[r * PACK_DEPTH + p] = a[i + r + p * lda];
+        x[r] = packed + r * PACK_DEPTH;
+      }
+    }
+
+    T *ci = c + i;
+    int j = 0;
+
+    if (rows == 2) {
+      for (; j + 4 <= n; j += 4)
+        DotBlock<V, 2, 4>(k, x, b + j * ldb, ldb, ci + j * ldc, ldc);
+      for (; j < n; j++)
+        DotBlock<V, 2, 1>(k, x, b + j * ldb, ldb, ci + j * ldc, ldc);
+    }
+    else {
+      for (; j + 8 <= n; j += 8)
+        DotBlock<V, 1, 8>(k, x, b + j * ldb, ldb, ci + j * ldc, ldc);
+      for (; j + 4 <= n; j += 4)
+        DotBlock<V, 1, 4>(k, x, b + j * ldb, ldb, ci + j * ldc, ldc);
+      for (; j < n; j++)
+        DotBlock<V, 1, 1>(k, x, b + j * ldb, ldb, ci + j * ldc, ldc);
+    }
+  }
+}
+
+
+/**
+ * @brief dst = lhs^T * rhs, with lhs k x m for a small k and rhs k x n. Each output column
+ *        is a sum of k scaled lhs rows, the rows are packed contiguous a chunk at a time.
+ */
+template <typename V>
+static void KernelTN(int m, int n, int k, const typename V::Scalar *a, long lda,
+                     const typename V::Scalar *b, long ldb, typename V::Scalar *c, long ldc)
+{
+  typedef typename V::Scalar T;
+  typedef typename V::Reg Reg;
+  T packed[Neural::SmallGemm::MAX_ROWS * PACK_CHUNK];
+  const T *x[Neural::SmallGemm::MAX_ROWS];
+
+  for (int q0 = 0; q0 < m; q0 += PACK_CHUNK) {
+    int mq = (m - q0 < PACK_CHUNK) ? m - q0 : PACK_CHUNK;
+
+    if (lda == 1) {
+      x[0] = a + q0;
+    }
+    else {
+      for (int p = 0; p < k; p++) {
+        for (int q = 0; q < mq; q++)
+          packed[p * PACK_CHUNK + q] = a[p + (q0 + q) * lda];
+        x[p] = packed + p * PACK_CHUNK;
+      }
+    }
+
+    for (int j = 0; j < n; j++) {
+      const T *bj = b + j * ldb;
+      T *cj = c + q0 + j * ldc;
+      int q = 0;
+
+      for (; q + 4 * V::N <= mq; q += 4 * V::N) {
+        Reg acc[4] = { V::Zero(), V::Zero(), V::Zero(), V::Zero() };
+        for (int p = 0; p < k; p++) {
+          Reg s = V::Set(bj[p]);
+          for (int u = 0; u < 4; u++)
+            acc[u] = V::Fma(s, V::Load(x[p] + q + u * V::N), acc[u]);
+        }
+        for (int u = 0; u < 4; u++)
+          V::Store(cj + q + u * V::N, acc[u]);
+      }
+
+      for (; q + V::N <= mq; q += V::N) {
+        Reg acc = V::Zero();
+        for (int p = 0; p < k; p++)
+          acc = V::Fma(V::Set(bj[p]), V::Load(x[p] + q), acc);
+        V::Store(cj + q, acc);
+      }
+
+      for (; q < mq; q++) {
+        T s = 0;
+        for (int p = 0; p < k; p++)
+          s += bj[p] * x[p][q];
+        cj[q] = s;
+      }
+    }
+  }
+}
+
+
+/**
+ * @brief dst = lhs * rhs^T, with lhs m x k for a small m and rhs n x k. Each output row is a
+ *        sum of k scaled rhs columns, written through a small buffer when the row is strided.
+ */
+template <typename V>
+static void KernelNT(int m, int n, int k, const typename V::Scalar *a, long lda,
+                     const typename V::Scalar *b, long ldb, typename V::Scalar *c, long ldc)
+{
+  typedef typename V::Scalar T;
+  typedef typename V::Reg Reg;
+  T row[4 * V::N];
+
+  for (int i = 0; i < m; i++) {
+    T *ci = c + i;
+    int j = 0;
+
+    for (; j + 4 * V::N <= n; j += 4 * V::N) {
+      Reg acc[4] = { V::Zero(), V::Zero(), V::Zero(), V::Zero() };
+      for (int p = 0; p < k; p++) {
+        Reg s = V::Set(a[i + p * lda]);
+        for (int u = 0; u < 4; u++)
+          acc[u] = V::Fma(s, V::Load(b + j + u * V::N + p * ldb), acc[u]);
+      }
+
+      if (ldc == 1) {
+        for (int u = 0; u < 4; u++)
+          V::Store(ci + j + u * V::N, acc[u]);
+      }
+      else {
+        for (int u = 0; u < 4; u++)
+          V::Store(row + u * V::N, acc[u]);
+        for (int q = 0; q < 4 * V::N; q++)
+          ci[(j + q) * ldc] = row[q];
+      }
+    }
+
+    for (; j + V::N <= n; j += V::N) {
+      Reg acc = V::Zero();
+      for (int p = 0; p < k; p++)
+        acc = V::Fma(V::Set(a[i + p * lda]), V::Load(b + j + p * ldb), acc);
+
+      if (ldc == 1) {
+        V::Store(ci + j, acc);
+      }
+      else {
+        V::Store(row, acc);
+        for (int q = 0; q < V::N; q++)
+          ci[(j + q) * ldc] = row[q];
+      }
+    }
+
+    for (; j < n; j++) {
+      T s = 0;
+      for (int p = 0; p < k; p++)
+        s += a[i + p * lda] * b[j + p * ldb];
+      ci[j * ldc] = s;
+    }
+  }
+}
@@ -0,0 +1,260 @@
+#include <iostream>
+#include <cmath>
+#include <algorithm>
+#include "goal_env.h"
+
+using namespace std;
+using namespace Neural;
+using namespace Eigen;
+
+
+static const double DEG_TO_RAD = 3.14159265358979323846 / 180.0;
+
+
+/**
+ * @brief Construct a new GoalEnv::GoalEnv object, all the instances reset.
+ *
+ * @param instances The number of independent instances
+ * @param threads The threads stepping them, 1 steps in the calling thread
+ * @param seed The seed of the random starts and goals, each instance has its own generator
+ */
+template <typename T>
+GoalEnvT<T>::GoalEnvT(int instances, int threads, unsigned seed)
+{
+  this->m_instances = instances;
+  this->m_pool = (threads > 1) ? new ThreadPool(threads) : nullptr;
+  this->m_chunks = std::min(threads, instances);
+  this->m_observer = nullptr;
+  this->m_observed = 0;
+
+  m_x.resize(instances);
+  m_y.resize(instances);
+  m_rotation.resize(instances);
+  m_dir_x.resize(instances);
+  m_dir_y.resize(instances);
+  m_goal_x.resize(instances);
+  m_goal_y.resize(instances);
+  m_time.resize(instances);
+  m_rewards.resize(instances);
+  m_done.resize(instances);
+  m_observations[0].resize(instances, OBSERVATIONS);
+  m_observations[1].resize(instances, OBSERVATIONS);
+
+  // xorshift generators, the state must not be zero
+  m_random.resize(instances);
+  for (int i = 0; i < instances; i++)
+    m_random[i] = (seed * 2654435761u + (uint32_t)i * 40503u) | 1u;
+
+  Reset();
+}
+
+
+/**
+ * @brief Destroy the GoalEnv::GoalEnv object
+ *
+ */
+template <typename T>
+GoalEnvT<T>::~GoalEnvT()
+{
+  delete m_pool;
+}
+
+
+template <typename T>
+T GoalEnvT<T>::Random(int instance, T min, T max)
+{
+  uint32_t x = m_random[instance];
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  m_random[instance] = x;
+
+  return min + (max - min) * T((x >> 8) * (1.0 / 16777216.0));
+}
+
+
+template <typename T>
+void GoalEnvT<T>::ResetInstance(int i)
+{
+  m_x(i) = WIDTH / 2;
+  m_y(i) = HEIGHT / 2;
+  m_rotation(i) = Random(i, 0, 360);
+  m_dir_x(i) = std::cos(m_rotation(i) * T(DEG_TO_RAD));
+  m_dir_y(i) = std::sin(m_rotation(i) * T(DEG_TO_RAD));
+  m_goal_x(i) = Random(i, 50, WIDTH - 50);
+  m_goal_y(i) = Random(i, 50, HEIGHT - 50);
+  m_time(i) = 0;
+}
+
+
+// the angle from the heading to the goal in (-180, 180] degrees and the distance to it
+template <typename T>
+void GoalEnvT<T>::Observe(int i, Matrix &observations)
+{
+  T dx = m_goal_x(i) - m_x(i);
+  T dy = m_goal_y(i) - m_y(i);
+
+  T angle = std::atan2(dy, dx) * T(1.0 / DEG_TO_RAD);
+  if (angle < 0) angle += 360;
+
+  angle -= m_rotation(i);
+  if (angle > 180)  angle -= 360;
+  if (angle < -180) angle += 360;
+
+  observations(i, 0) = angle;
+  observations(i, 1) = std::sqrt(dx * dx + dy * dy);
+}
+
+
+// steps the instances [begin, end), they share nothing so ranges can run on any thread
+template <typename T>
+void GoalEnvT<T>::StepRange(int begin, int end, const VectorXi &actions)
+{
+  const Matrix &previous = m_observations[m_current];
+  Matrix &next = m_observations[1 - m_current];
+
+  for (int i = begin; i < end; i++) {
+    // move along the heading, then turn
+    T x = m_x(i) + m_dir_x(i) * PLAYER_SPEED;
+    T y = m_y(i) + m_dir_y(i) * PLAYER_SPEED;
+    T rotation = m_rotation(i);
+
+    if (actions(i) == 1)      rotation += ROTATION_SPEED;
+    else if (actions(i) == 2) rotation -= ROTATION_SPEED;
+
+    if (rotation >= 360) rotation -= 360;
+    if (rotation < 0)    rotation += 360;
+
+    m_rotation(i) = rotation;
+    m_dir_x(i) = std::cos(rotation * T(DEG_TO_RAD));
+    m_dir_y(i) = std::sin(rotation * T(DEG_TO_RAD));
+
+    x = std::min(std::max(x, WALL), WIDTH - WALL);
+    y = std::min(std::max(y, WALL), HEIGHT - WALL);
+    m_x(i) = x;
+    m_y(i) = y;
+
+    // the goal circle against the player's square
+    T cx = std::min(std::max(m_goal_x(i), x - PLAYER_SIZE / 2), x + PLAYER_SIZE / 2);
+    T cy = std::min(std::max(m_goal_y(i), y - PLAYER_SIZE / 2), y + PLAYER_SIZE / 2);
+    T gx = m_goal_x(i) - cx;
+    T gy = m_goal_y(i) - cy;
+
+    if (gx * gx + gy * gy <= GOAL_RADIUS * GOAL_RADIUS) {
+      m_rewards(i) = 100;
+      m_done(i) = 1;
+    }
+    else if (x <= WALL || x >= WIDTH - WALL || y <= WALL || y >= HEIGHT - WALL) {
+      m_rewards(i) = -10;
+      m_done(i) = 1;
+    }
+    else {
+      m_done(i) = 0;
+    }
+
+    if (m_done(i) != 0) {
+      ResetInstance(i);
+      Observe(i, next);
+      continue;
+    }
+
+    Observe(i, next);
+
+    // a growing time penalty, facing the goal and closing in on it are rewarded
+    m_time(i) += T(0.01);
+    T reward = -m_time(i);
+
+    if (std::abs(next(i, 0)) < 10)
+      reward += T(0.5);
+    else if (std::abs(next(i, 0)) >= std::abs(previous(i, 0)))
+      reward -= 20;
+
+    reward += (next(i, 1) < previous(i, 1)) ? T(0.1) : T(-1);
+    m_rewards(i) = reward;
+  }
+}
+
+
+/**
+ * @brief Resets all the instances.
+ *
+ */
+template <typename T>
+void GoalEnvT<T>::Reset()
+{
+  m_current = 0;
+
+  for (int i = 0; i < m_instances; i++) {
+    ResetInstance(i);
+    Observe(i, m_observations[0]);
+  }
+
+  m_observations[1] = m_observations[0];
+  m_rewards.setZero();
+  m_done.setZero();
+}
+
+
+/**
+ * @brief Steps every instance with its action. Afterwards Observations holds the new
+ *        observations, those of the restarted episodes for the instances that are done,
+ *        and PreviousObservations the ones the actions were taken on.
+ *
+ * @param actions One action per instance: 0 none, 1 left, 2 right
+ */
+template <typename T>
+void GoalEnvT<T>::Step(const VectorXi &actions)
+{
+  if (actions.size() != m_instances) {
+    cerr << "The actions do not match the instances !!" << endl;
+    return;
+  }
+
+  if (m_pool != nullptr) {
+    m_pool->Run(m_chunks, [this, &actions](int c) {
+      StepRange(c * (long)m_instances / m_chunks, (c + 1) * (long)m_instances / m_chunks, actions);
+    });
+  }
+  else {
+    StepRange(0, m_instances, actions);
+  }
+
+  m_current = 1 - m_current;
+
+  if (m_observer != nullptr)
+    m_observer->OnStep(*this, m_observed);
+}
+
+
+/**
+ * @brief Sets the observer called after every step, a renderer for instance.
+ *
+ * @param observer The observer, not owned, nullptr for none
+ * @param instance The instance it is given
+ */
+template <typename T>
+void GoalEnvT<T>::Observe(EnvObserverT<T> *observer, int instance)
+{
+  m_observer = observer;
+  m_observed = instance;
+}
+
+
+/**
+ * @brief Moves the goal of an instance, its current observation follows.
+ *
+ * @param instance The instance
+ * @param x The new goal position
+ * @param y
+ */
+template <typename T>
+void GoalEnvT<T>::SetGoal(int instance, T x, T y)
+{
+  m_goal_x(instance) = x;
+  m_goal_y(instance) = y;
+  Observe(instance, m_observations[m_current]);
+}
+
+
+template class Neural::GoalEnvT<float>;
+template class Neural::GoalEnvT<double>;
@@ -4,21 +4,24 @@ using namespace Neural;
 using namespace Eigen;
 
 /**
- * @brief Construct a new Activation_Layer::Activation_Layer object
+ * @brief Construct a new Activation_LayerT::Activation_LayerT object
  * 
  */
-Activation_Layer::Activation_Layer()
+template <typename T>
+Activation_LayerT<T>::Activation_LayerT()
 {
   this->m_as_weight = false;
+  this->p_activation = nullptr;
 }
 
 
 /**
- * @brief Construct a new Activation_Layer::Activation_Layer object
+ * @brief Construct a new Activation_LayerT::Activation_LayerT object
  * 
  * @param a 
  */
-Activation_Layer::Activation_Layer(Activation *a)
+template <typename T>
+Activation_LayerT<T>::Activation_LayerT(ActivationT<T> *a)
 {
   this->m_as_weight = false;
   this->p_activation = a;
@@ -26,10 +29,11 @@ Activation_Layer::Activation_Layer(Activation *a)
 
 
 /**
- * @brief Destroy the Activation_Layer::Activation_Layer object
+ * @brief Destroy the Activation_LayerT::Activation_LayerT object
  * 
  */
-Activation_Layer::~Activation_Layer()
+template <typename T>
+Activation_LayerT<T>::~Activation_LayerT()
 {
   delete this->p_activation;
 }
@@ -39,24 +43,95 @@ Activation_Layer::~Activation_Layer()
  * @brief Performs forward propagation on the current layer.
  * 
  * @param input The inputs of the Layer = The outputs of the previous Layer, or The data of the first Layer 
- * @return MatrixXd Output Matrix of forward propagation results.
+ * @return Matrix Output Matrix of forward propagation results.
  */
-MatrixXd Activation_Layer::FeedForward(MatrixXd input_data)
+template <typename T>
+DynMatrix<T> Activation_LayerT<T>::FeedForward(const Matrix& input_data)
 {
   this->m_input = input_data;
   return this->p_activation->Compute(input_data);
 }
 
 
+/**
+ * @brief Performs inference forward propagation without touching the layer state, so it
+ *        can be called from several threads at once.
+ * 
+ * @param input_data The inputs of the Layer
+ * @param output Matrix receiving the activation results
+ */
+template <typename T>
+void Activation_LayerT<T>::Forward(const Matrix& input_data, Matrix& output) const
+{
+  output = this->p_activation->Compute(input_data);
+}
+
+
 /**
  * @brief Performs backward propagation on the current layer.
  * 
  * @param output_error Ths inputs of the Layer = The outputs of the previous layer, or the 
  *                     data of the first layer.
  * @param learning_rate The step size at each iteration.
- * @return MatrixXd Matrix of input layer error.
+ * @return Matrix Matrix of input layer error.
+ */
+template <typename T>
+DynMatrix<T> Activation_LayerT<T>::BackPropagation(const Matrix& output_error, float learning_rate)
+{
+  return this->p_activation->ComputeDerivative(this->m_input).array() * output_error.array();
+}
+
+
+/**
+ * @brief Computes the input error of the layer, an activation layer has no parameters.
+ * 
+ * @param output_error The error of the layer's output.
+ * @return Matrix Matrix of input layer error.
  */
-MatrixXd Activation_Layer::BackPropagation(MatrixXd output_error, float learning_rate)
+template <typename T>
+DynMatrix<T> Activation_LayerT<T>::Backward(const Matrix& output_error)
 {
   return this->p_activation->ComputeDerivative(this->m_input).array() * output_error.array();
-}
\ No newline at end of file
+}
+
+
+/**
+ * @brief Creates a copy of the layer with its own activation.
+ * 
+ * @return Layer* The new layer.
+ */
+template <typename T>
+LayerT<T>* Activation_LayerT<T>::Clone() const
+{
+  return new Activation_LayerT(this->p_activation->Clone());
+}
+
+
+/**
+ * @brief The model file only stores Fc_Layer, a standalone activation layer can't be saved.
+ * 
+ * @param outfile The output file stream.
+ */
+template <typename T>
+void Activation_LayerT<T>::SaveLayer(std::ofstream &outfile)
+{
+  std::cerr << "Activation_Layer can't be saved, use the activation of Fc_Layer !!" << std::endl;
+}
+
+
+/**
+ * @brief The model file only stores Fc_Layer, a standalone activation layer can't be saved.
+ * 
+ * @param writer The model writer.
+ * @return false
+ */
+template <typename T>
+bool Activation_LayerT<T>::SaveRecord(ModelWriter &writer) const
+{
+  std::cerr << "Activation_Layer can't be saved, use the activation of Fc_Layer !!" << std::endl;
+  return false;
+}
+
+
+template class Neural::Activation_LayerT<float>;
+template class Neural::Activation_LayerT<double>;
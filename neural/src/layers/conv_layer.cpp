@@ -0,0 +1,660 @@
+#include "layers/conv_layer.h"
+#include "core.h"
+#include "gemm.h"
+#include <fstream>
+#include <cmath>
+
+using namespace std;
+using namespace Neural;
+using namespace Eigen;
+
+// patch tiles are kept around this size, so a tile stays in L2 cache through its products
+static const size_t TILE_BYTES = 256 * 1024;
+
+
+/**
+ * @brief Rows of the patch tiles of a batch. A row is one window position of one sample,
+ *        the samples of a position are adjacent, so every tap copies a contiguous segment
+ *        of an input column.
+ */
+template <typename T>
+static int TileRows(const WindowShape &shape, int batch)
+{
+  size_t patch = (size_t)shape.channels * shape.Taps() * sizeof(T);
+  size_t rows = std::max<size_t>(1, TILE_BYTES / patch);
+
+  return (int)std::min<size_t>(rows, (size_t)batch * shape.Positions());
+}
+
+
+/**
+ * @brief Calls f(first sample, samples, first position, positions) for every tile of a
+ *        batch, all the samples of a tile at once when they fit.
+ */
+template <typename F>
+static void ForEachTile(int batch, int positions, int tile_rows, F f)
+{
+  int samples = std::min(batch, tile_rows);
+  int per_tile = std::max(1, tile_rows / samples);
+
+  for (int s = 0; s < batch; s += samples) {
+    for (int p = 0; p < positions; p += per_tile) {
+      f(s, std::min(samples, batch - s), p, std::min(per_tile, positions - p));
+    }
+  }
+}
+
+
+/**
+ * @brief im2col of a tile: column c * taps + t holds tap t of channel c for every
+ *        (position, sample) row of the tile, zero in the padding.
+ */
+template <typename T>
+static void Im2Col(const WindowShape &shape, const Ref<const DynMatrix<T>> &input, int s0, int samples, int p0,
+                   int positions, Map<DynMatrix<T>> &patches)
+{
+  int taps = shape.Taps();
+
+  for (int c = 0; c < shape.channels; c++) {
+    for (int t = 0; t < taps; t++) {
+      T *dst = patches.col(c * taps + t).data();
+
+      for (int j = 0; j < positions; j++, dst += samples) {
+        int pixel = shape.Tap(p0 + j, t);
+        if (pixel < 0) {
+          std::fill(dst, dst + samples, T(0));
+        }
+        else {
+          const T *src = input.data() + (size_t)(c * shape.Pixels() + pixel) * input.outerStride() + s0;
+          std::copy(src, src + samples, dst);
+        }
+      }
+    }
+  }
+}
+
+
+/**
+ * @brief col2im of a tile, the reverse of Im2Col: every patch value is added to the input
+ *        pixel it was read from, the padding is dropped.
+ */
+template <typename T>
+static void Col2Im(const WindowShape &shape, const Map<DynMatrix<T>> &patches, int s0, int samples, int p0,
+                   int positions, Ref<DynMatrix<T>> input_error)
+{
+  int taps = shape.Taps();
+
+  for (int c = 0; c < shape.channels; c++) {
+    for (int t = 0; t < taps; t++) {
+      const T *src = patches.col(c * taps + t).data();
+
+      for (int j = 0; j < positions; j++, src += samples) {
+        int pixel = shape.Tap(p0 + j, t);
+        if (pixel < 0)
+          continue;
+
+        T *dst = &input_error.coeffRef(s0, c * shape.Pixels() + pixel);
+        for (int s = 0; s < samples; s++)
+          dst[s] += src[s];
+      }
+    }
+  }
+}
+
+
+/**
+ * @brief Copies a filters-column tile to or from the rows of a batch laid out filter by
+ *        filter, position by position.
+ */
+template <typename T>
+static void CopyTile(const WindowShape &shape, Map<DynMatrix<T>> &tile, Ref<DynMatrix<T>> batch, int s0, int samples,
+                     int p0, int positions, bool to_batch)
+{
+  for (int f = 0; f < tile.cols(); f++) {
+    T *t = tile.col(f).data();
+
+    for (int j = 0; j < positions; j++, t += samples) {
+      T *b = &batch.coeffRef(s0, f * shape.Positions() + p0 + j);
+      if (to_batch)
+        std::copy(t, t + samples, b);
+      else
+        std::copy(b, b + samples, t);
+    }
+  }
+}
+
+
+/**
+ * @brief dst = op(lhs) * op(rhs) with the workspace panels, or allocating without one.
+ */
+template <typename T>
+static void Multiply(WorkspaceT<T> *workspace, const Ref<const DynMatrix<T>> &lhs, const Ref<const DynMatrix<T>> &rhs,
+                     Ref<DynMatrix<T>> dst, bool transpose_lhs, bool transpose_rhs)
+{
+  if (workspace != nullptr)
+    workspace->Product(lhs, rhs, dst, transpose_lhs, transpose_rhs);
+  else if (SmallGemm::Product<T>(lhs, rhs, dst, transpose_lhs, transpose_rhs))
+    return;
+  else if (transpose_lhs)
+    dst.noalias() = lhs.transpose() * rhs;
+  else if (transpose_rhs)
+    dst.noalias() = lhs * rhs.transpose();
+  else
+    dst.noalias() = lhs * rhs;
+}
+
+
+/**
+ * @brief Convolution of a batch into net sums, tile by tile: im2col, one product with the
+ *        weights and the bias, then the tile is copied into its rows. patches and tile
+ *        hold TileRows rows of the patch and filter widths.
+ */
+template <typename T>
+static void ConvForward(const WindowShape &shape, const Ref<const DynMatrix<T>> &input, const Ref<const DynMatrix<T>> &weights,
+                        const Ref<const DynMatrix<T>> &bias, Ref<DynMatrix<T>> net_sum, T *patches, T *tile,
+                        WorkspaceT<T> *workspace)
+{
+  int patch = weights.rows();
+  int filters = weights.cols();
+
+  ForEachTile(input.rows(), shape.Positions(), TileRows<T>(shape, input.rows()), [&](int s0, int samples, int p0, int positions) {
+    int rows = samples * positions;
+    Map<DynMatrix<T>> patch_tile(patches, rows, patch);
+    Map<DynMatrix<T>> out_tile(tile, rows, filters);
+
+    Im2Col<T>(shape, input, s0, samples, p0, positions, patch_tile);
+    Multiply<T>(workspace, patch_tile, weights, out_tile, false, false);
+    out_tile.rowwise() += bias.row(0);
+    CopyTile<T>(shape, out_tile, net_sum, s0, samples, p0, positions, true);
+  });
+}
+
+
+/**
+ * @brief Gradients of a convolution from the gradient of its net sums, tile by tile: the
+ *        weight gradient sums patches^T * gradient over the tiles, the input error is the
+ *        col2im of gradient * weights^T. The patch buffer holds the input error tile once
+ *        its patches are used.
+ */
+template <typename T>
+static void ConvBackward(const WindowShape &shape, const Ref<const DynMatrix<T>> &input, const Ref<const DynMatrix<T>> &weights,
+                         Ref<DynMatrix<T>> gradient, Ref<DynMatrix<T>> grad_weights, Ref<DynMatrix<T>> grad_bias,
+                         Ref<DynMatrix<T>> input_error, T *patches, T *tile, T *weight_tile, WorkspaceT<T> *workspace)
+{
+  int patch = weights.rows();
+  int filters = weights.cols();
+  int positions_per_filter = shape.Positions();
+  Map<DynMatrix<T>> weight_step(weight_tile, patch, filters);
+
+  grad_weights.setZero();
+  input_error.setZero();
+
+  // the loss gradient is already averaged over the batch, the bias sums it like the weights
+  for (int f = 0; f < filters; f++)
+    grad_bias(0, f) = gradient.middleCols(f * positions_per_filter, positions_per_filter).sum();
+
+  ForEachTile(input.rows(), shape.Positions(), TileRows<T>(shape, input.rows()), [&](int s0, int samples, int p0, int positions) {
+    int rows = samples * positions;
+    Map<DynMatrix<T>> patch_tile(patches, rows, patch);
+    Map<DynMatrix<T>> grad_tile(tile, rows, filters);
+
+    Im2Col<T>(shape, input, s0, samples, p0, positions, patch_tile);
+    CopyTile<T>(shape, grad_tile, gradient, s0, samples, p0, positions, false);
+
+    Multiply<T>(workspace, patch_tile, grad_tile, weight_step, true, false);
+    grad_weights += weight_step;
+
+    Multiply<T>(workspace, grad_tile, weights, patch_tile, false, true);
+    Col2Im<T>(shape, patch_tile, s0, samples, p0, positions, input_error);
+  });
+}
+
+
+/**
+ * @brief Construct a new Conv2D_Layer::Conv2D_Layer object. The weights are uniform in
+ *        +-sqrt(6 / (fan_in + fan_out)), fan-ins of whole patches saturate with the unit
+ *        range of Fc_Layer, and the bias starts at zero.
+ *
+ * @param channels Number of input channels
+ * @param height Height of the input images
+ * @param width Width of the input images
+ * @param filters Number of output channels
+ * @param kernel Size of the square kernel
+ * @param activationType The activation of the outputs
+ * @param stride Step of the kernel
+ * @param padding Zero pixels added on every side
+ * @param dilation Spacing of the kernel taps
+ */
+template <typename T>
+Conv2D_LayerT<T>::Conv2D_LayerT(int channels, int height, int width, int filters, int kernel, ActivationType activationType,
+                                int stride, int padding, int dilation)
+{
+  this->m_shape = WindowShape(channels, height, width, kernel, stride, padding, dilation);
+  if (!m_shape.Valid())
+    cerr << "Conv2D_Layer kernel doesn't fit in the input !!" << endl;
+
+  int patch = channels * kernel * kernel;
+  T limit = T(std::sqrt(6.0 / (patch + filters)));
+
+  this->m_as_weight = true;
+  this->AssignWeights(Core::RandomMatrix<T>(patch, filters, -1.0, 1.0) * limit);
+  this->AssignBias(Matrix::Zero(1, filters));
+  this->m_activation = activationType;
+  this->m_alpha = DefaultAlpha<T>(activationType);
+  this->m_tile_rows = 0;
+}
+
+
+/**
+ * @brief Construct a copy of a Conv2D_Layer, with the same shape, weights and bias but
+ *        without optimizer state.
+ *
+ * @param other The layer to copy
+ */
+template <typename T>
+Conv2D_LayerT<T>::Conv2D_LayerT(const Conv2D_LayerT &other)
+{
+  this->m_shape = other.m_shape;
+  this->m_as_weight = true;
+  this->AssignWeights(other.m_weights);
+  this->AssignBias(other.m_bias);
+  this->m_activation = other.m_activation;
+  this->m_alpha = other.m_alpha;
+  this->m_tile_rows = 0;
+}
+
+
+/**
+ * @brief Performs forward propagation on the current layer, keeping the input and net sum
+ *        for the backward pass.
+ *
+ * @param input_data The images, one per row
+ * @return Matrix The feature maps, one per row
+ */
+template <typename T>
+DynMatrix<T> Conv2D_LayerT<T>::FeedForward(const Matrix& input_data)
+{
+  int rows = TileRows<T>(m_shape, input_data.rows());
+  Matrix patches(rows, this->m_weights.rows()), tile(rows, this->m_weights.cols());
+
+  this->m_input = input_data;
+  this->m_net_sum.resize(input_data.rows(), OutputSize(input_data.cols()));
+  ConvForward<T>(m_shape, input_data, this->m_weights, this->m_bias, this->m_net_sum, patches.data(), tile.data(), nullptr);
+
+  this->m_output = this->m_net_sum;
+  DispatchActivation<T>(m_activation, [&](auto op) {
+    decltype(op)::Apply(this->m_output, m_alpha);
+  });
+
+  return this->m_output;
+}
+
+
+/**
+ * @brief Performs inference forward propagation, keeping no training cache so threads can
+ *        share the layer.
+ *
+ * @param input_data The images, one per row
+ * @param output Matrix receiving the feature maps
+ */
+template <typename T>
+void Conv2D_LayerT<T>::Forward(const Matrix& input_data, Matrix& output) const
+{
+  int rows = TileRows<T>(m_shape, input_data.rows());
+  Matrix patches(rows, this->m_weights.rows()), tile(rows, this->m_weights.cols());
+
+  output.resize(input_data.rows(), OutputSize(input_data.cols()));
+  ConvForward<T>(m_shape, input_data, this->m_weights, this->m_bias, output, patches.data(), tile.data(), nullptr);
+
+  DispatchActivation<T>(m_activation, [&](auto op) {
+    decltype(op)::Apply(output, m_alpha);
+  });
+}
+
+
+/**
+ * @brief Performs backward propagation on the current layer and updates it.
+ *
+ * @param output_error The error of the layer's output
+ * @param learning_rate The step size of the update
+ * @return Matrix The error of the layer's input
+ */
+template <typename T>
+DynMatrix<T> Conv2D_LayerT<T>::BackPropagation(const Matrix& output_error, float learning_rate)
+{
+  Matrix input_error = Backward(output_error);
+  this->ApplyGradients(learning_rate);
+
+  return input_error;
+}
+
+
+/**
+ * @brief Computes the weight and bias gradients of the layer without updating them, the
+ *        gradients are kept until the next call and applied with ApplyGradients.
+ *
+ * @param output_error The error of the layer's output
+ * @return Matrix The error of the layer's input
+ */
+template <typename T>
+DynMatrix<T> Conv2D_LayerT<T>::Backward(const Matrix& output_error)
+{
+  int rows = TileRows<T>(m_shape, output_error.rows());
+  Matrix patches(rows, this->m_weights.rows()), tile(rows, this->m_weights.cols());
+  Matrix weight_tile(this->m_weights.rows(), this->m_weights.cols());
+  Matrix gradient = output_error;
+
+  DispatchActivation<T>(m_activation, [&](auto op) {
+    decltype(op)::Derivative(this->m_net_sum, gradient, m_alpha);
+  });
+
+  this->m_grad_weights.resize(this->m_weights.rows(), this->m_weights.cols());
+  this->m_grad_bias.resize(1, this->m_weights.cols());
+  Matrix input_error(output_error.rows(), m_shape.InputSize());
+
+  ConvBackward<T>(m_shape, this->m_input, this->m_weights, gradient, this->m_grad_weights, this->m_grad_bias, input_error,
+                  patches.data(), tile.data(), weight_tile.data(), nullptr);
+
+  return input_error;
+}
+
+
+/**
+ * @brief Gets the size of the feature maps.
+ *
+ * @param input_size The size of the input rows, channels * height * width
+ * @return int filters * out_height * out_width
+ */
+template <typename T>
+int Conv2D_LayerT<T>::OutputSize(int input_size) const
+{
+  if (input_size != m_shape.InputSize())
+    cerr << "Conv2D_Layer expects " << m_shape.InputSize() << " inputs, not " << input_size << " !!" << endl;
+
+  return this->m_weights.cols() * m_shape.Positions();
+}
+
+
+/**
+ * @brief Takes the training buffers of the layer from a workspace: net sums, outputs,
+ *        gradients and input errors of max_batch rows, the patch, filter and weight tiles,
+ *        and the packing panels of the tile products. Without activation the outputs are
+ *        the net sums.
+ *
+ * @param workspace The workspace of the network, allocated after every layer is bound
+ * @param max_batch The largest batch of the training steps
+ */
+template <typename T>
+void Conv2D_LayerT<T>::BindWorkspace(WorkspaceT<T> &workspace, int max_batch)
+{
+  int patch = this->m_weights.rows();
+  int filters = this->m_weights.cols();
+  size_t out = (size_t)filters * m_shape.Positions();
+
+  this->m_tile_rows = TileRows<T>(m_shape, max_batch);
+  this->m_ws_net_sum = workspace.Take(max_batch * out);
+  this->m_ws_output = (m_activation == ActivationType::NONE) ? m_ws_net_sum : workspace.Take(max_batch * out);
+  this->m_ws_gradient = workspace.Take(max_batch * out, Lifetime::SCRATCH);
+  this->m_ws_input_error = workspace.Take((size_t)max_batch * m_shape.InputSize(), Lifetime::ERROR);
+  this->m_ws_patches = workspace.Take((size_t)m_tile_rows * patch, Lifetime::SCRATCH);
+  this->m_ws_tile = workspace.Take((size_t)m_tile_rows * filters, Lifetime::SCRATCH);
+  this->m_ws_weight_tile = workspace.Take((size_t)patch * filters, Lifetime::SCRATCH);
+
+  // forward tiles, weight gradient and input error tiles
+  workspace.ReserveProduct(m_tile_rows, filters, patch);
+  workspace.ReserveProduct(patch, filters, m_tile_rows);
+  workspace.ReserveProduct(m_tile_rows, patch, filters);
+
+  this->m_grad_weights.resize(patch, filters);
+  this->m_grad_bias.resize(1, filters);
+  this->m_workspace = &workspace;
+}
+
+
+/**
+ * @brief Training forward pass into the workspace buffers, nothing is allocated and the
+ *        input is not copied.
+ *
+ * @param input The images, they must stay valid until TrainBackward.
+ * @return const MatrixMap& The feature maps, valid until the next call.
+ */
+template <typename T>
+const typename Conv2D_LayerT<T>::MatrixMap& Conv2D_LayerT<T>::TrainForward(const Ref<const Matrix>& input)
+{
+  if (this->m_workspace == nullptr)
+    return LayerT<T>::TrainForward(input);
+
+  int batch = input.rows();
+  int out = this->m_weights.cols() * m_shape.Positions();
+  MatrixMap net_sum = this->m_workspace->View(m_ws_net_sum, batch, out);
+
+  new (&this->m_input_view) typename LayerT<T>::ConstMatrixMap(input.data(), batch, input.cols(), OuterStride<>(input.outerStride()));
+  new (&this->m_output_view) MatrixMap(this->m_workspace->Data(m_ws_output), batch, out);
+
+  ConvForward<T>(m_shape, input, this->m_weights, this->m_bias, net_sum, this->m_workspace->Data(m_ws_patches),
+                 this->m_workspace->Data(m_ws_tile), this->m_workspace);
+
+  if (m_activation == ActivationType::NONE)
+    return this->m_output_view;
+
+  this->m_output_view = net_sum;
+  DispatchActivation<T>(m_activation, [&](auto op) {
+    decltype(op)::Apply(this->m_output_view, m_alpha);
+  });
+
+  return this->m_output_view;
+}
+
+
+/**
+ * @brief Training backward pass into the workspace buffers, the gradients are kept for
+ *        ApplyGradients as with Backward.
+ *
+ * @param output_error The error of the layer's output.
+ * @return const MatrixMap& The error of the layer's input, valid until the next call.
+ */
+template <typename T>
+const typename Conv2D_LayerT<T>::MatrixMap& Conv2D_LayerT<T>::TrainBackward(const Ref<const Matrix>& output_error)
+{
+  if (this->m_workspace == nullptr)
+    return LayerT<T>::TrainBackward(output_error);
+
+  int batch = output_error.rows();
+  int out = output_error.cols();
+  MatrixMap net_sum = this->m_workspace->View(m_ws_net_sum, batch, out);
+  MatrixMap gradient = this->m_workspace->View(m_ws_gradient, batch, out);
+
+  gradient = output_error;
+
+  DispatchActivation<T>(m_activation, [&](auto op) {
+    decltype(op)::Derivative(net_sum, gradient, m_alpha);
+  });
+
+  new (&this->m_error_view) MatrixMap(this->m_workspace->Data(m_ws_input_error), batch, m_shape.InputSize());
+
+  ConvBackward<T>(m_shape, this->m_input_view, this->m_weights, gradient, this->m_grad_weights, this->m_grad_bias,
+                  this->m_error_view, this->m_workspace->Data(m_ws_patches), this->m_workspace->Data(m_ws_tile),
+                  this->m_workspace->Data(m_ws_weight_tile), this->m_workspace);
+
+  return this->m_error_view;
+}
+
+
+/**
+ * @brief Takes over the activation of an activation layer that follows, when the layer has
+ *        none of its own.
+ *
+ * @param type The activation of the following layer
+ * @param alpha Its parameter
+ * @return true if the layer applies the activation from now on
+ */
+template <typename T>
+bool Conv2D_LayerT<T>::FoldActivation(ActivationType type, T alpha)
+{
+  if (m_activation != ActivationType::NONE)
+    return false;
+
+  this->m_activation = type;
+  this->m_alpha = alpha;
+
+  return true;
+}
+
+
+/**
+ * @brief Creates a copy of the layer, used for per-thread training replicas.
+ *
+ * @return Layer* The new layer.
+ */
+template <typename T>
+LayerT<T>* Conv2D_LayerT<T>::Clone() const
+{
+  return new Conv2D_LayerT(*this);
+}
+
+
+/**
+ * @brief Gets the analytical cost of the layer on a batch: the tile products and the bias,
+ *        and the matrices each pass reads and writes once, the patch tiles included.
+ *
+ * @param batch Number of samples
+ * @return LayerCost The FLOPs and bytes of the layer calls
+ */
+template <typename T>
+LayerCost Conv2D_LayerT<T>::GetCost(int batch) const
+{
+  double patch = this->m_weights.rows();
+  double filters = this->m_weights.cols();
+  double rows = (double)batch * m_shape.Positions();
+  double in = (double)batch * m_shape.InputSize();
+  double out = rows * filters;
+  LayerCost cost;
+
+  cost.forward_flops = 2 * rows * patch * filters + out;
+  cost.backward_flops = 4 * rows * patch * filters + out;
+  // input, weights, bias read, patches written and read, net sum and output written
+  cost.forward_bytes = (in + patch * filters + filters + 2 * rows * patch + 2 * out) * sizeof(T);
+  // output error and net sum read, patches twice, input error written
+  cost.backward_bytes = (2 * out + in + 4 * rows * patch + 2 * patch * filters + filters + in) * sizeof(T);
+  cost.update_bytes = 3 * (patch * filters + filters) * sizeof(T);
+
+  return cost;
+}
+
+
+/**
+ * @brief The stream format only stores Fc_Layer, a Conv2D_Layer is saved by SaveModel.
+ *
+ * @param outfile The output file stream.
+ */
+template <typename T>
+void Conv2D_LayerT<T>::SaveLayer(std::ofstream &outfile)
+{
+  cerr << "Conv2D_Layer can't be saved in the stream format, use SaveModel !!" << endl;
+}
+
+
+/**
+ * @brief Adds the layer to a version 3 model file: the weights, bias and window shape as
+ *        blobs, the activation and its alpha in the layer record.
+ *
+ * @param writer The model writer
+ * @return true if the layer was added
+ */
+template <typename T>
+bool Conv2D_LayerT<T>::SaveRecord(ModelWriter &writer) const
+{
+  ModelLayerRecord record = {};
+  record.kind = static_cast<int32_t>(LayerKind::CONV2D);
+  record.activation = static_cast<int32_t>(this->m_activation);
+  record.rows = this->m_weights.rows();
+  record.cols = this->m_weights.cols();
+  record.blob[0] = writer.AddBlob(this->m_weights.data(), this->m_weights.size() * sizeof(T));
+  record.blob[1] = writer.AddBlob(this->m_bias.data(), this->m_bias.size() * sizeof(T));
+  record.blob[2] = writer.AddBlob(m_shape.record, sizeof(m_shape.record));
+  record.scalar = this->m_alpha;
+
+  writer.AddLayer(record);
+
+  return true;
+}
+
+
+/**
+ * @brief Creates a layer over the parameters of a mapped model file, without copy when the
+ *        file has the scalar type of the layer.
+ *
+ * @param file The mapped model file
+ * @param record The layer record
+ * @return Conv2D_LayerT* The new layer, nullptr if the record is out of the file or invalid
+ */
+template <typename T>
+Conv2D_LayerT<T>* Conv2D_LayerT<T>::MapLayer(const shared_ptr<ModelFile> &file, const ModelLayerRecord &record)
+{
+  int rows = record.rows;
+  int cols = record.cols;
+  size_t scalar_size = (file->GetDataType() == DataType::FLOAT32) ? sizeof(float) : sizeof(double);
+
+  if (rows <= 0 || cols <= 0 ||
+      !file->HasBlob(record.blob[0], (uint64_t)rows * cols * scalar_size) ||
+      !file->HasBlob(record.blob[1], (uint64_t)cols * scalar_size) ||
+      !file->HasBlob(record.blob[2], WindowShape::FIELDS * sizeof(int32_t))) {
+    cerr << "Conv2D_Layer record is out of the model file !!" << endl;
+    return nullptr;
+  }
+
+  WindowShape shape = WindowShape::Read(reinterpret_cast<const int32_t*>(file->Blob(record.blob[2])));
+  if (!shape.Valid() || shape.channels * shape.Taps() != rows) {
+    cerr << "Conv2D_Layer record has an invalid shape !!" << endl;
+    return nullptr;
+  }
+
+  Conv2D_LayerT *layer = new Conv2D_LayerT();
+  layer->m_shape = shape;
+  layer->m_as_weight = true;
+  layer->m_activation = static_cast<ActivationType>(record.activation);
+  layer->m_alpha = T(record.scalar);
+  layer->m_tile_rows = 0;
+
+  if (file->GetDataType() == DataTypeOf<T>::value) {
+    layer->BindParameters(reinterpret_cast<T*>(file->Blob(record.blob[0])), rows, cols,
+                          reinterpret_cast<T*>(file->Blob(record.blob[1])), file);
+  }
+  else {
+    Matrix weights, bias;
+    file->CopyMatrix(record.blob[0], weights, rows, cols);
+    file->CopyMatrix(record.blob[1], bias, 1, cols);
+    layer->AssignWeights(weights);
+    layer->AssignBias(bias);
+  }
+
+  return layer;
+}
+
+
+/**
+ * @brief Sets the weights of the layer, (channels * kernel * kernel) x filters.
+ *
+ * @param weights A matrix containing the new weights for the layer.
+ */
+template <typename T>
+void Conv2D_LayerT<T>::SetWeights(Matrix &weights)
+{
+  this->AssignWeights(weights);
+}
+
+
+/**
+ * @brief Sets the biases of the layer, one per filter.
+ *
+ * @param bias A matrix containing the new biases for the layer.
+ */
+template <typename T>
+void Conv2D_LayerT<T>::SetBias(Matrix &bias)
+{
+  this->AssignBias(bias);
+}
+
+
+template class Neural::Conv2D_LayerT<float>;
+template class Neural::Conv2D_LayerT<double>;
@@ -0,0 +1,589 @@
+#include "layers/embedding_layer.h"
+#include "core.h"
+#include <fstream>
+
+using namespace std;
+using namespace Neural;
+using namespace Eigen;
+
+
+/**
+ * @brief The id stored in an input value, -1 outside the vocabulary.
+ */
+template <typename T>
+static inline int IdOf(T value, int vocab)
+{
+  return (value >= T(0) && value < T(vocab)) ? static_cast<int>(value) : -1;
+}
+
+
+/**
+ * @brief Gathers the vectors of the ids of a batch, id k of a row fills the output columns
+ *        k * dim to (k + 1) * dim.
+ */
+template <typename T>
+static void Gather(const Ref<const DynMatrix<T>> &ids, const Ref<const DynMatrix<T>> &weights, Ref<DynMatrix<T>> output)
+{
+  int batch = ids.rows();
+  int dim = weights.rows();
+  Index stride = output.outerStride();
+
+  for (int k = 0; k < ids.cols(); k++) {
+    T *out = output.col(k * dim).data();
+
+    for (int s = 0; s < batch; s++) {
+      int id = IdOf<T>(ids(s, k), weights.cols());
+      const T *vector = weights.col(std::max(id, 0)).data();
+
+      for (int d = 0; d < dim; d++)
+        out[d * stride + s] = (id >= 0) ? vector[d] : T(0);
+    }
+  }
+}
+
+
+/**
+ * @brief Construct a new Embedding_Layer::Embedding_Layer object
+ *
+ * @param vocab Number of ids
+ * @param dim Size of the vector of an id
+ * @param inputs Number of ids in every input row
+ */
+template <typename T>
+Embedding_LayerT<T>::Embedding_LayerT(int vocab, int dim, int inputs)
+  : Embedding_LayerT()
+{
+  this->m_as_weight = true;
+  this->AssignWeights(Core::RandomMatrix<T>(dim, vocab, -1.0, 1.0));
+  this->m_inputs = inputs;
+  this->m_slot.assign(vocab, -1);
+}
+
+
+/**
+ * @brief Construct a copy of an Embedding_Layer, with the same table but without optimizer
+ *        state. The copy is in sync with the layer for CopyParameters.
+ *
+ * @param other The layer to copy
+ */
+template <typename T>
+Embedding_LayerT<T>::Embedding_LayerT(const Embedding_LayerT &other)
+  : Embedding_LayerT()
+{
+  this->m_as_weight = true;
+  this->AssignWeights(other.m_weights);
+  this->m_inputs = other.m_inputs;
+  this->m_slot.assign(other.m_slot.size(), -1);
+  this->m_synced = other.m_version;
+}
+
+
+/**
+ * @brief The gradient columns of the ids of the last backward pass.
+ */
+template <typename T>
+typename Embedding_LayerT<T>::MatrixMap Embedding_LayerT<T>::GradColumns()
+{
+  return MatrixMap(this->m_grad_weights.data(), this->m_weights.rows(), m_columns.size());
+}
+
+
+/**
+ * @brief Grows the gradient columns and id lists to hold a number of ids, they never
+ *        shrink so the steps of a bound batch size allocate nothing.
+ */
+template <typename T>
+void Embedding_LayerT<T>::ReserveColumns(size_t columns)
+{
+  if ((size_t)this->m_grad_weights.cols() < columns)
+    this->m_grad_weights.conservativeResize(this->m_weights.rows(), columns);
+
+  m_columns.reserve(columns);
+  m_updated.reserve(columns);
+}
+
+
+/**
+ * @brief The gradient column of an id, a new zero column on its first use in the pass.
+ */
+template <typename T>
+int Embedding_LayerT<T>::Slot(int id)
+{
+  if (m_slot[id] < 0) {
+    m_slot[id] = m_columns.size();
+    m_columns.push_back(id);
+    this->m_grad_weights.col(m_slot[id]).setZero();
+  }
+
+  return m_slot[id];
+}
+
+
+/**
+ * @brief Sums the output error of every id of a batch into its gradient column, the
+ *        columns of the previous pass are released first.
+ */
+template <typename T>
+void Embedding_LayerT<T>::Accumulate(const Ref<const Matrix> &ids, const Ref<const Matrix> &output_error)
+{
+  int batch = ids.rows();
+  int dim = this->m_weights.rows();
+  Index stride = output_error.outerStride();
+
+  for (int id : m_columns)
+    m_slot[id] = -1;
+  m_columns.clear();
+  ReserveColumns(std::min<size_t>(this->m_weights.cols(), (size_t)batch * ids.cols()));
+
+  for (int k = 0; k < ids.cols(); k++) {
+    const T *error = output_error.col(k * dim).data();
+
+    for (int s = 0; s < batch; s++) {
+      int id = IdOf<T>(ids(s, k), this->m_weights.cols());
+      if (id < 0)
+        continue;
+
+      T *grad = this->m_grad_weights.col(Slot(id)).data();
+      for (int d = 0; d < dim; d++)
+        grad[d] += error[d * stride + s];
+    }
+  }
+}
+
+
+/**
+ * @brief Performs forward propagation on the current layer, keeping the ids for the
+ *        backward pass.
+ *
+ * @param input_data The ids, m_inputs per row
+ * @return Matrix The vectors of the ids, one row per sample
+ */
+template <typename T>
+DynMatrix<T> Embedding_LayerT<T>::FeedForward(const Matrix& input_data)
+{
+  this->m_input = input_data;
+  this->m_output.resize(input_data.rows(), OutputSize(input_data.cols()));
+  Gather<T>(input_data, this->m_weights, this->m_output);
+
+  return this->m_output;
+}
+
+
+/**
+ * @brief Performs inference forward propagation, keeping no training cache so threads can
+ *        share the layer.
+ *
+ * @param input_data The ids, m_inputs per row
+ * @param output Matrix receiving the vectors of the ids
+ */
+template <typename T>
+void Embedding_LayerT<T>::Forward(const Matrix& input_data, Matrix& output) const
+{
+  output.resize(input_data.rows(), OutputSize(input_data.cols()));
+  Gather<T>(input_data, this->m_weights, output);
+}
+
+
+/**
+ * @brief Performs backward propagation on the current layer and updates the vectors of the
+ *        ids of the batch.
+ *
+ * @param output_error The error of the layer's output
+ * @param learning_rate The step size of the update
+ * @return Matrix Zero, the ids have no gradient
+ */
+template <typename T>
+DynMatrix<T> Embedding_LayerT<T>::BackPropagation(const Matrix& output_error, float learning_rate)
+{
+  Matrix input_error = Backward(output_error);
+  this->ApplyGradients(learning_rate);
+
+  return input_error;
+}
+
+
+/**
+ * @brief Sums the gradients of the ids of the last FeedForward without updating them.
+ *
+ * @param output_error The error of the layer's output
+ * @return Matrix Zero, the ids have no gradient
+ */
+template <typename T>
+DynMatrix<T> Embedding_LayerT<T>::Backward(const Matrix& output_error)
+{
+  Accumulate(this->m_input, output_error);
+
+  return Matrix::Zero(output_error.rows(), m_inputs);
+}
+
+
+/**
+ * @brief Applies the gradients of the last backward pass to the columns of its ids, with
+ *        the sparse update of the layer's optimizer or plain gradient descent.
+ *
+ * @param learning_rate The step size used when no optimizer is set.
+ */
+template <typename T>
+void Embedding_LayerT<T>::ApplyGradients(float learning_rate)
+{
+  MatrixMap grad = GradColumns();
+
+  if (this->m_optimizer != nullptr) {
+    this->m_optimizer->UpdateColumns(this->m_weights, grad, m_columns);
+  }
+  else {
+    for (size_t j = 0; j < m_columns.size(); j++)
+      this->m_weights.col(m_columns[j]).noalias() -= T(learning_rate) * grad.col(j);
+  }
+
+  m_updated = m_columns;
+  m_version++;
+}
+
+
+/**
+ * @brief Gets the size of the output rows.
+ *
+ * @param input_size The number of ids per input row
+ * @return int inputs * dim
+ */
+template <typename T>
+int Embedding_LayerT<T>::OutputSize(int input_size) const
+{
+  if (input_size != m_inputs)
+    cerr << "Embedding_Layer expects " << m_inputs << " ids per row, not " << input_size << " !!" << endl;
+
+  return input_size * this->m_weights.rows();
+}
+
+
+/**
+ * @brief Takes the output and input error buffers of the layer from a workspace and sizes
+ *        the gradient columns for max_batch rows of ids.
+ *
+ * @param workspace The workspace of the network, allocated after every layer is bound
+ * @param max_batch The largest batch of the training steps
+ */
+template <typename T>
+void Embedding_LayerT<T>::BindWorkspace(WorkspaceT<T> &workspace, int max_batch)
+{
+  size_t ids = (size_t)max_batch * m_inputs;
+
+  this->m_ws_output = workspace.Take(ids * this->m_weights.rows());
+  this->m_ws_input_error = workspace.Take(ids, Lifetime::ERROR);
+  ReserveColumns(std::min<size_t>(this->m_weights.cols(), ids));
+
+  this->m_workspace = &workspace;
+}
+
+
+/**
+ * @brief Training forward pass into the workspace buffers, nothing is allocated and the
+ *        ids are not copied.
+ *
+ * @param input The ids, they must stay valid until TrainBackward.
+ * @return const MatrixMap& The vectors of the ids, valid until the next call.
+ */
+template <typename T>
+const typename Embedding_LayerT<T>::MatrixMap& Embedding_LayerT<T>::TrainForward(const Ref<const Matrix>& input)
+{
+  if (this->m_workspace == nullptr)
+    return LayerT<T>::TrainForward(input);
+
+  int batch = input.rows();
+
+  new (&this->m_input_view) typename LayerT<T>::ConstMatrixMap(input.data(), batch, input.cols(), OuterStride<>(input.outerStride()));
+  new (&this->m_output_view) MatrixMap(this->m_workspace->Data(m_ws_output), batch, OutputSize(input.cols()));
+  Gather<T>(input, this->m_weights, this->m_output_view);
+
+  return this->m_output_view;
+}
+
+
+/**
+ * @brief Training backward pass, the gradients are kept for ApplyGradients as with
+ *        Backward.
+ *
+ * @param output_error The error of the layer's output.
+ * @return const MatrixMap& Zero, valid until the next call.
+ */
+template <typename T>
+const typename Embedding_LayerT<T>::MatrixMap& Embedding_LayerT<T>::TrainBackward(const Ref<const Matrix>& output_error)
+{
+  if (this->m_workspace == nullptr)
+    return LayerT<T>::TrainBackward(output_error);
+
+  Accumulate(this->m_input_view, output_error);
+
+  new (&this->m_error_view) MatrixMap(this->m_workspace->Data(m_ws_input_error), output_error.rows(), m_inputs);
+  this->m_error_view.setZero();
+
+  return this->m_error_view;
+}
+
+
+/**
+ * @brief Creates a copy of the layer, used for per-thread training replicas.
+ *
+ * @return Layer* The new layer.
+ */
+template <typename T>
+LayerT<T>* Embedding_LayerT<T>::Clone() const
+{
+  return new Embedding_LayerT(*this);
+}
+
+
+/**
+ * @brief Gets the analytical cost of the layer on a batch, it only moves the vectors of
+ *        the ids of the batch.
+ *
+ * @param batch Number of samples
+ * @return LayerCost The FLOPs and bytes of the layer calls
+ */
+template <typename T>
+LayerCost Embedding_LayerT<T>::GetCost(int batch) const
+{
+  double ids = (double)batch * m_inputs;
+  double values = ids * this->m_weights.rows();
+  LayerCost cost;
+
+  cost.backward_flops = values;
+  // ids read, vectors read and written
+  cost.forward_bytes = (ids + 2 * values) * sizeof(T);
+  // ids and output error read, gradient columns written
+  cost.backward_bytes = (ids + 2 * values) * sizeof(T);
+  // at most one column per id: vectors and gradients read, vectors written
+  cost.update_bytes = 3 * values * sizeof(T);
+
+  return cost;
+}
+
+
+/**
+ * @brief Copies the table of the layer it replicates. After one update of the other layer
+ *        since the last copy only the updated columns are copied, otherwise all of them.
+ *
+ * @param other The layer to copy from.
+ */
+template <typename T>
+void Embedding_LayerT<T>::CopyParameters(const LayerT<T> &other)
+{
+  const Embedding_LayerT &source = static_cast<const Embedding_LayerT&>(other);
+
+  if (m_synced + 1 == source.m_version) {
+    for (int id : source.m_updated)
+      this->m_weights.col(id) = source.m_weights.col(id);
+  }
+  else if (m_synced != source.m_version) {
+    this->m_weights = source.m_weights;
+  }
+
+  m_synced = source.m_version;
+}
+
+
+/**
+ * @brief Multiplies the gradient columns by a factor.
+ *
+ * @param factor The scale factor.
+ */
+template <typename T>
+void Embedding_LayerT<T>::ScaleGradients(double factor)
+{
+  GradColumns() *= T(factor);
+}
+
+
+/**
+ * @brief Adds the gradient columns of another layer of the same vocabulary, by id.
+ *
+ * @param other The layer to accumulate from.
+ */
+template <typename T>
+void Embedding_LayerT<T>::AddGradients(const LayerT<T> &other)
+{
+  const Embedding_LayerT &source = static_cast<const Embedding_LayerT&>(other);
+
+  ReserveColumns(std::min(m_slot.size(), m_columns.size() + source.m_columns.size()));
+
+  for (size_t j = 0; j < source.m_columns.size(); j++)
+    this->m_grad_weights.col(Slot(source.m_columns[j])) += source.m_grad_weights.col(j);
+}
+
+
+/**
+ * @brief Replaces the gradient columns with the ones of another layer of the same
+ *        vocabulary.
+ *
+ * @param other The layer to copy from.
+ */
+template <typename T>
+void Embedding_LayerT<T>::CopyGradients(const LayerT<T> &other)
+{
+  const Embedding_LayerT &source = static_cast<const Embedding_LayerT&>(other);
+
+  for (int id : m_columns)
+    m_slot[id] = -1;
+  m_columns.clear();
+  ReserveColumns(source.m_columns.size());
+
+  for (size_t j = 0; j < source.m_columns.size(); j++)
+    this->m_grad_weights.col(Slot(source.m_columns[j])) = source.m_grad_weights.col(j);
+}
+
+
+/**
+ * @brief Copies or adds the gradient columns into gradients kept apart from the layer, by
+ *        id. The sum keeps the column of every id of the vocabulary, not its vectors.
+ *
+ * @param sum The gradients to write.
+ * @param add Adds to the columns of the sum instead of replacing them.
+ */
+template <typename T>
+void Embedding_LayerT<T>::StoreGradients(typename LayerT<T>::Gradients &sum, bool add) const
+{
+  int dim = this->m_weights.rows();
+
+  if (sum.slot.size() != m_slot.size())
+    sum.slot.assign(m_slot.size(), -1);
+
+  if (!add) {
+    for (int id : sum.columns)
+      sum.slot[id] = -1;
+    sum.columns.clear();
+  }
+
+  // grows like ReserveColumns, a bound batch size allocates nothing after the first steps
+  size_t columns = std::min(m_slot.size(), sum.columns.size() + m_columns.size());
+  if ((size_t)sum.weights.cols() < columns)
+    sum.weights.conservativeResize(dim, columns);
+  sum.columns.reserve(columns);
+
+  for (size_t j = 0; j < m_columns.size(); j++) {
+    int id = m_columns[j];
+    if (sum.slot[id] < 0) {
+      sum.slot[id] = sum.columns.size();
+      sum.columns.push_back(id);
+      sum.weights.col(sum.slot[id]).setZero();
+    }
+    sum.weights.col(sum.slot[id]) += this->m_grad_weights.col(j);
+  }
+}
+
+
+/**
+ * @brief Replaces the gradient columns with gradients kept apart from the layer.
+ *
+ * @param sum The gradients to copy, written by StoreGradients of this layer.
+ */
+template <typename T>
+void Embedding_LayerT<T>::LoadGradients(const typename LayerT<T>::Gradients &sum)
+{
+  for (int id : m_columns)
+    m_slot[id] = -1;
+  m_columns.clear();
+  ReserveColumns(sum.columns.size());
+
+  for (size_t j = 0; j < sum.columns.size(); j++)
+    this->m_grad_weights.col(Slot(sum.columns[j])) = sum.weights.col(j);
+}
+
+
+/**
+ * @brief The stream format only stores Fc_Layer, an Embedding_Layer is saved by SaveModel.
+ *
+ * @param outfile The output file stream.
+ */
+template <typename T>
+void Embedding_LayerT<T>::SaveLayer(std::ofstream &outfile)
+{
+  cerr << "Embedding_Layer can't be saved in the stream format, use SaveModel !!" << endl;
+}
+
+
+/**
+ * @brief Adds the layer to a version 3 model file: the table as a blob, and the number of
+ *        ids per row as the record scalar.
+ *
+ * @param writer The model writer
+ * @return true if the layer was added
+ */
+template <typename T>
+bool Embedding_LayerT<T>::SaveRecord(ModelWriter &writer) const
+{
+  ModelLayerRecord record = {};
+  record.kind = static_cast<int32_t>(LayerKind::EMBEDDING);
+  record.activation = static_cast<int32_t>(ActivationType::NONE);
+  record.rows = this->m_weights.rows();
+  record.cols = this->m_weights.cols();
+  record.blob[0] = writer.AddBlob(this->m_weights.data(), this->m_weights.size() * sizeof(T));
+  record.scalar = m_inputs;
+
+  writer.AddLayer(record);
+
+  return true;
+}
+
+
+/**
+ * @brief Creates a layer over the table of a mapped model file, without copy when the file
+ *        has the scalar type of the layer.
+ *
+ * @param file The mapped model file
+ * @param record The layer record
+ * @return Embedding_LayerT* The new layer, nullptr if the record is out of the file
+ */
+template <typename T>
+Embedding_LayerT<T>* Embedding_LayerT<T>::MapLayer(const shared_ptr<ModelFile> &file, const ModelLayerRecord &record)
+{
+  int rows = record.rows;
+  int cols = record.cols;
+  size_t scalar_size = (file->GetDataType() == DataType::FLOAT32) ? sizeof(float) : sizeof(double);
+
+  if (rows <= 0 || cols <= 0 || record.scalar < 1 ||
+      !file->HasBlob(record.blob[0], (uint64_t)rows * cols * scalar_size)) {
+    cerr << "Embedding_Layer record is out of the model file !!" << endl;
+    return nullptr;
+  }
+
+  Embedding_LayerT *layer = new Embedding_LayerT();
+  layer->m_as_weight = true;
+  layer->m_inputs = static_cast<int>(record.scalar);
+  layer->m_slot.assign(cols, -1);
+
+  if (file->GetDataType() == DataTypeOf<T>::value) {
+    new (&layer->m_weights) MatrixMap(reinterpret_cast<T*>(file->Blob(record.blob[0])), rows, cols);
+    layer->m_mapping = file;
+  }
+  else {
+    Matrix weights;
+    file->CopyMatrix(record.blob[0], weights, rows, cols);
+    layer->AssignWeights(weights);
+  }
+
+  return layer;
+}
+
+
+/**
+ * @brief Sets the table of the layer, dim x vocab. Replicas copy all of it on their next
+ *        sync.
+ *
+ * @param weights A matrix containing the new vectors, one column per id.
+ */
+template <typename T>
+void Embedding_LayerT<T>::SetWeights(Matrix &weights)
+{
+  this->AssignWeights(weights);
+
+  for (int id : m_columns)
+    m_slot[id] = -1;
+  m_columns.clear();
+  m_slot.assign(weights.cols(), -1);
+  m_version += 2;
+}
+
+
+template class Neural::Embedding_LayerT<float>;
+template class Neural::Embedding_LayerT<double>;
@@ -1,67 +1,137 @@
 #include "layers/fc_layer.h"
 #include "core.h"
+#include "gemm.h"
 #include <fstream>
+#include <type_traits>
 
 using namespace std;
 using namespace Neural;
 using namespace Eigen;
 //using Eigen::MatrixXd;
 
+// output tile of the fused dense kernel, sized to stay in L2 cache
+static const int ROW_TILE = 128;
+static const int COL_TILE = 64;
+
+
+/**
+ * @brief Fused dense + bias + activation kernel. The output is computed tile by tile, each
+ *        tile gets its bias and activation right after its product while it is still in
+ *        cache. When output is net_sum the activation is applied in place, otherwise
+ *        net_sum keeps the pre-activation values for training. With a workspace the tile
+ *        products pack into its panels instead of allocating, small batches go to the
+ *        micro-kernels either way.
+ */
+template <typename T, typename Op>
+static void DenseForward(const Ref<const DynMatrix<T>> &input, const Ref<const DynMatrix<T>> &weights,
+                         const Ref<const DynMatrix<T>> &bias, Ref<DynMatrix<T>> net_sum, Ref<DynMatrix<T>> output,
+                         T alpha, WorkspaceT<T> *workspace = nullptr)
+{
+  int rows = input.rows();
+  int cols = weights.cols();
+  bool in_place = output.data() == net_sum.data();
+  // softmax normalizes whole rows, its tiles span every column
+  int col_tile = std::is_same<Op, ActivationOp<ActivationType::SOFTMAX, T>>::value ? cols : COL_TILE;
+
+  for (int i = 0; i < rows; i += ROW_TILE) {
+    int m = std::min(ROW_TILE, rows - i);
+
+    for (int j = 0; j < cols; j += col_tile) {
+      int n = std::min(col_tile, cols - j);
+      auto tile = net_sum.block(i, j, m, n);
+
+      if (workspace != nullptr)
+        workspace->Product(input.middleRows(i, m), weights.middleCols(j, n), tile);
+      else if (!SmallGemm::Product<T>(input.middleRows(i, m), weights.middleCols(j, n), tile))
+        tile.noalias() = input.middleRows(i, m) * weights.middleCols(j, n);
+      tile.rowwise() += bias.row(0).segment(j, n);
+
+      if (!in_place) {
+        auto out = output.block(i, j, m, n);
+        out = tile;
+        Op::Apply(out, alpha);
+      }
+      else {
+        Op::Apply(tile, alpha);
+      }
+    }
+  }
+}
+
+
 /**
  * @brief Construct a new Fc_Layer::Fc_Layer object
  * 
  * @param input_size size of input data
  * @param output_size size of output data
  */
-Fc_Layer::Fc_Layer(int input_size, int output_size, ActivationType activationType)
+template <typename T>
+Fc_LayerT<T>::Fc_LayerT(int input_size, int output_size, ActivationType activationType)
 {
   this->m_as_weight = true;
-  this->m_weights = Core::RandomMatrix(input_size, output_size, -1.0, 1.0);
-  this->m_bias = Core::RandomMatrix(1, output_size, -0.5, 0.5);
-
-  switch (activationType) {
-    case ActivationType::SIGMOID:
-      this->p_activation = new Sigmoid();
-      break;
-    case ActivationType::RELU:
-      this->p_activation = new ReLU();
-      break;
-    case ActivationType::LEAKY_RELU:
-      this->p_activation = new LeakyReLU();
-      break;
-    case ActivationType::ELU:
-      this->p_activation = new ELU();
-      break;
-    case ActivationType::TANH:
-      this->p_activation = new Tanh();
-      break;
-    case ActivationType::SOFTMAX:
-      this->p_activation = new Softmax();
-      break;
-    default:
-      this->p_activation = nullptr;
-  }
+  this->AssignWeights(Core::RandomMatrix<T>(input_size, output_size, -1.0, 1.0));
+  this->AssignBias(Core::RandomMatrix<T>(1, output_size, -0.5, 0.5));
+  this->m_activation = activationType;
+  this->m_alpha = DefaultAlpha<T>(activationType);
+  this->m_fused_softmax = false;
+}
+
+
+/**
+ * @brief Construct a copy of a Fc_Layer, with the same weights, bias and activation but
+ *        without optimizer state.
+ * 
+ * @param other The layer to copy
+ */
+template <typename T>
+Fc_LayerT<T>::Fc_LayerT(const Fc_LayerT &other)
+{
+  this->m_as_weight = true;
+  this->AssignWeights(other.m_weights);
+  this->AssignBias(other.m_bias);
+  this->m_activation = other.m_activation;
+  this->m_alpha = other.m_alpha;
+  this->m_fused_softmax = false;
 }
 
 
 /**
- * @brief Performs forward propagation on the current layer.
+ * @brief Performs forward propagation on the current layer, keeping the input, net sum and
+ *        output for the backward pass.
  * 
  * @param input The inputs of the Layer = The outputs of the previous Layer, or The data of the first Layer 
- * @return MatrixXd Output Matrix of forward propagation results.
+ * @return Matrix Output Matrix of forward propagation results.
  */
-MatrixXd Fc_Layer::FeedForward(const MatrixXd& input_data)
+template <typename T>
+DynMatrix<T> Fc_LayerT<T>::FeedForward(const Matrix& input_data)
 {
   this->m_input = input_data;
-  this->m_net_sum = (input_data * this->m_weights).rowwise() + this->m_bias.row(0);
-  
-  // calculate activation function output
-  if (p_activation != nullptr)
-    this->m_output = p_activation->Compute(m_net_sum);
-  else
-    this->m_output = m_net_sum;
+  this->m_net_sum.resize(input_data.rows(), this->m_weights.cols());
+  this->m_output.resize(input_data.rows(), this->m_weights.cols());
+
+  DispatchActivation<T>(m_activation, [&](auto op) {
+    DenseForward<T, decltype(op)>(input_data, this->m_weights, this->m_bias, this->m_net_sum, this->m_output, m_alpha);
+  });
+
+  return this->m_output;
+}
+
+
+/**
+ * @brief Performs inference forward propagation. Unlike FeedForward it keeps no training
+ *        cache and writes only into the caller's buffer, so threads can share the layer.
+ * 
+ * @param input_data The inputs of the Layer = The outputs of the previous Layer, or The data of the first Layer
+ * @param output Matrix receiving the forward propagation results
+ */
+template <typename T>
+void Fc_LayerT<T>::Forward(const Matrix& input_data, Matrix& output) const
+{
+  output.resize(input_data.rows(), this->m_weights.cols());
 
-  return m_output;
+  DispatchActivation<T>(m_activation, [&](auto op) {
+    DenseForward<T, decltype(op)>(input_data, this->m_weights, this->m_bias, output, output, m_alpha);
+  });
 }
 
 
@@ -71,50 +141,268 @@ MatrixXd Fc_Layer::FeedForward(const MatrixXd& input_data)
  * @param output_error The error of the layer's output, which is the difference between
  *                     the expected output and the actual output.
  * @param learning_rate The step size at each iteration for updating weights and biases.
- * @return MatrixXd The error of the input layer, which will be propagated backward to 
+ * @return Matrix The error of the input layer, which will be propagated backward to 
  *                  the previous layer.
  */
-MatrixXd Fc_Layer::BackPropagation(const MatrixXd& output_error, float learning_rate)
+template <typename T>
+DynMatrix<T> Fc_LayerT<T>::BackPropagation(const Matrix& output_error, float learning_rate)
 {
-  Eigen::MatrixXd gradient;
+  Matrix input_error = Backward(output_error);
+  this->ApplyGradients(learning_rate);
 
-  if (this->p_activation != nullptr)
-    gradient = this->p_activation->ComputeDerivative(this->m_net_sum).array() * output_error.array();
-  else
-    gradient = output_error;
+  return input_error;
+}
 
-  MatrixXd input_error = gradient * m_weights.transpose();
-  MatrixXd weight_error = m_input.transpose() * gradient;
-  MatrixXd bias_gradient = gradient.colwise().mean();
 
-  if (this->m_optimizer != nullptr) {
-    m_optimizer->UpdateWeights(m_weights, weight_error);
-    m_optimizer->UpdateBias(m_bias, bias_gradient);
-  }
-  else {
-    this->m_weights.noalias() -= learning_rate * weight_error;
-    this->m_bias.noalias() -= learning_rate * bias_gradient;
-  }
+/**
+ * @brief Computes the weight and bias gradients of the layer without updating them, the
+ *        gradients are kept until the next call and applied with ApplyGradients.
+ * 
+ * @param output_error The error of the layer's output.
+ * @return Matrix The error of the input layer.
+ */
+template <typename T>
+DynMatrix<T> Fc_LayerT<T>::Backward(const Matrix& output_error)
+{
+  Matrix gradient = output_error;
+
+  DispatchActivation<T>(m_activation, [&](auto op) {
+    decltype(op)::Derivative(this->m_net_sum, gradient, m_alpha);
+  });
+
+  this->m_grad_weights.resize(this->m_weights.rows(), this->m_weights.cols());
+  if (!SmallGemm::Product<T>(this->m_input, gradient, this->m_grad_weights, true, false))
+    this->m_grad_weights.noalias() = this->m_input.transpose() * gradient;
+  // the loss gradient is already averaged over the batch, the bias sums it like the weights
+  this->m_grad_bias = gradient.colwise().sum();
+
+  Matrix input_error(gradient.rows(), this->m_weights.rows());
+  if (!SmallGemm::Product<T>(gradient, this->m_weights, input_error, false, true))
+    input_error.noalias() = gradient * this->m_weights.transpose();
 
   return input_error;
 }
 
 
+/**
+ * @brief Takes the training buffers of the layer from a workspace: net sums, outputs,
+ *        gradients and input errors of max_batch rows, and the packing panels of its
+ *        products. The gradients of the parameters get their final shape. Without a
+ *        training activation the outputs are the net sums and the gradients the output
+ *        errors, those buffers are not taken.
+ * 
+ * @param workspace The workspace of the network, allocated after every layer is bound
+ * @param max_batch The largest batch of the training steps
+ */
+template <typename T>
+void Fc_LayerT<T>::BindWorkspace(WorkspaceT<T> &workspace, int max_batch)
+{
+  int in = this->m_weights.rows();
+  int out = this->m_weights.cols();
+  bool identity = TrainingActivation() == ActivationType::NONE;
+
+  this->m_ws_net_sum = workspace.Take((size_t)max_batch * out);
+  this->m_ws_output = identity ? m_ws_net_sum : workspace.Take((size_t)max_batch * out);
+  this->m_ws_gradient = identity ? 0 : workspace.Take((size_t)max_batch * out, Lifetime::SCRATCH);
+  this->m_ws_input_error = workspace.Take((size_t)max_batch * in, Lifetime::ERROR);
+
+  // forward tiles, weight gradient and input error
+  workspace.ReserveProduct(std::min(ROW_TILE, max_batch), m_activation == ActivationType::SOFTMAX ? out : std::min(COL_TILE, out), in);
+  workspace.ReserveProduct(in, out, max_batch);
+  workspace.ReserveProduct(max_batch, in, out);
+
+  this->m_grad_weights.resize(in, out);
+  this->m_grad_bias.resize(1, out);
+  this->m_workspace = &workspace;
+}
+
+
+/**
+ * @brief Training forward pass into the workspace buffers, the first input.rows() rows of
+ *        each buffer hold the batch. Nothing is allocated and the input is not copied.
+ * 
+ * @param input The batch inputs, they must stay valid until TrainBackward.
+ * @return const MatrixMap& The batch outputs, valid until the next call.
+ */
+template <typename T>
+const typename Fc_LayerT<T>::MatrixMap& Fc_LayerT<T>::TrainForward(const Ref<const Matrix>& input)
+{
+  if (this->m_workspace == nullptr)
+    return LayerT<T>::TrainForward(input);
+
+  int batch = input.rows();
+  int out = this->m_weights.cols();
+  MatrixMap net_sum = this->m_workspace->View(m_ws_net_sum, batch, out);
+
+  new (&this->m_input_view) typename LayerT<T>::ConstMatrixMap(input.data(), batch, input.cols(), OuterStride<>(input.outerStride()));
+  new (&this->m_output_view) MatrixMap(this->m_workspace->Data(m_ws_output), batch, out);
+
+  DispatchActivation<T>(TrainingActivation(), [&](auto op) {
+    DenseForward<T, decltype(op)>(input, this->m_weights, this->m_bias, net_sum, this->m_output_view, m_alpha, this->m_workspace);
+  });
+
+  return this->m_output_view;
+}
+
+
+/**
+ * @brief Training backward pass into the workspace buffers, the gradients are kept for
+ *        ApplyGradients as with Backward.
+ * 
+ * @param output_error The error of the layer's output.
+ * @return const MatrixMap& The error of the layer's input, valid until the next call.
+ */
+template <typename T>
+const typename Fc_LayerT<T>::MatrixMap& Fc_LayerT<T>::TrainBackward(const Ref<const Matrix>& output_error)
+{
+  if (this->m_workspace == nullptr)
+    return LayerT<T>::TrainBackward(output_error);
+
+  int batch = output_error.rows();
+  int in = this->m_weights.rows();
+  int out = this->m_weights.cols();
+  new (&this->m_error_view) MatrixMap(this->m_workspace->Data(m_ws_input_error), batch, in);
+
+  auto propagate = [&](const Ref<const Matrix> &gradient) {
+    this->m_workspace->Product(this->m_input_view, gradient, this->m_grad_weights, true, false);
+    this->m_grad_bias = gradient.colwise().sum();
+    this->m_workspace->Product(gradient, this->m_weights, this->m_error_view, false, true);
+  };
+
+  // without activation the output error is the gradient of the net sums
+  if (TrainingActivation() == ActivationType::NONE) {
+    propagate(output_error);
+    return this->m_error_view;
+  }
+
+  MatrixMap net_sum = this->m_workspace->View(m_ws_net_sum, batch, out);
+  MatrixMap gradient = this->m_workspace->View(m_ws_gradient, batch, out);
+
+  gradient = output_error;
+
+  DispatchActivation<T>(TrainingActivation(), [&](auto op) {
+    decltype(op)::Derivative(net_sum, gradient, m_alpha);
+  });
+
+  propagate(gradient);
+
+  return this->m_error_view;
+}
+
+
+/**
+ * @brief Folds a final softmax into the loss: TrainForward outputs the logits and
+ *        TrainBackward takes the loss gradient as the gradient of the logits. Inference
+ *        keeps the softmax.
+ * 
+ * @param fuse Enables the folding, false restores the softmax in training
+ * @return true if the training outputs are logits, with a softmax or no activation
+ */
+template <typename T>
+bool Fc_LayerT<T>::FuseSoftmax(bool fuse)
+{
+  this->m_fused_softmax = fuse && m_activation == ActivationType::SOFTMAX;
+
+  return m_fused_softmax || m_activation == ActivationType::NONE;
+}
+
+
+/**
+ * @brief Takes over the activation of an activation layer that follows, when the layer has
+ *        none of its own. The activation is then applied on each output tile of the dense
+ *        kernel instead of in a pass of its own.
+ * 
+ * @param type The activation of the following layer
+ * @param alpha Its parameter
+ * @return true if the layer applies the activation from now on
+ */
+template <typename T>
+bool Fc_LayerT<T>::FoldActivation(ActivationType type, T alpha)
+{
+  if (m_activation != ActivationType::NONE)
+    return false;
+
+  this->m_activation = type;
+  this->m_alpha = alpha;
+
+  return true;
+}
+
+
+/**
+ * @brief The activation of the training passes, none when the softmax is in the loss.
+ * 
+ * @return ActivationType The activation of TrainForward and TrainBackward
+ */
+template <typename T>
+ActivationType Fc_LayerT<T>::TrainingActivation() const
+{
+  return m_fused_softmax ? ActivationType::NONE : m_activation;
+}
+
+
+/**
+ * @brief Creates a copy of the layer, used for per-thread training replicas.
+ * 
+ * @return Layer* The new layer.
+ */
+template <typename T>
+LayerT<T>* Fc_LayerT<T>::Clone() const
+{
+  return new Fc_LayerT(*this);
+}
+
+
+/**
+ * @brief Gets the activation type of the layer.
+ * 
+ * @return ActivationType The activation type, NONE when the layer has no activation.
+ */
+template <typename T>
+ActivationType Fc_LayerT<T>::GetActivationType() const
+{
+  return this->m_activation;
+}
+
+
+/**
+ * @brief Gets the analytical cost of the layer on a batch: the products and the bias for
+ *        the forward pass, the weight gradient and input error products for the backward
+ *        pass, and the matrices each pass reads and writes once.
+ * 
+ * @param batch Number of samples
+ * @return LayerCost The FLOPs and bytes of the layer calls
+ */
+template <typename T>
+LayerCost Fc_LayerT<T>::GetCost(int batch) const
+{
+  double in = this->m_weights.rows();
+  double out = this->m_weights.cols();
+  double b = batch;
+  LayerCost cost;
+
+  cost.forward_flops = 2 * b * in * out + b * out;
+  cost.backward_flops = 4 * b * in * out + b * out;
+  // input, weights, bias read, net sum and output written
+  cost.forward_bytes = (b * in + in * out + out + 2 * b * out) * sizeof(T);
+  // output error and net sum, input, weights read, weight and bias gradients, input error written
+  cost.backward_bytes = (2 * b * out + b * in + 2 * in * out + out + b * in) * sizeof(T);
+  cost.update_bytes = 3 * (in * out + out) * sizeof(T);
+
+  return cost;
+}
+
+
 /**
  * @brief Saves the layer's configuration and parameters to an output file stream.
  * 
  * @param outfile The output file stream to which the layer's data will be written.
  */
-void Fc_Layer::SaveLayer(ofstream &outfile)
+template <typename T>
+void Fc_LayerT<T>::SaveLayer(ofstream &outfile)
 {
   // write activation type
-  ActivationType type;
-  if (this->p_activation != nullptr) {
-    type = this->p_activation->getType();
-  }
-  else {
-    type = ActivationType::NONE;
-  }
+  ActivationType type = GetActivationType();
 
   outfile.write(reinterpret_cast<const char*>(&type), sizeof(type));
 
@@ -123,7 +411,7 @@ void Fc_Layer::SaveLayer(ofstream &outfile)
   int cols = this->m_weights.cols();
   outfile.write(reinterpret_cast<const char*>(&rows), sizeof(int));
   outfile.write(reinterpret_cast<const char*>(&cols), sizeof(int));
-  outfile.write(reinterpret_cast<const char*>(m_weights.data()), rows * cols * sizeof(double));
+  outfile.write(reinterpret_cast<const char*>(this->m_weights.data()), rows * cols * sizeof(T));
 
   rows = this->m_bias.rows();
   cols = this->m_bias.cols();
@@ -131,7 +419,7 @@ void Fc_Layer::SaveLayer(ofstream &outfile)
   // write the bias of the layer
   outfile.write(reinterpret_cast<const char*>(&rows), sizeof(int));
   outfile.write(reinterpret_cast<const char*>(&cols), sizeof(int));
-  outfile.write(reinterpret_cast<const char*>(m_bias.data()), rows * cols * sizeof(double));
+  outfile.write(reinterpret_cast<const char*>(this->m_bias.data()), rows * cols * sizeof(T));
 }
 
 
@@ -139,9 +427,11 @@ void Fc_Layer::SaveLayer(ofstream &outfile)
  * @brief Loads the layer's configuration and parameters from an input file stream.
  * 
  * @param infile The input file stream from which the layer's data will be read.
- * @return Fc_Layer* A pointer to the newly created Fc_Layer with the loaded parameters.
+ * @param dtype The scalar type of the parameters in the file.
+ * @return Fc_LayerT* A pointer to the newly created Fc_Layer with the loaded parameters.
  */
-Fc_Layer* Fc_Layer::LoadLayer(ifstream &infile)
+template <typename T>
+Fc_LayerT<T>* Fc_LayerT<T>::LoadLayer(ifstream &infile, DataType dtype)
 {
   ActivationType type;
   infile.read(reinterpret_cast<char*>(&type), sizeof(type));
@@ -150,33 +440,105 @@ Fc_Layer* Fc_Layer::LoadLayer(ifstream &infile)
   infile.read(reinterpret_cast<char*>(&rows), sizeof(int));
   infile.read(reinterpret_cast<char*>(&cols), sizeof(int));
 
-  Fc_Layer *layer = new Fc_Layer(rows, cols, type);
+  // the parameters come from the file, skip the random initialization
+  Fc_LayerT *layer = new Fc_LayerT();
+  layer->m_as_weight = true;
+  layer->m_activation = type;
+  layer->m_alpha = DefaultAlpha<T>(type);
 
-  MatrixXd weights;
-  weights.resize(rows, cols);
-  infile.read(reinterpret_cast<char*>(weights.data()), rows * cols * sizeof(double));
+  Matrix weights;
+  Core::ReadMatrix(infile, weights, rows, cols, dtype);
   layer->SetWeights(weights);
 
   infile.read(reinterpret_cast<char*>(&rows), sizeof(int));
   infile.read(reinterpret_cast<char*>(&cols), sizeof(int));
 
-  MatrixXd bias;
-  bias.resize(rows, cols);
-  infile.read(reinterpret_cast<char*>(bias.data()), rows * cols * sizeof(double));
+  Matrix bias;
+  Core::ReadMatrix(infile, bias, rows, cols, dtype);
   layer->SetBias(bias);
 
   return layer;
 }
 
 
+/**
+ * @brief Adds the layer to a version 3 model file: the weights and bias are written as
+ *        aligned blobs, the activation and its alpha in the layer record.
+ * 
+ * @param writer The model writer
+ * @return true if the layer was added
+ */
+template <typename T>
+bool Fc_LayerT<T>::SaveRecord(ModelWriter &writer) const
+{
+  ModelLayerRecord record = {};
+  record.kind = static_cast<int32_t>(LayerKind::FC);
+  record.activation = static_cast<int32_t>(this->m_activation);
+  record.rows = this->m_weights.rows();
+  record.cols = this->m_weights.cols();
+  record.blob[0] = writer.AddBlob(this->m_weights.data(), this->m_weights.size() * sizeof(T));
+  record.blob[1] = writer.AddBlob(this->m_bias.data(), this->m_bias.size() * sizeof(T));
+  record.scalar = this->m_alpha;
+
+  writer.AddLayer(record);
+
+  return true;
+}
+
+
+/**
+ * @brief Creates a layer over the weights and bias of a mapped model file. When the file
+ *        has the scalar type of the layer nothing is copied, the pages are read on first
+ *        use, otherwise the parameters are converted into owned storage.
+ * 
+ * @param file The mapped model file
+ * @param record The layer record
+ * @return Fc_LayerT* The new layer, nullptr if the record points outside the file
+ */
+template <typename T>
+Fc_LayerT<T>* Fc_LayerT<T>::MapLayer(const shared_ptr<ModelFile> &file, const ModelLayerRecord &record)
+{
+  int rows = record.rows;
+  int cols = record.cols;
+  size_t scalar_size = (file->GetDataType() == DataType::FLOAT32) ? sizeof(float) : sizeof(double);
+
+  if (rows <= 0 || cols <= 0 ||
+      !file->HasBlob(record.blob[0], (uint64_t)rows * cols * scalar_size) ||
+      !file->HasBlob(record.blob[1], (uint64_t)cols * scalar_size)) {
+    cerr << "Fc_Layer record is out of the model file !!" << endl;
+    return nullptr;
+  }
+
+  Fc_LayerT *layer = new Fc_LayerT();
+  layer->m_as_weight = true;
+  layer->m_activation = static_cast<ActivationType>(record.activation);
+  layer->m_alpha = T(record.scalar);
+
+  if (file->GetDataType() == DataTypeOf<T>::value) {
+    layer->BindParameters(reinterpret_cast<T*>(file->Blob(record.blob[0])), rows, cols,
+                          reinterpret_cast<T*>(file->Blob(record.blob[1])), file);
+  }
+  else {
+    Matrix weights, bias;
+    file->CopyMatrix(record.blob[0], weights, rows, cols);
+    file->CopyMatrix(record.blob[1], bias, 1, cols);
+    layer->AssignWeights(weights);
+    layer->AssignBias(bias);
+  }
+
+  return layer;
+}
+
+
 /**
  * @brief Sets the weights of the layer.
  * 
  * @param weights A matrix containing the new weights for the layer.
  */
-void Fc_Layer::SetWeights(Eigen::MatrixXd &weights)
+template <typename T>
+void Fc_LayerT<T>::SetWeights(Matrix &weights)
 {
-  this->m_weights = weights;
+  this->AssignWeights(weights);
 }
 
 
@@ -185,7 +547,12 @@ void Fc_Layer::SetWeights(Eigen::MatrixXd &weights)
  * 
  * @param bias A matrix containing the new biases for the layer.
  */
-void Fc_Layer::SetBias(Eigen::MatrixXd &bias)
+template <typename T>
+void Fc_LayerT<T>::SetBias(Matrix &bias)
 {
-  this->m_bias = bias;
-}
\ No newline at end of file
+  this->AssignBias(bias);
+}
+
+
+template class Neural::Fc_LayerT<float>;
+template class Neural::Fc_LayerT<double>;
@@ -0,0 +1,220 @@
+#include "layers/layer.h"
+#include "model_file.h"
+
+using namespace Neural;
+using namespace Eigen;
+
+
+/**
+ * @brief Applies the gradients computed by the last Backward call to the weights and bias,
+ *        with the layer's optimizer or plain gradient descent.
+ * 
+ * @param learning_rate The step size used when no optimizer is set.
+ */
+template <typename T>
+void LayerT<T>::ApplyGradients(float learning_rate)
+{
+  if (!this->m_as_weight)
+    return;
+
+  if (this->m_optimizer != nullptr) {
+    m_optimizer->UpdateWeights(m_weights, m_grad_weights);
+    m_optimizer->UpdateBias(m_bias, m_grad_bias);
+  }
+  else {
+    this->m_weights.noalias() -= T(learning_rate) * m_grad_weights;
+    this->m_bias.noalias() -= T(learning_rate) * m_grad_bias;
+  }
+}
+
+
+/**
+ * @brief Training forward pass of a layer without workspace buffers, it runs FeedForward and
+ *        keeps the result in the layer. Layers bound to a workspace override it and write
+ *        into their buffers without allocating.
+ * 
+ * @param input The batch inputs, they must stay valid until TrainBackward.
+ * @return const MatrixMap& The batch outputs, valid until the next call.
+ */
+template <typename T>
+const typename LayerT<T>::MatrixMap& LayerT<T>::TrainForward(const Ref<const Matrix> &input)
+{
+  // copied into the kept matrix, a recomputed forward pass writes where the next layer reads
+  Matrix output = FeedForward(input);
+  this->m_output = output;
+  new (&this->m_output_view) MatrixMap(m_output.data(), m_output.rows(), m_output.cols());
+
+  return this->m_output_view;
+}
+
+
+/**
+ * @brief Training backward pass of a layer without workspace buffers, it runs Backward and
+ *        keeps the input error in the layer.
+ * 
+ * @param output_error The error of the layer's output.
+ * @return const MatrixMap& The error of the layer's input, valid until the next call.
+ */
+template <typename T>
+const typename LayerT<T>::MatrixMap& LayerT<T>::TrainBackward(const Ref<const Matrix> &output_error)
+{
+  this->m_input_error = Backward(output_error);
+  new (&this->m_error_view) MatrixMap(m_input_error.data(), m_input_error.rows(), m_input_error.cols());
+
+  return this->m_error_view;
+}
+
+
+/**
+ * @brief Copies weights into the owned storage of the layer and points the weight view
+ *        at it. A view over a mapped model file is replaced by an owned copy.
+ * 
+ * @param weights The new weights.
+ */
+template <typename T>
+void LayerT<T>::AssignWeights(const Ref<const Matrix> &weights)
+{
+  this->m_weight_storage = weights;
+  new (&this->m_weights) MatrixMap(m_weight_storage.data(), m_weight_storage.rows(), m_weight_storage.cols());
+}
+
+
+/**
+ * @brief Copies a bias into the owned storage of the layer and points the bias view at it.
+ * 
+ * @param bias The new bias.
+ */
+template <typename T>
+void LayerT<T>::AssignBias(const Ref<const Matrix> &bias)
+{
+  this->m_bias_storage = bias;
+  new (&this->m_bias) MatrixMap(m_bias_storage.data(), m_bias_storage.rows(), m_bias_storage.cols());
+}
+
+
+/**
+ * @brief Points the weight and bias views at memory of a mapped model file, without copy.
+ *        The layer keeps the mapping alive.
+ * 
+ * @param weights The rows x cols weights, column-major.
+ * @param rows Number of inputs.
+ * @param cols Number of outputs.
+ * @param bias The 1 x cols bias.
+ * @param mapping The mapped model file holding the memory.
+ */
+template <typename T>
+void LayerT<T>::BindParameters(T *weights, int rows, int cols, T *bias, const std::shared_ptr<ModelFile> &mapping)
+{
+  this->m_weight_storage.resize(0, 0);
+  this->m_bias_storage.resize(0, 0);
+  new (&this->m_weights) MatrixMap(weights, rows, cols);
+  new (&this->m_bias) MatrixMap(bias, 1, cols);
+  this->m_mapping = mapping;
+}
+
+
+/**
+ * @brief Copies the weights and bias of another layer of the same shape.
+ * 
+ * @param other The layer to copy from.
+ */
+template <typename T>
+void LayerT<T>::CopyParameters(const LayerT &other)
+{
+  this->m_weights = other.m_weights;
+  this->m_bias = other.m_bias;
+}
+
+
+/**
+ * @brief Points the weights and bias of the layer at the ones of another layer of the same
+ *        shape, without copy. An update through either layer changes both.
+ * 
+ * @param other The layer that owns the parameters, it must outlive this one.
+ */
+template <typename T>
+void LayerT<T>::ShareParameters(LayerT &other)
+{
+  this->m_weight_storage.resize(0, 0);
+  this->m_bias_storage.resize(0, 0);
+  new (&this->m_weights) MatrixMap(other.m_weights.data(), other.m_weights.rows(), other.m_weights.cols());
+  new (&this->m_bias) MatrixMap(other.m_bias.data(), other.m_bias.rows(), other.m_bias.cols());
+  this->m_mapping = other.m_mapping;
+}
+
+
+/**
+ * @brief Multiplies the stored gradients by a factor.
+ * 
+ * @param factor The scale factor.
+ */
+template <typename T>
+void LayerT<T>::ScaleGradients(double factor)
+{
+  this->m_grad_weights *= T(factor);
+  this->m_grad_bias *= T(factor);
+}
+
+
+/**
+ * @brief Adds the stored gradients of another layer of the same shape to this one.
+ * 
+ * @param other The layer to accumulate from.
+ */
+template <typename T>
+void LayerT<T>::AddGradients(const LayerT &other)
+{
+  this->m_grad_weights += other.m_grad_weights;
+  this->m_grad_bias += other.m_grad_bias;
+}
+
+
+
+/**
+ * @brief Replaces the stored gradients with the ones of another layer of the same shape.
+ * 
+ * @param other The layer to copy from.
+ */
+template <typename T>
+void LayerT<T>::CopyGradients(const LayerT &other)
+{
+  this->m_grad_weights = other.m_grad_weights;
+  this->m_grad_bias = other.m_grad_bias;
+}
+
+
+/**
+ * @brief Copies or adds the stored gradients into gradients kept apart from the layer.
+ * 
+ * @param sum The gradients to write, of the same shape when adding.
+ * @param add Adds to the sum instead of replacing it.
+ */
+template <typename T>
+void LayerT<T>::StoreGradients(Gradients &sum, bool add) const
+{
+  if (add) {
+    sum.weights += this->m_grad_weights;
+    sum.bias += this->m_grad_bias;
+  }
+  else {
+    sum.weights = this->m_grad_weights;
+    sum.bias = this->m_grad_bias;
+  }
+}
+
+
+/**
+ * @brief Replaces the stored gradients with gradients kept apart from the layer.
+ * 
+ * @param sum The gradients to copy, written by StoreGradients of this layer.
+ */
+template <typename T>
+void LayerT<T>::LoadGradients(const Gradients &sum)
+{
+  this->m_grad_weights = sum.weights;
+  this->m_grad_bias = sum.bias;
+}
+
+
+template class Neural::LayerT<float>;
+template class Neural::LayerT<double>;
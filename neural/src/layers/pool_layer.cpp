@@ -0,0 +1,397 @@
+#include "layers/pool_layer.h"
+#include <fstream>
+#include <limits>
+
+using namespace std;
+using namespace Neural;
+using namespace Eigen;
+
+
+/**
+ * @brief Pools a batch column by column. For max pooling argmax receives the window tap of
+ *        every maximum, it may be nullptr when no backward pass follows.
+ */
+template <typename T>
+static void PoolForward(LayerKind kind, const WindowShape &shape, const Ref<const DynMatrix<T>> &input,
+                        Ref<DynMatrix<T>> output, int *argmax)
+{
+  int batch = input.rows();
+  int taps = shape.Taps();
+
+  for (int c = 0; c < shape.channels; c++) {
+    for (int p = 0; p < shape.Positions(); p++) {
+      int o = c * shape.Positions() + p;
+      T *out = output.col(o).data();
+      int *arg = (argmax != nullptr) ? argmax + (size_t)o * batch : nullptr;
+      int count = 0;
+
+      if (kind == LayerKind::MAX_POOL)
+        std::fill(out, out + batch, -numeric_limits<T>::infinity());
+      else
+        std::fill(out, out + batch, T(0));
+      if (arg != nullptr)
+        std::fill(arg, arg + batch, -1);
+
+      for (int t = 0; t < taps; t++) {
+        int pixel = shape.Tap(p, t);
+        if (pixel < 0)
+          continue;
+
+        const T *in = input.data() + (size_t)(c * shape.Pixels() + pixel) * input.outerStride();
+        count++;
+
+        if (kind == LayerKind::AVG_POOL) {
+          for (int s = 0; s < batch; s++)
+            out[s] += in[s];
+        }
+        else if (arg != nullptr) {
+          for (int s = 0; s < batch; s++) {
+            if (in[s] > out[s]) {
+              out[s] = in[s];
+              arg[s] = t;
+            }
+          }
+        }
+        else {
+          for (int s = 0; s < batch; s++)
+            out[s] = std::max(out[s], in[s]);
+        }
+      }
+
+      // a window entirely in the padding outputs zero
+      if (count == 0)
+        std::fill(out, out + batch, T(0));
+      else if (kind == LayerKind::AVG_POOL)
+        output.col(o) *= T(1) / count;
+    }
+  }
+}
+
+
+/**
+ * @brief Routes the output error back to the input pixels: to the maximum of each window,
+ *        or evenly to the taps inside the image for average pooling.
+ */
+template <typename T>
+static void PoolBackward(LayerKind kind, const WindowShape &shape, const Ref<const DynMatrix<T>> &output_error,
+                         Ref<DynMatrix<T>> input_error, const int *argmax)
+{
+  int batch = output_error.rows();
+  int taps = shape.Taps();
+  size_t stride = input_error.outerStride();
+
+  input_error.setZero();
+
+  for (int c = 0; c < shape.channels; c++) {
+    T *channel = input_error.col(c * shape.Pixels()).data();
+
+    for (int p = 0; p < shape.Positions(); p++) {
+      int o = c * shape.Positions() + p;
+      const T *error = output_error.data() + (size_t)o * output_error.outerStride();
+
+      if (kind == LayerKind::MAX_POOL) {
+        const int *arg = argmax + (size_t)o * batch;
+
+        for (int s = 0; s < batch; s++) {
+          if (arg[s] >= 0)
+            channel[shape.Tap(p, arg[s]) * stride + s] += error[s];
+        }
+        continue;
+      }
+
+      int count = 0;
+      for (int t = 0; t < taps; t++)
+        count += shape.Tap(p, t) >= 0;
+
+      for (int t = 0; t < taps; t++) {
+        int pixel = shape.Tap(p, t);
+        if (pixel < 0)
+          continue;
+
+        T *in = channel + pixel * stride;
+        for (int s = 0; s < batch; s++)
+          in[s] += error[s] / count;
+      }
+    }
+  }
+}
+
+
+/**
+ * @brief Construct a new Pool_Layer::Pool_Layer object
+ *
+ * @param kind MAX_POOL or AVG_POOL
+ * @param channels Number of input channels
+ * @param height Height of the input images
+ * @param width Width of the input images
+ * @param pool Size of the square window
+ * @param stride Step of the window, 0 for non-overlapping windows
+ * @param padding Pixels added on every side, never selected nor counted
+ */
+template <typename T>
+Pool_LayerT<T>::Pool_LayerT(LayerKind kind, int channels, int height, int width, int pool, int stride, int padding)
+  : Pool_LayerT(kind, WindowShape(channels, height, width, pool, (stride > 0) ? stride : pool, padding, 1))
+{
+  if (!m_shape.Valid())
+    cerr << "Pool_Layer window doesn't fit in the input !!" << endl;
+}
+
+
+/**
+ * @brief Construct a new Pool_Layer::Pool_Layer object of a given window.
+ *
+ * @param kind MAX_POOL or AVG_POOL
+ * @param shape The window of the pooling
+ */
+template <typename T>
+Pool_LayerT<T>::Pool_LayerT(LayerKind kind, const WindowShape &shape)
+{
+  this->m_as_weight = false;
+  this->m_kind = kind;
+  this->m_shape = shape;
+}
+
+
+/**
+ * @brief Performs forward propagation on the current layer, keeping the input rows and the
+ *        maxima for the backward pass.
+ *
+ * @param input_data The images, one per row
+ * @return Matrix The pooled images, one per row
+ */
+template <typename T>
+DynMatrix<T> Pool_LayerT<T>::FeedForward(const Matrix& input_data)
+{
+  int out = OutputSize(input_data.cols());
+
+  this->m_input = input_data;
+  this->m_output.resize(input_data.rows(), out);
+  if (m_kind == LayerKind::MAX_POOL)
+    m_argmax.resize((size_t)input_data.rows() * out);
+
+  PoolForward<T>(m_kind, m_shape, input_data, this->m_output, m_argmax.data());
+
+  return this->m_output;
+}
+
+
+/**
+ * @brief Performs inference forward propagation, keeping no training cache so threads can
+ *        share the layer.
+ *
+ * @param input_data The images, one per row
+ * @param output Matrix receiving the pooled images
+ */
+template <typename T>
+void Pool_LayerT<T>::Forward(const Matrix& input_data, Matrix& output) const
+{
+  output.resize(input_data.rows(), OutputSize(input_data.cols()));
+  PoolForward<T>(m_kind, m_shape, input_data, output, nullptr);
+}
+
+
+/**
+ * @brief Performs backward propagation on the current layer, it has nothing to update.
+ *
+ * @param output_error The error of the layer's output
+ * @param learning_rate Unused
+ * @return Matrix The error of the layer's input
+ */
+template <typename T>
+DynMatrix<T> Pool_LayerT<T>::BackPropagation(const Matrix& output_error, float learning_rate)
+{
+  return Backward(output_error);
+}
+
+
+/**
+ * @brief Computes the error of the layer's input from the last FeedForward.
+ *
+ * @param output_error The error of the layer's output
+ * @return Matrix The error of the layer's input
+ */
+template <typename T>
+DynMatrix<T> Pool_LayerT<T>::Backward(const Matrix& output_error)
+{
+  Matrix input_error(output_error.rows(), m_shape.InputSize());
+
+  PoolBackward<T>(m_kind, m_shape, output_error, input_error, m_argmax.data());
+
+  return input_error;
+}
+
+
+/**
+ * @brief Gets the size of the pooled images.
+ *
+ * @param input_size The size of the input rows, channels * height * width
+ * @return int channels * out_height * out_width
+ */
+template <typename T>
+int Pool_LayerT<T>::OutputSize(int input_size) const
+{
+  if (input_size != m_shape.InputSize())
+    cerr << "Pool_Layer expects " << m_shape.InputSize() << " inputs, not " << input_size << " !!" << endl;
+
+  return m_shape.channels * m_shape.Positions();
+}
+
+
+/**
+ * @brief Takes the output and input error buffers of the layer from a workspace, and sizes
+ *        the maxima for max_batch rows.
+ *
+ * @param workspace The workspace of the network, allocated after every layer is bound
+ * @param max_batch The largest batch of the training steps
+ */
+template <typename T>
+void Pool_LayerT<T>::BindWorkspace(WorkspaceT<T> &workspace, int max_batch)
+{
+  size_t out = (size_t)m_shape.channels * m_shape.Positions();
+
+  this->m_ws_output = workspace.Take(max_batch * out);
+  this->m_ws_input_error = workspace.Take((size_t)max_batch * m_shape.InputSize(), Lifetime::ERROR);
+  if (m_kind == LayerKind::MAX_POOL)
+    m_argmax.resize(max_batch * out);
+
+  this->m_workspace = &workspace;
+}
+
+
+/**
+ * @brief Training forward pass into the workspace buffers, nothing is allocated and the
+ *        input is not copied.
+ *
+ * @param input The images, they must stay valid until TrainBackward.
+ * @return const MatrixMap& The pooled images, valid until the next call.
+ */
+template <typename T>
+const typename Pool_LayerT<T>::MatrixMap& Pool_LayerT<T>::TrainForward(const Ref<const Matrix>& input)
+{
+  if (this->m_workspace == nullptr)
+    return LayerT<T>::TrainForward(input);
+
+  int batch = input.rows();
+
+  new (&this->m_output_view) MatrixMap(this->m_workspace->Data(m_ws_output), batch, m_shape.channels * m_shape.Positions());
+  PoolForward<T>(m_kind, m_shape, input, this->m_output_view, m_argmax.data());
+
+  return this->m_output_view;
+}
+
+
+/**
+ * @brief Training backward pass into the workspace buffers.
+ *
+ * @param output_error The error of the layer's output.
+ * @return const MatrixMap& The error of the layer's input, valid until the next call.
+ */
+template <typename T>
+const typename Pool_LayerT<T>::MatrixMap& Pool_LayerT<T>::TrainBackward(const Ref<const Matrix>& output_error)
+{
+  if (this->m_workspace == nullptr)
+    return LayerT<T>::TrainBackward(output_error);
+
+  new (&this->m_error_view) MatrixMap(this->m_workspace->Data(m_ws_input_error), output_error.rows(), m_shape.InputSize());
+  PoolBackward<T>(m_kind, m_shape, output_error, this->m_error_view, m_argmax.data());
+
+  return this->m_error_view;
+}
+
+
+/**
+ * @brief Creates a copy of the layer, used for per-thread training replicas.
+ *
+ * @return Layer* The new layer.
+ */
+template <typename T>
+LayerT<T>* Pool_LayerT<T>::Clone() const
+{
+  return new Pool_LayerT(m_kind, m_shape);
+}
+
+
+/**
+ * @brief Gets the analytical cost of the layer on a batch: one operation per window tap,
+ *        and the input and output read or written once.
+ *
+ * @param batch Number of samples
+ * @return LayerCost The FLOPs and bytes of the layer calls
+ */
+template <typename T>
+LayerCost Pool_LayerT<T>::GetCost(int batch) const
+{
+  double in = (double)batch * m_shape.InputSize();
+  double out = (double)batch * m_shape.channels * m_shape.Positions();
+  LayerCost cost;
+
+  cost.forward_flops = out * m_shape.Taps();
+  cost.backward_flops = (m_kind == LayerKind::MAX_POOL) ? out : out * m_shape.Taps();
+  cost.forward_bytes = (in + out) * sizeof(T);
+  cost.backward_bytes = (in + out) * sizeof(T);
+
+  return cost;
+}
+
+
+/**
+ * @brief The stream format only stores Fc_Layer, a pooling layer is saved by SaveModel.
+ *
+ * @param outfile The output file stream.
+ */
+template <typename T>
+void Pool_LayerT<T>::SaveLayer(std::ofstream &outfile)
+{
+  cerr << "Pool_Layer can't be saved in the stream format, use SaveModel !!" << endl;
+}
+
+
+/**
+ * @brief Adds the layer to a version 3 model file, the window shape is its only blob.
+ *
+ * @param writer The model writer
+ * @return true if the layer was added
+ */
+template <typename T>
+bool Pool_LayerT<T>::SaveRecord(ModelWriter &writer) const
+{
+  ModelLayerRecord record = {};
+  record.kind = static_cast<int32_t>(m_kind);
+  record.activation = static_cast<int32_t>(ActivationType::NONE);
+  record.rows = m_shape.channels;
+  record.cols = m_shape.channels * m_shape.Positions();
+  record.blob[0] = writer.AddBlob(m_shape.record, sizeof(m_shape.record));
+
+  writer.AddLayer(record);
+
+  return true;
+}
+
+
+/**
+ * @brief Creates a layer from its record in a mapped model file.
+ *
+ * @param file The mapped model file
+ * @param record The layer record
+ * @return Pool_LayerT* The new layer, nullptr if the record is out of the file or invalid
+ */
+template <typename T>
+Pool_LayerT<T>* Pool_LayerT<T>::MapLayer(const shared_ptr<ModelFile> &file, const ModelLayerRecord &record)
+{
+  if (!file->HasBlob(record.blob[0], WindowShape::FIELDS * sizeof(int32_t))) {
+    cerr << "Pool_Layer record is out of the model file !!" << endl;
+    return nullptr;
+  }
+
+  WindowShape shape = WindowShape::Read(reinterpret_cast<const int32_t*>(file->Blob(record.blob[0])));
+  if (!shape.Valid() || shape.channels != record.rows) {
+    cerr << "Pool_Layer record has an invalid shape !!" << endl;
+    return nullptr;
+  }
+
+  return new Pool_LayerT(static_cast<LayerKind>(record.kind), shape);
+}
+
+
+template class Neural::Pool_LayerT<float>;
+template class Neural::Pool_LayerT<double>;
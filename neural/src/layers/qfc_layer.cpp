@@ -0,0 +1,405 @@
+#include "layers/qfc_layer.h"
+#include "core.h"
+#include "gemm.h"
+#include <fstream>
+#include <cmath>
+#include <vector>
+
+using namespace std;
+using namespace Neural;
+using namespace Eigen;
+
+
+/**
+ * @brief Quantizes the weights of each output channel (column) with its own scale.
+ */
+template <typename T>
+static void QuantizeWeights(const Ref<const DynMatrix<T>> &weights, typename QFc_LayerT<T>::QMatrix &qweights, DynMatrix<T> &scale)
+{
+  qweights.resize(weights.rows(), weights.cols());
+  scale.resize(1, weights.cols());
+
+  for (int j = 0; j < weights.cols(); j++) {
+    T amax = weights.col(j).cwiseAbs().maxCoeff();
+    scale(0, j) = (amax > T(0)) ? amax / T(127) : T(1);
+
+    for (int k = 0; k < weights.rows(); k++) {
+      T q = std::nearbyint(weights(k, j) / scale(0, j));
+      qweights(k, j) = static_cast<int8_t>(std::max(T(-127), std::min(T(127), q)));
+    }
+  }
+}
+
+
+/**
+ * @brief Construct a new QFc_Layer::QFc_Layer object from a trained Fc_Layer.
+ * 
+ * @param layer The layer to quantize
+ * @param input_range The largest absolute input value seen during calibration
+ */
+template <typename T>
+QFc_LayerT<T>::QFc_LayerT(const Fc_LayerT<T> &layer, T input_range) : m_qweights(nullptr, 0, 0)
+{
+  this->m_as_weight = false;
+  this->AssignBias(layer.GetBias());
+  this->m_activation = layer.GetActivationType();
+  this->m_alpha = layer.GetAlpha();
+  this->m_input_scale = (input_range > T(0)) ? input_range / T(127) : T(1);
+
+  QuantizeWeights<T>(layer.GetWeights(), this->m_qweight_storage, this->m_weight_scale);
+  UseQWeightStorage();
+}
+
+
+/**
+ * @brief Points the int8 weight view at the owned storage.
+ * 
+ */
+template <typename T>
+void QFc_LayerT<T>::UseQWeightStorage()
+{
+  new (&this->m_qweights) QMatrixMap(m_qweight_storage.data(), m_qweight_storage.rows(), m_qweight_storage.cols());
+  PackWeights();
+}
+
+
+/**
+ * @brief Lays the int8 weights out for SmallGemm::Int8Product: one row per output, zero
+ *        padded to a multiple of SmallGemm::INT8_DEPTH, with the sum of each row. Mapped
+ *        layers keep this copy too, it is the size of their int8 weights.
+ * 
+ */
+template <typename T>
+void QFc_LayerT<T>::PackWeights()
+{
+  int inputs = this->m_qweights.rows();
+  int outputs = this->m_qweights.cols();
+  int depth = (inputs + SmallGemm::INT8_DEPTH - 1) / SmallGemm::INT8_DEPTH * SmallGemm::INT8_DEPTH;
+
+  m_qpacked.setZero(outputs, depth);
+  m_qpacked.leftCols(inputs) = this->m_qweights.transpose();
+  m_qsums = m_qpacked.template cast<int32_t>().rowwise().sum().transpose();
+}
+
+
+/**
+ * @brief Performs forward propagation on the current layer, the quantized layer keeps only
+ *        its output since it can't be trained.
+ * 
+ * @param input_data The inputs of the Layer
+ * @return Matrix Output Matrix of forward propagation results.
+ */
+template <typename T>
+DynMatrix<T> QFc_LayerT<T>::FeedForward(const Matrix& input_data)
+{
+  Forward(input_data, this->m_output);
+
+  return this->m_output;
+}
+
+
+/**
+ * @brief Performs inference forward propagation with the int8 kernel of SmallGemm. Inputs
+ *        are quantized with the calibrated scale, products are accumulated in int32, and requantization,
+ *        bias and activation are applied on each block of rows while it is in cache.
+ * 
+ * @param input_data The inputs of the Layer
+ * @param output Matrix receiving the forward propagation results
+ */
+template <typename T>
+void QFc_LayerT<T>::Forward(const Matrix& input_data, Matrix& output) const
+{
+  int batch = input_data.rows();
+  int inputs = this->m_qweights.rows();
+  int outputs = this->m_qweights.cols();
+  int depth = m_qpacked.cols();
+
+  // int8 inputs and int32 accumulators of a block of rows, per thread since several threads
+  // can predict on one layer, they only grow so steady-state calls don't allocate
+  const int block = SmallGemm::MAX_ROWS;
+  static thread_local std::vector<int8_t> qinput;
+  static thread_local std::vector<int32_t> acc;
+
+  if (qinput.size() < (size_t)block * depth)
+    qinput.resize((size_t)block * depth);
+  if (acc.size() < (size_t)block * outputs)
+    acc.resize((size_t)block * outputs);
+
+  output.resize(batch, outputs);
+
+  T inv_scale = T(1) / this->m_input_scale;
+
+  for (int b = 0; b < batch; b += block) {
+    int rows = std::min(block, batch - b);
+
+    // quantize the rows of the block, the padding past the inputs stays zero
+    for (int r = 0; r < rows; r++) {
+      int8_t *q = qinput.data() + (size_t)r * depth;
+
+      for (int k = 0; k < inputs; k++) {
+        T v = std::max(T(-127), std::min(T(127), input_data(b + r, k) * inv_scale));
+        q[k] = static_cast<int8_t>(v < T(0) ? v - T(0.5) : v + T(0.5));
+      }
+      std::fill(q + inputs, q + depth, 0);
+    }
+
+    SmallGemm::Int8Product(rows, outputs, depth, qinput.data(), depth, m_qpacked.data(), depth,
+                           m_qsums.data(), acc.data(), outputs);
+
+    // requantize, add bias and activate while the accumulators are in cache
+    for (int j = 0; j < outputs; j++) {
+      T scale = this->m_input_scale * this->m_weight_scale(0, j);
+      T bias = this->m_bias(0, j);
+
+      for (int r = 0; r < rows; r++) {
+        output(b + r, j) = T(acc[(size_t)r * outputs + j]) * scale + bias;
+      }
+    }
+
+    DispatchActivation<T>(this->m_activation, [&](auto op) {
+      decltype(op)::Apply(output.middleRows(b, rows), this->m_alpha);
+    });
+  }
+}
+
+
+/**
+ * @brief A quantized layer is frozen, training it is not supported.
+ * 
+ * @return Matrix A zero input error.
+ */
+template <typename T>
+DynMatrix<T> QFc_LayerT<T>::BackPropagation(const Matrix& output_error, float learning_rate)
+{
+  return Backward(output_error);
+}
+
+
+/**
+ * @brief A quantized layer is frozen, training it is not supported.
+ * 
+ * @return Matrix A zero input error.
+ */
+template <typename T>
+DynMatrix<T> QFc_LayerT<T>::Backward(const Matrix& output_error)
+{
+  cerr << "QFc_Layer is inference only, train the Fc_Layer before quantization !!" << endl;
+
+  return Matrix::Zero(output_error.rows(), this->m_qweights.rows());
+}
+
+
+/**
+ * @brief Creates a copy of the layer.
+ * 
+ * @return Layer* The new layer.
+ */
+template <typename T>
+LayerT<T>* QFc_LayerT<T>::Clone() const
+{
+  QFc_LayerT *layer = new QFc_LayerT();
+  layer->m_as_weight = false;
+  layer->AssignBias(this->m_bias);
+  layer->m_qweight_storage = this->m_qweights;
+  layer->UseQWeightStorage();
+  layer->m_weight_scale = this->m_weight_scale;
+  layer->m_input_scale = this->m_input_scale;
+  layer->m_activation = this->m_activation;
+  layer->m_alpha = this->m_alpha;
+
+  return layer;
+}
+
+
+/**
+ * @brief Gets the analytical cost of the layer on a batch, the integer multiply-adds of the
+ *        int8 product are counted like FLOPs.
+ * 
+ * @param batch Number of samples
+ * @return LayerCost The operations and bytes of a forward call
+ */
+template <typename T>
+LayerCost QFc_LayerT<T>::GetCost(int batch) const
+{
+  double in = this->m_qweights.rows();
+  double out = this->m_qweights.cols();
+  double b = batch;
+  LayerCost cost;
+
+  cost.forward_flops = 2 * b * in * out + 2 * b * out;
+  // input read and quantized, int8 weights, scales and bias read, output written
+  cost.forward_bytes = b * in * (sizeof(T) + 1) + in * out + 2 * out * sizeof(T) + b * out * sizeof(T);
+
+  return cost;
+}
+
+
+/**
+ * @brief Saves the layer's configuration, int8 weights, scales and activation parameter to
+ *        an output file stream.
+ * 
+ * @param outfile The output file stream to which the layer's data will be written.
+ */
+template <typename T>
+void QFc_LayerT<T>::SaveLayer(ofstream &outfile)
+{
+  outfile.write(reinterpret_cast<const char*>(&this->m_activation), sizeof(this->m_activation));
+
+  // write the int8 weights and the per channel scales
+  int rows = this->m_qweights.rows();
+  int cols = this->m_qweights.cols();
+  outfile.write(reinterpret_cast<const char*>(&rows), sizeof(int));
+  outfile.write(reinterpret_cast<const char*>(&cols), sizeof(int));
+  outfile.write(reinterpret_cast<const char*>(this->m_qweights.data()), rows * cols * sizeof(int8_t));
+  outfile.write(reinterpret_cast<const char*>(this->m_weight_scale.data()), cols * sizeof(T));
+  outfile.write(reinterpret_cast<const char*>(&this->m_input_scale), sizeof(T));
+  outfile.write(reinterpret_cast<const char*>(&this->m_alpha), sizeof(T));
+
+  // write the bias of the layer
+  outfile.write(reinterpret_cast<const char*>(this->m_bias.data()), cols * sizeof(T));
+}
+
+
+/**
+ * @brief Loads the layer's configuration, int8 weights and scales from an input file stream.
+ * 
+ * @param infile The input file stream from which the layer's data will be read.
+ * @param dtype The scalar type of the scales and bias in the file.
+ * @return QFc_LayerT* A pointer to the newly created QFc_Layer.
+ */
+template <typename T>
+QFc_LayerT<T>* QFc_LayerT<T>::LoadLayer(ifstream &infile, DataType dtype)
+{
+  QFc_LayerT *layer = new QFc_LayerT();
+  layer->m_as_weight = false;
+
+  infile.read(reinterpret_cast<char*>(&layer->m_activation), sizeof(layer->m_activation));
+
+  int rows, cols;
+  infile.read(reinterpret_cast<char*>(&rows), sizeof(int));
+  infile.read(reinterpret_cast<char*>(&cols), sizeof(int));
+
+  layer->m_qweight_storage.resize(rows, cols);
+  infile.read(reinterpret_cast<char*>(layer->m_qweight_storage.data()), rows * cols * sizeof(int8_t));
+  layer->UseQWeightStorage();
+  Core::ReadMatrix(infile, layer->m_weight_scale, 1, cols, dtype);
+
+  // the input scale and the activation parameter
+  Matrix scalars;
+  Core::ReadMatrix(infile, scalars, 1, 2, dtype);
+  layer->m_input_scale = scalars(0, 0);
+  layer->m_alpha = scalars(0, 1);
+
+  Matrix bias;
+  Core::ReadMatrix(infile, bias, 1, cols, dtype);
+  layer->AssignBias(bias);
+
+  return layer;
+}
+
+
+/**
+ * @brief Adds the layer to a version 3 model file: int8 weights, bias, per channel scales
+ *        and the input scale as aligned blobs, the activation parameter in the layer record
+ *        like the other layers.
+ * 
+ * @param writer The model writer
+ * @return true if the layer was added
+ */
+template <typename T>
+bool QFc_LayerT<T>::SaveRecord(ModelWriter &writer) const
+{
+  ModelLayerRecord record = {};
+  record.kind = static_cast<int32_t>(LayerKind::QUANTIZED_FC);
+  record.activation = static_cast<int32_t>(this->m_activation);
+  record.rows = this->m_qweights.rows();
+  record.cols = this->m_qweights.cols();
+  record.blob[0] = writer.AddBlob(this->m_qweights.data(), this->m_qweights.size() * sizeof(int8_t));
+  record.blob[1] = writer.AddBlob(this->m_bias.data(), this->m_bias.size() * sizeof(T));
+  record.blob[2] = writer.AddBlob(this->m_weight_scale.data(), this->m_weight_scale.size() * sizeof(T));
+  record.blob[3] = writer.AddBlob(&this->m_input_scale, sizeof(T));
+  record.scalar = this->m_alpha;
+
+  writer.AddLayer(record);
+
+  return true;
+}
+
+
+/**
+ * @brief Creates a layer over the int8 weights and bias of a mapped model file. The per
+ *        channel scales and the input scale are small and always copied.
+ * 
+ * @param file The mapped model file
+ * @param record The layer record
+ * @return QFc_LayerT* The new layer, nullptr if the record points outside the file
+ */
+template <typename T>
+QFc_LayerT<T>* QFc_LayerT<T>::MapLayer(const shared_ptr<ModelFile> &file, const ModelLayerRecord &record)
+{
+  int rows = record.rows;
+  int cols = record.cols;
+  size_t scalar_size = (file->GetDataType() == DataType::FLOAT32) ? sizeof(float) : sizeof(double);
+
+  if (rows <= 0 || cols <= 0 ||
+      !file->HasBlob(record.blob[0], (uint64_t)rows * cols) ||
+      !file->HasBlob(record.blob[1], (uint64_t)cols * scalar_size) ||
+      !file->HasBlob(record.blob[2], (uint64_t)cols * scalar_size) ||
+      !file->HasBlob(record.blob[3], scalar_size)) {
+    cerr << "QFc_Layer record is out of the model file !!" << endl;
+    return nullptr;
+  }
+
+  QFc_LayerT *layer = new QFc_LayerT();
+  layer->m_as_weight = false;
+  layer->m_activation = static_cast<ActivationType>(record.activation);
+  layer->m_alpha = T(record.scalar);
+  new (&layer->m_qweights) QMatrixMap(reinterpret_cast<int8_t*>(file->Blob(record.blob[0])), rows, cols);
+  layer->PackWeights();
+  layer->m_mapping = file;
+  file->CopyMatrix(record.blob[2], layer->m_weight_scale, 1, cols);
+
+  Matrix input_scale;
+  file->CopyMatrix(record.blob[3], input_scale, 1, 1);
+  layer->m_input_scale = input_scale(0, 0);
+
+  if (file->GetDataType() == DataTypeOf<T>::value) {
+    new (&layer->m_bias) typename LayerT<T>::MatrixMap(reinterpret_cast<T*>(file->Blob(record.blob[1])), 1, cols);
+  }
+  else {
+    Matrix bias;
+    file->CopyMatrix(record.blob[1], bias, 1, cols);
+    layer->AssignBias(bias);
+  }
+
+  return layer;
+}
+
+
+/**
+ * @brief Sets the weights of the layer, they are quantized with new per channel scales.
+ * 
+ * @param weights A matrix containing the new weights for the layer.
+ */
+template <typename T>
+void QFc_LayerT<T>::SetWeights(Matrix &weights)
+{
+  QuantizeWeights<T>(weights, this->m_qweight_storage, this->m_weight_scale);
+  UseQWeightStorage();
+}
+
+
+/**
+ * @brief Sets the biases of the layer.
+ * 
+ * @param bias A matrix containing the new biases for the layer.
+ */
+template <typename T>
+void QFc_LayerT<T>::SetBias(Matrix &bias)
+{
+  this->AssignBias(bias);
+}
+
+
+template class Neural::QFc_LayerT<float>;
+template class Neural::QFc_LayerT<double>;
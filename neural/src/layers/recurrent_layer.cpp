@@ -0,0 +1,754 @@
+#include "layers/recurrent_layer.h"
+#include "core.h"
+#include "gemm.h"
+#include <fstream>
+#include <cmath>
+
+using namespace std;
+using namespace Neural;
+using namespace Eigen;
+
+template <typename T>
+using StridedMap = Map<DynMatrix<T>, 0, OuterStride<>>;
+
+template <typename T>
+using BlockMap = Map<Array<T, Dynamic, Dynamic>, 0, OuterStride<>>;
+
+
+/**
+ * @brief The rows of one step of a stacked steps * batch x cols buffer.
+ */
+template <typename T>
+static StridedMap<T> StepRows(T *buffer, int step, int batch, int cols, Index stride)
+{
+  return StridedMap<T>(buffer + (size_t)step * batch, batch, cols, OuterStride<>(stride));
+}
+
+
+/**
+ * @brief Columns [column, column + span) of the rows of one step, batch x span values.
+ */
+template <typename T>
+static BlockMap<T> StepBlock(T *buffer, int step, int batch, int column, int span, Index stride)
+{
+  return BlockMap<T>(buffer + (size_t)column * stride + (size_t)step * batch, batch, span, OuterStride<>(stride));
+}
+
+
+/**
+ * @brief Hidden units processed at once by the gate kernels: one unit when the batch fills
+ *        the vector registers, more for small batches so a step is not a loop of
+ *        single-value expressions.
+ */
+static int UnitSpan(int batch, int hidden)
+{
+  return std::min(hidden, std::max(1, 64 / batch));
+}
+
+
+/**
+ * @brief Logistic function of an array expression.
+ */
+template <typename Derived>
+static auto GateSigmoid(const ArrayBase<Derived> &x)
+{
+  typedef typename Derived::Scalar T;
+  return (T(1) + (-x).exp()).inverse();
+}
+
+
+/**
+ * @brief Hyperbolic tangent of an array expression through exp, which Eigen vectorizes
+ *        for both scalar types when tanh is a scalar loop for double.
+ */
+template <typename Derived>
+static auto GateTanh(const ArrayBase<Derived> &x)
+{
+  typedef typename Derived::Scalar T;
+  return T(2) * GateSigmoid(T(2) * x) - T(1);
+}
+
+
+/**
+ * @brief dst = op(lhs) * op(rhs) with the workspace panels, or allocating without one.
+ */
+template <typename T>
+static void Multiply(WorkspaceT<T> *workspace, const Ref<const DynMatrix<T>> &lhs, const Ref<const DynMatrix<T>> &rhs,
+                     Ref<DynMatrix<T>> dst, bool transpose_lhs, bool transpose_rhs)
+{
+  if (workspace != nullptr)
+    workspace->Product(lhs, rhs, dst, transpose_lhs, transpose_rhs);
+  else if (SmallGemm::Product<T>(lhs, rhs, dst, transpose_lhs, transpose_rhs))
+    return;
+  else if (transpose_lhs)
+    dst.noalias() = lhs.transpose() * rhs;
+  else if (transpose_rhs)
+    dst.noalias() = lhs * rhs.transpose();
+  else
+    dst.noalias() = lhs * rhs;
+}
+
+
+/**
+ * @brief Construct a new Recurrent_Layer::Recurrent_Layer object. The weights are uniform in
+ *        +-1/sqrt(hidden), the LSTM forget gate bias starts at one and the others at zero.
+ *
+ * @param kind LSTM or GRU
+ * @param features Number of input features of a step
+ * @param hidden Size of the hidden state
+ * @param steps Number of steps of the sequences
+ * @param sequences Outputs the hidden state of every step, or of the last one
+ * @param bptt Steps of the truncated backpropagation, 0 for the whole sequence
+ */
+template <typename T>
+Recurrent_LayerT<T>::Recurrent_LayerT(LayerKind kind, int features, int hidden, int steps, bool sequences, int bptt)
+{
+  this->m_kind = kind;
+  this->m_features = features;
+  this->m_hidden = hidden;
+  this->m_steps = steps;
+  this->m_sequences = sequences;
+  this->m_bptt = bptt;
+
+  int32_t fields[FIELDS] = { features, hidden, steps, sequences, bptt };
+  std::copy(fields, fields + FIELDS, m_record);
+
+  int width = Gates() * hidden;
+  Matrix bias = Matrix::Zero(1, width);
+  if (kind == LayerKind::LSTM)
+    bias.middleCols(hidden, hidden).setOnes();
+
+  this->m_as_weight = true;
+  this->AssignWeights(Core::RandomMatrix<T>(features + hidden, width, -1.0, 1.0) / std::sqrt(T(hidden)));
+  this->AssignBias(bias);
+}
+
+
+/**
+ * @brief Construct a copy of a Recurrent_Layer, with the same shape and parameters but
+ *        without optimizer state.
+ *
+ * @param other The layer to copy
+ */
+template <typename T>
+Recurrent_LayerT<T>::Recurrent_LayerT(const Recurrent_LayerT &other)
+{
+  this->m_kind = other.m_kind;
+  this->m_features = other.m_features;
+  this->m_hidden = other.m_hidden;
+  this->m_steps = other.m_steps;
+  this->m_sequences = other.m_sequences;
+  this->m_bptt = other.m_bptt;
+  std::copy(other.m_record, other.m_record + FIELDS, m_record);
+
+  this->m_as_weight = true;
+  this->AssignWeights(other.m_weights);
+  this->AssignBias(other.m_bias);
+}
+
+
+/**
+ * @brief Scalars of the training buffers of a batch.
+ */
+template <typename T>
+size_t Recurrent_LayerT<T>::BufferSize(int batch) const
+{
+  size_t rows = (size_t)m_steps * batch;
+  size_t width = (size_t)Gates() * m_hidden;
+  size_t size = rows * m_features + rows * width + (rows + batch) * m_hidden + batch * width + 2 * batch * m_hidden;
+
+  if (m_kind == LayerKind::LSTM)
+    size += (rows + batch) * m_hidden;
+  else
+    size += rows * m_hidden + rows * width;
+
+  return size;
+}
+
+
+/**
+ * @brief Lays the training buffers of a batch out in BufferSize(batch) scalars.
+ */
+template <typename T>
+typename Recurrent_LayerT<T>::Buffers Recurrent_LayerT<T>::Layout(T *memory, int batch) const
+{
+  size_t rows = (size_t)m_steps * batch;
+  size_t width = (size_t)Gates() * m_hidden;
+  Buffers buffers = {};
+
+  buffers.inputs = memory;
+  buffers.gates = buffers.inputs + rows * m_features;
+  buffers.hidden = buffers.gates + rows * width;
+  buffers.recurrent = buffers.hidden + (rows + batch) * m_hidden;
+  buffers.hidden_error = buffers.recurrent + batch * width;
+  buffers.cell_error = buffers.hidden_error + batch * m_hidden;
+  T *end = buffers.cell_error + batch * m_hidden;
+
+  if (m_kind == LayerKind::LSTM) {
+    buffers.cells = end;
+  }
+  else {
+    buffers.candidate = end;
+    buffers.recurrent_gradient = buffers.candidate + rows * m_hidden;
+  }
+
+  return buffers;
+}
+
+
+/**
+ * @brief Fused gate kernel of a step, a span of hidden units at a time so the gate columns
+ *        of the units stay in L1: the recurrent product is added to the input projections, the
+ *        gates are activated in place and the new states written.
+ */
+template <typename T>
+void Recurrent_LayerT<T>::CellForward(const Buffers &buffers, int step, int batch) const
+{
+  Index rows = (Index)m_steps * batch;
+  Index states = rows + batch;
+  int H = m_hidden;
+  int span = UnitSpan(batch, H);
+
+  for (int j = 0; j < H; j += span) {
+    span = std::min(span, H - j);
+    auto h_prev = StepBlock<T>(buffers.hidden, step, batch, j, span, states);
+    auto h = StepBlock<T>(buffers.hidden, step + 1, batch, j, span, states);
+
+    if (m_kind == LayerKind::LSTM) {
+      auto i = StepBlock<T>(buffers.gates, step, batch, j, span, rows);
+      auto f = StepBlock<T>(buffers.gates, step, batch, H + j, span, rows);
+      auto g = StepBlock<T>(buffers.gates, step, batch, 2 * H + j, span, rows);
+      auto o = StepBlock<T>(buffers.gates, step, batch, 3 * H + j, span, rows);
+      auto c_prev = StepBlock<T>(buffers.cells, step, batch, j, span, states);
+      auto c = StepBlock<T>(buffers.cells, step + 1, batch, j, span, states);
+
+      i = GateSigmoid(i + StepBlock<T>(buffers.recurrent, 0, batch, j, span, batch));
+      f = GateSigmoid(f + StepBlock<T>(buffers.recurrent, 0, batch, H + j, span, batch));
+      g = GateTanh(g + StepBlock<T>(buffers.recurrent, 0, batch, 2 * H + j, span, batch));
+      o = GateSigmoid(o + StepBlock<T>(buffers.recurrent, 0, batch, 3 * H + j, span, batch));
+      c = f * c_prev + i * g;
+      h = o * GateTanh(c);
+    }
+    else {
+      auto r = StepBlock<T>(buffers.gates, step, batch, j, span, rows);
+      auto z = StepBlock<T>(buffers.gates, step, batch, H + j, span, rows);
+      auto n = StepBlock<T>(buffers.gates, step, batch, 2 * H + j, span, rows);
+      auto candidate = StepBlock<T>(buffers.candidate, step, batch, j, span, rows);
+
+      r = GateSigmoid(r + StepBlock<T>(buffers.recurrent, 0, batch, j, span, batch));
+      z = GateSigmoid(z + StepBlock<T>(buffers.recurrent, 0, batch, H + j, span, batch));
+      candidate = StepBlock<T>(buffers.recurrent, 0, batch, 2 * H + j, span, batch);
+      n = GateTanh(n + r * candidate);
+      h = n + z * (h_prev - n);
+    }
+  }
+}
+
+
+/**
+ * @brief Fused gate gradient kernel of a step. The gradients of the gate pre-activations
+ *        replace the gates, the cell error is carried to the previous step, and for the GRU
+ *        the direct part of the hidden error and the gradient of the recurrent products
+ *        are written. The LSTM keeps tanh(c) of a unit in the free recurrent buffer.
+ */
+template <typename T>
+void Recurrent_LayerT<T>::CellBackward(const Buffers &buffers, int step, int batch) const
+{
+  Index rows = (Index)m_steps * batch;
+  Index states = rows + batch;
+  int H = m_hidden;
+  int span = UnitSpan(batch, H);
+
+  for (int j = 0; j < H; j += span) {
+    span = std::min(span, H - j);
+    auto dh = StepBlock<T>(buffers.hidden_error, 0, batch, j, span, batch);
+
+    if (m_kind == LayerKind::LSTM) {
+      auto i = StepBlock<T>(buffers.gates, step, batch, j, span, rows);
+      auto f = StepBlock<T>(buffers.gates, step, batch, H + j, span, rows);
+      auto g = StepBlock<T>(buffers.gates, step, batch, 2 * H + j, span, rows);
+      auto o = StepBlock<T>(buffers.gates, step, batch, 3 * H + j, span, rows);
+      auto c_prev = StepBlock<T>(buffers.cells, step, batch, j, span, states);
+      auto tc = StepBlock<T>(buffers.recurrent, 0, batch, 0, span, batch);
+      auto dc = StepBlock<T>(buffers.cell_error, 0, batch, j, span, batch);
+
+      tc = GateTanh(StepBlock<T>(buffers.cells, step + 1, batch, j, span, states));
+      dc += dh * o * (T(1) - tc.square());
+      o = dh * tc * o * (T(1) - o);
+      dh = dc * g;            // gradient of i, the hidden error is rewritten after the step
+      g = dc * i * (T(1) - g.square());
+      i = dh * i * (T(1) - i);
+      dh = dc * c_prev;       // gradient of f
+      dc *= f;
+      f = dh * f * (T(1) - f);
+    }
+    else {
+      auto r = StepBlock<T>(buffers.gates, step, batch, j, span, rows);
+      auto z = StepBlock<T>(buffers.gates, step, batch, H + j, span, rows);
+      auto n = StepBlock<T>(buffers.gates, step, batch, 2 * H + j, span, rows);
+      auto candidate = StepBlock<T>(buffers.candidate, step, batch, j, span, rows);
+      auto h_prev = StepBlock<T>(buffers.hidden, step, batch, j, span, states);
+      auto dr = StepBlock<T>(buffers.recurrent_gradient, step, batch, j, span, rows);
+      auto dz = StepBlock<T>(buffers.recurrent_gradient, step, batch, H + j, span, rows);
+      auto dn = StepBlock<T>(buffers.recurrent_gradient, step, batch, 2 * H + j, span, rows);
+
+      dn = dh * (T(1) - z) * (T(1) - n.square());
+      dz = dh * (h_prev - n) * z * (T(1) - z);
+      dr = dn * candidate * r * (T(1) - r);
+      dh *= z;
+      n = dn;
+      dn *= r;
+      r = dr;
+      z = dz;
+    }
+  }
+}
+
+
+/**
+ * @brief Forward pass of a batch into the buffers: the inputs are stacked step by step and
+ *        projected in one product, then the steps run one recurrent product and one gate
+ *        kernel each. The hidden states of the output steps are copied to output.
+ */
+template <typename T>
+void Recurrent_LayerT<T>::Run(const Ref<const Matrix> &input, Buffers &buffers, Ref<Matrix> output,
+                              WorkspaceT<T> *workspace) const
+{
+  int batch = input.rows();
+  int F = m_features, H = m_hidden;
+  Index rows = (Index)m_steps * batch;
+  Index states = rows + batch;
+  auto weights_x = this->m_weights.topRows(F);
+  auto weights_h = this->m_weights.bottomRows(H);
+  Map<Matrix> inputs(buffers.inputs, rows, F);
+  Map<Matrix> gates(buffers.gates, rows, Gates() * H);
+  Map<Matrix> recurrent(buffers.recurrent, batch, Gates() * H);
+
+  for (int t = 0; t < m_steps; t++) {
+    for (int f = 0; f < F; f++) {
+      const T *src = input.data() + (size_t)(t * F + f) * input.outerStride();
+      std::copy(src, src + batch, inputs.col(f).data() + (size_t)t * batch);
+    }
+  }
+
+  Multiply<T>(workspace, inputs, weights_x, gates, false, false);
+  gates.rowwise() += this->m_bias.row(0);
+
+  StepRows<T>(buffers.hidden, 0, batch, H, states).setZero();
+  if (m_kind == LayerKind::LSTM)
+    StepRows<T>(buffers.cells, 0, batch, H, states).setZero();
+
+  for (int t = 0; t < m_steps; t++) {
+    Multiply<T>(workspace, StepRows<T>(buffers.hidden, t, batch, H, states), weights_h, recurrent, false, false);
+    CellForward(buffers, t, batch);
+  }
+
+  if (m_sequences) {
+    for (int t = 0; t < m_steps; t++)
+      output.middleCols(t * H, H) = StepRows<T>(buffers.hidden, t + 1, batch, H, states);
+  }
+  else {
+    output = StepRows<T>(buffers.hidden, m_steps, batch, H, states);
+  }
+}
+
+
+/**
+ * @brief Truncated backpropagation through time over the buffers of the last forward pass.
+ *        The steps run backward with one gate gradient kernel and one product for the
+ *        hidden error each, then the parameter gradients and the input error of all the
+ *        steps are three products.
+ */
+template <typename T>
+void Recurrent_LayerT<T>::RunBackward(const Ref<const Matrix> &output_error, const Buffers &buffers, Ref<Matrix> input_error,
+                                      WorkspaceT<T> *workspace)
+{
+  int batch = output_error.rows();
+  int F = m_features, H = m_hidden;
+  Index rows = (Index)m_steps * batch;
+  Index states = rows + batch;
+  int width = Gates() * H;
+  bool lstm = m_kind == LayerKind::LSTM;
+  auto weights_x = this->m_weights.topRows(F);
+  auto weights_h = this->m_weights.bottomRows(H);
+  Map<Matrix> inputs(buffers.inputs, rows, F);
+  Map<Matrix> gates(buffers.gates, rows, width);
+  Map<Matrix> hidden_error(buffers.hidden_error, batch, H);
+  Map<Matrix> cell_error(buffers.cell_error, batch, H);
+  Map<Matrix> direct(buffers.recurrent, batch, H);
+  // the LSTM gates are their own recurrent gradient
+  T *recurrent_gradient = lstm ? buffers.gates : buffers.recurrent_gradient;
+
+  hidden_error.setZero();
+  cell_error.setZero();
+
+  for (int t = m_steps - 1; t >= 0; t--) {
+    if (m_sequences)
+      hidden_error += output_error.middleCols(t * H, H);
+    else if (t == m_steps - 1)
+      hidden_error += output_error;
+
+    CellBackward(buffers, t, batch);
+
+    // the gradient is not carried into the previous truncation window
+    if (t == 0 || (m_bptt > 0 && t % m_bptt == 0)) {
+      hidden_error.setZero();
+      cell_error.setZero();
+      continue;
+    }
+
+    if (lstm) {
+      Multiply<T>(workspace, StepRows<T>(recurrent_gradient, t, batch, width, rows), weights_h, hidden_error, false, true);
+    }
+    else {
+      direct = hidden_error;
+      Multiply<T>(workspace, StepRows<T>(recurrent_gradient, t, batch, width, rows), weights_h, hidden_error, false, true);
+      hidden_error += direct;
+    }
+  }
+
+  this->m_grad_bias = gates.colwise().sum();
+  Multiply<T>(workspace, inputs, gates, this->m_grad_weights.topRows(F), true, false);
+  Multiply<T>(workspace, StridedMap<T>(buffers.hidden, rows, H, OuterStride<>(states)),
+              Map<Matrix>(recurrent_gradient, rows, width), this->m_grad_weights.bottomRows(H), true, false);
+
+  // the stacked inputs are not needed anymore, they receive the input error
+  Multiply<T>(workspace, gates, weights_x, inputs, false, true);
+
+  for (int t = 0; t < m_steps; t++) {
+    for (int f = 0; f < F; f++) {
+      const T *src = inputs.col(f).data() + (size_t)t * batch;
+      std::copy(src, src + batch, input_error.col(t * F + f).data());
+    }
+  }
+}
+
+
+/**
+ * @brief Performs forward propagation on the current layer, keeping the states of every
+ *        step for the backward pass.
+ *
+ * @param input_data The sequences, one per row
+ * @return Matrix The hidden states, one row per sequence
+ */
+template <typename T>
+DynMatrix<T> Recurrent_LayerT<T>::FeedForward(const Matrix& input_data)
+{
+  int batch = input_data.rows();
+
+  if ((size_t)m_storage.size() < BufferSize(batch))
+    m_storage.resize(BufferSize(batch), 1);
+
+  this->m_buffers = Layout(m_storage.data(), batch);
+  this->m_output.resize(batch, OutputSize(input_data.cols()));
+  Run(input_data, m_buffers, this->m_output, nullptr);
+
+  return this->m_output;
+}
+
+
+/**
+ * @brief Performs inference forward propagation in buffers of its own, so threads can
+ *        share the layer.
+ *
+ * @param input_data The sequences, one per row
+ * @param output Matrix receiving the hidden states
+ */
+template <typename T>
+void Recurrent_LayerT<T>::Forward(const Matrix& input_data, Matrix& output) const
+{
+  Matrix storage(BufferSize(input_data.rows()), 1);
+  Buffers buffers = Layout(storage.data(), input_data.rows());
+
+  output.resize(input_data.rows(), OutputSize(input_data.cols()));
+  Run(input_data, buffers, output, nullptr);
+}
+
+
+/**
+ * @brief Performs backward propagation on the current layer and updates it.
+ *
+ * @param output_error The error of the layer's output
+ * @param learning_rate The step size of the update
+ * @return Matrix The error of the layer's input
+ */
+template <typename T>
+DynMatrix<T> Recurrent_LayerT<T>::BackPropagation(const Matrix& output_error, float learning_rate)
+{
+  Matrix input_error = Backward(output_error);
+  this->ApplyGradients(learning_rate);
+
+  return input_error;
+}
+
+
+/**
+ * @brief Computes the weight and bias gradients of the last FeedForward without updating
+ *        them, the gradients are kept until the next call and applied with ApplyGradients.
+ *
+ * @param output_error The error of the layer's output
+ * @return Matrix The error of the layer's input
+ */
+template <typename T>
+DynMatrix<T> Recurrent_LayerT<T>::Backward(const Matrix& output_error)
+{
+  Matrix input_error(output_error.rows(), m_steps * m_features);
+
+  this->m_grad_weights.resize(this->m_weights.rows(), this->m_weights.cols());
+  RunBackward(output_error, m_buffers, input_error, nullptr);
+
+  return input_error;
+}
+
+
+/**
+ * @brief Gets the size of the output rows.
+ *
+ * @param input_size The size of the input rows, steps * features
+ * @return int steps * hidden for the sequences, hidden for the last state
+ */
+template <typename T>
+int Recurrent_LayerT<T>::OutputSize(int input_size) const
+{
+  if (input_size != m_steps * m_features)
+    cerr << "Recurrent layer expects " << m_steps * m_features << " inputs, not " << input_size << " !!" << endl;
+
+  return m_sequences ? m_steps * m_hidden : m_hidden;
+}
+
+
+/**
+ * @brief Takes the training buffers of the layer from a workspace: the states of every
+ *        step, the output and the input error of max_batch rows, and the packing panels of
+ *        the step and sequence products.
+ *
+ * @param workspace The workspace of the network, allocated after every layer is bound
+ * @param max_batch The largest batch of the training steps
+ */
+template <typename T>
+void Recurrent_LayerT<T>::BindWorkspace(WorkspaceT<T> &workspace, int max_batch)
+{
+  int F = m_features, H = m_hidden;
+  int width = Gates() * H;
+  int rows = m_steps * max_batch;
+
+  this->m_ws_buffers = workspace.Take(BufferSize(max_batch));
+  this->m_ws_output = workspace.Take((size_t)max_batch * OutputSize(m_steps * F));
+  this->m_ws_input_error = workspace.Take((size_t)max_batch * m_steps * F, Lifetime::ERROR);
+
+  // input projections, steps, hidden errors, weight gradients and input error
+  workspace.ReserveProduct(rows, width, F);
+  workspace.ReserveProduct(max_batch, width, H);
+  workspace.ReserveProduct(max_batch, H, width);
+  workspace.ReserveProduct(F, width, rows);
+  workspace.ReserveProduct(H, width, rows);
+  workspace.ReserveProduct(rows, F, width);
+
+  this->m_grad_weights.resize(F + H, width);
+  this->m_grad_bias.resize(1, width);
+  this->m_workspace = &workspace;
+}
+
+
+/**
+ * @brief Training forward pass into the workspace buffers, nothing is allocated.
+ *
+ * @param input The sequences, one per row.
+ * @return const MatrixMap& The hidden states, valid until the next call.
+ */
+template <typename T>
+const typename Recurrent_LayerT<T>::MatrixMap& Recurrent_LayerT<T>::TrainForward(const Ref<const Matrix>& input)
+{
+  if (this->m_workspace == nullptr)
+    return LayerT<T>::TrainForward(input);
+
+  int batch = input.rows();
+
+  this->m_buffers = Layout(this->m_workspace->Data(m_ws_buffers), batch);
+  new (&this->m_output_view) MatrixMap(this->m_workspace->Data(m_ws_output), batch, OutputSize(input.cols()));
+  Run(input, m_buffers, this->m_output_view, this->m_workspace);
+
+  return this->m_output_view;
+}
+
+
+/**
+ * @brief Training backward pass into the workspace buffers, the gradients are kept for
+ *        ApplyGradients as with Backward.
+ *
+ * @param output_error The error of the layer's output.
+ * @return const MatrixMap& The error of the layer's input, valid until the next call.
+ */
+template <typename T>
+const typename Recurrent_LayerT<T>::MatrixMap& Recurrent_LayerT<T>::TrainBackward(const Ref<const Matrix>& output_error)
+{
+  if (this->m_workspace == nullptr)
+    return LayerT<T>::TrainBackward(output_error);
+
+  new (&this->m_error_view) MatrixMap(this->m_workspace->Data(m_ws_input_error), output_error.rows(), m_steps * m_features);
+  RunBackward(output_error, m_buffers, this->m_error_view, this->m_workspace);
+
+  return this->m_error_view;
+}
+
+
+/**
+ * @brief Creates a copy of the layer, used for per-thread training replicas.
+ *
+ * @return Layer* The new layer.
+ */
+template <typename T>
+LayerT<T>* Recurrent_LayerT<T>::Clone() const
+{
+  return new Recurrent_LayerT(*this);
+}
+
+
+/**
+ * @brief Gets the analytical cost of the layer on a batch: the products of every step and
+ *        the states each pass reads and writes once.
+ *
+ * @param batch Number of samples
+ * @return LayerCost The FLOPs and bytes of the layer calls
+ */
+template <typename T>
+LayerCost Recurrent_LayerT<T>::GetCost(int batch) const
+{
+  double rows = (double)m_steps * batch;
+  double width = Gates() * m_hidden;
+  double parameters = (double)this->m_weights.size() + width;
+  double states = rows * (m_features + width + 2 * m_hidden);
+  LayerCost cost;
+
+  cost.forward_flops = 2 * rows * (m_features + m_hidden) * width + 10 * rows * width;
+  cost.backward_flops = 4 * rows * (m_features + m_hidden) * width + 12 * rows * width;
+  cost.forward_bytes = (states + parameters) * sizeof(T);
+  cost.backward_bytes = (2 * states + 2 * parameters) * sizeof(T);
+  cost.update_bytes = 3 * parameters * sizeof(T);
+
+  return cost;
+}
+
+
+/**
+ * @brief The stream format only stores Fc_Layer, a recurrent layer is saved by SaveModel.
+ *
+ * @param outfile The output file stream.
+ */
+template <typename T>
+void Recurrent_LayerT<T>::SaveLayer(std::ofstream &outfile)
+{
+  cerr << "Recurrent layers can't be saved in the stream format, use SaveModel !!" << endl;
+}
+
+
+/**
+ * @brief Adds the layer to a version 3 model file: the packed weights, the bias and the
+ *        shape fields as blobs.
+ *
+ * @param writer The model writer
+ * @return true if the layer was added
+ */
+template <typename T>
+bool Recurrent_LayerT<T>::SaveRecord(ModelWriter &writer) const
+{
+  ModelLayerRecord record = {};
+  record.kind = static_cast<int32_t>(m_kind);
+  record.activation = static_cast<int32_t>(ActivationType::NONE);
+  record.rows = this->m_weights.rows();
+  record.cols = this->m_weights.cols();
+  record.blob[0] = writer.AddBlob(this->m_weights.data(), this->m_weights.size() * sizeof(T));
+  record.blob[1] = writer.AddBlob(this->m_bias.data(), this->m_bias.size() * sizeof(T));
+  record.blob[2] = writer.AddBlob(m_record, sizeof(m_record));
+
+  writer.AddLayer(record);
+
+  return true;
+}
+
+
+/**
+ * @brief Creates a layer over the parameters of a mapped model file, without copy when the
+ *        file has the scalar type of the layer.
+ *
+ * @param file The mapped model file
+ * @param record The layer record
+ * @return Recurrent_LayerT* The new layer, nullptr if the record is out of the file or invalid
+ */
+template <typename T>
+Recurrent_LayerT<T>* Recurrent_LayerT<T>::MapLayer(const shared_ptr<ModelFile> &file, const ModelLayerRecord &record)
+{
+  int rows = record.rows;
+  int cols = record.cols;
+  size_t scalar_size = (file->GetDataType() == DataType::FLOAT32) ? sizeof(float) : sizeof(double);
+
+  if (rows <= 0 || cols <= 0 ||
+      !file->HasBlob(record.blob[0], (uint64_t)rows * cols * scalar_size) ||
+      !file->HasBlob(record.blob[1], (uint64_t)cols * scalar_size) ||
+      !file->HasBlob(record.blob[2], FIELDS * sizeof(int32_t))) {
+    cerr << "Recurrent layer record is out of the model file !!" << endl;
+    return nullptr;
+  }
+
+  const int32_t *fields = reinterpret_cast<const int32_t*>(file->Blob(record.blob[2]));
+  LayerKind kind = static_cast<LayerKind>(record.kind);
+  int gates = (kind == LayerKind::LSTM) ? 4 : 3;
+
+  if (fields[0] <= 0 || fields[1] <= 0 || fields[2] <= 0 || fields[4] < 0 ||
+      rows != fields[0] + fields[1] || cols != gates * fields[1]) {
+    cerr << "Recurrent layer record has an invalid shape !!" << endl;
+    return nullptr;
+  }
+
+  Recurrent_LayerT *layer = new Recurrent_LayerT();
+  layer->m_kind = kind;
+  layer->m_features = fields[0];
+  layer->m_hidden = fields[1];
+  layer->m_steps = fields[2];
+  layer->m_sequences = fields[3] != 0;
+  layer->m_bptt = fields[4];
+  std::copy(fields, fields + FIELDS, layer->m_record);
+  layer->m_as_weight = true;
+
+  if (file->GetDataType() == DataTypeOf<T>::value) {
+    layer->BindParameters(reinterpret_cast<T*>(file->Blob(record.blob[0])), rows, cols,
+                          reinterpret_cast<T*>(file->Blob(record.blob[1])), file);
+  }
+  else {
+    Matrix weights, bias;
+    file->CopyMatrix(record.blob[0], weights, rows, cols);
+    file->CopyMatrix(record.blob[1], bias, 1, cols);
+    layer->AssignWeights(weights);
+    layer->AssignBias(bias);
+  }
+
+  return layer;
+}
+
+
+/**
+ * @brief Sets the packed weights of the layer, (features + hidden) x (gates * hidden).
+ *
+ * @param weights A matrix containing the new weights for the layer.
+ */
+template <typename T>
+void Recurrent_LayerT<T>::SetWeights(Matrix &weights)
+{
+  this->AssignWeights(weights);
+}
+
+
+/**
+ * @brief Sets the biases of the gates, 1 x (gates * hidden).
+ *
+ * @param bias A matrix containing the new biases for the layer.
+ */
+template <typename T>
+void Recurrent_LayerT<T>::SetBias(Matrix &bias)
+{
+  this->AssignBias(bias);
+}
+
+
+template class Neural::Recurrent_LayerT<float>;
+template class Neural::Recurrent_LayerT<double>;
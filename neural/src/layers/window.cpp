@@ -0,0 +1,68 @@
+#include <algorithm>
+#include "layers/window.h"
+
+using namespace Neural;
+
+
+/**
+ * @brief Construct a new WindowShape::WindowShape object and its tap table.
+ *
+ * @param channels Number of input channels
+ * @param height Height of the input images
+ * @param width Width of the input images
+ * @param kernel Size of the square window
+ * @param stride Step of the window
+ * @param padding Zero pixels added on every side
+ * @param dilation Spacing of the window taps, 1 for adjacent pixels
+ */
+WindowShape::WindowShape(int channels, int height, int width, int kernel, int stride, int padding, int dilation)
+{
+  this->channels = channels;
+  this->height = height;
+  this->width = width;
+  this->kernel = kernel;
+  this->stride = stride;
+  this->padding = padding;
+  this->dilation = dilation;
+
+  int32_t fields[FIELDS] = { channels, height, width, kernel, stride, padding, dilation };
+  std::copy(fields, fields + FIELDS, record);
+
+  int span = dilation * (kernel - 1) + 1;
+  // the window must fit before dividing, the division truncates toward zero
+  bool valid = channels > 0 && kernel > 0 && stride > 0 && padding >= 0 && dilation > 0 &&
+               height + 2 * padding >= span && width + 2 * padding >= span;
+  this->out_height = valid ? (height + 2 * padding - span) / stride + 1 : 0;
+  this->out_width = valid ? (width + 2 * padding - span) / stride + 1 : 0;
+
+  if (!Valid())
+    return;
+
+  taps.resize((size_t)Positions() * Taps());
+
+  for (int oy = 0; oy < out_height; oy++) {
+    for (int ox = 0; ox < out_width; ox++) {
+      int *tap = &taps[(size_t)(oy * out_width + ox) * Taps()];
+
+      for (int ky = 0; ky < kernel; ky++) {
+        for (int kx = 0; kx < kernel; kx++) {
+          int y = oy * stride - padding + ky * dilation;
+          int x = ox * stride - padding + kx * dilation;
+          *tap++ = (y >= 0 && y < height && x >= 0 && x < width) ? y * width + x : -1;
+        }
+      }
+    }
+  }
+}
+
+
+/**
+ * @brief Reads a shape from its record.
+ *
+ * @param fields The FIELDS integers of the record
+ * @return WindowShape The shape, not Valid if the fields are not
+ */
+WindowShape WindowShape::Read(const int32_t *fields)
+{
+  return WindowShape(fields[0], fields[1], fields[2], fields[3], fields[4], fields[5], fields[6]);
+}
@@ -0,0 +1,117 @@
+#include <iostream>
+#include "mapped_file.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+using namespace Neural;
+
+
+/**
+ * @brief Construct a new MappedFile::MappedFile object
+ *
+ */
+MappedFile::MappedFile()
+{
+  this->m_data = nullptr;
+  this->m_size = 0;
+#ifdef _WIN32
+  this->m_file = nullptr;
+  this->m_mapping = nullptr;
+#endif
+}
+
+
+/**
+ * @brief Destroy the MappedFile::MappedFile object, unmaps the file.
+ *
+ */
+MappedFile::~MappedFile()
+{
+  Close();
+}
+
+
+/**
+ * @brief Unmaps the file.
+ *
+ */
+void MappedFile::Close()
+{
+#ifdef _WIN32
+  if (m_data != nullptr) UnmapViewOfFile(m_data);
+  if (m_mapping != nullptr) CloseHandle(m_mapping);
+  if (m_file != nullptr && m_file != INVALID_HANDLE_VALUE) CloseHandle(m_file);
+  this->m_file = nullptr;
+  this->m_mapping = nullptr;
+#else
+  if (m_data != nullptr) munmap(m_data, m_size);
+#endif
+  this->m_data = nullptr;
+  this->m_size = 0;
+}
+
+
+/**
+ * @brief Maps a whole file copy on write. Nothing is read until the pages are touched.
+ *
+ * @param name The file name
+ * @return true if the file is mapped
+ */
+bool MappedFile::Open(const string &name)
+{
+  Close();
+
+#ifdef _WIN32
+  HANDLE file = CreateFileA(name.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                            FILE_ATTRIBUTE_NORMAL, NULL);
+  this->m_file = file;
+  if (file == INVALID_HANDLE_VALUE) {
+    cerr << "Can't open file !!" << endl;
+    return false;
+  }
+
+  LARGE_INTEGER size;
+  GetFileSizeEx(file, &size);
+  this->m_size = size.QuadPart;
+
+  // copy on write view, the Windows counterpart of MAP_PRIVATE
+  if (m_size > 0)
+    this->m_mapping = CreateFileMappingA(file, NULL, PAGE_WRITECOPY, 0, 0, NULL);
+  if (m_mapping != nullptr)
+    this->m_data = static_cast<char*>(MapViewOfFile(m_mapping, FILE_MAP_COPY, 0, 0, 0));
+#else
+  int fd = open(name.c_str(), O_RDONLY);
+  if (fd < 0) {
+    cerr << "Can't open file !!" << endl;
+    return false;
+  }
+
+  struct stat st;
+  fstat(fd, &st);
+  this->m_size = st.st_size;
+
+  if (m_size > 0) {
+    void *data = mmap(nullptr, m_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    this->m_data = (data == MAP_FAILED) ? nullptr : static_cast<char*>(data);
+  }
+  close(fd);
+#endif
+
+  if (m_data == nullptr) {
+    cerr << "Can't map file !!" << endl;
+    Close();
+    return false;
+  }
+
+  return true;
+}
@@ -0,0 +1,238 @@
+#include <iostream>
+#include <fstream>
+#include <cstring>
+#include "model_file.h"
+
+using namespace std;
+using namespace Neural;
+using namespace Eigen;
+
+
+static uint64_t AlignUp(uint64_t offset)
+{
+  return (offset + MODEL_ALIGNMENT - 1) / MODEL_ALIGNMENT * MODEL_ALIGNMENT;
+}
+
+
+/**
+ * @brief 64-bit FNV-1a hash, used as the checksum of the model file sections.
+ *
+ * @param data The bytes to hash
+ * @param bytes Number of bytes
+ * @param hash The hash of the previous bytes, to hash a section in several parts
+ * @return uint64_t The hash
+ */
+uint64_t Neural::Fnv1a(const void *data, size_t bytes, uint64_t hash)
+{
+  const unsigned char *p = static_cast<const unsigned char*>(data);
+
+  for (size_t i = 0; i < bytes; i++) {
+    hash ^= p[i];
+    hash *= 0x100000001b3ull;
+  }
+
+  return hash;
+}
+
+
+/**
+ * @brief Construct a new ModelWriter::ModelWriter object
+ *
+ */
+ModelWriter::ModelWriter()
+{
+  this->m_data_size = 0;
+}
+
+
+/**
+ * @brief Adds a parameter blob to the data section. The memory must stay valid until Save.
+ *
+ * @param data The blob bytes
+ * @param bytes The blob size
+ * @return uint64_t The offset of the blob in the data section, 64-byte aligned
+ */
+uint64_t ModelWriter::AddBlob(const void *data, size_t bytes)
+{
+  uint64_t offset = AlignUp(this->m_data_size);
+
+  m_blobs.push_back({data, bytes, offset});
+  this->m_data_size = offset + bytes;
+
+  return offset;
+}
+
+
+/**
+ * @brief Appends a record to the layer table.
+ *
+ * @param record The layer record, its blob offsets come from AddBlob
+ */
+void ModelWriter::AddLayer(const ModelLayerRecord &record)
+{
+  m_records.push_back(record);
+}
+
+
+/**
+ * @brief Writes the header, the layer table and the aligned blobs.
+ *
+ * @param name The file name
+ * @param dtype The scalar type of the floating point blobs
+ * @return true if the file was written
+ */
+bool ModelWriter::Save(const string &name, DataType dtype)
+{
+  ofstream ofs(name.c_str(), ios::out | ios::binary | ios::trunc);
+
+  if (!ofs) {
+    cerr << "Can't open file !!" << endl;
+    return false;
+  }
+
+  ModelHeader header;
+  memset(&header, 0, sizeof(header));
+
+  uint64_t table_bytes = m_records.size() * sizeof(ModelLayerRecord);
+
+  header.magic = MODEL_MAGIC;
+  header.version = MODEL_VERSION;
+  header.byte_order = MODEL_BYTE_ORDER;
+  header.dtype = static_cast<int32_t>(dtype);
+  header.layer_count = m_records.size();
+  header.record_size = sizeof(ModelLayerRecord);
+  header.table_offset = sizeof(ModelHeader);
+  header.data_offset = AlignUp(header.table_offset + table_bytes);
+  header.data_size = AlignUp(this->m_data_size);
+  header.table_checksum = Fnv1a(m_records.data(), table_bytes);
+
+  // the padding is hashed as zeros, like it is written
+  static const char zeros[MODEL_ALIGNMENT] = {0};
+  uint64_t hash = 0xcbf29ce484222325ull;
+  uint64_t position = 0;
+
+  for (auto &blob : m_blobs) {
+    hash = Fnv1a(zeros, blob.offset - position, hash);
+    hash = Fnv1a(blob.data, blob.bytes, hash);
+    position = blob.offset + blob.bytes;
+  }
+  hash = Fnv1a(zeros, header.data_size - position, hash);
+  header.data_checksum = hash;
+
+  ofs.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  ofs.write(reinterpret_cast<const char*>(m_records.data()), table_bytes);
+  ofs.write(zeros, header.data_offset - header.table_offset - table_bytes);
+
+  position = 0;
+  for (auto &blob : m_blobs) {
+    ofs.write(zeros, blob.offset - position);
+    ofs.write(static_cast<const char*>(blob.data), blob.bytes);
+    position = blob.offset + blob.bytes;
+  }
+  ofs.write(zeros, header.data_size - position);
+
+  ofs.close();
+
+  return !ofs.fail();
+}
+
+
+/**
+ * @brief Maps a version 3 model file and checks its header and layer table. Parameter
+ *        pages are not touched, unless verify asks for the data checksum.
+ *
+ * @param name The file name
+ * @param verify Checks the checksum of the parameter blobs, this reads the whole file
+ * @return true if the file is a valid model
+ */
+bool ModelFile::Open(const string &name, bool verify)
+{
+  if (!m_file.Open(name))
+    return false;
+
+  if (m_file.Size() < sizeof(ModelHeader)) {
+    cerr << "Model file is truncated !!" << endl;
+    m_file.Close();
+    return false;
+  }
+
+  const ModelHeader &header = Header();
+
+  if (header.magic != MODEL_MAGIC || header.byte_order != MODEL_BYTE_ORDER) {
+    cerr << "Not a model file of this byte order !!" << endl;
+    m_file.Close();
+    return false;
+  }
+
+  if (header.version != MODEL_VERSION || header.record_size != sizeof(ModelLayerRecord)) {
+    cerr << "Unsupported model version " << header.version << " !!" << endl;
+    m_file.Close();
+    return false;
+  }
+
+  uint64_t table_bytes = (uint64_t)header.layer_count * sizeof(ModelLayerRecord);
+
+  if (header.layer_count < 0 || header.table_offset + table_bytes > m_file.Size() ||
+      header.data_offset + header.data_size > m_file.Size()) {
+    cerr << "Model file is truncated !!" << endl;
+    m_file.Close();
+    return false;
+  }
+
+  if (Fnv1a(m_file.Data() + header.table_offset, table_bytes) != header.table_checksum ||
+      (verify && Fnv1a(m_file.Data() + header.data_offset, header.data_size) != header.data_checksum)) {
+    cerr << "Model file checksum mismatch !!" << endl;
+    m_file.Close();
+    return false;
+  }
+
+  return true;
+}
+
+
+/**
+ * @brief Gets a record of the layer table.
+ *
+ * @param index The layer index
+ * @return const ModelLayerRecord& The record
+ */
+const ModelLayerRecord& ModelFile::Layer(int index) const
+{
+  return reinterpret_cast<const ModelLayerRecord*>(m_file.Data() + Header().table_offset)[index];
+}
+
+
+/**
+ * @brief Checks that a blob lies inside the data section.
+ *
+ * @param offset The blob offset in the data section
+ * @param bytes The blob size
+ * @return true if the blob is inside the file
+ */
+bool ModelFile::HasBlob(uint64_t offset, uint64_t bytes) const
+{
+  return offset <= Header().data_size && bytes <= Header().data_size - offset;
+}
+
+
+/**
+ * @brief Copies a rows x cols blob into a matrix, converting it when the file was saved
+ *        with another scalar type. Used when the blob can't be mapped directly.
+ *
+ * @param offset The blob offset in the data section
+ * @param m The matrix receiving the data
+ * @param rows Number of rows
+ * @param cols Number of columns
+ */
+template <typename T>
+void ModelFile::CopyMatrix(uint64_t offset, DynMatrix<T> &m, int rows, int cols)
+{
+  if (GetDataType() == DataType::FLOAT32)
+    m = Map<MatrixXf>(reinterpret_cast<float*>(Blob(offset)), rows, cols).cast<T>();
+  else
+    m = Map<MatrixXd>(reinterpret_cast<double*>(Blob(offset)), rows, cols).cast<T>();
+}
+
+
+template void ModelFile::CopyMatrix<float>(uint64_t offset, DynMatrix<float> &m, int rows, int cols);
+template void ModelFile::CopyMatrix<double>(uint64_t offset, DynMatrix<double> &m, int rows, int cols);
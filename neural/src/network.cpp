@@ -1,23 +1,44 @@
 #include <iostream>
 #include <fstream>
 #include <chrono>
+#include <algorithm>
+#include <cmath>
 #include "network.h"
+#include "model_file.h"
 
 
 using namespace std;
 using namespace Neural;
 using namespace Eigen;
 
-typedef Matrix<double, Dynamic, Dynamic, RowMajor> RowMajMat;
+typedef Eigen::Matrix<double, Dynamic, Dynamic, RowMajor> RowMajMat;
 
 
 /**
  * @brief Construct a new Network:: Network object
  * 
  */
-Network::Network()
+template <typename T>
+NetworkT<T>::NetworkT()
 {
   this->m_loss = nullptr;
+  this->m_threads = 1;
+  this->m_micro_batch = 0;
+  this->m_checkpoint = 0;
+  this->m_pipeline = 0;
+  this->m_schedule = PipelineSchedule::ONE_F_ONE_B;
+  this->m_stage_pool = nullptr;
+  this->m_hogwild = 0;
+  this->m_worker_pool = nullptr;
+  this->m_updates = 0;
+  this->m_staleness = 0;
+  this->m_pool = nullptr;
+  this->m_profiler = nullptr;
+  this->m_ws_loss_gradient = 0;
+  this->m_bound_batch = 0;
+  this->m_bound_inputs = 0;
+  this->m_compiled = false;
+  this->m_allocation_free = false;
 }
 
 
@@ -25,13 +46,21 @@ Network::Network()
  * @brief Destroy the Network:: Network object
  * 
  */
-Network::~Network()
+template <typename T>
+NetworkT<T>::~NetworkT()
 {
   for (int i = 0; i < m_layer.size(); i++) {
     delete(m_layer[i]);
   }
 
   delete m_loss;
+
+  ClearReplicas();
+  ClearStages();
+  delete m_pool;
+  delete m_stage_pool;
+  delete m_worker_pool;
+  delete m_profiler;
 }
 
 
@@ -40,9 +69,11 @@ Network::~Network()
  * 
  * @param layer The pointer of the Layer Mother (class Layer)
  */
-void Network::Add(Layer *layer)
+template <typename T>
+void NetworkT<T>::Add(LayerT<T> *layer)
 {
   m_layer.push_back(layer);
+  this->m_bound_batch = 0;
 }
 
 
@@ -51,20 +82,1105 @@ void Network::Add(Layer *layer)
  * 
  * @param l The pointer of th loss function
  */
-void Network::Use(Loss *l)
+template <typename T>
+void NetworkT<T>::Use(LossT<T> *l)
 {
   this->m_loss = l;
+  this->m_bound_batch = 0;
+}
+
+
+/**
+ * @brief Compiles the layer list into the plan the network runs. The list is walked once:
+ *        an activation layer after a layer without activation is folded into it and runs
+ *        on its output tiles, a ReLU, LeakyReLU or ELU layer after an output that can't be
+ *        negative is an identity and dropped. The training buffers of a compiled network
+ *        are then laid out by liveness, the backward buffers of the layers share memory.
+ *        Layers added afterwards are compiled by the next call.
+ * 
+ * @return CompileReport The layers folded and dropped
+ */
+template <typename T>
+CompileReport NetworkT<T>::Compile()
+{
+  auto non_negative = [](ActivationType type) {
+    return type == ActivationType::RELU || type == ActivationType::SIGMOID || type == ActivationType::SOFTMAX;
+  };
+  auto identity_on_non_negative = [](ActivationType type) {
+    return type == ActivationType::RELU || type == ActivationType::LEAKY_RELU || type == ActivationType::ELU;
+  };
+
+  CompileReport report;
+  vector<LayerT<T>*> plan;
+  report.layers = m_layer.size();
+
+  for (auto layer : m_layer) {
+    if (layer->GetKind() == LayerKind::ACTIVATION && !plan.empty()) {
+      auto activation = static_cast<Activation_LayerT<T>*>(layer);
+      ActivationType type = activation->GetActivationType();
+
+      if (non_negative(plan.back()->GetActivationType()) && identity_on_non_negative(type)) {
+        delete layer;
+        report.dropped++;
+        continue;
+      }
+
+      if (plan.back()->FoldActivation(type, activation->GetAlpha())) {
+        delete layer;
+        report.folded++;
+        continue;
+      }
+    }
+
+    plan.push_back(layer);
+  }
+
+  this->m_layer.swap(plan);
+  report.steps = m_layer.size();
+
+  ClearReplicas();
+  this->m_compiled = true;
+  this->m_bound_batch = 0;
+
+  return report;
 }
 
 
 /**
  * @brief Adding a optimizer to network
  */
-void Network::UseOptimizer(Optimizer* optimizer)
+template <typename T>
+void NetworkT<T>::UseOptimizer(OptimizerT<T>* optimizer)
 {
   for (auto layer : this->m_layer) {
     layer->m_optimizer = optimizer->Clone();
   }
+
+  // the workers of asynchronous training get copies of the new optimizer at the next bind
+  if (m_hogwild > 0) {
+    ClearReplicas();
+    this->m_bound_batch = 0;
+  }
+}
+
+
+/**
+ * @brief Sets the number of threads used by Fit. With more than one thread every mini-batch
+ *        is split across a thread pool, each thread computes the gradients of its part on its
+ *        own replica of the layers, and the gradients are reduced before a single update.
+ * 
+ * @param threads Number of training threads
+ */
+template <typename T>
+void NetworkT<T>::UseThreads(int threads)
+{
+  if (threads < 1)
+    threads = 1;
+
+  if (threads == this->m_threads)
+    return;
+
+  ClearReplicas();
+  delete m_pool;
+
+  this->m_threads = threads;
+  this->m_pool = (threads > 1) ? new ThreadPool(threads) : nullptr;
+  this->m_bound_batch = 0;
+}
+
+
+/**
+ * @brief Sets gradient accumulation. Every batch of Fit or TrainOnBatch is then split into
+ *        micro-batches of at most `rows` rows that run one after the other, their gradients
+ *        are summed in the network layers and the optimizer steps once per batch. The
+ *        training buffers are sized for one micro-batch, so the batch size is no longer
+ *        bound by memory and a small micro-batch keeps its activations in cache.
+ * 
+ * @param rows Rows of the largest micro-batch, 0 to train on whole batches
+ */
+template <typename T>
+void NetworkT<T>::UseMicroBatches(int rows)
+{
+  rows = std::max(rows, 0);
+
+  if (rows == this->m_micro_batch)
+    return;
+
+  ClearReplicas();
+  this->m_micro_batch = rows;
+  this->m_bound_batch = 0;
+}
+
+
+/**
+ * @brief Sets activation checkpointing. The layers are grouped in segments of `segment`
+ *        layers, the last layer of each segment keeps its outputs for the backward pass
+ *        and the others hold theirs only until the next layer has run. Before the backward
+ *        pass of a segment its other layers run forward again from the outputs kept by the
+ *        segment before. The training buffers are laid out by liveness, a network of L
+ *        layers keeps about L / segment + segment layers of activations instead of L, for
+ *        one more forward pass of most layers. A segment of about sqrt(L) keeps the least.
+ *        Layers without workspace buffers keep theirs.
+ * 
+ * @param segment Layers per segment, 0 or 1 keeps the outputs of every layer
+ */
+template <typename T>
+void NetworkT<T>::UseCheckpoints(int segment)
+{
+  segment = std::max(segment, 0);
+
+  if (segment == this->m_checkpoint)
+    return;
+
+  this->m_checkpoint = segment;
+  this->m_bound_batch = 0;
+}
+
+
+/**
+ * @brief Sets pipeline-parallel training. The layers are split into contiguous stages of
+ *        about the same training cost, each stage runs on a thread of its own and updates
+ *        its own layers, no layer is copied to the other threads. Every batch is split into
+ *        micro-batches, the micro-batches set by UseMicroBatches or 4 per stage, that flow
+ *        through the stages: each stage passes its outputs forward and its input errors
+ *        backward through lock-free queues, the gradients are summed over the micro-batches
+ *        and applied once per batch.
+ *
+ *        A stage keeps the inputs of its micro-batches, not their activations: a backward
+ *        pass runs the forward pass of the stage again unless it is the micro-batch of its
+ *        last forward pass, which is always the case on the last stage with 1F1B. The
+ *        stages of GPipe run every forward pass first, the stages of 1F1B only fill the
+ *        pipeline and then alternate forward and backward passes, so the gradients flow back
+ *        sooner. UseThreads does not apply to pipelined training.
+ * 
+ * @param stages Number of stages and threads, at most one per layer, 0 or 1 to turn it off
+ * @param schedule Order of the passes of a stage
+ */
+template <typename T>
+void NetworkT<T>::UsePipeline(int stages, PipelineSchedule schedule)
+{
+  stages = (stages > 1) ? stages : 0;
+
+  if (stages == this->m_pipeline && schedule == this->m_schedule)
+    return;
+
+  ClearStages();
+  delete m_stage_pool;
+
+  this->m_pipeline = stages;
+  this->m_schedule = schedule;
+  this->m_stage_pool = (stages > 1) ? new ThreadPool(stages) : nullptr;
+  this->m_bound_batch = 0;
+}
+
+
+/**
+ * @brief Sets asynchronous training without locks (Hogwild). Fit then runs `workers`
+ *        threads that each take the next mini-batch of the epoch, compute its gradients on
+ *        their own replica of the layers and apply them straight to the parameters of the
+ *        network, which every replica shares. The updates are not synchronized: a worker
+ *        may compute on parameters other workers are changing, and updates of the same
+ *        layer may overlap. On small models the steps are mostly independent and the
+ *        workers never wait for each other. Each worker has its own copy of the optimizer.
+ *        TrainOnBatch runs one step of the first worker.
+ *
+ *        The staleness of a step is the number of steps of the other workers applied
+ *        between its read of the parameters and its update, a conflict a layer update that
+ *        overlapped an update of the same layer by another worker, see GetHogwildReport.
+ * 
+ * @param workers Number of worker threads, 0 for synchronous training
+ */
+template <typename T>
+void NetworkT<T>::UseHogwild(int workers)
+{
+  workers = std::max(workers, 0);
+
+  if (workers == this->m_hogwild)
+    return;
+
+  ClearReplicas();
+  delete m_worker_pool;
+
+  this->m_hogwild = workers;
+  this->m_worker_pool = (workers > 0) ? new ThreadPool(workers) : nullptr;
+  this->m_bound_batch = 0;
+}
+
+
+/**
+ * @brief Turns the per-layer counters on or off. While on, every layer call of Fit and
+ *        Predict is timed and the heap allocations are counted, in builds with
+ *        NEURAL_COUNT_ALLOCATIONS; while off the counters cost a null pointer test per
+ *        layer call.
+ * 
+ * @param enable true to start profiling, false to stop and drop the counters
+ */
+template <typename T>
+void NetworkT<T>::EnableProfiling(bool enable)
+{
+  if (enable && m_profiler == nullptr) {
+    this->m_profiler = new Profiler();
+  }
+  else if (!enable) {
+    delete m_profiler;
+    this->m_profiler = nullptr;
+  }
+}
+
+
+/**
+ * @brief Gets the counters recorded since profiling was enabled or reset, with the kind and
+ *        shape of each layer.
+ * 
+ * @return ProfileReport The report, empty when profiling is off
+ */
+template <typename T>
+ProfileReport NetworkT<T>::GetProfile() const
+{
+  if (m_profiler == nullptr)
+    return ProfileReport();
+
+  ProfileReport report = m_profiler->Report();
+  report.layers.resize(m_layer.size());
+
+  for (int i = 0; i < m_layer.size(); i++) {
+    report.layers[i].index = i;
+    report.layers[i].kind = m_layer[i]->GetKind();
+    report.layers[i].inputs = m_layer[i]->GetWeights().rows();
+    report.layers[i].outputs = m_layer[i]->GetWeights().cols();
+  }
+
+  return report;
+}
+
+
+/**
+ * @brief Clears the profiling counters.
+ * 
+ */
+template <typename T>
+void NetworkT<T>::ResetProfile()
+{
+  if (m_profiler != nullptr)
+    m_profiler->Reset();
+}
+
+
+/**
+ * @brief Gets the memory of the training workspaces, of the network, its replicas or its
+ *        pipeline stages.
+ * 
+ * @return size_t The bytes of the workspaces, 0 before the first training step
+ */
+template <typename T>
+size_t NetworkT<T>::WorkspaceBytes() const
+{
+  size_t bytes = m_workspace.Bytes();
+
+  for (auto &workspace : m_replica_workspace) {
+    bytes += workspace.Bytes();
+  }
+
+  for (auto stage : m_stages) {
+    bytes += stage->workspace.Bytes();
+  }
+
+  return bytes;
+}
+
+
+/**
+ * @brief Gets the memory of the training buffers, the activations, gradients and errors of
+ *        the layers without the packing panels. With liveness sharing it is the most that
+ *        is live at once in a training step.
+ * 
+ * @return size_t The bytes of the buffers of the workspaces, 0 before the first training step
+ */
+template <typename T>
+size_t NetworkT<T>::ActivationBytes() const
+{
+  size_t bytes = m_workspace.BufferBytes();
+
+  for (auto &workspace : m_replica_workspace) {
+    bytes += workspace.BufferBytes();
+  }
+
+  // pipeline stages, with the inputs and output errors of the micro-batches in flight
+  for (auto stage : m_stages) {
+    bytes += stage->workspace.BufferBytes() + (stage->input.size() + stage->error.size()) * sizeof(T);
+  }
+
+  return bytes;
+}
+
+
+/**
+ * @brief Deletes the per-thread layer replicas.
+ * 
+ */
+template <typename T>
+void NetworkT<T>::ClearReplicas()
+{
+  for (auto &replica : m_replica) {
+    for (auto layer : replica) {
+      delete layer;
+    }
+  }
+
+  m_replica.clear();
+}
+
+
+/**
+ * @brief Deletes the pipeline stages.
+ * 
+ */
+template <typename T>
+void NetworkT<T>::ClearStages()
+{
+  for (auto stage : m_stages) {
+    delete stage;
+  }
+
+  m_stages.clear();
+}
+
+
+/**
+ * @brief Binds layers to a workspace, followed by the loss gradient, and allocates it. A
+ *        compiled or checkpointed network is bound twice, the second time on the buffers
+ *        packed by Share. A recomputed layer runs forward again at the backward step of the
+ *        layer that ends its segment.
+ * 
+ * @param layers The layers of the network or of one replica
+ * @param workspace The workspace
+ * @param max_batch The largest batch the layers train on
+ * @param inputs Number of network inputs
+ * @param output The layers end with the output layer, false for the first stages of a pipeline
+ * @return size_t The workspace offset of the loss gradient
+ */
+template <typename T>
+size_t NetworkT<T>::BindLayers(const vector<LayerT<T>*> &layers, WorkspaceT<T> &workspace, int max_batch, int inputs,
+                               bool output)
+{
+  int count = layers.size();
+  size_t loss_gradient = 0;
+
+  // the buffers of the output layer depend on its training activation, it is set first
+  bool logits = this->m_loss != nullptr && this->m_loss->TakesLogits();
+  if (output && !layers.empty() && !layers.back()->FuseSoftmax(logits) && logits)
+    cerr << "The loss expects logits, end the network with a softmax or linear Fc_Layer !!" << endl;
+
+  for (int pass = 0; pass < ((m_compiled || m_checkpoint > 0) ? 2 : 1); pass++) {
+    int width = inputs;
+
+    if (pass == 0)
+      workspace.Reset();
+    else
+      workspace.Share();
+
+    for (int k = 0; k < count; k++) {
+      int checkpoint = std::min(count - 1, (m_checkpoint > 0) ? (k / m_checkpoint + 1) * m_checkpoint - 1 : k);
+      workspace.SetLayer(k, count, Recomputed(k, count) ? 2 * count - checkpoint : -1);
+      layers[k]->BindWorkspace(workspace, max_batch);
+      width = layers[k]->OutputSize(width);
+    }
+
+    // the loss gradient is the input error of one more layer
+    if (output) {
+      workspace.SetLayer(count, count);
+      loss_gradient = workspace.Take((size_t)max_batch * width, Lifetime::ERROR);
+    }
+  }
+
+  workspace.Allocate();
+
+  for (auto layer : layers) {
+    if (!layer->TrainsInWorkspace())
+      this->m_allocation_free = false;
+  }
+
+  return loss_gradient;
+}
+
+
+/**
+ * @brief Lays out the training buffers for a maximum batch size, on the network layers or,
+ *        with several threads or micro-batches, on the replicas with the largest shard of a
+ *        micro-batch. The memory only grows, a Fit with the same shapes allocates nothing
+ *        here.
+ * 
+ * @param max_batch The largest batch of the training steps
+ * @param inputs Number of network inputs
+ */
+template <typename T>
+void NetworkT<T>::BindWorkspace(int max_batch, int inputs)
+{
+  this->m_allocation_free = true;
+
+  if (m_pipeline > 0) {
+    BindStages(max_batch, inputs);
+  }
+  else if (m_hogwild > 0) {
+    if (m_replica.size() != m_hogwild || m_replica[0].size() != m_layer.size()) {
+      ClearReplicas();
+      m_replica.resize(m_hogwild);
+      for (auto &replica : m_replica) {
+        for (auto layer : m_layer) {
+          LayerT<T> *copy = layer->Clone();
+          copy->ShareParameters(*layer);
+          if (layer->m_optimizer != nullptr)
+            copy->m_optimizer = layer->m_optimizer->Clone();
+          replica.push_back(copy);
+        }
+      }
+    }
+
+    m_replica_workspace.resize(m_hogwild);
+    for (int t = 0; t < m_hogwild; t++) {
+      this->m_ws_loss_gradient = BindLayers(m_replica[t], m_replica_workspace[t], max_batch, inputs);
+    }
+
+    this->m_writers.reset(new std::atomic<int>[m_layer.size()]());
+    m_worker_x.resize(m_hogwild);
+    m_worker_y.resize(m_hogwild);
+    m_worker_counters.resize(m_hogwild);
+  }
+  else if (OnReplicas()) {
+    if (m_replica.size() != m_threads || m_replica[0].size() != m_layer.size()) {
+      ClearReplicas();
+      m_replica.resize(m_threads);
+      for (auto &replica : m_replica) {
+        for (auto layer : m_layer) {
+          replica.push_back(layer->Clone());
+        }
+      }
+    }
+
+    int rows = (m_micro_batch > 0) ? std::min(max_batch, m_micro_batch) : max_batch;
+    int shard = (rows + m_threads - 1) / m_threads;
+    m_replica_workspace.resize(m_threads);
+
+    for (int t = 0; t < m_threads; t++) {
+      this->m_ws_loss_gradient = BindLayers(m_replica[t], m_replica_workspace[t], shard, inputs);
+    }
+  }
+  else {
+    this->m_ws_loss_gradient = BindLayers(m_layer, m_workspace, max_batch, inputs);
+  }
+
+  m_losses.resize(m_threads);
+  this->m_bound_batch = max_batch;
+  this->m_bound_inputs = inputs;
+}
+
+
+/**
+ * @brief Number of micro-batches of a pipelined batch, of the rows set by UseMicroBatches
+ *        or 4 per stage.
+ * 
+ * @param rows Rows of the batch
+ * @return int The number of micro-batches
+ */
+template <typename T>
+int NetworkT<T>::PipelineMicroBatches(int rows) const
+{
+  if (m_micro_batch > 0)
+    return (rows + m_micro_batch - 1) / m_micro_batch;
+
+  return std::max(1, std::min(rows, 4 * m_pipeline));
+}
+
+
+/**
+ * @brief Lays out the pipeline stages for a maximum batch size. The layers are cut where
+ *        the summed training FLOPs are closest to an even share of every stage, each stage
+ *        gets at least one layer. Every stage binds its layers to its own workspace for
+ *        the largest micro-batch and takes buffers for the inputs and output errors of a
+ *        whole batch, which the stages around it write.
+ * 
+ * @param max_batch The largest batch of the training steps
+ * @param inputs Number of network inputs
+ */
+template <typename T>
+void NetworkT<T>::BindStages(int max_batch, int inputs)
+{
+  ClearStages();
+
+  int count = m_layer.size();
+  int stages = std::min(m_pipeline, count);
+  int micro_batches = PipelineMicroBatches(max_batch);
+  int rows = (m_micro_batch > 0) ? std::min(max_batch, m_micro_batch) : (max_batch + micro_batches - 1) / micro_batches;
+
+  // summed training cost of the layers before each layer
+  vector<double> cost(count + 1, 0.0);
+  for (int k = 0; k < count; k++) {
+    LayerCost layer = m_layer[k]->GetCost(rows);
+    cost[k + 1] = cost[k] + layer.forward_flops + layer.backward_flops;
+  }
+
+  this->m_pipeline_report = PipelineReport();
+  this->m_pipeline_report.stages.resize(stages);
+
+  int first = 0;
+  int width = inputs;
+  for (int s = 0; s < stages; s++) {
+    int end = count;
+
+    if (s < stages - 1) {
+      double share = cost[count] * (s + 1) / stages;
+      end = first + 1;
+      while (end < count - (stages - s - 1) && std::abs(cost[end + 1] - share) <= std::abs(cost[end] - share))
+        end++;
+    }
+
+    Stage *stage = new Stage();
+    stage->first = first;
+    stage->inputs = width;
+    stage->last_forward = -1;
+    stage->layers.assign(m_layer.begin() + first, m_layer.begin() + end);
+    stage->sums.resize(stage->layers.size());
+    for (auto layer : stage->layers) {
+      width = layer->OutputSize(width);
+    }
+
+    stage->ws_loss_gradient = BindLayers(stage->layers, stage->workspace, rows, stage->inputs, s == stages - 1);
+    if (s > 0)
+      stage->input.resize(max_batch, stage->inputs);
+    if (s < stages - 1)
+      stage->error.resize(max_batch, width);
+    stage->forward.Reserve(micro_batches);
+    stage->backward.Reserve(micro_batches);
+
+    this->m_pipeline_report.stages[s].first_layer = first;
+    this->m_pipeline_report.stages[s].layers = end - first;
+    m_stages.push_back(stage);
+    first = end;
+  }
+}
+
+
+/**
+ * @brief Runs the forward pass of a checkpoint segment again before the backward pass of
+ *        its last layer, which reads the outputs of the layer before. Nothing runs when the
+ *        layer before kept its outputs.
+ * 
+ * @param layers The layers of the network or of one replica
+ * @param layer The layer whose backward pass is next
+ * @param x_batch Matrix input data of the batch, the input of the first segment
+ */
+template <typename T>
+void NetworkT<T>::Recompute(const vector<LayerT<T>*> &layers, int layer, const Ref<const Matrix>& x_batch)
+{
+  int count = layers.size();
+
+  if (layer == 0 || !Recomputed(layer - 1, count) || Recomputed(layer, count))
+    return;
+
+  int first = (layer / m_checkpoint) * m_checkpoint;
+  int batch = x_batch.rows();
+
+  const MatrixMap *output = (first > 0) ? &layers[first - 1]->TrainOutput() : nullptr;
+  for (int l = first; l < layer; l++) {
+    LayerScope scope(m_profiler, l, Profiler::Phase::FORWARD, layers[l], batch);
+    output = (l == 0) ? &layers[l]->TrainForward(x_batch) : &layers[l]->TrainForward(*output);
+  }
+}
+
+
+/**
+ * @brief Runs forward and backward propagation on one mini-batch and updates the layers.
+ *        The layers work in the workspace bound by Fit, the step allocates nothing.
+ * 
+ * @param x_batch Matrix input data of the batch
+ * @param y_batch Matrix result data of the batch
+ * @param learning_rate The step size
+ * @param loss The loss of the step
+ * @return double The loss of the batch
+ */
+template <typename T>
+double NetworkT<T>::TrainStep(const Ref<const Matrix>& x_batch, const Ref<const Matrix>& y_batch, double learning_rate,
+                              LossT<T> &loss)
+{
+  int batch = x_batch.rows();
+
+  // Forward pass, each layer reads the output view of the previous one
+  const MatrixMap *output = nullptr;
+  for (int l = 0; l < m_layer.size(); l++) {
+    LayerScope scope(m_profiler, l, Profiler::Phase::FORWARD, m_layer[l], batch);
+    output = (l == 0) ? &m_layer[l]->TrainForward(x_batch) : &m_layer[l]->TrainForward(*output);
+  }
+
+  // Compute loss and its gradient
+  MatrixMap loss_gradient = m_workspace.View(m_ws_loss_gradient, batch, output->cols());
+  double err = loss.ComputeWithDerivative(y_batch, *output, loss_gradient);
+
+  // Backward pass
+  const MatrixMap *error = &loss_gradient;
+  for (int k = m_layer.size() - 1; k >= 0; k--) {
+    Recompute(m_layer, k, x_batch);
+    {
+      LayerScope scope(m_profiler, k, Profiler::Phase::BACKWARD, m_layer[k], batch);
+      error = &m_layer[k]->TrainBackward(*error);
+    }
+    LayerScope scope(m_profiler, k, Profiler::Phase::UPDATE, m_layer[k], batch);
+    m_layer[k]->ApplyGradients(learning_rate);
+  }
+
+  return err;
+}
+
+
+/**
+ * @brief One asynchronous training step of a worker on its replica. The gradients of each
+ *        layer are applied to the shared parameters right after its backward pass, without
+ *        lock, and the staleness and conflicts of the step are counted for the worker.
+ * 
+ * @param worker Index of the worker and of its replica
+ * @param x_batch Matrix input data of the batch
+ * @param y_batch Matrix result data of the batch
+ * @param learning_rate The step size
+ * @param loss The loss of the step
+ * @return double The loss of the batch
+ */
+template <typename T>
+double NetworkT<T>::HogwildStep(int worker, const Ref<const Matrix>& x_batch, const Ref<const Matrix>& y_batch, double learning_rate,
+                                LossT<T> &loss)
+{
+  vector<LayerT<T>*> &replica = m_replica[worker];
+  WorkerCounters &counters = m_worker_counters[worker];
+  int batch = x_batch.rows();
+  long long read = m_updates.load(std::memory_order_relaxed);
+
+  const MatrixMap *output = nullptr;
+  for (int l = 0; l < replica.size(); l++) {
+    LayerScope scope(m_profiler, l, Profiler::Phase::FORWARD, replica[l], batch);
+    output = (l == 0) ? &replica[l]->TrainForward(x_batch) : &replica[l]->TrainForward(*output);
+  }
+
+  MatrixMap loss_gradient = m_replica_workspace[worker].View(m_ws_loss_gradient, batch, output->cols());
+  double err = loss.ComputeWithDerivative(y_batch, *output, loss_gradient);
+
+  const MatrixMap *error = &loss_gradient;
+  for (int k = replica.size() - 1; k >= 0; k--) {
+    Recompute(replica, k, x_batch);
+    {
+      LayerScope scope(m_profiler, k, Profiler::Phase::BACKWARD, replica[k], batch);
+      error = &replica[k]->TrainBackward(*error);
+    }
+    LayerScope scope(m_profiler, k, Profiler::Phase::UPDATE, replica[k], batch);
+    if (m_writers[k].fetch_add(1, std::memory_order_acq_rel) > 0)
+      counters.conflicts++;
+    replica[k]->ApplyGradients(learning_rate);
+    m_writers[k].fetch_sub(1, std::memory_order_acq_rel);
+  }
+
+  long long staleness = m_updates.fetch_add(1, std::memory_order_relaxed) - read;
+  counters.updates++;
+  counters.staleness += staleness;
+  counters.max_staleness = std::max(counters.max_staleness, staleness);
+
+  return err;
+}
+
+
+/**
+ * @brief One epoch of asynchronous training: the workers take the batches of the loader
+ *        in turn, under a lock that only covers the copy into their own buffers, and train
+ *        on them with HogwildStep until the epoch is over. The counters of the workers are
+ *        then added to the report.
+ * 
+ * @param loader The loader of the epoch, started
+ * @param learning_rate The step size
+ * @return double The sum of the batch losses
+ */
+template <typename T>
+double NetworkT<T>::HogwildEpoch(DataLoaderT<T> &loader, double learning_rate)
+{
+  struct Epoch {
+    DataLoaderT<T> *loader;
+    std::mutex mutex;
+    double learning_rate;
+    long long samples;
+    double err;
+  } epoch = { &loader, {}, learning_rate, 0, 0.0 };
+
+  for (auto &counters : m_worker_counters) {
+    counters = WorkerCounters();
+  }
+
+  auto start = chrono::steady_clock::now();
+
+  m_worker_pool->Run(m_hogwild, [this, &epoch](int t) {
+    Matrix &x = m_worker_x[t];
+    Matrix &y = m_worker_y[t];
+    double err = 0.0;
+    long long samples = 0;
+
+    for (;;) {
+      int rows;
+      {
+        std::lock_guard<std::mutex> lock(epoch.mutex);
+        const MatrixMap *x_batch, *y_batch;
+        if (!epoch.loader->Next(x_batch, y_batch))
+          break;
+
+        rows = x_batch->rows();
+        if (x.rows() < rows || x.cols() != x_batch->cols())
+          x.resize(std::max<Index>(rows, x.rows()), x_batch->cols());
+        if (y.rows() < rows || y.cols() != y_batch->cols())
+          y.resize(std::max<Index>(rows, y.rows()), y_batch->cols());
+        x.topRows(rows) = *x_batch;
+        y.topRows(rows) = *y_batch;
+      }
+
+      err += HogwildStep(t, x.topRows(rows), y.topRows(rows), epoch.learning_rate, *m_loss);
+      samples += rows;
+    }
+
+    std::lock_guard<std::mutex> lock(epoch.mutex);
+    epoch.err += err;
+    epoch.samples += samples;
+  });
+
+  HogwildReport &report = this->m_hogwild_report;
+  report.seconds += chrono::duration<double>(chrono::steady_clock::now() - start).count();
+  report.samples += epoch.samples;
+
+  for (auto &counters : m_worker_counters) {
+    report.updates += counters.updates;
+    report.layer_updates += counters.updates * m_layer.size();
+    report.conflicts += counters.conflicts;
+    report.max_staleness = std::max(report.max_staleness, counters.max_staleness);
+    this->m_staleness += counters.staleness;
+  }
+  report.mean_staleness = report.updates > 0 ? (double)m_staleness / report.updates : 0.0;
+
+  return epoch.err;
+}
+
+
+/**
+ * @brief Gradients of a batch on the replicas. The rows are split across the thread pool,
+ *        each replica computes the gradients of its shard and the replicas are summed with
+ *        a tree reduction into the first one.
+ * 
+ * @param x_batch Matrix input data of the batch
+ * @param y_batch Matrix result data of the batch
+ * @param loss The loss of the step
+ * @param scale Factor of the gradients and of the loss, the share of the batch in the step
+ * @param sync Copies the parameters of the network layers to the replicas first
+ * @return double The loss of the batch times scale
+ */
+template <typename T>
+double NetworkT<T>::ReplicaGradients(const Ref<const Matrix>& x_batch, const Ref<const Matrix>& y_batch, LossT<T> &loss,
+                                     double scale, bool sync)
+{
+  int rows = x_batch.rows();
+  int shards = std::min(m_threads, rows);
+
+  struct Step {
+    const Ref<const Matrix> *x, *y;
+    LossT<T> *loss;
+    int rows, shards;
+    double scale;
+    bool sync;
+  } step = { &x_batch, &y_batch, &loss, rows, shards, scale, sync };
+
+  auto shard = [this, &step](int t) {
+    int begin = (long long)step.rows * t / step.shards;
+    int count = (long long)step.rows * (t + 1) / step.shards - begin;
+    double weight = (double)count / step.rows * step.scale;
+    vector<LayerT<T>*> &replica = m_replica[t];
+
+    const MatrixMap *output = nullptr;
+    for (int l = 0; l < replica.size(); l++) {
+      if (step.sync)
+        replica[l]->CopyParameters(*m_layer[l]);
+      LayerScope scope(m_profiler, l, Profiler::Phase::FORWARD, replica[l], count);
+      output = (l == 0) ? &replica[l]->TrainForward(step.x->middleRows(begin, count)) : &replica[l]->TrainForward(*output);
+    }
+
+    // the loss derivative is normalized by the shard size, rescale it to the batch size
+    MatrixMap loss_gradient = m_replica_workspace[t].View(m_ws_loss_gradient, count, output->cols());
+    m_losses[t] = step.loss->ComputeWithDerivative(step.y->middleRows(begin, count), *output, loss_gradient) * weight;
+
+    const MatrixMap *error = &loss_gradient;
+    for (int k = replica.size() - 1; k >= 0; k--) {
+      Recompute(replica, k, step.x->middleRows(begin, count));
+      LayerScope scope(m_profiler, k, Profiler::Phase::BACKWARD, replica[k], count);
+      error = &replica[k]->TrainBackward(*error);
+      replica[k]->ScaleGradients(weight);
+    }
+  };
+
+  if (m_pool != nullptr)
+    m_pool->Run(shards, shard);
+  else
+    shard(0);
+
+  // tree reduction, replica i accumulates replica i + stride
+  for (int stride = 1; stride < shards; stride *= 2) {
+    int pairs = (shards - stride + 2 * stride - 1) / (2 * stride);
+
+    m_pool->Run(pairs, [this, &stride](int p) {
+      int i = p * 2 * stride;
+      for (int l = 0; l < m_layer.size(); l++) {
+        m_replica[i][l]->AddGradients(*m_replica[i + stride][l]);
+      }
+    });
+  }
+
+  double err = 0.0;
+  for (int t = 0; t < shards; t++) {
+    err += m_losses[t];
+  }
+
+  return err;
+}
+
+
+/**
+ * @brief Version of TrainStep on the replicas, for several threads or micro-batches. The
+ *        batch is split into micro-batches of at most m_micro_batch rows, or taken whole,
+ *        and each one into data-parallel shards. The gradients of the micro-batches, scaled
+ *        by their share of the batch, are summed in the network layers and applied once.
+ * 
+ * @param x_batch Matrix input data of the batch
+ * @param y_batch Matrix result data of the batch
+ * @param learning_rate The step size
+ * @param loss The loss of the step
+ * @return double The loss of the batch
+ */
+template <typename T>
+double NetworkT<T>::ParallelTrainStep(const Ref<const Matrix>& x_batch, const Ref<const Matrix>& y_batch, double learning_rate,
+                                      LossT<T> &loss)
+{
+  int rows = x_batch.rows();
+  int micro_batches = (m_micro_batch > 0) ? (rows + m_micro_batch - 1) / m_micro_batch : 1;
+  double err = 0.0;
+
+  for (int i = 0; i < micro_batches; i++) {
+    int begin = (long long)rows * i / micro_batches;
+    int count = (long long)rows * (i + 1) / micro_batches - begin;
+
+    // the parameters only change after the last micro-batch, the replicas are synced once
+    err += ReplicaGradients(x_batch.middleRows(begin, count), y_batch.middleRows(begin, count), loss, (double)count / rows, i == 0);
+
+    for (int l = 0; l < m_layer.size(); l++) {
+      if (i == 0)
+        m_layer[l]->CopyGradients(*m_replica[0][l]);
+      else
+        m_layer[l]->AddGradients(*m_replica[0][l]);
+    }
+  }
+
+  for (int l = 0; l < m_layer.size(); l++) {
+    LayerScope scope(m_profiler, l, Profiler::Phase::UPDATE, m_layer[l], rows);
+    m_layer[l]->ApplyGradients(learning_rate);
+  }
+
+  return err;
+}
+
+
+/**
+ * @brief Version of TrainStep on the pipeline stages, every stage runs its passes on its
+ *        own thread and the step ends when every stage has updated its layers.
+ * 
+ * @param x_batch Matrix input data of the batch
+ * @param y_batch Matrix result data of the batch
+ * @param learning_rate The step size
+ * @param loss The loss of the step
+ * @return double The loss of the batch
+ */
+template <typename T>
+double NetworkT<T>::PipelineTrainStep(const Ref<const Matrix>& x_batch, const Ref<const Matrix>& y_batch, double learning_rate,
+                                      LossT<T> &loss)
+{
+  struct Step {
+    const Ref<const Matrix> *x, *y;
+    LossT<T> *loss;
+    double learning_rate;
+    int micro_batches;
+    double err;
+  } step = { &x_batch, &y_batch, &loss, learning_rate, PipelineMicroBatches(x_batch.rows()), 0.0 };
+
+  int stages = m_stages.size();
+  auto start = chrono::steady_clock::now();
+
+  m_stage_pool->Run(stages, [this, &step](int s) {
+    double err = RunStage(*m_stages[s], s, *step.x, *step.y, step.learning_rate, *step.loss, step.micro_batches);
+    if (s == m_stages.size() - 1)
+      step.err = err;
+  });
+
+  PipelineReport &report = this->m_pipeline_report;
+  report.micro_batches = step.micro_batches;
+  report.steps++;
+  report.seconds += chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+  double busy = 0.0;
+  for (auto &profile : report.stages) {
+    profile.utilization = profile.busy_seconds / report.seconds;
+    busy += profile.busy_seconds;
+  }
+  report.bubble = 1.0 - busy / (stages * report.seconds);
+
+  return step.err;
+}
+
+
+/**
+ * @brief The passes of one pipeline stage over the micro-batches of a batch, in the order
+ *        of the schedule, then the update of its layers. The stage waits for the inputs and
+ *        output errors of the stages around it, and runs the forward pass of a micro-batch
+ *        again before its backward pass while the stages after it work on the error.
+ * 
+ * @param stage The stage
+ * @param s Index of the stage
+ * @param x_batch Matrix input data of the batch
+ * @param y_batch Matrix result data of the batch
+ * @param learning_rate The step size
+ * @param loss The loss of the step
+ * @param micro_batches Number of micro-batches of the batch
+ * @return double The loss of the batch on the last stage, 0 on the others
+ */
+template <typename T>
+double NetworkT<T>::RunStage(Stage &stage, int s, const Ref<const Matrix>& x_batch, const Ref<const Matrix>& y_batch,
+                             double learning_rate, LossT<T> &loss, int micro_batches)
+{
+  typedef chrono::steady_clock Clock;
+
+  int stages = m_stages.size();
+  int rows = x_batch.rows();
+  int count = stage.layers.size();
+  Stage *next = (s < stages - 1) ? m_stages[s + 1] : nullptr;
+  Stage *previous = (s > 0) ? m_stages[s - 1] : nullptr;
+  PipelineStageProfile &profile = this->m_pipeline_report.stages[s];
+  double err = 0.0;
+  int backwards = 0;
+
+  // the rows of a micro-batch, split as in ParallelTrainStep
+  auto begin = [&](int m) { return (int)((long long)rows * m / micro_batches); };
+
+  auto forward = [&](int m) -> const MatrixMap& {
+    int size = begin(m + 1) - begin(m);
+    const MatrixMap *output = nullptr;
+
+    for (int l = 0; l < count; l++) {
+      LayerScope scope(m_profiler, stage.first + l, Profiler::Phase::FORWARD, stage.layers[l], size);
+      if (l > 0)
+        output = &stage.layers[l]->TrainForward(*output);
+      else if (s == 0)
+        output = &stage.layers[l]->TrainForward(x_batch.middleRows(begin(m), size));
+      else
+        output = &stage.layers[l]->TrainForward(stage.input.middleRows(begin(m), size));
+    }
+
+    stage.last_forward = m;
+    return *output;
+  };
+
+  // the stages before send the micro-batches in order
+  auto run_forward = [&](int m) {
+    if (previous != nullptr)
+      stage.forward.Receive();
+
+    auto start = Clock::now();
+    const MatrixMap &output = forward(m);
+
+    if (next != nullptr)
+      next->input.middleRows(begin(m), output.rows()) = output;
+    profile.forwards++;
+    profile.busy_seconds += chrono::duration<double>(Clock::now() - start).count();
+
+    if (next != nullptr)
+      next->forward.Send(m);
+  };
+
+  auto run_backward = [&](int m) {
+    int size = begin(m + 1) - begin(m);
+    double weight = (double)size / rows;
+    auto start = Clock::now();
+
+    if (stage.last_forward != m) {
+      forward(m);
+      profile.recomputes++;
+    }
+
+    const MatrixMap &output = stage.layers.back()->TrainOutput();
+    MatrixMap loss_gradient = stage.workspace.View(stage.ws_loss_gradient, (next == nullptr) ? size : 0, output.cols());
+
+    if (next == nullptr) {
+      // the loss derivative is normalized by the micro-batch size, rescale it to the batch size
+      err += loss.ComputeWithDerivative(y_batch.middleRows(begin(m), size), output, loss_gradient) * weight;
+    }
+    else {
+      // the stages after run the backward passes in the same order
+      profile.busy_seconds += chrono::duration<double>(Clock::now() - start).count();
+      stage.backward.Receive();
+      start = Clock::now();
+    }
+
+    const MatrixMap *error = nullptr;
+    for (int k = count - 1; k >= 0; k--) {
+      if (s == 0)
+        Recompute(stage.layers, k, x_batch.middleRows(begin(m), size));
+      else
+        Recompute(stage.layers, k, stage.input.middleRows(begin(m), size));
+
+      LayerScope scope(m_profiler, stage.first + k, Profiler::Phase::BACKWARD, stage.layers[k], size);
+      if (k < count - 1)
+        error = &stage.layers[k]->TrainBackward(*error);
+      else if (next == nullptr)
+        error = &stage.layers[k]->TrainBackward(loss_gradient);
+      else
+        error = &stage.layers[k]->TrainBackward(stage.error.middleRows(begin(m), size));
+
+      stage.layers[k]->ScaleGradients(weight);
+      if (micro_batches > 1)
+        stage.layers[k]->StoreGradients(stage.sums[k], backwards > 0);
+    }
+
+    if (previous != nullptr)
+      previous->error.middleRows(begin(m), size) = *error;
+    backwards++;
+    profile.backwards++;
+    profile.busy_seconds += chrono::duration<double>(Clock::now() - start).count();
+
+    if (previous != nullptr)
+      previous->backward.Send(m);
+  };
+
+  // GPipe fills the pipeline with every micro-batch, 1F1B with one per stage after this one
+  int warmup = (m_schedule == PipelineSchedule::GPIPE) ? micro_batches : std::min(stages - 1 - s, micro_batches);
+  int forwards = 0;
+  stage.last_forward = -1;
+
+  for (; forwards < warmup; forwards++) {
+    run_forward(forwards);
+  }
+
+  for (int i = 0; i < micro_batches; i++) {
+    if (forwards < micro_batches) {
+      run_forward(forwards);
+      forwards++;
+    }
+    run_backward((m_schedule == PipelineSchedule::GPIPE) ? micro_batches - 1 - i : i);
+  }
+
+  auto start = Clock::now();
+  for (int l = 0; l < count; l++) {
+    if (micro_batches > 1)
+      stage.layers[l]->LoadGradients(stage.sums[l]);
+
+    LayerScope scope(m_profiler, stage.first + l, Profiler::Phase::UPDATE, stage.layers[l], rows);
+    stage.layers[l]->ApplyGradients(learning_rate);
+  }
+  profile.busy_seconds += chrono::duration<double>(Clock::now() - start).count();
+
+  return err;
 }
 
 
@@ -77,53 +1193,122 @@ void Network::UseOptimizer(Optimizer* optimizer)
  * @param learning_rate The step size at each iteration
  * @param batch_size 
  */
-void Network::Fit(Eigen::MatrixXd x_train, Eigen::MatrixXd y_train, int epochs, double learning_rate, int batch_size, int verbose)
+template <typename T>
+void NetworkT<T>::Fit(const Matrix& x_train, const Matrix& y_train, int epochs, double learning_rate, int batch_size, int verbose)
+{
+    MemoryDataSourceT<T> source(x_train, y_train);
+
+    Fit(source, epochs, learning_rate, batch_size, verbose);
+}
+
+
+/**
+ * @brief One training step on a batch as given: no shuffle, no timing and no output, for
+ *        callers that build their own batches such as reinforcement learners. The workspace
+ *        is bound at the first call and again only for a larger batch, a step of a known
+ *        shape allocates nothing.
+ * 
+ * @param x_batch Matrix input data of the batch
+ * @param y_batch Matrix result data of the batch, read by the loss
+ * @param learning_rate The step size
+ * @param loss The loss of this step, the network loss when null. The output layer is
+ *             bound for the network loss, both must agree on TakesLogits.
+ * @return double The loss of the batch
+ */
+template <typename T>
+double NetworkT<T>::TrainOnBatch(const Ref<const Matrix>& x_batch, const Ref<const Matrix>& y_batch, double learning_rate,
+                                 LossT<T> *loss)
 {
-    int samples = x_train.rows();
-    int cols = x_train.cols();
+  CallScope call(m_profiler, Profiler::Call::TRAIN_ON_BATCH);
+
+  if (loss == nullptr)
+    loss = m_loss;
+
+  if (loss == nullptr) {
+    cerr << "No loss to train with !!" << endl;
+    return 0.0;
+  }
+
+  if (x_batch.rows() == 0)
+    return 0.0;
+
+  if (x_batch.rows() > m_bound_batch || x_batch.cols() != m_bound_inputs)
+    BindWorkspace(std::max((int)x_batch.rows(), m_bound_inputs == x_batch.cols() ? m_bound_batch : 0), x_batch.cols());
+
+  if (m_pipeline > 0)
+    return PipelineTrainStep(x_batch, y_batch, learning_rate, *loss);
+  else if (m_hogwild > 0)
+    return HogwildStep(0, x_batch, y_batch, learning_rate, *loss);
+  else if (OnReplicas())
+    return ParallelTrainStep(x_batch, y_batch, learning_rate, *loss);
+  else
+    return TrainStep(x_batch, y_batch, learning_rate, *loss);
+}
+
+
+/**
+ * @brief Training a network on a data source. Every epoch shuffles the sample indices, the
+ *        mini-batches are gathered into reused buffers by a background thread one batch
+ *        ahead of training, so the source can stream data that doesn't fit in memory.
+ *        When every layer trains in its workspace the epochs after the first allocate
+ *        nothing, builds with EIGEN_RUNTIME_NO_MALLOC assert it. Their check is process
+ *        wide: the gathering thread, the source and any other thread using Eigen during
+ *        those epochs must not allocate either, a concurrent PredictBatch can't be run.
+ * 
+ * @param source The training data
+ * @param epochs The number of times the entire training dataset is passed through the network
+ * @param learning_rate The step size at each iteration
+ * @param batch_size Number of samples per batch
+ * @param verbose Level of verbosity
+ */
+template <typename T>
+void NetworkT<T>::Fit(DataSourceT<T>& source, int epochs, double learning_rate, int batch_size, int verbose)
+{
+    CallScope call(m_profiler, Profiler::Call::FIT);
+    int samples = source.Size();
+    DataLoaderT<T> loader(source, batch_size);
+
+    // the buffers of the largest batch, a smaller last batch uses their first rows
+    BindWorkspace(std::max(1, std::min(batch_size, samples)), source.InputSize());
+    m_error.reserve(m_error.size() + epochs);
 
     auto start = chrono::high_resolution_clock::now();
 
     for (int i = 0; i < epochs; i++) {
         double err = 0.0;
+        long long allocations = AllocationCounter::Count();
         auto t_start = chrono::high_resolution_clock::now();
 
+        // the buffers are all taken by the first epoch, the next ones must not allocate
+        NoMallocScope steady_state(i > 0 && m_allocation_free);
+
         // Shuffle training data
-        Eigen::PermutationMatrix<Eigen::Dynamic, Eigen::Dynamic> perm(samples);
-        perm.setIdentity();
-        std::random_shuffle(perm.indices().data(), perm.indices().data() + perm.indices().size());
-        x_train = perm * x_train;
-        y_train = perm * y_train;
+        loader.Start();
 
         // Mini-batch training
-        for (int j = 0; j < samples; j += batch_size) {
-            int batch_end = std::min(j + batch_size, samples);
-            int current_batch_size = batch_end - j;
-
-            Eigen::MatrixXd x_batch = x_train.block(j, 0, current_batch_size, cols);
-            Eigen::MatrixXd y_batch = y_train.block(j, 0, current_batch_size, y_train.cols());
-
-            Eigen::MatrixXd output = x_batch;
-
-            // Forward pass
-            for (int l = 0; l < m_layer.size(); l++) {
-                output = m_layer[l]->FeedForward(output);
-            }
+        const MatrixMap *x_batch;
+        const MatrixMap *y_batch;
+        int j = 0;
 
-            // Compute loss
-            err += this->m_loss->Compute(y_batch, output);
+        // the workers of asynchronous training take the batches themselves
+        if (m_hogwild > 0)
+            err = HogwildEpoch(loader, learning_rate);
 
-            // Backward pass
-            Eigen::MatrixXd error = this->m_loss->ComputeDerivative(y_batch, output);
-            for (int k = m_layer.size() - 1; k >= 0; k--) {
-                error = m_layer[k]->BackPropagation(error, learning_rate);
-            }
+        while (m_hogwild == 0 && loader.Next(x_batch, y_batch)) {
+            if (m_pipeline > 0)
+                err += PipelineTrainStep(*x_batch, *y_batch, learning_rate, *m_loss);
+            else if (OnReplicas())
+                err += ParallelTrainStep(*x_batch, *y_batch, learning_rate, *m_loss);
+            else
+                err += TrainStep(*x_batch, *y_batch, learning_rate, *m_loss);
 
             // Update progress (optional)
             if (verbose >= 2 && j % 100 == 0) {
-                cout << "\rBatch " << j / batch_size + 1 << "/" << (samples + batch_size - 1) / batch_size 
+                cout << "\rBatch " << j / batch_size + 1 << "/" << loader.Batches()
                      << " | Loss: " << err / (j + 1) << flush;
             }
+
+            j += x_batch->rows();
         }
 
         err /= samples;
@@ -131,11 +1316,19 @@ void Network::Fit(Eigen::MatrixXd x_train, Eigen::MatrixXd y_train, int epochs,
         auto t_end = chrono::high_resolution_clock::now();
         double elapsed_time_s = chrono::duration<double>(t_end - t_start).count();
 
+        // heap allocations of the epoch, counted while profiling
+        allocations = AllocationCounter::Count() - allocations;
+        if (m_profiler != nullptr)
+            m_profiler->RecordEpoch(allocations);
+
         // Epoch summary
         if (verbose >= 1) {
             cout << "\rEpoch " << i + 1 << "/" << epochs 
                  << " | Loss: " << err 
-                 << " | Time: " << elapsed_time_s << "s" << endl;
+                 << " | Time: " << elapsed_time_s << "s";
+            if (m_profiler != nullptr && AllocationCounter::Enabled())
+                cout << " | Allocations: " << allocations;
+            cout << endl;
         }
 
         m_error.push_back(err);
@@ -156,7 +1349,8 @@ void Network::Fit(Eigen::MatrixXd x_train, Eigen::MatrixXd y_train, int epochs,
  * @param y_train 
  * @param y_test 
  */
-void Network::Evaluate(MatrixXd y_train, MatrixXd y_test) 
+template <typename T>
+void NetworkT<T>::Evaluate(Matrix y_train, Matrix y_test) 
 {
 
 }
@@ -164,20 +1358,26 @@ void Network::Evaluate(MatrixXd y_train, MatrixXd y_test)
 
 /**
  * @brief Predict data based on input data, forward propagation throughout the network.
+ *        Inference only reads the layers, several threads can predict on one network.
  * 
  * @param input_data Matrix input data
- * @return vector<MatrixXd> The array of Matrix output res
+ * @return vector<Matrix> The array of Matrix output res
  */
-vector<MatrixXd> Network::Predict(MatrixXd input_data)
+template <typename T>
+vector<DynMatrix<T>> NetworkT<T>::Predict(const Matrix& input_data) const
 {
+  CallScope call(m_profiler, Profiler::Call::PREDICT);
   int samples = input_data.rows();
-  vector<MatrixXd> res;
+  vector<Matrix> res;
+  Matrix scratch;
 
   for (int i = 0; i < samples; i++) {
-    MatrixXd output = input_data.row(i);
+    Matrix output = input_data.row(i);
 
     for (int j = 0; j < m_layer.size(); j++) {
-      output = m_layer[j]->FeedForward(output);
+      LayerScope scope(m_profiler, j, Profiler::Phase::FORWARD, m_layer[j], 1);
+      m_layer[j]->Forward(output, scratch);
+      output.swap(scratch);
     }
 
     res.push_back(output);
@@ -187,25 +1387,136 @@ vector<MatrixXd> Network::Predict(MatrixXd input_data)
 }
 
 
-void Network::SaveModel(string name)
+/**
+ * @brief Predict a whole block of samples at once, each layer runs one matrix-matrix
+ *        product per chunk instead of one vector product per sample.
+ * 
+ * @param input_data Matrix input data, one sample per row
+ * @param chunk_size Number of rows pushed through the network at once, 0 for all rows
+ * @return Matrix Output matrix, one result per row
+ */
+template <typename T>
+DynMatrix<T> NetworkT<T>::PredictBatch(const Matrix& input_data, int chunk_size) const
 {
-  ofstream ofs(name.c_str(), ios::out | ios::binary | ios::trunc);
+  Matrix output;
+  PredictBatch(input_data, output, chunk_size);
+
+  return output;
+}
 
-  int layer_size = m_layer.size();
 
-  ofs.write(reinterpret_cast<const char*>(&layer_size), sizeof(int));
-  
+/**
+ * @brief Predict a whole block of samples into a caller-provided buffer. The buffer is
+ *        only resized when its shape does not match, so it can be reused across calls.
+ * 
+ * @param input_data Matrix input data, one sample per row
+ * @param output Matrix receiving one result per row
+ * @param chunk_size Number of rows pushed through the network at once, 0 for all rows
+ */
+template <typename T>
+void NetworkT<T>::PredictBatch(const Matrix& input_data, Matrix& output, int chunk_size) const
+{
+  CallScope call(m_profiler, Profiler::Call::PREDICT);
+  int samples = input_data.rows();
+
+  if (chunk_size <= 0 || chunk_size > samples)
+    chunk_size = samples;
+
+  // no rows: the result is empty, a reused buffer must not keep its previous predictions
+  if (samples == 0) {
+    int width = input_data.cols();
+    for (auto layer : m_layer)
+      width = layer->OutputSize(width);
+    output.resize(0, width);
+    return;
+  }
+
+  // per-call scratch, the layers themselves are left untouched
+  Matrix chunk, scratch;
+
+  for (int i = 0; i < samples; i += chunk_size) {
+    int rows = std::min(chunk_size, samples - i);
+    chunk = input_data.middleRows(i, rows);
+
+    for (int j = 0; j < m_layer.size(); j++) {
+      LayerScope scope(m_profiler, j, Profiler::Phase::FORWARD, m_layer[j], rows);
+      m_layer[j]->Forward(chunk, scratch);
+      chunk.swap(scratch);
+    }
+
+    if (output.rows() != samples || output.cols() != chunk.cols())
+      output.resize(samples, chunk.cols());
+
+    output.middleRows(i, rows) = chunk;
+  }
+}
+
+
+/**
+ * @brief Post-training quantization. The calibration data is run through the layers to find
+ *        the input range of each layer, and every Fc_Layer is replaced by an int8 QFc_Layer.
+ * 
+ * @param calibration_data Matrix of sample inputs, one sample per row
+ * @return NetworkT* A new inference-only network, the network itself is unchanged
+ */
+template <typename T>
+NetworkT<T> *NetworkT<T>::Quantize(const Matrix& calibration_data)
+{
+  NetworkT *network = new NetworkT();
+  Matrix output = calibration_data;
+
+  for (int i = 0; i < m_layer.size(); i++) {
+    T input_range = output.cwiseAbs().maxCoeff();
+
+    if (m_layer[i]->GetKind() == LayerKind::FC)
+      network->Add(new QFc_LayerT<T>(static_cast<const Fc_LayerT<T>&>(*m_layer[i]), input_range));
+    else
+      network->Add(m_layer[i]->Clone());
+
+    output = m_layer[i]->FeedForward(output);
+  }
+
+  network->Use(new MseT<T>());
+
+  return network;
+}
+
+
+/**
+ * @brief Saves the network to a binary model file: a header with the scalar type, byte
+ *        order and checksums, a table of layer records and the 64-byte aligned parameter
+ *        blobs, so the model can be mapped back without conversion or copy.
+ * 
+ * @param name The file name
+ */
+template <typename T>
+void NetworkT<T>::SaveModel(string name)
+{
+  ModelWriter writer;
+
   for (int i = 0; i < m_layer.size(); i++) {
-    m_layer[i]->SaveLayer(ofs);
+    if (!m_layer[i]->SaveRecord(writer))
+      return;
   }
 
-  ofs.close();
+  writer.Save(name, DataTypeOf<T>::value);
 }
 
 
-Network *Network::LoadModel(string name)
+/**
+ * @brief Loads a network from a binary model file. Version 3 files are mapped and the layers
+ *        use the weights in place, several processes loading one model share its pages.
+ *        A model saved with another scalar type is converted, headerless files from older
+ *        versions are read as double.
+ * 
+ * @param name The file name
+ * @param verify Checks the checksum of the parameters, this reads the whole file
+ * @return NetworkT* The loaded network, nullptr if the file can't be read
+ */
+template <typename T>
+NetworkT<T> *NetworkT<T>::LoadModel(string name, bool verify)
 {
-  Network *network = new Network();
+  NetworkT *network = new NetworkT();
   ifstream ifs(name.c_str(), ios::in | ios::binary);
 
   if (!ifs) {
@@ -215,17 +1526,90 @@ Network *Network::LoadModel(string name)
   }
 
   int layer_size = 0;
+  int version = 0;
+  DataType dtype = DataType::FLOAT64;
   ifs.read(reinterpret_cast<char*>(&layer_size), sizeof(layer_size));
 
+  if (layer_size == MODEL_MAGIC) {
+    ifs.read(reinterpret_cast<char*>(&version), sizeof(version));
+
+    if (version >= 3) {
+      ifs.close();
+      shared_ptr<ModelFile> file = make_shared<ModelFile>();
+
+      if (!file->Open(name, verify)) {
+        delete network;
+        return nullptr;
+      }
+
+      for (int i = 0; i < file->Header().layer_count; i++) {
+        const ModelLayerRecord &record = file->Layer(i);
+        LayerT<T> *layer = nullptr;
+
+        if (record.kind == static_cast<int32_t>(LayerKind::FC))
+          layer = Fc_LayerT<T>::MapLayer(file, record);
+        else if (record.kind == static_cast<int32_t>(LayerKind::QUANTIZED_FC))
+          layer = QFc_LayerT<T>::MapLayer(file, record);
+        else if (record.kind == static_cast<int32_t>(LayerKind::CONV2D))
+          layer = Conv2D_LayerT<T>::MapLayer(file, record);
+        else if (record.kind == static_cast<int32_t>(LayerKind::MAX_POOL) ||
+                 record.kind == static_cast<int32_t>(LayerKind::AVG_POOL))
+          layer = Pool_LayerT<T>::MapLayer(file, record);
+        else if (record.kind == static_cast<int32_t>(LayerKind::EMBEDDING))
+          layer = Embedding_LayerT<T>::MapLayer(file, record);
+        else if (record.kind == static_cast<int32_t>(LayerKind::LSTM) ||
+                 record.kind == static_cast<int32_t>(LayerKind::GRU))
+          layer = Recurrent_LayerT<T>::MapLayer(file, record);
+        else
+          cerr << "Unknown layer in model file !!" << endl;
+
+        if (layer == nullptr) {
+          delete network;
+          return nullptr;
+        }
+        network->Add(layer);
+      }
+
+      network->Use(new MseT<T>());
+
+      return network;
+    }
+
+    ifs.read(reinterpret_cast<char*>(&dtype), sizeof(dtype));
+    ifs.read(reinterpret_cast<char*>(&layer_size), sizeof(layer_size));
+
+    if (version < 1) {
+      cerr << "Unsupported model version " << version << " !!" << endl;
+      delete network;
+      return nullptr;
+    }
+  }
+
   for (int i = 0; i < layer_size; i++) {
-    Fc_Layer *layer = Fc_Layer::LoadLayer(ifs);
-    network->Add(layer);
+    LayerKind kind = LayerKind::FC;
+    if (version >= 2)
+      ifs.read(reinterpret_cast<char*>(&kind), sizeof(kind));
+
+    if (kind == LayerKind::FC) {
+      network->Add(Fc_LayerT<T>::LoadLayer(ifs, dtype));
+    }
+    else if (kind == LayerKind::QUANTIZED_FC) {
+      network->Add(QFc_LayerT<T>::LoadLayer(ifs, dtype));
+    }
+    else {
+      cerr << "Unknown layer in model file !!" << endl;
+      delete network;
+      return nullptr;
+    }
   }
 
-  network->Use(new Mse());
+  network->Use(new MseT<T>());
 
   ifs.close();
 
   return network;
 }
 
+
+template class Neural::NetworkT<float>;
+template class Neural::NetworkT<double>;
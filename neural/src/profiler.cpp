@@ -0,0 +1,259 @@
+#include <atomic>
+#include <iostream>
+#include <iomanip>
+#include "profiler.h"
+
+using namespace std;
+using namespace Neural;
+
+
+static std::atomic<int> active_counters(0);
+static std::atomic<long long> allocation_count(0);
+static std::atomic<long long> allocation_bytes(0);
+
+
+/**
+ * @brief Counts one heap allocation, called by the allocator hooks of allocation_hooks.cpp.
+ *        Only tests a flag while no counter user is started.
+ *
+ * @param size The allocated bytes
+ */
+void AllocationCounter::Add(size_t size)
+{
+  if (active_counters.load(std::memory_order_relaxed) > 0) {
+    allocation_count.fetch_add(1, std::memory_order_relaxed);
+    allocation_bytes.fetch_add(size, std::memory_order_relaxed);
+  }
+}
+
+
+/**
+ * @brief Tells if the allocator hooks are built in, the counts are 0 otherwise.
+ *
+ * @return bool True in builds with NEURAL_COUNT_ALLOCATIONS
+ */
+bool AllocationCounter::Enabled()
+{
+#ifdef NEURAL_COUNT_ALLOCATIONS
+  return true;
+#else
+  return false;
+#endif
+}
+
+
+/**
+ * @brief Starts counting allocations, the counter runs while at least one user started it.
+ *
+ */
+void AllocationCounter::Start()
+{
+  active_counters.fetch_add(1);
+}
+
+
+/**
+ * @brief Stops counting allocations for one user.
+ *
+ */
+void AllocationCounter::Stop()
+{
+  active_counters.fetch_sub(1);
+}
+
+
+/**
+ * @brief Gets the number of allocations counted since the program start.
+ *
+ * @return long long The allocation count
+ */
+long long AllocationCounter::Count()
+{
+  return allocation_count.load(std::memory_order_relaxed);
+}
+
+
+/**
+ * @brief Gets the number of bytes allocated since the program start, while counting.
+ *
+ * @return long long The allocated bytes
+ */
+long long AllocationCounter::Bytes()
+{
+  return allocation_bytes.load(std::memory_order_relaxed);
+}
+
+
+/**
+ * @brief Construct a new Profiler::Profiler object, starts the allocation counter.
+ *
+ */
+Profiler::Profiler()
+{
+  AllocationCounter::Start();
+}
+
+
+/**
+ * @brief Destroy the Profiler::Profiler object, stops the allocation counter.
+ *
+ */
+Profiler::~Profiler()
+{
+  AllocationCounter::Stop();
+}
+
+
+/**
+ * @brief Adds one layer call to the counters of the layer.
+ *
+ * @param layer The layer index
+ * @param phase Forward, backward or optimizer update
+ * @param seconds The call time
+ * @param cost The analytical cost of the call
+ * @param allocations Heap allocations made during the call
+ */
+void Profiler::Record(int layer, Phase phase, double seconds, const LayerCost &cost, long long allocations)
+{
+  lock_guard<mutex> lock(m_mutex);
+
+  if (layer >= m_report.layers.size())
+    m_report.layers.resize(layer + 1);
+
+  LayerProfile &p = m_report.layers[layer];
+  p.index = layer;
+  p.allocations += allocations;
+
+  if (phase == Phase::FORWARD) {
+    p.forward_calls++;
+    p.forward_seconds += seconds;
+    p.forward_flops += cost.forward_flops;
+    p.forward_bytes += cost.forward_bytes;
+  }
+  else if (phase == Phase::BACKWARD) {
+    p.backward_calls++;
+    p.backward_seconds += seconds;
+    p.backward_flops += cost.backward_flops;
+    p.backward_bytes += cost.backward_bytes;
+  }
+  else {
+    p.update_calls++;
+    p.update_seconds += seconds;
+    p.update_bytes += cost.update_bytes;
+  }
+}
+
+
+/**
+ * @brief Adds one Fit, Predict or TrainOnBatch call.
+ *
+ * @param call The kind of call
+ * @param seconds The call time
+ * @param allocations Heap allocations made during the call
+ * @param bytes Bytes allocated during the call
+ */
+void Profiler::Record(Call call, double seconds, long long allocations, long long bytes)
+{
+  lock_guard<mutex> lock(m_mutex);
+
+  CallProfile &p = (call == Call::FIT) ? m_report.fit : (call == Call::PREDICT) ? m_report.predict : m_report.train_on_batch;
+  p.calls++;
+  p.seconds += seconds;
+  p.allocations += allocations;
+  p.allocated_bytes += bytes;
+}
+
+
+/**
+ * @brief Adds the allocation count of one Fit epoch.
+ *
+ * @param allocations Heap allocations made during the epoch
+ */
+void Profiler::RecordEpoch(long long allocations)
+{
+  lock_guard<mutex> lock(m_mutex);
+  m_report.epoch_allocations.push_back(allocations);
+}
+
+
+/**
+ * @brief Gets a copy of the counters.
+ *
+ * @return ProfileReport The counters recorded since the last Reset
+ */
+ProfileReport Profiler::Report()
+{
+  lock_guard<mutex> lock(m_mutex);
+  return m_report;
+}
+
+
+/**
+ * @brief Clears the counters.
+ *
+ */
+void Profiler::Reset()
+{
+  lock_guard<mutex> lock(m_mutex);
+  m_report = ProfileReport();
+}
+
+
+static const char* KindName(LayerKind kind)
+{
+  switch (kind) {
+    case LayerKind::FC:           return "Fc_Layer";
+    case LayerKind::QUANTIZED_FC: return "QFc_Layer";
+    case LayerKind::CONV2D:       return "Conv2D_Layer";
+    case LayerKind::MAX_POOL:     return "MaxPool_Layer";
+    case LayerKind::AVG_POOL:     return "AvgPool_Layer";
+    case LayerKind::EMBEDDING:    return "Embedding_Layer";
+    case LayerKind::LSTM:         return "LSTM_Layer";
+    case LayerKind::GRU:          return "GRU_Layer";
+    default:                      return "Activation_Layer";
+  }
+}
+
+
+/**
+ * @brief Prints the report as a table, one line per layer.
+ *
+ * @param os The output stream
+ */
+void ProfileReport::Print(ostream &os) const
+{
+  os << left << setw(4) << "#" << setw(18) << "layer" << setw(12) << "shape"
+     << right << setw(12) << "fwd ms" << setw(10) << "fwd GF/s"
+     << setw(12) << "bwd ms" << setw(10) << "bwd GF/s" << setw(12) << "update ms"
+     << setw(12) << "MB moved" << setw(10) << "allocs" << endl;
+
+  for (auto &p : layers) {
+    string shape = to_string(p.inputs) + "x" + to_string(p.outputs);
+    os << left << setw(4) << p.index << setw(18) << KindName(p.kind) << setw(12) << shape
+       << right << fixed << setprecision(3)
+       << setw(12) << p.forward_seconds * 1e3 << setw(10) << p.ForwardGflops()
+       << setw(12) << p.backward_seconds * 1e3 << setw(10) << p.BackwardGflops()
+       << setw(12) << p.update_seconds * 1e3
+       << setw(12) << (p.forward_bytes + p.backward_bytes + p.update_bytes) / 1e6
+       << setw(10) << p.allocations << endl;
+  }
+
+  os << defaultfloat;
+  os << "fit     : " << fit.calls << " calls, " << fit.seconds << " s, "
+     << fit.allocations << " allocations, " << fit.allocated_bytes << " bytes" << endl;
+  os << "predict : " << predict.calls << " calls, " << predict.seconds << " s, "
+     << predict.allocations << " allocations, " << predict.allocated_bytes << " bytes" << endl;
+  if (train_on_batch.calls > 0)
+    os << "batches : " << train_on_batch.calls << " calls, " << train_on_batch.seconds << " s, "
+       << train_on_batch.allocations << " allocations, " << train_on_batch.allocated_bytes << " bytes" << endl;
+
+  if (!AllocationCounter::Enabled())
+    os << "allocations are not counted, build with NEURAL_COUNT_ALLOCATIONS to count them" << endl;
+
+  if (!epoch_allocations.empty()) {
+    os << "epochs  : " << epoch_allocations.size() << ", allocations per epoch";
+    for (long long n : epoch_allocations)
+      os << " " << n;
+    os << endl;
+  }
+}
@@ -0,0 +1,253 @@
+#include <iostream>
+#include <cmath>
+#include <algorithm>
+#include "replay_memory.h"
+
+using namespace std;
+using namespace Neural;
+using namespace Eigen;
+
+
+/**
+ * @brief Construct a new SumTree object with all priorities zero.
+ *
+ * @param capacity The number of leaves
+ */
+SumTree::SumTree(int capacity)
+{
+  m_leaves = 1;
+  while (m_leaves < capacity)
+    m_leaves *= 2;
+
+  m_nodes.assign(2 * m_leaves, 0.0);
+}
+
+
+/**
+ * @brief Sets the priority of a leaf, the sums on its path to the root are recomputed
+ *        rather than adjusted so rounding errors don't pile up.
+ *
+ * @param index The leaf
+ * @param priority The priority, not negative
+ */
+void SumTree::Set(int index, double priority)
+{
+  int node = m_leaves + index;
+  m_nodes[node] = priority;
+
+  for (node /= 2; node >= 1; node /= 2)
+    m_nodes[node] = m_nodes[2 * node] + m_nodes[2 * node + 1];
+}
+
+
+/**
+ * @brief Finds the leaf where the running sum of priorities passes mass.
+ *
+ * @param mass A value in [0, Total())
+ * @return int The leaf, never one of zero priority while Total() is positive
+ */
+int SumTree::Find(double mass) const
+{
+  int node = 1;
+
+  while (node < m_leaves) {
+    int left = 2 * node;
+    if (mass < m_nodes[left] || m_nodes[left + 1] <= 0.0) {
+      node = left;
+    }
+    else {
+      mass -= m_nodes[left];
+      node = left + 1;
+    }
+  }
+
+  return node - m_leaves;
+}
+
+
+/**
+ * @brief Construct a new ReplayMemory::ReplayMemory object. All the buffers are allocated
+ *        here, adding and sampling allocate nothing.
+ *
+ * @param capacity The number of transitions kept
+ * @param state_size The number of values of a state
+ * @param prioritized Samples in proportion to the priorities instead of uniformly
+ * @param alpha How much the priorities count, 0 is uniform
+ * @param seed The seed of the sampling
+ */
+template <typename T>
+ReplayMemoryT<T>::ReplayMemoryT(int capacity, int state_size, bool prioritized, double alpha, unsigned seed)
+  : m_capacity(capacity), m_size(0), m_next(0),
+    m_states(capacity, state_size), m_next_states(capacity, state_size),
+    m_actions(capacity), m_rewards(capacity), m_done(capacity),
+    m_prioritized(prioritized), m_alpha(alpha), m_max_priority(1.0),
+    m_tree(prioritized ? capacity : 0), m_random(seed)
+{
+}
+
+
+/**
+ * @brief Stores a transition, over the oldest one once the memory is full.
+ *
+ * @param state The state, one row
+ * @param action The action taken
+ * @param reward The reward received
+ * @param next_state The state after the action, one row
+ * @param done The transition ended the episode
+ */
+template <typename T>
+void ReplayMemoryT<T>::Add(const Ref<const Matrix> &state, int action, double reward, const Ref<const Matrix> &next_state,
+                           bool done)
+{
+  if (state.size() != StateSize() || next_state.size() != StateSize()) {
+    cerr << "State size does not match the replay memory !!" << endl;
+    return;
+  }
+
+  m_states.row(m_next) = state.reshaped().transpose();
+  m_next_states.row(m_next) = next_state.reshaped().transpose();
+  m_actions(m_next) = action;
+  m_rewards(m_next) = T(reward);
+  m_done(m_next) = done ? T(1) : T(0);
+
+  if (m_prioritized)
+    m_tree.Set(m_next, m_max_priority);
+
+  m_next = (m_next + 1) % m_capacity;
+  m_size = std::min(m_size + 1, m_capacity);
+}
+
+
+/**
+ * @brief Stores a batch of transitions in row order, those of a vectorized environment step.
+ *
+ * @param states The states, one per row
+ * @param actions The action taken in each transition
+ * @param rewards The reward of each transition
+ * @param next_states The state after each transition, one per row
+ * @param done 1 where the transition ended the episode, 0 elsewhere
+ */
+template <typename T>
+void ReplayMemoryT<T>::Add(const Matrix &states, const VectorXi &actions, const Vector &rewards, const Matrix &next_states,
+                           const Vector &done)
+{
+  if (states.cols() != StateSize() || next_states.cols() != StateSize()) {
+    cerr << "State size does not match the replay memory !!" << endl;
+    return;
+  }
+
+  for (int i = 0; i < states.rows(); i++) {
+    m_states.row(m_next) = states.row(i);
+    m_next_states.row(m_next) = next_states.row(i);
+    m_actions(m_next) = actions(i);
+    m_rewards(m_next) = rewards(i);
+    m_done(m_next) = done(i);
+
+    if (m_prioritized)
+      m_tree.Set(m_next, m_max_priority);
+
+    m_next = (m_next + 1) % m_capacity;
+  }
+
+  m_size = std::min(m_size + (int)states.rows(), m_capacity);
+}
+
+
+/**
+ * @brief Copies the transitions of batch.indices into the batch.
+ */
+template <typename T>
+void ReplayMemoryT<T>::Gather(TransitionBatchT<T> &batch) const
+{
+  int count = batch.indices.size();
+
+  batch.states.resize(count, StateSize());
+  batch.next_states.resize(count, StateSize());
+  batch.actions.resize(count);
+  batch.rewards.resize(count);
+  batch.done.resize(count);
+
+  for (int i = 0; i < count; i++) {
+    int slot = batch.indices[i];
+    batch.states.row(i) = m_states.row(slot);
+    batch.next_states.row(i) = m_next_states.row(slot);
+    batch.actions(i) = m_actions(slot);
+    batch.rewards(i) = m_rewards(slot);
+    batch.done(i) = m_done(slot);
+  }
+}
+
+
+/**
+ * @brief Samples a batch of transitions with replacement. A prioritized memory draws one
+ *        transition from each of batch_size equal slices of the total priority, and weighs
+ *        them by (size * P(i))^-beta scaled so the largest weight is 1.
+ *
+ * @param batch_size The number of transitions
+ * @param batch The batch to fill, its buffers are reused
+ * @param beta How much the weights correct the bias of prioritized sampling, 1 is fully
+ * @return true if the memory holds any transition
+ */
+template <typename T>
+bool ReplayMemoryT<T>::Sample(int batch_size, TransitionBatchT<T> &batch, double beta)
+{
+  if (m_size == 0 || batch_size <= 0)
+    return false;
+
+  batch.indices.resize(batch_size);
+
+  if (!m_prioritized) {
+    std::uniform_int_distribution<int> slot(0, m_size - 1);
+    for (int i = 0; i < batch_size; i++)
+      batch.indices[i] = slot(m_random);
+
+    batch.weights.resize(0);
+  }
+  else {
+    double total = m_tree.Total();
+    double segment = total / batch_size;
+    std::uniform_real_distribution<double> offset(0.0, segment);
+
+    batch.weights.resize(batch_size);
+    for (int i = 0; i < batch_size; i++) {
+      int slot = std::min(m_tree.Find(i * segment + offset(m_random)), m_size - 1);
+      batch.indices[i] = slot;
+      batch.weights(i) = T(std::pow(m_size * m_tree.Get(slot) / total, -beta));
+    }
+
+    batch.weights /= batch.weights.maxCoeff();
+  }
+
+  Gather(batch);
+  return true;
+}
+
+
+/**
+ * @brief Sets the priorities of sampled transitions from their TD errors,
+ *        (|error| + epsilon)^alpha. Does nothing on a uniform memory.
+ *
+ * @param indices The slots of the transitions, as sampled
+ * @param td_errors The TD error of each transition
+ */
+template <typename T>
+void ReplayMemoryT<T>::UpdatePriorities(const std::vector<int> &indices, const Vector &td_errors)
+{
+  if (!m_prioritized)
+    return;
+
+  if (td_errors.size() != (int)indices.size()) {
+    cerr << "The TD errors do not match the sampled transitions !!" << endl;
+    return;
+  }
+
+  for (int i = 0; i < (int)indices.size(); i++) {
+    double priority = std::pow(std::abs(double(td_errors(i))) + 1e-6, m_alpha);
+    m_max_priority = std::max(m_max_priority, priority);
+    m_tree.Set(indices[i], priority);
+  }
+}
+
+
+template class Neural::ReplayMemoryT<float>;
+template class Neural::ReplayMemoryT<double>;
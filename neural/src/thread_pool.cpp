@@ -0,0 +1,93 @@
+#include "thread_pool.h"
+
+using namespace std;
+using namespace Neural;
+
+
+/**
+ * @brief Construct a new ThreadPool::ThreadPool object
+ * 
+ * @param threads Number of worker threads
+ */
+ThreadPool::ThreadPool(int threads)
+{
+  this->m_task_count = 0;
+  this->m_next_task = 0;
+  this->m_pending = 0;
+  this->m_stop = false;
+
+  for (int i = 0; i < threads; i++) {
+    m_workers.emplace_back(&ThreadPool::WorkerLoop, this);
+  }
+}
+
+
+/**
+ * @brief Destroy the ThreadPool::ThreadPool object, waits for the workers to exit.
+ * 
+ */
+ThreadPool::~ThreadPool()
+{
+  {
+    lock_guard<mutex> lock(m_mutex);
+    m_stop = true;
+  }
+  m_start.notify_all();
+
+  for (auto &worker : m_workers) {
+    worker.join();
+  }
+}
+
+
+/**
+ * @brief Runs task(0) ... task(task_count - 1) on the workers and blocks until all of
+ *        them are finished. The task is copied into a std::function, which stores a
+ *        lambda capturing at most two pointers without allocating: the training loops
+ *        capture this and one struct holding the arguments of the step.
+ * 
+ * @param task_count Number of tasks
+ * @param task The function called with the index of each task
+ */
+void ThreadPool::Run(int task_count, const function<void(int)> &task)
+{
+  if (task_count <= 0)
+    return;
+
+  unique_lock<mutex> lock(m_mutex);
+  m_task = task;
+  m_task_count = task_count;
+  m_next_task = 0;
+  m_pending = task_count;
+  m_start.notify_all();
+
+  m_done.wait(lock, [this]() { return m_pending == 0; });
+  m_task = nullptr;
+}
+
+
+/**
+ * @brief Worker thread body, picks up task indices until the pool is stopped.
+ * 
+ */
+void ThreadPool::WorkerLoop()
+{
+  unique_lock<mutex> lock(m_mutex);
+
+  while (true) {
+    m_start.wait(lock, [this]() { return m_stop || m_next_task < m_task_count; });
+
+    if (m_stop)
+      return;
+
+    int index = m_next_task++;
+    lock.unlock();
+    m_task(index);
+    lock.lock();
+
+    if (--m_pending == 0) {
+      m_task_count = 0;
+      m_done.notify_one();
+    }
+  }
+}
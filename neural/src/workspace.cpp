@@ -0,0 +1,296 @@
+#include <algorithm>
+#include <numeric>
+#include "workspace.h"
+#include "gemm.h"
+
+using namespace Neural;
+using namespace Eigen;
+
+// buffers start on 64-byte boundaries, a cache line and the widest SIMD load
+static const size_t ALIGNMENT = 64;
+
+
+template <typename T>
+static size_t RoundUp(size_t count)
+{
+  size_t step = ALIGNMENT / sizeof(T);
+  return (count + step - 1) / step * step;
+}
+
+
+/**
+ * @brief Eigen's blocking of a product, with the packing panels in the workspace instead of
+ *        on the stack or the heap.
+ */
+template <typename T>
+class PanelBlocking : public internal::level3_blocking<T, T>
+{
+  public:
+    PanelBlocking(T *lhs, T *rhs, Index mc, Index nc, Index kc)
+    {
+      this->m_blockA = lhs;
+      this->m_blockB = rhs;
+      this->m_mc = mc;
+      this->m_nc = nc;
+      this->m_kc = kc;
+    }
+};
+
+
+/**
+ * @brief Runs Eigen's sequential GEMM kernel, dst += lhs * rhs, the storage orders give the
+ *        transposes of the operands.
+ */
+template <typename T, int LhsOrder, int RhsOrder>
+static void Gemm(const Ref<const DynMatrix<T>> &lhs, const Ref<const DynMatrix<T>> &rhs, Ref<DynMatrix<T>> dst,
+                 Index depth, PanelBlocking<T> &blocking)
+{
+  internal::general_matrix_matrix_product<Index, T, LhsOrder, false, T, RhsOrder, false, ColMajor, 1>::run(
+    dst.rows(), dst.cols(), depth, lhs.data(), lhs.outerStride(), rhs.data(), rhs.outerStride(),
+    dst.data(), 1, dst.outerStride(), T(1), blocking, nullptr);
+}
+
+
+/**
+ * @brief Construct a new Workspace::Workspace object, without memory until Allocate.
+ *
+ */
+template <typename T>
+WorkspaceT<T>::WorkspaceT()
+{
+  this->m_used = 0;
+  this->m_panel_lhs = 0;
+  this->m_panel_rhs = 0;
+  this->m_layer = 0;
+  this->m_layers = 0;
+  this->m_recompute = -1;
+  this->m_taken = 0;
+}
+
+
+/**
+ * @brief Starts a new layout, the memory is kept for it.
+ *
+ */
+template <typename T>
+void WorkspaceT<T>::Reset()
+{
+  this->m_used = 0;
+  this->m_panel_lhs = 0;
+  this->m_panel_rhs = 0;
+  this->m_layer = 0;
+  this->m_layers = 0;
+  this->m_recompute = -1;
+  this->m_buffers.clear();
+  this->m_offsets.clear();
+  this->m_taken = 0;
+}
+
+
+/**
+ * @brief Sets the layer that takes the next buffers, their lifetimes are placed in the
+ *        training step from its position. The loss gradient is the error of layer `layers`.
+ *
+ * @param layer Index of the layer
+ * @param layers Number of layers of the network
+ * @param recompute Step at which the forward pass of the layer runs again, after the loss
+ *                  and before its backward pass, -1 when its outputs are kept
+ */
+template <typename T>
+void WorkspaceT<T>::SetLayer(int layer, int layers, int recompute)
+{
+  this->m_layer = layer;
+  this->m_layers = layers;
+  this->m_recompute = recompute;
+}
+
+
+/**
+ * @brief Takes a buffer from the layout. The memory exists after Allocate, the offset stays
+ *        valid when the workspace grows. After Share the buffers get their packed offsets
+ *        as long as they are taken in the same order and sizes as before.
+ *
+ * @param count Number of scalars
+ * @param lifetime When the buffer holds data, the whole training step by default
+ * @return size_t The offset of the buffer, for Data and View
+ */
+template <typename T>
+size_t WorkspaceT<T>::Take(size_t count, Lifetime lifetime)
+{
+  // layer k runs forward at step k and backward at step 2 * layers - k, the loss at step layers
+  int backward = 2 * m_layers - m_layer;
+  Buffer buffer = { RoundUp<T>(count), { 0, 1 }, { 2 * m_layers + 1, 0 } };
+
+  // a recomputed layer is read by the next forward pass, then from its second forward pass
+  // to its backward pass
+  if (lifetime == Lifetime::STEP && m_recompute >= 0)
+    buffer = { buffer.count, { m_layer, m_recompute }, { m_layer + 1, backward } };
+  else if (lifetime == Lifetime::SCRATCH && m_recompute >= 0)
+    buffer = { buffer.count, { m_layer, m_recompute }, { m_layer, backward } };
+  else if (lifetime == Lifetime::SCRATCH)
+    buffer = { buffer.count, { m_layer, backward }, { m_layer, backward } };
+  else if (lifetime == Lifetime::ERROR)
+    buffer = { buffer.count, { backward, 1 }, { backward + 1, 0 } };
+
+  if (m_taken < m_offsets.size()) {
+    const Buffer &packed = m_buffers[m_taken];
+
+    if (packed.count == buffer.count && std::equal(packed.first, packed.first + 2, buffer.first) &&
+        std::equal(packed.last, packed.last + 2, buffer.last))
+      return m_offsets[m_taken++];
+
+    // another layout than the packed one, the rest is taken after it
+    this->m_offsets.clear();
+  }
+  else if (m_offsets.empty()) {
+    this->m_buffers.push_back(buffer);
+  }
+
+  size_t offset = m_used;
+  this->m_used += buffer.count;
+
+  return offset;
+}
+
+
+/**
+ * @brief Packs the buffers taken since Reset by liveness: the largest buffers are placed
+ *        first, each at the lowest offset that no buffer live at the same time uses. The
+ *        layout then restarts, the layers must be bound again to get the packed offsets.
+ *
+ */
+template <typename T>
+void WorkspaceT<T>::Share()
+{
+  auto live_together = [](const Buffer &a, const Buffer &b) {
+    for (int i = 0; i < 2; i++) {
+      for (int j = 0; j < 2; j++) {
+        if (a.first[i] <= a.last[i] && b.first[j] <= b.last[j] && a.first[i] <= b.last[j] && b.first[j] <= a.last[i])
+          return true;
+      }
+    }
+    return false;
+  };
+
+  std::vector<size_t> order(m_buffers.size());
+  std::iota(order.begin(), order.end(), 0);
+  std::stable_sort(order.begin(), order.end(), [this](size_t a, size_t b) { return m_buffers[a].count > m_buffers[b].count; });
+
+  std::vector<std::pair<size_t, size_t>> busy;
+  size_t end = 0;
+  this->m_offsets.assign(m_buffers.size(), 0);
+
+  for (size_t k = 0; k < order.size(); k++) {
+    const Buffer &buffer = m_buffers[order[k]];
+
+    busy.clear();
+    for (size_t j = 0; j < k; j++) {
+      if (live_together(buffer, m_buffers[order[j]]))
+        busy.push_back({ m_offsets[order[j]], m_offsets[order[j]] + m_buffers[order[j]].count });
+    }
+    std::sort(busy.begin(), busy.end());
+
+    size_t offset = 0;
+    for (auto &range : busy) {
+      if (offset + buffer.count <= range.first)
+        break;
+      offset = std::max(offset, range.second);
+    }
+
+    this->m_offsets[order[k]] = offset;
+    end = std::max(end, offset + buffer.count);
+  }
+
+  this->m_used = end;
+  this->m_taken = 0;
+}
+
+
+/**
+ * @brief Makes the packing panels big enough for a product of this shape.
+ *
+ * @param rows Rows of the result
+ * @param cols Columns of the result
+ * @param depth Inner dimension of the product
+ */
+template <typename T>
+void WorkspaceT<T>::ReserveProduct(int rows, int cols, int depth)
+{
+  Index kc = depth, mc = rows, nc = cols;
+  internal::computeProductBlockingSizes<T, T, 1, Index>(kc, mc, nc, 1);
+
+  this->m_panel_lhs = std::max(m_panel_lhs, RoundUp<T>(kc * mc));
+  this->m_panel_rhs = std::max(m_panel_rhs, RoundUp<T>(kc * nc));
+}
+
+
+/**
+ * @brief Allocates the memory of the layout. It only grows, a layout that fits in the
+ *        current memory allocates nothing.
+ *
+ */
+template <typename T>
+void WorkspaceT<T>::Allocate()
+{
+  size_t size = m_used + m_panel_lhs + m_panel_rhs;
+
+  if ((size_t)m_memory.size() < size)
+    m_memory.resize(size, 1);
+}
+
+
+/**
+ * @brief Matrix product into a preallocated result, dst = op(lhs) * op(rhs). Small batches
+ *        run on the micro-kernels without panels, shapes larger than the reserved panels
+ *        fall back to Eigen's product, which allocates its own.
+ *
+ * @param lhs The left operand
+ * @param rhs The right operand
+ * @param dst The result, of the product's shape
+ * @param transpose_lhs Uses the transpose of lhs
+ * @param transpose_rhs Uses the transpose of rhs
+ */
+template <typename T>
+void WorkspaceT<T>::Product(const Ref<const Matrix> &lhs, const Ref<const Matrix> &rhs, Ref<Matrix> dst,
+                            bool transpose_lhs, bool transpose_rhs)
+{
+  if (SmallGemm::Product<T>(lhs, rhs, dst, transpose_lhs, transpose_rhs))
+    return;
+
+  Index depth = transpose_lhs ? lhs.rows() : lhs.cols();
+  Index kc = depth, mc = dst.rows(), nc = dst.cols();
+  internal::computeProductBlockingSizes<T, T, 1, Index>(kc, mc, nc, 1);
+  size_t size = m_used + m_panel_lhs + m_panel_rhs;
+
+  if ((size_t)(kc * mc) > m_panel_lhs || (size_t)(kc * nc) > m_panel_rhs || (size_t)m_memory.size() < size) {
+    if (transpose_lhs && transpose_rhs)
+      dst.noalias() = lhs.transpose() * rhs.transpose();
+    else if (transpose_lhs)
+      dst.noalias() = lhs.transpose() * rhs;
+    else if (transpose_rhs)
+      dst.noalias() = lhs * rhs.transpose();
+    else
+      dst.noalias() = lhs * rhs;
+    return;
+  }
+
+  dst.setZero();
+  if (dst.size() == 0 || depth == 0)
+    return;
+
+  PanelBlocking<T> blocking(Data(m_used), Data(m_used + m_panel_lhs), mc, nc, kc);
+
+  // a transposed column-major operand is the same memory read row-major
+  if (transpose_lhs && transpose_rhs)
+    Gemm<T, RowMajor, RowMajor>(lhs, rhs, dst, depth, blocking);
+  else if (transpose_lhs)
+    Gemm<T, RowMajor, ColMajor>(lhs, rhs, dst, depth, blocking);
+  else if (transpose_rhs)
+    Gemm<T, ColMajor, RowMajor>(lhs, rhs, dst, depth, blocking);
+  else
+    Gemm<T, ColMajor, ColMajor>(lhs, rhs, dst, depth, blocking);
+}
+
+
+template class Neural::WorkspaceT<float>;
+template class Neural::WorkspaceT<double>;